@@ -11,44 +11,59 @@ Node *get_expression(Expr_Arr *exprs)
 }
 
 static Scope_Array scopes = {.scopes = {}, .size = 0};
+// @NOTE: the hash tables stay on the heap, stb_ds grows them with realloc which
+// the perm arena can't do. Their keys and symbols live in the perm arena and a
+// failed line's entries are deleted from them by restore_analyzer_checkpoint
+static Global_Table *global_table;
+static char **global_names; // Declaration order, used to roll back a failed line
+static char **type_names;   // Types the lines added (structs and fn types), rolled back the same way
+Type_Table *type_table;
 
 Symbol *get_symbol(char *name)
 {
-	assert(scopes.size > 0);
-
-	for(int i = 0; i < scopes.size; ++i)
+	int symbol_size = arrlen(scopes.symbols);
+	for(int i = symbol_size - 1; i >= 0; --i)
 	{
-		Symbol *symbols = scopes.scopes[i].symbols;
-		int symbol_size = ArrLen(symbols);
-		for(int j = 0; j < symbol_size; ++j)
+		if(VStrCmp(scopes.symbols[i].name, name))
 		{
-			if(VStrCmp(symbols[j].id->string, name))
-			{
-				return symbols + j;
-			}
+			return scopes.symbols + i;
 		}
 	}
+
+	Global_Table *global = shgetp_null(global_table, name);
+	if(global)
+		return &global->value;
+
 	return NULL;
 }
 
 void add_symbol(Token *id, const Type_Info *type)
 {
-	assert(scopes.size > 0);
-	
 	Symbol *redecleration = get_symbol(id->string);
 	if(redecleration != NULL)
 	{
 		// @TODO: previously declared line number
 		report_error(id, "Redeclaration of symbol %s", id->string);
 	}
-	Symbol new_sym = {.id = id, .type = type};
-	ArrPush(scopes.scopes[scopes.size - 1].symbols, new_sym);
+
+	if(scopes.size == 0)
+	{
+		// Tokens die with the line, the global scope doesn't
+		char *name = perm_strdup(id->string);
+		Symbol new_sym = {.name = name, .type = type};
+		shput(global_table, name, new_sym);
+		arrput(global_names, name);
+		return;
+	}
+
+	Symbol new_sym = {.name = id->string, .type = type};
+	arrput(scopes.symbols, new_sym);
 }
 
 void push_scope(Token *token)
 {
 	scopes.scopes[scopes.size].token = token;
-	scopes.scopes[scopes.size].symbols = ArrCreate(Symbol);
+	scopes.scopes[scopes.size].first_symbol = arrlen(scopes.symbols);
 	scopes.size++;
 }
 
@@ -61,24 +76,77 @@ void pop_scope(Token *token)
 
 	scopes.size--;
 	scopes.scopes[scopes.size].token = NULL;
-	ArrFree(scopes.scopes[scopes.size].symbols);
+	arrsetlen(scopes.symbols, scopes.scopes[scopes.size].first_symbol);
 }
 
-Type_Table *type_table;
+Analyzer_Checkpoint get_analyzer_checkpoint()
+{
+	Analyzer_Checkpoint result = {.global_count = arrlen(global_names), .scope_count = scopes.size,
+		.type_count = arrlen(type_names)};
+	return result;
+}
 
-const Type_Info *create_fn_type(const Type_Info **args, const Type_Info *ret)
+// @NOTE: undoes everything a line did to the global scope, used when a line
+// fails half way through analysis or code generation
+void restore_analyzer_checkpoint(Analyzer_Checkpoint checkpoint)
 {
-	Type_Info *result = (Type_Info *)VAlloc(sizeof(Type_Info *));
+	while(scopes.size > checkpoint.scope_count)
+		pop_scope(NULL);
+
+	while(arrlen(global_names) > checkpoint.global_count)
+	{
+		char *name = arrpop(global_names);
+		shdel(global_table, name);
+	}
+
+	// They're in permanent memory that's rolled back too
+	while(arrlen(type_names) > checkpoint.type_count)
+	{
+		char *name = arrpop(type_names);
+		shdel(type_table, name);
+	}
+}
+
+// @NOTE: fn types are interned by signature, so they're only ever allocated once
+// and can be compared by identity like the basic types. args can be scratch memory,
+// they get copied to permanent memory the first time the signature is seen
+const Type_Info *create_fn_type(const Type_Info **args, int arg_count, const Type_Info *ret)
+{
+	int name_size = 8;
+	for(int i = 0; i < arg_count; ++i)
+		name_size += VStrLen(args[i]->name) + 2;
+	if(ret)
+		name_size += VStrLen(ret->name) + 4;
+
+	char *name = alloc_analysis_memory(name_size);
+	char *at = name;
+	at += sprintf(at, "fn(");
+	for(int i = 0; i < arg_count; ++i)
+		at += sprintf(at, i == 0 ? "%s" : ", %s", args[i]->name);
+	at += sprintf(at, ")");
+	if(ret)
+		sprintf(at, " -> %s", ret->name);
+
+	Type_Info *interned = shget(type_table, name);
+	if(interned)
+		return interned;
+
+	Type_Info *result = (Type_Info *)alloc_perm_memory(sizeof(Type_Info));
 	result->type = T_FN;
-	result->name = "fn()";
-	result->fn.arguments = args;
+	result->name = perm_strdup(name);
+	result->fn.arguments = alloc_perm_memory(sizeof(Type_Info *) * arg_count);
+	memcpy(result->fn.arguments, args, sizeof(Type_Info *) * arg_count);
+	result->fn.argument_count = arg_count;
 	result->fn.ret = ret;
+
+	shput(type_table, (char *)result->name, result);
+	arrput(type_names, (char *)result->name);
 	return result;
 }
 
 const Type_Info *create_basic_type(const char *name, Type_Type type, int size)
 {
-	Type_Info *result = (Type_Info *)VAlloc(sizeof(Type_Info *));
+	Type_Info *result = (Type_Info *)alloc_perm_memory(sizeof(Type_Info));
 	result->type = type;
 	result->size = size;
 	result->name = name;
@@ -95,8 +163,8 @@ const Type_Info *get_type(char *name)
 
 b32 types_match(const Type_Info *a, const Type_Info *b)
 {
-	// @TODO: type checking
-	return false;
+	// All types are interned, so they can be compared by identity
+	return a == b;
 }
 
 void types_must_match(const Type_Info *a, const Type_Info *b, Token *token)
@@ -109,6 +177,7 @@ void types_must_match(const Type_Info *a, const Type_Info *b, Token *token)
 
 void init_analyzer()
 {
+	arrsetcap(scopes.symbols, 256);
 	shdefault(type_table, NULL);
 	create_basic_type("i8",  T_INT,   8);
 	create_basic_type("i16", T_INT,   16);
@@ -122,18 +191,19 @@ void init_analyzer()
 
 void free_temp_analyzer()
 {
+	reset_analysis_memory();
 }
 
+// @NOTE: top level expressions are analyzed straight into the global scope,
+// so declarations stay visible to the lines that come after
 void analyze_ast(Node *root)
 {
 	int len = ArrLen(root->root.expressions);
 	Expr_Arr expressions = {.arr = root->root.expressions, .i = 0, .length = len};
-	push_scope(root->token);
 	for (int i = 0; i < len; ++i)
 	{
 		analyze_next_expression(&expressions);
 	}
-	pop_scope(expressions.arr[expressions.i - 1]->token);
 }
 
 const Type_Info *analyze_next_expression(Expr_Arr *exprs)
@@ -142,25 +212,50 @@ const Type_Info *analyze_next_expression(Expr_Arr *exprs)
 	return analyze_expression(expr);
 }
 
+const Type_Info *analyze_fn_arg_type(Node *arg)
+{
+	if(arg->fn_arg.type == NULL)
+	{
+		report_error(arg->token, "Missing type for argument %s", arg->fn_arg.identifier->string);
+	}
+	const Type_Info *result = get_type(arg->fn_arg.type->string);
+	if(result == NULL)
+	{
+		report_error(arg->fn_arg.type, "Unknown type %s", arg->fn_arg.type->string);
+	}
+	return result;
+}
+
 const Type_Info *analyze_type(Node *node)
 {
-	// @TODO: fn type
 	if(node->type == ND_ID)
 	{
-		return get_type(node->token->string);
+		const Type_Info *result = get_type(node->token->string);
+		if(result == NULL)
+		{
+			report_error(node->token, "Unknown type %s", node->token->string);
+		}
+		return result;
 	}
 	else if(node->type == ND_FN)
 	{
 		Node **args = node->func.arguments;
 		int arg_size = ArrLen(args);
-		const Type_Info **arg_types = (const Type_Info **)ArrCreate(Type_Info *);
+		const Type_Info **arg_types = alloc_analysis_memory(sizeof(Type_Info *) * arg_size);
 		for(int i = 0; i < arg_size; ++i)
 		{
-			const Type_Info *arg_type = analyze_expression(args[i]);
-			ArrPush(arg_types, arg_type);
+			arg_types[i] = analyze_fn_arg_type(args[i]);
+			if(arg_types[i]->type == T_STRUCT)
+			{
+				report_error(args[i]->token, "Struct %s can't be passed to a function", arg_types[i]->name);
+			}
 		}
-		const Type_Info *ret_type = analyze_type(node->func.ret);
-		return create_fn_type(arg_types, ret_type);
+		const Type_Info *ret_type = node->func.ret ? analyze_type(node->func.ret) : NULL;
+		if(ret_type && ret_type->type == T_STRUCT)
+		{
+			report_error(node->token, "Struct %s can't be returned from a function", ret_type->name);
+		}
+		return create_fn_type(arg_types, arg_size, ret_type);
 	}
 	else
 	{
@@ -171,8 +266,17 @@ const Type_Info *analyze_type(Node *node)
 	return NULL;
 }
 
+void type_is_value(const Type_Info *type, Token *token)
+{
+	if(type == NULL)
+	{
+		report_error(token, "Expected an expression that has a value");
+	}
+}
+
 void type_is_boolean(const Type_Info *type, Token *token)
 {
+	type_is_value(type, token);
 	if(type->type != T_BOOL)
 	{
 		report_error(token, "Expected boolean expression");
@@ -181,12 +285,85 @@ void type_is_boolean(const Type_Info *type, Token *token)
 
 void type_is_arithmetic(const Type_Info *type, Token *token)
 {
+	type_is_value(type, token);
 	Type_Type t = type->type;
 	if(t == T_INT || t == T_FLOAT || t == T_BOOL)
 		return;
 	report_error(token, "Trying to perform a binary expression with non arithmetic type");
 }
 
+void type_is_integer(const Type_Info *type, Token *token)
+{
+	type_is_value(type, token);
+	if(type->type != T_INT)
+	{
+		report_error(token, "Expected integer expression");
+	}
+}
+
+// @NOTE: declarations and function definitions carry their type in type_info,
+// but they don't leave anything behind for the expression around them. Structs
+// aren't values either, they're only ever read a field at a time
+b32 is_value_expression(Node *expr)
+{
+	return expr->type_info != NULL && expr->type != ND_DECL && expr->type != ND_FN &&
+		expr->type != ND_STRUCT && expr->type_info->type != T_STRUCT;
+}
+
+b32 is_assignment_op(Token_Value op)
+{
+	switch((int)op)
+	{
+		case '=':
+		case tok_plus_equals:
+		case tok_minus_equals:
+		case tok_mult_equals:
+		case tok_div_equals:
+		case tok_mod_equals:
+		case tok_and_equals:
+		case tok_xor_equals:
+		case tok_or_equals:
+		case tok_lshift_equals:
+		case tok_rshift_equals:
+		return true;
+	}
+	return false;
+}
+
+b32 is_comparison_op(Token_Value op)
+{
+	switch((int)op)
+	{
+		case '<':
+		case '>':
+		case tok_logical_lequal:
+		case tok_logical_gequal:
+		case tok_logical_is:
+		case tok_logical_isnot:
+		return true;
+	}
+	return false;
+}
+
+// @NOTE: gives the binary operator a compound assignment applies, '=' gives itself
+Token_Value get_assignment_base_op(Token_Value op)
+{
+	switch((int)op)
+	{
+		case tok_plus_equals:   return '+';
+		case tok_minus_equals:  return '-';
+		case tok_mult_equals:   return '*';
+		case tok_div_equals:    return '/';
+		case tok_mod_equals:    return '%';
+		case tok_and_equals:    return '&';
+		case tok_xor_equals:    return '^';
+		case tok_or_equals:     return '|';
+		case tok_lshift_equals: return tok_bits_lshift;
+		case tok_rshift_equals: return tok_bits_rshift;
+	}
+	return op;
+}
+
 const Type_Info *get_literal_type(Node *literal)
 {
 	switch(literal->literal.type)
@@ -196,6 +373,7 @@ const Type_Info *get_literal_type(Node *literal)
 		case LIT_DOUBLE:
 		return get_type("f64");
 		case LIT_INT:
+		case LIT_UINT:
 		return get_type("i64");
 		default:
 		assert(false);
@@ -203,6 +381,303 @@ const Type_Info *get_literal_type(Node *literal)
 	return NULL;
 }
 
+// @NOTE: literals take the declared type if it's the same kind of number,
+// so x : i32 = 5 doesn't need a cast
+void coerce_literal(Node *literal, const Type_Info *type)
+{
+	if(literal->type != ND_LITERAL || type == NULL)
+		return;
+
+	Literal_Type lit = literal->literal.type;
+	if(type->type == T_INT && lit != LIT_DOUBLE)
+		literal->type_info = type;
+	else if(type->type == T_FLOAT && lit == LIT_DOUBLE)
+		literal->type_info = type;
+}
+
+// The value generate_literal would push, floats are kept as f64 bits
+u64 get_literal_value(Node *literal)
+{
+	const Type_Info *type = literal->type_info;
+	if(type->type == T_FLOAT)
+	{
+		f64 value = literal->literal._f64;
+		if(type->size == 32)
+			value = (f32)value;
+		return *(u64 *)&value;
+	}
+
+	i64 value = literal->literal._i64;
+	switch(type->size)
+	{
+		case 8:  value = (i8)value;  break;
+		case 16: value = (i16)value; break;
+		case 32: value = (i32)value; break;
+	}
+	return (u64)value;
+}
+
+int get_type_alignment(const Type_Info *type)
+{
+	switch(type->type)
+	{
+		case T_STRUCT: return type->struct_.alignment;
+		// string pointers and function indexes take a whole cell
+		case T_STRING:
+		case T_FN:     return 8;
+		default:       return type->size / 8;
+	}
+}
+
+static int get_type_bytes(const Type_Info *type)
+{
+	return type->type == T_STRING || type->type == T_FN ? 8 : type->size / 8;
+}
+
+static int align_up(int value, int alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+// Gives the fields offsets in the order they're in, returns the padded size
+static int lay_out_fields(Struct_Field *fields, int count, int alignment)
+{
+	int size = 0;
+	for(int i = 0; i < count; ++i)
+	{
+		size = align_up(size, get_type_alignment(fields[i].type));
+		fields[i].offset = size;
+		size += get_type_bytes(fields[i].type);
+	}
+	return align_up(size, alignment);
+}
+
+static const Type_Info *analyze_struct(Node *expr)
+{
+	Token *name = expr->struct_.name;
+	if(scopes.size != 0)
+	{
+		report_error(expr->token, "Structs can only be declared in the global scope");
+	}
+	if(get_type(name->string))
+	{
+		report_error(name, "Redeclaration of type %s", name->string);
+	}
+	Node **nodes = expr->struct_.fields;
+	int count = ArrLen(nodes);
+	if(count == 0)
+	{
+		report_error(name, "Struct %s has no fields", name->string);
+	}
+
+	Struct_Field *fields = alloc_perm_memory(sizeof(Struct_Field) * count);
+	int alignment = 1;
+	for(int i = 0; i < count; ++i)
+	{
+		Token *field_name = nodes[i]->fn_arg.identifier;
+		for(int j = 0; j < i; ++j)
+		{
+			if(VStrCmp((char *)fields[j].name, field_name->string))
+				report_error(field_name, "Struct %s already has a field %s", name->string, field_name->string);
+		}
+		if(nodes[i]->fn_arg.type == NULL)
+		{
+			report_error(field_name, "Missing type for field %s", field_name->string);
+		}
+		const Type_Info *type = get_type(nodes[i]->fn_arg.type->string);
+		if(type == NULL)
+		{
+			report_error(nodes[i]->fn_arg.type, "Unknown type %s", nodes[i]->fn_arg.type->string);
+		}
+		Struct_Field field = {.name = perm_strdup(field_name->string), .type = type};
+		fields[i] = field;
+		if(get_type_alignment(type) > alignment)
+			alignment = get_type_alignment(type);
+	}
+
+	int declared_size = lay_out_fields(fields, count, alignment);
+	if(!expr->struct_.is_fixed)
+	{
+		// Insertion sort keeps equal alignments in order, and there aren't many fields
+		for(int i = 1; i < count; ++i)
+		{
+			Struct_Field field = fields[i];
+			int j = i;
+			for(; j > 0 && get_type_alignment(fields[j - 1].type) < get_type_alignment(field.type); --j)
+				fields[j] = fields[j - 1];
+			fields[j] = field;
+		}
+	}
+	int size = lay_out_fields(fields, count, alignment);
+	if(size > STRUCT_MAX_SIZE)
+	{
+		report_error(name, "Struct %s is %d bytes, it can't be over %d", name->string, size, STRUCT_MAX_SIZE);
+	}
+
+	Type_Info *result = (Type_Info *)alloc_perm_memory(sizeof(Type_Info));
+	result->type = T_STRUCT;
+	result->size = size * 8;
+	result->name = perm_strdup(name->string);
+	result->struct_.fields = fields;
+	result->struct_.field_count = count;
+	result->struct_.alignment = alignment;
+	result->struct_.declared_size = declared_size;
+	result->struct_.is_fixed = expr->struct_.is_fixed;
+	shput(type_table, (char *)result->name, result);
+	arrput(type_names, (char *)result->name);
+	return result;
+}
+
+void print_struct_layout(const Type_Info *type)
+{
+	printf("struct %s: %d bytes, aligned to %d", type->name, type->size / 8, type->struct_.alignment);
+	if(type->struct_.declared_size != type->size / 8)
+		printf(" (%d in the declared order)", type->struct_.declared_size);
+	printf("\n");
+	for(int i = 0; i < type->struct_.field_count; ++i)
+	{
+		Struct_Field *field = &type->struct_.fields[i];
+		printf("%6d  %s: %s\n", field->offset, field->name, field->type->name);
+	}
+}
+
+// The variable a chain of fields starts at, ex. a for a.b.c
+Node *get_field_root(Node *expr)
+{
+	while(expr->type == ND_FIELD)
+		expr = expr->field.operand;
+	return expr;
+}
+
+// Structs are copied field by field, so the copy has to come from somewhere
+// that has them
+static void check_struct_copy(Node *source, Token *token)
+{
+	if(source->type_info && source->type_info->type == T_STRUCT &&
+			source->type != ND_ID && source->type != ND_FIELD)
+	{
+		report_error(token, "A struct can only be copied from a variable or a field");
+	}
+}
+
+// Labels are integer or string literals of the value's type, one value can't
+// be in two cases
+static void analyze_switch(Node *expr)
+{
+	const Type_Info *type = analyze_expression(expr->switch_.value);
+	type_is_value(type, expr->token);
+	if(type->type != T_INT && type->type != T_STRING)
+		report_error(expr->token, "Can only switch on integers and strings, got %s", type->name);
+
+	int label_count = 0;
+	for(int i = 0; i < ArrLen(expr->switch_.cases); ++i)
+		label_count += ArrLen(expr->switch_.cases[i]->case_.labels);
+	Node **seen = alloc_analysis_memory(sizeof(Node *) * (label_count + 1));
+	int seen_count = 0;
+	for(int i = 0; i < ArrLen(expr->switch_.cases); ++i)
+	{
+		Node *case_ = expr->switch_.cases[i];
+		for(int l = 0; l < ArrLen(case_->case_.labels); ++l)
+		{
+			Node *label = case_->case_.labels[l];
+			if(label->type != ND_LITERAL && label->type != ND_STRING)
+				report_error(label->token, "Case values have to be literals");
+			analyze_expression(label);
+			coerce_literal(label, type);
+			types_must_match(type, label->type_info, label->token);
+			for(int s = 0; s < seen_count; ++s)
+			{
+				b32 same = type->type == T_STRING ?
+					VStrCmp(seen[s]->token->string, label->token->string) :
+					get_literal_value(seen[s]) == get_literal_value(label);
+				if(same)
+					report_error(label->token, "Value is already handled by another case");
+			}
+			seen[seen_count++] = label;
+		}
+		push_scope(case_->token);
+		analyze_expression(case_->case_.body);
+		pop_scope(case_->token);
+	}
+
+	if(expr->switch_.otherwise)
+	{
+		push_scope(expr->token);
+		analyze_expression(expr->switch_.otherwise);
+		pop_scope(expr->token);
+	}
+}
+
+const Type_Info *analyze_binary_expression(Node *expr)
+{
+	Token_Value op = expr->binary.op->value;
+	const Type_Info *left  = analyze_expression(expr->binary.left);
+	const Type_Info *right = analyze_expression(expr->binary.right);
+	if(is_assignment_op(op))
+	{
+		if(expr->binary.left->type != ND_ID && expr->binary.left->type != ND_FIELD)
+		{
+			report_error(expr->token, "Left side of an assignment has to be a variable or a field");
+		}
+		type_is_value(right, expr->token);
+		// A field is assigned through the variable it's in
+		char *name = get_field_root(expr->binary.left)->token->string;
+		Symbol *symbol = get_symbol(name);
+		if(symbol->is_function)
+		{
+			report_error(expr->token, "Cannot assign to function %s", name);
+		}
+		if(symbol->is_const)
+		{
+			report_error(expr->token, "Cannot assign to constant %s", name);
+		}
+		check_struct_copy(expr->binary.right, expr->token);
+		if(op != '=')
+		{
+			type_is_arithmetic(left, expr->token);
+			Token_Value base_op = get_assignment_base_op(op);
+			if(base_op == '%' || base_op == '&' || base_op == '^' || base_op == '|' ||
+					base_op == tok_bits_lshift || base_op == tok_bits_rshift)
+				type_is_integer(left, expr->token);
+		}
+		coerce_literal(expr->binary.right, left);
+		types_must_match(left, expr->binary.right->type_info, expr->token);
+		return NULL;
+	}
+
+	type_is_arithmetic(left, expr->token);
+	type_is_arithmetic(right, expr->token);
+	if(expr->binary.right->type == ND_LITERAL)
+		coerce_literal(expr->binary.right, left);
+	else if(expr->binary.left->type == ND_LITERAL)
+		coerce_literal(expr->binary.left, right);
+	left = expr->binary.left->type_info;
+	right = expr->binary.right->type_info;
+	types_must_match(left, right, expr->token);
+	switch((int)op)
+	{
+		case tok_logical_and:
+		case tok_logical_or:
+		{
+			type_is_boolean(left, expr->token);
+			return left;
+		} break;
+		case '%':
+		case '&':
+		case '|':
+		case '^':
+		case tok_bits_lshift:
+		case tok_bits_rshift:
+		{
+			type_is_integer(left, expr->token);
+			return left;
+		} break;
+	}
+	if(is_comparison_op(op))
+		return get_type("b32");
+	return left;
+}
+
 const Type_Info *analyze_expression(Node *expr)
 {
 	const Type_Info *result = NULL;
@@ -216,24 +691,42 @@ const Type_Info *analyze_expression(Node *expr)
 				Node *decl_type = expr->decl.type;
 
 				result = analyze_type(decl_type);
-				const Type_Info *expr_type = analyze_expression(expr->decl.expr);
-				types_must_match(result, expr_type, expr->token);
+				if(expr->decl.expr == NULL)
+				{
+					// Structs start out zeroed
+					if(result->type != T_STRUCT)
+					{
+						report_error(expr->token, "Declaration of %s needs a value",
+								expr->decl.operand->token->string);
+					}
+				}
+				else
+				{
+					analyze_expression(expr->decl.expr);
+					coerce_literal(expr->decl.expr, result);
+					type_is_value(expr->decl.expr->type_info, expr->token);
+					types_must_match(result, expr->decl.expr->type_info, expr->token);
+					check_struct_copy(expr->decl.expr, expr->token);
+				}
 			}
 			else
 			{
 				result = analyze_expression(expr->decl.expr);
+				type_is_value(result, expr->token);
+				check_struct_copy(expr->decl.expr, expr->token);
 			}
 			add_symbol(expr->decl.operand->token, result);
+			get_symbol(expr->decl.operand->token->string)->is_const = expr->decl.is_const;
 		} break;
 		case ND_CALL:
 		{
 			const Type_Info *fn_type = analyze_expression(expr->fn_call.operand);
-			if(fn_type->type != T_FN)
+			if(fn_type == NULL || fn_type->type != T_FN)
 			{
 				report_error(expr->token, "Operand of function call is not a function");
 			}
 			const Type_Info **args = fn_type->fn.arguments;
-			int arg_size = ArrLen(args);
+			int arg_size = fn_type->fn.argument_count;
 			int passed_size = ArrLen(expr->fn_call.arguments);
 			if(passed_size != arg_size)
 			{
@@ -244,8 +737,12 @@ const Type_Info *analyze_expression(Node *expr)
 			for(int i = 0; i < arg_size; ++i)
 			{
 				Node *arg = expr->fn_call.arguments[i];
-				types_must_match(args[i], analyze_expression(arg), arg->token);
+				analyze_expression(arg);
+				coerce_literal(arg, args[i]);
+				type_is_value(arg->type_info, arg->token);
+				types_must_match(args[i], arg->type_info, arg->token);
 			}
+			result = fn_type->fn.ret;
 		} break;
 		case ND_BODY:
 		{
@@ -258,6 +755,10 @@ const Type_Info *analyze_expression(Node *expr)
 				analyze_expression(body_exprs[i]);
 			}
 
+			// The body has the value of its last expression
+			if(expr_count > 0 && is_value_expression(body_exprs[expr_count - 1]))
+				result = body_exprs[expr_count - 1]->type_info;
+
 			pop_scope(expr->token);
 		} break;
 		case ND_STRING:
@@ -279,12 +780,7 @@ const Type_Info *analyze_expression(Node *expr)
 		} break;
 		case ND_BINARY:
 		{
-			const Type_Info *left  = analyze_expression(expr->binary.left);
-			const Type_Info *right = analyze_expression(expr->binary.right);
-			type_is_arithmetic(left, expr->token);
-			type_is_arithmetic(right, expr->token);
-			types_must_match(left, right, expr->token);
-			result = left;
+			result = analyze_binary_expression(expr);
 		} break;
 		case ND_IF:
 		{
@@ -292,8 +788,104 @@ const Type_Info *analyze_expression(Node *expr)
 			type_is_boolean(condition, expr->token);
 			analyze_expression(expr->if_.then);
 		} break;
+		case ND_SWITCH:
+		{
+			analyze_switch(expr);
+		} break;
+		case ND_FOR:
+		{
+			// What the init declares is only there for the loop
+			push_scope(expr->token);
+			if(expr->for_.init)
+				analyze_expression(expr->for_.init);
+			const Type_Info *condition = analyze_expression(expr->for_.condition);
+			type_is_boolean(condition, expr->token);
+			if(expr->for_.step)
+				analyze_expression(expr->for_.step);
+			analyze_expression(expr->for_.body);
+			pop_scope(expr->token);
+		} break;
 		case ND_FN:
+		{
+			if(expr->func.body == NULL)
+			{
+				report_error(expr->token, "Expected a body for function");
+			}
+			if(expr->func.name == NULL)
+			{
+				report_error(expr->token, "Function literals are not supported, give the function a name");
+			}
+			if(scopes.size != 0)
+			{
+				report_error(expr->token, "Functions can only be declared in the global scope");
+			}
+
+			result = analyze_type(expr);
+			add_symbol(expr->func.name, result);
+			get_symbol(expr->func.name->string)->is_function = true;
+
+			push_scope(expr->token);
+			Node **args = expr->func.arguments;
+			int arg_size = ArrLen(args);
+			for(int i = 0; i < arg_size; ++i)
+			{
+				add_symbol(args[i]->fn_arg.identifier, result->fn.arguments[i]);
+			}
+
+			analyze_expression(expr->func.body);
+			if(result->fn.ret)
+			{
+				// Functions return the value of the last expression in their body
+				Node *body = expr->func.body;
+				int expr_count = ArrLen(body->body.expressions);
+				if(expr_count > 0)
+				{
+					Node *last = body->body.expressions[expr_count - 1];
+					coerce_literal(last, result->fn.ret);
+					if(is_value_expression(last))
+						body->type_info = last->type_info;
+				}
+				if(body->type_info == NULL)
+				{
+					report_error(expr->token, "Function %s has to return %s",
+							expr->func.name->string, result->fn.ret->name);
+				}
+				types_must_match(result->fn.ret, body->type_info, expr->token);
+			}
+			pop_scope(expr->token);
+		} break;
+		case ND_STRUCT:
+		{
+			result = analyze_struct(expr);
+		} break;
+		case ND_FIELD:
+		{
+			Node *operand = expr->field.operand;
+			const Type_Info *type = analyze_expression(operand);
+			if(type == NULL || type->type != T_STRUCT)
+			{
+				report_error(expr->token, "Only structs have fields");
+			}
+			if(operand->type != ND_ID && operand->type != ND_FIELD)
+			{
+				report_error(expr->token, "Fields can only be read out of a variable or another field");
+			}
+			char *name = expr->field.name->string;
+			for(int i = 0; i < type->struct_.field_count && result == NULL; ++i)
+			{
+				if(VStrCmp((char *)type->struct_.fields[i].name, name))
+				{
+					expr->field.offset = type->struct_.fields[i].offset;
+					result = type->struct_.fields[i].type;
+				}
+			}
+			if(result == NULL)
+			{
+				report_error(expr->field.name, "Struct %s has no field %s", type->name, name);
+			}
+		} break;
 		case ND_FN_ARG:
+		case ND_CASE:
 		case ND_ROOT:
 		case ND_ERROR:
 		{
@@ -304,5 +896,3 @@ const Type_Info *analyze_expression(Node *expr)
 	expr->type_info = result;
 	return result;
 }
-
-
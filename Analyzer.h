@@ -16,18 +16,45 @@ typedef enum
 	T_BOOL,
 } Type_Type;
 
+// @NOTE: structs are laid out here, not by the generator. Unless they're
+// declared fixed, fields are sorted by alignment from the largest down (stably,
+// so equal ones keep their order). Every size is a multiple of its alignment,
+// so that leaves no padding in between them and only the end is padded to the
+// struct's alignment. Offsets are 16 bits in the bytecode, hence the limit.
+//
+// A struct is a run of slots, and calls pass and return single cells. So a
+// struct can't be a function's argument or return value, analyze_type reports
+// it. Copy the fields in and out through scalars or a global struct instead
+#define STRUCT_MAX_SIZE (1 << 15) // in bytes
+
+typedef struct
+{
+	const char *name;
+	const struct _Type_Info *type;
+	int offset; // in bytes
+} Struct_Field;
+
 typedef struct _Type_Info
 {
 	Type_Type type;
-	int size;
+	int size;         // in bits
 	const char *name;
 	union
 	{
 		struct
 		{
-			const struct _Type_Info **arguments; // Dynamic array
+			const struct _Type_Info **arguments;
+			int argument_count;
 			const struct _Type_Info *ret;
 		} fn;
+		struct
+		{
+			Struct_Field *fields; // in layout order
+			int field_count;
+			int alignment;        // in bytes
+			int declared_size;    // in bytes, what the declared order would take
+			b32 is_fixed;
+		} struct_;
 	};
 } Type_Info;
 
@@ -41,19 +68,26 @@ typedef struct
 typedef struct
 {
 	const Type_Info *type;
-	Token *id;
+	char *name;
+	b32 is_function; // Named function definition, can't be assigned to
+	b32 is_const;    // Declared with ::, can't be assigned to either
+	b32 has_value;   // Folding found the constant's value, see fold_constants
+	u64 value;       // Stored the way a load of the symbol gives it back
 } Symbol;
 
 typedef struct
 {
-	Symbol *symbols;
+	int first_symbol; // Index into the symbol stack
 	Token *token;
 } Scope;
 
+// @NOTE: all local scopes share one symbol stack, popping a scope just drops
+// its symbols off the top so nothing is allocated once the stack is warm
 typedef struct
 {
 	Scope scopes[256];
 	int size;
+	Symbol *symbols; // stb_ds array
 } Scope_Array;
 
 typedef struct
@@ -62,10 +96,38 @@ typedef struct
 	Type_Info *value;
 } Type_Table;
 
+// @NOTE: the global scope lives for the whole session, so it's a hash table
+// in permanent memory instead of a scope array that gets pushed and popped
+typedef struct
+{
+	char *key;
+	Symbol value;
+} Global_Table;
+
+typedef struct
+{
+	int global_count;
+	int scope_count;
+	int type_count;
+} Analyzer_Checkpoint;
+
+void init_analyzer();
 void analyze_ast(Node *root);
 void free_temp_analyzer();
+const Type_Info *get_type(char *name);
+Symbol *get_symbol(char *name);
+Analyzer_Checkpoint get_analyzer_checkpoint();
+void restore_analyzer_checkpoint(Analyzer_Checkpoint checkpoint);
 const Type_Info *analyze_expression(Node *expressions);
 const Type_Info *analyze_next_expression(Expr_Arr *exprs);
+b32 is_value_expression(Node *expr);
+b32 is_assignment_op(Token_Value op);
+b32 is_comparison_op(Token_Value op);
+Token_Value get_assignment_base_op(Token_Value op);
+u64 get_literal_value(Node *literal);
+int get_type_alignment(const Type_Info *type);
+Node *get_field_root(Node *expr);
+void print_struct_layout(const Type_Info *type);
 
 
 #endif // _ANALYZER_H
@@ -0,0 +1,259 @@
+#include "Benchmark.h"
+#include "Session.h"
+
+// i := 0; sum := 0; while i < count { sum += i; i += 1 } sum
+// Built by hand with the test at the top, for loops are rotated (see generate_for)
+Function *make_counting_loop(u32 count)
+{
+	Function *fn = alloc_perm_memory(sizeof(Function));
+	*fn = (Function){.name = "counting_loop", .code = make_bytecode(INITIAL_BYTECODE_SIZE),
+		.frame_size = 2, .ret = get_type("i64")};
+	Bytecode *code = &fn->code;
+	pushop_int(code, 0);
+	push_byte(STOREQW, code); push_word(0, code);
+	pushop_int(code, 0);
+	push_byte(STOREQW, code); push_word(1, code);
+
+	int loop = code->i;
+	push_byte(LOADQW, code); push_word(0, code);
+	pushop_int(code, count);
+	push_byte(LTQW, code);
+	int exit = push_jump(JZ, code);
+
+	push_byte(LOADQW, code); push_word(1, code);
+	push_byte(LOADQW, code); push_word(0, code);
+	push_byte(ADDQW, code);
+	push_byte(STOREQW, code); push_word(1, code);
+
+	push_byte(LOADQW, code); push_word(0, code);
+	pushop_int(code, 1);
+	push_byte(ADDQW, code);
+	push_byte(STOREQW, code); push_word(0, code);
+
+	push_byte(JMP, code); push_dword(loop, code);
+	patch_jump_here(exit, code);
+	push_byte(LOADQW, code); push_word(1, code);
+	push_byte(RET, code); push_byte(1, code);
+	finish_bytecode(code);
+	fn->max_stack = compute_max_stack(code);
+	return fn;
+}
+
+Function *compile_benchmark(char *name, char *source)
+{
+	// The error was printed by the session, running garbage would only hide it
+	int index = -1;
+	if(session_run_line(source, strlen(source)))
+		index = find_function(name);
+	if(index == -1)
+	{
+		printf("Benchmark %s didn't compile\n", name);
+		exit(1);
+	}
+	return &functions[index];
+}
+
+Benchmark_Result run_benchmark(VM *vm, Benchmark *benchmark, Interpret_Proc run)
+{
+	Benchmark_Result result = {};
+
+	// One profiled run for the instruction count, it's left out of the timing
+	vm->profiling = true;
+	vm->dispatch_count = 0;
+	run(vm, benchmark->fn, benchmark->args);
+	vm->profiling = false;
+	result.instructions = vm->dispatch_count;
+
+	result.best_ns = INT64_MAX;
+	for(int i = 0; i < BENCHMARK_RUNS; ++i)
+	{
+		i64 start = VLibClockNs();
+		result.result = run(vm, benchmark->fn, benchmark->args);
+		i64 elapsed = VLibClockNs() - start;
+		if(elapsed < result.best_ns)
+			result.best_ns = elapsed;
+	}
+	return result;
+}
+
+void print_benchmark_result(const char *name, Benchmark_Result result)
+{
+	printf("%-16s %12llu instructions %10.3f ms %8.3f ns/instruction (result %lld)\n", name,
+			(unsigned long long)result.instructions, result.best_ns / 1000000.0,
+			(f64)result.best_ns / (f64)result.instructions, (long long)result.result);
+}
+
+// What one trip around the loop costs, the empty loop's is all overhead
+static void print_iteration_cost(Benchmark *benchmark, const char *engine, Benchmark_Result result)
+{
+	if(benchmark->iterations)
+		printf("  %s: %.3f ns and %.2f instructions per iteration\n", engine,
+				(f64)result.best_ns / (f64)benchmark->iterations,
+				(f64)result.instructions / (f64)benchmark->iterations);
+}
+
+// The stack interpreter with hot loops traced. The traces stay with the
+// function, only the profiled first run records and compiles them
+u64 run_traced(VM *vm, Function *fn, u64 *args)
+{
+	vm->tracing = true;
+	u64 result = interpret(vm, fn, args);
+	vm->tracing = false;
+	return result;
+}
+
+void prepare_benchmark_function(Function *fn)
+{
+	translate_to_registers(fn);
+	decode_function(fn);
+	jit_function(fn);
+}
+
+void run_benchmarks()
+{
+	InitVLib();
+	printf("dispatch: %s\n", USE_COMPUTED_GOTO ? "computed goto" : "switch");
+
+	// Compiled plain first, the superinstructions are measured against it at the end
+	b32 fuse = codegen_options.superinstructions;
+	codegen_options.superinstructions = false;
+	// fib mostly measures CALL and RET, arith is the arithmetic heavy one and
+	// branches the conditional heavy one, dispatch goes through a jump table.
+	// empty_loop is nothing but the backedge, loop_body adds a little work to it
+	// and calls makes that work a call to a function small enough to inline
+	Benchmark benchmarks[] = {
+		{.name = "counting_loop", .fn = make_counting_loop(10000000), .iterations = 10000000},
+		{.name = "empty_loop", .args = {10000000}, .iterations = 10000000, .fn = compile_benchmark("empty_loop",
+			"fn empty_loop(n: i64) -> i64 { for i := 0, i < n, i += 1 { } n }\n")},
+		{.name = "loop_body", .args = {10000000}, .iterations = 10000000, .fn = compile_benchmark("loop_body",
+			"fn loop_body(n: i64) -> i64 { s := 0 for i := 0, i < n, i += 1 { s += i * i % 7 } s }\n")},
+		{.name = "calls", .args = {10000000}, .iterations = 10000000, .fn = compile_benchmark("calls",
+			"fn call_leaf(x: i64) -> i64 { x * x % 7 } "
+			"fn calls(n: i64) -> i64 { s := 0 for i := 0, i < n, i += 1 { s += call_leaf(i) } s }\n")},
+		{.name = "fib", .args = {27}, .fn = compile_benchmark("fib",
+			"fn fib(n: i64) -> i64 { r := n if n > 1 { r = fib(n - 1) + fib(n - 2) } r }\n")},
+		{.name = "arith", .args = {50000}, .fn = compile_benchmark("arith",
+			"fn arith(n: i64) -> i64 { r := 0 if n > 0 { a := n * n + 3 * n + 7 "
+			"b := a * 5 - n * 2 c := (a + b) * (a - b) % 1000003 r = c + arith(n - 1) } r }\n")},
+		{.name = "branches", .args = {50000}, .fn = compile_benchmark("branches",
+			"fn branches(n: i64) -> i64 { r := 0 if n > 0 { a := n % 7 b := n % 5 "
+			"if a < 3 && b > 1 { r += 1 } if a == 0 || b == 4 { r += 2 } if a >= b { r += 4 } "
+			"if a != 6 && (b < 2 || a > 4) { r += 8 } r += branches(n - 1) } r }\n")},
+		{.name = "dispatch", .args = {50000}, .fn = compile_benchmark("dispatch",
+			"fn dispatch(n: i64) -> i64 { r := 0 if n > 0 { switch n % 10 { case 0 r = 3 case 1 r = n "
+			"case 2, 3 r = n * 2 case 4 r = 7 case 5 r = n % 3 case 6 r = 11 case 7, 8 r = 1 else r = 5 } "
+			"r += dispatch(n - 1) } r }\n")},
+	};
+	codegen_options.superinstructions = fuse;
+	int count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+	// Compiling one can grow functions and move the ones before it, so they're
+	// looked up again once they're all there
+	for(int i = 0; i < count; ++i)
+	{
+		int index = find_function((char *)benchmarks[i].name);
+		if(index != -1)
+			benchmarks[i].fn = &functions[index];
+	}
+
+	for(int i = 0; i < arrlen(functions); ++i)
+		prepare_benchmark_function(&functions[i]);
+
+	static VM vm;
+	init_vm(&vm);
+	vm.sequences = make_op_profile();
+	Benchmark_Result plain[sizeof(benchmarks) / sizeof(benchmarks[0])];
+	for(int i = 0; i < count; ++i)
+	{
+		Function *fn = benchmarks[i].fn;
+		translate_to_registers(fn);
+		i64 decode_start = VLibClockNs();
+		Decode_Stats decode = decode_function(fn);
+		i64 decode_ns = VLibClockNs() - decode_start;
+		i64 jit_start = VLibClockNs();
+		Jit_Stats jit = jit_function(fn);
+		i64 jit_ns = VLibClockNs() - jit_start;
+
+		Benchmark_Result stack = run_benchmark(&vm, &benchmarks[i], interpret);
+		Benchmark_Result registers = run_benchmark(&vm, &benchmarks[i], interpret_registers);
+		Benchmark_Result decoded = run_benchmark(&vm, &benchmarks[i], interpret_decoded);
+		Benchmark_Result native = run_benchmark(&vm, &benchmarks[i], run_jit);
+		Benchmark_Result traced = run_benchmark(&vm, &benchmarks[i], run_traced);
+		assert(stack.result == registers.result && stack.result == decoded.result);
+		assert(stack.result == native.result && stack.result == traced.result);
+		// The decoded form and native code don't profile, they do what the stack code does
+		decoded.instructions = stack.instructions;
+		native.instructions = stack.instructions;
+		traced.instructions = stack.instructions;
+		plain[i] = stack;
+
+		print_benchmark_result(benchmarks[i].name, stack);
+		print_benchmark_result("  registers", registers);
+		printf("  %.1f%% fewer instructions, %.2fx the speed\n",
+				100.0 - 100.0 * registers.instructions / stack.instructions,
+				(f64)stack.best_ns / (f64)registers.best_ns);
+		print_benchmark_result("  decoded", decoded);
+		printf("  %.2fx the speed, decoding %d instructions (%d code bytes to %d) took %.3f us",
+				(f64)stack.best_ns / (f64)decoded.best_ns, decode.instructions, fn->code.i,
+				decode.bytes, decode_ns / 1000.0);
+		i64 saved = stack.best_ns - decoded.best_ns;
+		if(saved > 0)
+			printf(", pays off after %lld runs\n", (long long)(decode_ns / saved + 1));
+		else
+			printf(", never pays off\n");
+		print_benchmark_result("  jit", native);
+		if(jit.fallback)
+			print_jit_stats(fn, jit);
+		else
+			printf("  %.2fx the speed, %d bytes of native code compiled in %.3f us\n",
+					(f64)stack.best_ns / (f64)native.best_ns, jit.code_bytes, jit_ns / 1000.0);
+		print_benchmark_result("  traced", traced);
+		int trace_count = 0;
+		for(int t = 0; t < hmlen(fn->traces); ++t)
+			trace_count += fn->traces[t].value->native != NULL;
+		printf("  %.2fx the speed, %d loop%s traced\n", (f64)stack.best_ns / (f64)traced.best_ns,
+				trace_count, trace_count == 1 ? "" : "s");
+		print_iteration_cost(&benchmarks[i], "stack", stack);
+		print_iteration_cost(&benchmarks[i], "registers", registers);
+		print_iteration_cost(&benchmarks[i], "jit", native);
+		print_iteration_cost(&benchmarks[i], "traced", traced);
+	}
+
+	printf("\nstack code opcode sequences:\n");
+	print_op_profile(vm.sequences, stdout);
+	VFree(vm.sequences);
+	vm.sequences = NULL;
+
+	// Everything gets fused in place, the recursive ones call the fused code too
+	printf("\nsuperinstructions:\n");
+	int fused_count = 0;
+	for(int i = 0; i < arrlen(functions); ++i)
+	{
+		fused_count += fuse_superinstructions(&functions[i]);
+		prepare_benchmark_function(&functions[i]);
+	}
+	for(int i = 0; i < count; ++i)
+	{
+		Function *fn = benchmarks[i].fn;
+		if(fn < functions || fn >= functions + arrlen(functions))
+		{
+			fused_count += fuse_superinstructions(fn);
+			prepare_benchmark_function(fn);
+		}
+	}
+	printf("%d fused in total\n", fused_count);
+	for(int i = 0; i < count; ++i)
+	{
+		Benchmark_Result fused = run_benchmark(&vm, &benchmarks[i], interpret);
+		Benchmark_Result decoded = run_benchmark(&vm, &benchmarks[i], interpret_decoded);
+		assert(fused.result == plain[i].result && decoded.result == plain[i].result);
+		decoded.instructions = fused.instructions;
+		print_benchmark_result(benchmarks[i].name, fused);
+		printf("  %.1f%% fewer instructions, %.2fx the speed\n",
+				100.0 - 100.0 * fused.instructions / plain[i].instructions,
+				(f64)plain[i].best_ns / (f64)fused.best_ns);
+		print_benchmark_result("  decoded", decoded);
+		print_iteration_cost(&benchmarks[i], "fused", fused);
+		print_iteration_cost(&benchmarks[i], "decoded", decoded);
+	}
+}
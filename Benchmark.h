@@ -0,0 +1,32 @@
+#ifndef _BENCHMARK_H
+#define _BENCHMARK_H
+
+#include "Basic.h"
+#include "Bytecode.h"
+#include "Interpreter.h"
+#include "Jit.h"
+#include "Trace.h"
+
+#define BENCHMARK_RUNS 5
+
+typedef struct
+{
+	const char *name;
+	Function *fn;
+	u64 args[4];
+	u64 iterations; // of the loop it's timing, 0 if it isn't a loop benchmark
+} Benchmark;
+
+typedef struct
+{
+	u64 instructions; // dispatched per run
+	i64 best_ns;      // fastest of BENCHMARK_RUNS
+	u64 result;
+} Benchmark_Result;
+
+typedef u64 (*Interpret_Proc)(VM *vm, Function *fn, u64 *args);
+
+Benchmark_Result run_benchmark(VM *vm, Benchmark *benchmark, Interpret_Proc run);
+void run_benchmarks();
+
+#endif // _BENCHMARK_H
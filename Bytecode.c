@@ -1,53 +1,392 @@
+
 #include "Bytecode.h"
+#include "Error.h"
 #include "stb_ds.h"
 #include <assert.h>
 #include <stdbool.h>
 
+// @NOTE: name, operand size, values popped, values pushed. Calls and returns
+// depend on their operands so they're -1. SWITCH's size is the part before its
+// entries, see get_instruction_size
+OP_Info op_info[OP_COUNT] = {
+	[NOP]     = {"NOP",     0,  0, 0},
+	[LOADB]   = {"LOADB",   2,  0, 1},
+	[LOADW]   = {"LOADW",   2,  0, 1},
+	[LOADDW]  = {"LOADDW",  2,  0, 1},
+	[LOADQW]  = {"LOADQW",  2,  0, 1},
+	[LOADF]   = {"LOADF",   2,  0, 1},
+	[LOADD]   = {"LOADD",   2,  0, 1},
+	[STOREB]  = {"STOREB",  2,  1, 0},
+	[STOREW]  = {"STOREW",  2,  1, 0},
+	[STOREDW] = {"STOREDW", 2,  1, 0},
+	[STOREQW] = {"STOREQW", 2,  1, 0},
+	[STOREF]  = {"STOREF",  2,  1, 0},
+	[STORED]  = {"STORED",  2,  1, 0},
+	[TEEB]    = {"TEEB",    2,  1, 1},
+	[TEEW]    = {"TEEW",    2,  1, 1},
+	[TEEDW]   = {"TEEDW",   2,  1, 1},
+	[TEEQW]   = {"TEEQW",   2,  1, 1},
+	[TEEF]    = {"TEEF",    2,  1, 1},
+	[TEED]    = {"TEED",    2,  1, 1},
+	[PUSHB]   = {"PUSHB",   1,  0, 1},
+	[PUSHW]   = {"PUSHW",   2,  0, 1},
+	[PUSHDW]  = {"PUSHDW",  4,  0, 1},
+	[PUSHQW]  = {"PUSHQW",  8,  0, 1},
+	[PUSHF]   = {"PUSHF",   4,  0, 1},
+	[PUSHD]   = {"PUSHD",   8,  0, 1},
+	[ADDDW]   = {"ADDDW",   0,  2, 1},
+	[ADDQW]   = {"ADDQW",   0,  2, 1},
+	[ADDF]    = {"ADDF",    0,  2, 1},
+	[ADDD]    = {"ADDD",    0,  2, 1},
+	[SUBDW]   = {"SUBDW",   0,  2, 1},
+	[SUBQW]   = {"SUBQW",   0,  2, 1},
+	[SUBF]    = {"SUBF",    0,  2, 1},
+	[SUBD]    = {"SUBD",    0,  2, 1},
+	[MULDW]   = {"MULDW",   0,  2, 1},
+	[MULQW]   = {"MULQW",   0,  2, 1},
+	[MULF]    = {"MULF",    0,  2, 1},
+	[MULD]    = {"MULD",    0,  2, 1},
+	[DIVDW]   = {"DIVDW",   0,  2, 1},
+	[DIVQW]   = {"DIVQW",   0,  2, 1},
+	[DIVF]    = {"DIVF",    0,  2, 1},
+	[DIVD]    = {"DIVD",    0,  2, 1},
+	[MODDW]   = {"MODDW",   0,  2, 1},
+	[MODQW]   = {"MODQW",   0,  2, 1},
+	[ANDDW]   = {"ANDDW",   0,  2, 1},
+	[ANDQW]   = {"ANDQW",   0,  2, 1},
+	[ORDW]    = {"ORDW",    0,  2, 1},
+	[ORQW]    = {"ORQW",    0,  2, 1},
+	[XORDW]   = {"XORDW",   0,  2, 1},
+	[XORQW]   = {"XORQW",   0,  2, 1},
+	[SHLDW]   = {"SHLDW",   0,  2, 1},
+	[SHLQW]   = {"SHLQW",   0,  2, 1},
+	[SHRDW]   = {"SHRDW",   0,  2, 1},
+	[SHRQW]   = {"SHRQW",   0,  2, 1},
+	[EQDW]    = {"EQDW",    0,  2, 1},
+	[EQQW]    = {"EQQW",    0,  2, 1},
+	[EQF]     = {"EQF",     0,  2, 1},
+	[EQD]     = {"EQD",     0,  2, 1},
+	[NEDW]    = {"NEDW",    0,  2, 1},
+	[NEQW]    = {"NEQW",    0,  2, 1},
+	[NEF]     = {"NEF",     0,  2, 1},
+	[NED]     = {"NED",     0,  2, 1},
+	[LTDW]    = {"LTDW",    0,  2, 1},
+	[LTQW]    = {"LTQW",    0,  2, 1},
+	[LTF]     = {"LTF",     0,  2, 1},
+	[LTD]     = {"LTD",     0,  2, 1},
+	[LEDW]    = {"LEDW",    0,  2, 1},
+	[LEQW]    = {"LEQW",    0,  2, 1},
+	[LEF]     = {"LEF",     0,  2, 1},
+	[LED]     = {"LED",     0,  2, 1},
+	[GTDW]    = {"GTDW",    0,  2, 1},
+	[GTQW]    = {"GTQW",    0,  2, 1},
+	[GTF]     = {"GTF",     0,  2, 1},
+	[GTD]     = {"GTD",     0,  2, 1},
+	[GEDW]    = {"GEDW",    0,  2, 1},
+	[GEQW]    = {"GEQW",    0,  2, 1},
+	[GEF]     = {"GEF",     0,  2, 1},
+	[GED]     = {"GED",     0,  2, 1},
+	[GLOAD]   = {"GLOAD",   2,  0, 1},
+	[GSTORE]  = {"GSTORE",  2,  1, 0},
+	[PUSHS]   = {"PUSHS",   4,  0, 1},
+	[POP]     = {"POP",     0,  1, 0},
+	[EQS]     = {"EQS",     0,  2, 1},
+	[HASHS]   = {"HASHS",   8,  1, 1},
+	[JMP]     = {"JMP",     4,  0, 0},
+	[JZ]      = {"JZ",      4,  1, 0},
+	[JNZ]     = {"JNZ",     4,  1, 0},
+	[JEQDW]   = {"JEQDW",   4,  2, 0},
+	[JEQQW]   = {"JEQQW",   4,  2, 0},
+	[JEQF]    = {"JEQF",    4,  2, 0},
+	[JEQD]    = {"JEQD",    4,  2, 0},
+	[JNEDW]   = {"JNEDW",   4,  2, 0},
+	[JNEQW]   = {"JNEQW",   4,  2, 0},
+	[JNEF]    = {"JNEF",    4,  2, 0},
+	[JNED]    = {"JNED",    4,  2, 0},
+	[JLTDW]   = {"JLTDW",   4,  2, 0},
+	[JLTQW]   = {"JLTQW",   4,  2, 0},
+	[JLTF]    = {"JLTF",    4,  2, 0},
+	[JLTD]    = {"JLTD",    4,  2, 0},
+	[JLEDW]   = {"JLEDW",   4,  2, 0},
+	[JLEQW]   = {"JLEQW",   4,  2, 0},
+	[JLEF]    = {"JLEF",    4,  2, 0},
+	[JLED]    = {"JLED",    4,  2, 0},
+	[JGTDW]   = {"JGTDW",   4,  2, 0},
+	[JGTQW]   = {"JGTQW",   4,  2, 0},
+	[JGTF]    = {"JGTF",    4,  2, 0},
+	[JGTD]    = {"JGTD",    4,  2, 0},
+	[JGEDW]   = {"JGEDW",   4,  2, 0},
+	[JGEQW]   = {"JGEQW",   4,  2, 0},
+	[JGEF]    = {"JGEF",    4,  2, 0},
+	[JGED]    = {"JGED",    4,  2, 0},
+	[JNLTF]   = {"JNLTF",   4,  2, 0},
+	[JNLTD]   = {"JNLTD",   4,  2, 0},
+	[JNLEF]   = {"JNLEF",   4,  2, 0},
+	[JNLED]   = {"JNLED",   4,  2, 0},
+	[JNGTF]   = {"JNGTF",   4,  2, 0},
+	[JNGTD]   = {"JNGTD",   4,  2, 0},
+	[JNGEF]   = {"JNGEF",   4,  2, 0},
+	[JNGED]   = {"JNGED",   4,  2, 0},
+	[SWITCH]  = {"SWITCH",  16, 1, 0},
+	[CALL]    = {"CALL",    4, -1, -1},
+	[CALLI]   = {"CALLI",   2, -1, -1},
+	[RET]     = {"RET",     1, -1, -1},
+	[TAILCALL] = {"TAILCALL", 4, -1, -1},
+	[ADDQW_LL] = {"ADDQW_LL", 4, 0, 1},
+	[SUBQW_LL] = {"SUBQW_LL", 4, 0, 1},
+	[MULQW_LL] = {"MULQW_LL", 4, 0, 1},
+	[ADDQW_LI] = {"ADDQW_LI", 6, 0, 1},
+	[SUBQW_LI] = {"SUBQW_LI", 6, 0, 1},
+	[MULQW_LI] = {"MULQW_LI", 6, 0, 1},
+	[EQQW_LI]  = {"EQQW_LI",  6, 0, 1},
+	[NEQW_LI]  = {"NEQW_LI",  6, 0, 1},
+	[LTQW_LI]  = {"LTQW_LI",  6, 0, 1},
+	[LEQW_LI]  = {"LEQW_LI",  6, 0, 1},
+	[GTQW_LI]  = {"GTQW_LI",  6, 0, 1},
+	[GEQW_LI]  = {"GEQW_LI",  6, 0, 1},
+	[LOOPQW_LI] = {"LOOPQW_LI", 14, 0, 0},
+	[LOOPQW_LL] = {"LOOPQW_LL", 12, 0, 0},
+	[FLOADB]    = {"FLOADB",    4, 0, 1},
+	[FLOADW]    = {"FLOADW",    4, 0, 1},
+	[FLOADDW]   = {"FLOADDW",   4, 0, 1},
+	[FLOADQW]   = {"FLOADQW",   4, 0, 1},
+	[FLOADF]    = {"FLOADF",    4, 0, 1},
+	[FLOADD]    = {"FLOADD",    4, 0, 1},
+	[FSTOREB]   = {"FSTOREB",   4, 1, 0},
+	[FSTOREW]   = {"FSTOREW",   4, 1, 0},
+	[FSTOREDW]  = {"FSTOREDW",  4, 1, 0},
+	[FSTOREQW]  = {"FSTOREQW",  4, 1, 0},
+	[FSTOREF]   = {"FSTOREF",   4, 1, 0},
+	[FSTORED]   = {"FSTORED",   4, 1, 0},
+	[GFLOADB]   = {"GFLOADB",   4, 0, 1},
+	[GFLOADW]   = {"GFLOADW",   4, 0, 1},
+	[GFLOADDW]  = {"GFLOADDW",  4, 0, 1},
+	[GFLOADQW]  = {"GFLOADQW",  4, 0, 1},
+	[GFLOADF]   = {"GFLOADF",   4, 0, 1},
+	[GFLOADD]   = {"GFLOADD",   4, 0, 1},
+	[GFSTOREB]  = {"GFSTOREB",  4, 1, 0},
+	[GFSTOREW]  = {"GFSTOREW",  4, 1, 0},
+	[GFSTOREDW] = {"GFSTOREDW", 4, 1, 0},
+	[GFSTOREQW] = {"GFSTOREQW", 4, 1, 0},
+	[GFSTOREF]  = {"GFSTOREF",  4, 1, 0},
+	[GFSTORED]  = {"GFSTORED",  4, 1, 0},
+	[NARROWB]   = {"NARROWB",   0, 1, 1},
+	[NARROWW]   = {"NARROWW",   0, 1, 1},
+};
+
+Codegen_Options codegen_options = {.fold_constants = true, .peephole = true, .superinstructions = true, .reuse_slots = true,
+	.inline_calls = true, .tail_calls = true, .evaluate_calls = true};
+
+// @NOTE: slots handed out at scope 0 belong to the session and persist between
+// lines, so do functions and the string pool. The code for a line is compiled
+// as a function with its own frame (scope 1), a function definition gets the
+// scope after the one it's defined in. Every local gets a fresh slot here,
+// allocate_slots packs them afterwards
 Alloc_Table *alloc_table;
+static char **alloc_names; // Allocation order, used to roll back a failed line
 static u16 scope_allocations[1024] = {};
 int current_scope = 0;
 
-Bytecode generate_bytecode(Node *tree)
-{
-	Bytecode bytecode = {.bytecode = alloc_temp_memory(MB(256)), .i = 0};
-	return bytecode;
-}
+// Locals of the frame that's being generated, the analyzer doesn't allow
+// shadowing so a flat table per frame is enough
+static Alloc_Table *local_table;
+// How many bodies deep we are in the current frame, declarations at depth 0 of
+// a line are globals
+static int body_depth = 0;
+// Index of the function that's being generated, -1 for a line
+static int function_index = -1;
+
+Function *functions;
+Alloc_Table *function_table;
+char **string_pool;
+Alloc_Table *string_table;
 
 void init_bytecode()
 {
 	shdefault(alloc_table, -1);
+	shdefault(function_table, -1);
+	shdefault(string_table, -1);
+}
+
+Bytecode_Checkpoint get_bytecode_checkpoint()
+{
+	Bytecode_Checkpoint result = {.alloc_count = arrlen(alloc_names),
+		.global_allocations = scope_allocations[0],
+		.function_count = arrlen(functions),
+		.string_count = arrlen(string_pool)};
+	return result;
+}
+
+void restore_bytecode_checkpoint(Bytecode_Checkpoint checkpoint)
+{
+	while(arrlen(alloc_names) > checkpoint.alloc_count)
+	{
+		char *name = arrpop(alloc_names);
+		shdel(alloc_table, name);
+	}
+	while(arrlen(functions) > checkpoint.function_count)
+	{
+		// Still in functions, the JIT finds its entry by the index
+		Function *fn = &functions[arrlen(functions) - 1];
+		shdel(function_table, fn->name);
+		free_bytecode(&fn->code);
+		free_bytecode(&fn->registers);
+		free_bytecode(&fn->inline_body);
+		if(fn->decoded)
+			VFree(fn->decoded);
+		jit_free_function(fn);
+		trace_free_function(fn);
+		arrsetlen(functions, arrlen(functions) - 1);
+	}
+	while(arrlen(string_pool) > checkpoint.string_count)
+	{
+		char *string = arrpop(string_pool);
+		shdel(string_table, string);
+	}
+	scope_allocations[0] = checkpoint.global_allocations;
+	current_scope = 0;
+	body_depth = 0;
+	shfree(local_table);
+}
+
+Bytecode make_bytecode(int initial_capacity)
+{
+	Bytecode result = {};
+	reserve_bytecode(initial_capacity, &result);
+	return result;
+}
+
+Bytecode bytecode_from_memory(void *memory, int capacity)
+{
+	Bytecode result = {.bytecode = memory, .i = 0, .capacity = capacity, .external = true};
+	return result;
 }
 
-int find_alloc(char *name)
+void free_bytecode(Bytecode *bytecode)
 {
-	return shget(alloc_table, name);
+	if(!bytecode->external)
+		VFree(bytecode->bytecode);
+	bytecode->bytecode = NULL;
+	bytecode->i = 0;
+	bytecode->capacity = 0;
+}
+
+void finish_bytecode(Bytecode *bytecode)
+{
+	if(bytecode->external || bytecode->i == 0)
+		return;
+	bytecode->bytecode = realloc(bytecode->bytecode, bytecode->i);
+	bytecode->capacity = bytecode->i;
+}
+
+void reserve_bytecode(int size, Bytecode *bytecode)
+{
+	if(size <= bytecode->capacity - bytecode->i)
+		return;
+
+	if(bytecode->external)
+	{
+		report_error(NULL, "Bytecode doesn't fit in the %d bytes it was given", bytecode->capacity);
+	}
+	if(size > MAX_BYTECODE_SIZE - bytecode->i)
+	{
+		report_error(NULL, "Bytecode is over the %d byte limit", MAX_BYTECODE_SIZE);
+	}
+
+	// Both stay under MAX_BYTECODE_SIZE, so doubling can't overflow
+	int needed = bytecode->i + size;
+	int capacity = bytecode->capacity ? bytecode->capacity : INITIAL_BYTECODE_SIZE;
+	while(capacity < needed)
+		capacity *= 2;
+	if(capacity > MAX_BYTECODE_SIZE)
+		capacity = MAX_BYTECODE_SIZE;
+
+	u8 *grown = realloc(bytecode->bytecode, capacity);
+	if(grown == NULL)
+	{
+		fprintf(stderr, "Out of memory, couldn't grow bytecode to %d bytes!", capacity);
+		exit(1);
+	}
+	bytecode->bytecode = grown;
+	bytecode->capacity = capacity;
 }
 
 void push_byte(u8 byte, Bytecode *bytecode)
 {
+	reserve_bytecode(1, bytecode);
 	bytecode->bytecode[bytecode->i++] = byte;
 }
 
 void push_word(u16 word, Bytecode *bytecode)
 {
-	push_byte(word >> 8, bytecode);
-	push_byte(word, bytecode);
+	reserve_bytecode(2, bytecode);
+	memcpy(bytecode->bytecode + bytecode->i, &word, 2);
+	bytecode->i += 2;
 }
 
 void push_dword(u32 dword, Bytecode *bytecode)
 {
-	push_word(dword >> 16, bytecode);
-	push_word(dword, bytecode);
+	reserve_bytecode(4, bytecode);
+	memcpy(bytecode->bytecode + bytecode->i, &dword, 4);
+	bytecode->i += 4;
 }
 
 void push_qword(u64 qword, Bytecode *bytecode)
 {
-	push_dword(qword >> 32, bytecode);
-	push_dword(qword, bytecode);
+	reserve_bytecode(8, bytecode);
+	memcpy(bytecode->bytecode + bytecode->i, &qword, 8);
+	bytecode->i += 8;
+}
+
+void push_bytes(const void *bytes, int size, Bytecode *bytecode)
+{
+	reserve_bytecode(size, bytecode);
+	memcpy(bytecode->bytecode + bytecode->i, bytes, size);
+	bytecode->i += size;
+}
+
+u16 read_word(u8 *at)
+{
+	u16 result;
+	memcpy(&result, at, 2);
+	return result;
+}
+
+u32 read_dword(u8 *at)
+{
+	u32 result;
+	memcpy(&result, at, 4);
+	return result;
 }
 
-void push_binary_instruction_based_on_type(OP first_op, Bytecode *bytecode,
-		const Type_Info *type_info, b32 floatable)
+u64 read_qword(u8 *at)
+{
+	u64 result;
+	memcpy(&result, at, 8);
+	return result;
+}
+
+// @NOTE: overwrites a dword pushed earlier, used to fill in jump targets
+void patch_dword(u32 dword, int at, Bytecode *bytecode)
+{
+	memcpy(bytecode->bytecode + at, &dword, 4);
+}
+
+// @NOTE: emits a jump with a target to be patched later, gives the target's offset
+int push_jump(OP op, Bytecode *bytecode)
+{
+	push_byte(op, bytecode);
+	int at = bytecode->i;
+	push_dword(0, bytecode);
+	return at;
+}
+
+void patch_jump_here(int at, Bytecode *bytecode)
+{
+	patch_dword(bytecode->i, at, bytecode);
+}
+
+OP get_op_based_on_type(OP first_op, const Type_Info *type_info, b32 floatable)
 {
 	switch(type_info->type)
 	{
@@ -55,13 +394,15 @@ void push_binary_instruction_based_on_type(OP first_op, Bytecode *bytecode,
 		{
 			switch(type_info->size)
 			{
+				case 8:
+				case 16:
 				case 32:
 				{
-					push_byte(first_op, bytecode);
+					return first_op;
 				} break;
 				case 64:
 				{
-					push_byte(first_op + 1, bytecode);
+					return first_op + 1;
 				} break;
 			}
 		} break;
@@ -74,23 +415,24 @@ void push_binary_instruction_based_on_type(OP first_op, Bytecode *bytecode,
 			{
 				case 32:
 				{
-					push_byte(first_op + 2, bytecode);
+					return first_op + 2;
 				} break;
 				case 64:
 				{
-					push_byte(first_op + 3, bytecode);
+					return first_op + 3;
 				} break;
 			}
 		} break;
 		case T_BOOL:
 		{
-			push_byte(first_op, bytecode);
+			return first_op;
 		} break;
 		default:
 		{
 			assert(false);
 		} break;
 	}
+	return NOP;
 }
 
 void push_instruction_based_on_type(OP first_op, Bytecode *bytecode,
@@ -138,6 +480,12 @@ void push_instruction_based_on_type(OP first_op, Bytecode *bytecode,
 		{
 			push_byte(first_op + 2, bytecode);
 		} break;
+		case T_STRING:
+		case T_FN:
+		{
+			// string pointers and function indexes take the whole slot
+			push_byte(first_op + 3, bytecode);
+		} break;
 		default:
 		{
 			assert(false);
@@ -145,20 +493,177 @@ void push_instruction_based_on_type(OP first_op, Bytecode *bytecode,
 	}
 }
 
-void load_value(int alloc, Bytecode *bytecode, const Type_Info *type_info)
+typedef struct
 {
-	push_instruction_based_on_type(LOADB, bytecode, type_info);
-	push_word(alloc, bytecode);
+	int slot;
+	b32 is_global;
+} Alloc;
+
+Alloc find_alloc(char *name)
+{
+	Alloc result = {.slot = shget(local_table, name), .is_global = false};
+	if(result.slot == -1)
+	{
+		result.slot = shget(alloc_table, name);
+		result.is_global = true;
+	}
+	return result;
+}
+
+int find_function(char *name)
+{
+	return shget(function_table, name);
+}
+
+// Gives fn's index in functions, -1 for code that isn't in there like a REPL line
+int get_function_index(Function *fn)
+{
+	if(fn >= functions && fn < functions + arrlen(functions))
+		return (int)(fn - functions);
+	return -1;
 }
 
-void store_value(Bytecode *bytecode, char *name, const Type_Info *type_info)
+void load_value(Alloc alloc, Bytecode *bytecode, const Type_Info *type_info)
 {
-	int alloc = scope_allocations[current_scope];
+	if(alloc.is_global)
+	{
+		push_byte(GLOAD, bytecode);
+		push_word(alloc.slot, bytecode);
+		return;
+	}
+	push_instruction_based_on_type(LOADB, bytecode, type_info);
+	push_word(alloc.slot, bytecode);
+}
 
+void store_to(Alloc alloc, Bytecode *bytecode, const Type_Info *type_info)
+{
+	if(alloc.is_global)
+	{
+		push_byte(GSTORE, bytecode);
+		push_word(alloc.slot, bytecode);
+		return;
+	}
 	push_instruction_based_on_type(STOREB, bytecode, type_info);
-	push_word(alloc, bytecode);
+	push_word(alloc.slot, bytecode);
+}
+
+// Allocates slot_count slots in a row for name, structs take more than one
+Alloc add_variable(Token *token, char *name, int slot_count)
+{
+	b32 is_global = current_scope == 1 && body_depth == 0;
+	int scope = is_global ? 0 : current_scope;
+	if(scope_allocations[scope] + slot_count > UINT16_MAX)
+	{
+		report_error(token, "Out of slots for %s", name);
+	}
+	Alloc alloc = {.slot = scope_allocations[scope], .is_global = is_global};
+	scope_allocations[scope] += slot_count;
+
+	if(is_global)
+	{
+		name = perm_strdup(name);
+		arrput(alloc_names, name);
+		shput(alloc_table, name, alloc.slot);
+	}
+	else
+	{
+		shput(local_table, name, alloc.slot);
+	}
+	return alloc;
+}
+
+// @NOTE: allocates a new slot for name and stores the top of the stack in it
+void store_value(Bytecode *bytecode, Token *token, const Type_Info *type_info)
+{
+	Alloc alloc = add_variable(token, token->string, 1);
+	store_to(alloc, bytecode, type_info);
+}
+
+// A field is in the variable its chain of fields starts at, the offsets of the
+// fields on the way add up. Gives the variable's slot, for a variable offset is 0
+Alloc find_field_alloc(Node *expr, int *offset)
+{
+	*offset = 0;
+	for(; expr->type == ND_FIELD; expr = expr->field.operand)
+		*offset += expr->field.offset;
+	Alloc alloc = find_alloc(expr->token->string);
+	assert(alloc.slot != -1);
+	return alloc;
+}
+
+// How many bytes a field load or store touches
+int get_field_width(OP op)
+{
+	static const int widths[] = {1, 2, 4, 8, 4, 8};
+	if(op >= GFLOADB)
+		op -= GFLOADB - FLOADB;
+	return widths[(op - FLOADB) % 6];
+}
+
+void load_field(Alloc alloc, int offset, Bytecode *bytecode, const Type_Info *type_info)
+{
+	push_instruction_based_on_type(alloc.is_global ? GFLOADB : FLOADB, bytecode, type_info);
+	push_word(alloc.slot, bytecode);
+	push_word(offset, bytecode);
+}
+
+void store_field(Alloc alloc, int offset, Bytecode *bytecode, const Type_Info *type_info)
+{
+	push_instruction_based_on_type(alloc.is_global ? GFSTOREB : FSTOREB, bytecode, type_info);
+	push_word(alloc.slot, bytecode);
+	push_word(offset, bytecode);
+}
+
+// Structs are copied a field at a time, nested ones a field of theirs at a time
+void copy_struct(const Type_Info *type, Alloc from, int from_offset, Alloc to, int to_offset,
+		Bytecode *bytecode)
+{
+	for(int i = 0; i < type->struct_.field_count; ++i)
+	{
+		Struct_Field *field = &type->struct_.fields[i];
+		if(field->type->type == T_STRUCT)
+		{
+			copy_struct(field->type, from, from_offset + field->offset, to, to_offset + field->offset, bytecode);
+			continue;
+		}
+		load_field(from, from_offset + field->offset, bytecode, field->type);
+		store_field(to, to_offset + field->offset, bytecode, field->type);
+	}
+}
+
+// @NOTE: a struct takes whole slots, so zeroing it a slot at a time also zeroes
+// the padding
+void generate_struct_declaration(Node *decl, Bytecode *bytecode)
+{
+	const Type_Info *type = decl->type_info;
+	int bytes = type->size / 8;
+	Token *name = decl->decl.operand->token;
+	Alloc alloc = add_variable(name, name->string, (bytes + 7) / 8);
+	if(decl->decl.expr)
+	{
+		int offset;
+		Alloc from = find_field_alloc(decl->decl.expr, &offset);
+		copy_struct(type, from, offset, alloc, 0, bytecode);
+		return;
+	}
+	for(int offset = 0; offset < bytes; offset += 8)
+	{
+		pushop_int(bytecode, 0);
+		store_field(alloc, offset, bytecode, get_type("i64"));
+	}
+}
+
+int add_string_constant(char *string)
+{
+	int index = shget(string_table, string);
+	if(index != -1)
+		return index;
 
-	shput(alloc_table, name, scope_allocations[current_scope]++);
+	string = perm_strdup(string);
+	index = arrlen(string_pool);
+	arrput(string_pool, string);
+	shput(string_table, string, index);
+	return index;
 }
 
 void pushop_byte(Bytecode *bytecode, u8 byte)
@@ -175,85 +680,1389 @@ void pushop_word(Bytecode *bytecode, u16 word)
 
 void pushop_dword(Bytecode *bytecode, u32 double_word)
 {
-	push_byte(PUSHW, bytecode);
+	push_byte(PUSHDW, bytecode);
 	push_dword(double_word, bytecode);
 }
 
 void pushop_qword(Bytecode *bytecode, u64 quad_word)
 {
-	push_byte(PUSHW, bytecode);
+	push_byte(PUSHQW, bytecode);
 	push_qword(quad_word, bytecode);
 }
 
-void generate_binary_expression(Node *binary, Bytecode *bytecode)
+// @NOTE: integer pushes are sign extended, so pick the smallest one that gives
+// back the same value
+void pushop_int(Bytecode *bytecode, i64 value)
 {
-	generate_expression(binary->binary.left, bytecode);
-	generate_expression(binary->binary.right, bytecode);
-	switch((int)binary->binary.op->value)
+	if(value >= INT8_MIN && value <= INT8_MAX)
+		pushop_byte(bytecode, value);
+	else if(value >= INT16_MIN && value <= INT16_MAX)
+		pushop_word(bytecode, value);
+	else if(value >= INT32_MIN && value <= INT32_MAX)
+		pushop_dword(bytecode, value);
+	else
+		pushop_qword(bytecode, value);
+}
+
+OP get_binary_op(Token_Value op, const Type_Info *operand_type)
+{
+	switch((int)op)
 	{
 		case '+':
 		{
-			push_binary_instruction_based_on_type(ADDDW, bytecode, binary->type_info,
-					true);
+			return get_op_based_on_type(ADDDW, operand_type, true);
 		} break;
 		case '-':
 		{
-			push_binary_instruction_based_on_type(SUBDW, bytecode, binary->type_info,
-					true);
+			return get_op_based_on_type(SUBDW, operand_type, true);
 		} break;
 		case '*':
 		{
-			push_binary_instruction_based_on_type(MULDW, bytecode, binary->type_info,
-					true);
+			return get_op_based_on_type(MULDW, operand_type, true);
 		} break;
 		case '/':
 		{
-			push_binary_instruction_based_on_type(DIVDW, bytecode, binary->type_info,
-					true);
+			return get_op_based_on_type(DIVDW, operand_type, true);
+		} break;
+		case '%':
+		{
+			return get_op_based_on_type(MODDW, operand_type, false);
+		} break;
+		// Only constants are folded with these, the generated code short circuits
+		case tok_logical_and:
+		case '&':
+		{
+			return get_op_based_on_type(ANDDW, operand_type, false);
+		} break;
+		case tok_logical_or:
+		case '|':
+		{
+			return get_op_based_on_type(ORDW, operand_type, false);
+		} break;
+		case '^':
+		{
+			return get_op_based_on_type(XORDW, operand_type, false);
+		} break;
+		case tok_bits_lshift:
+		{
+			return get_op_based_on_type(SHLDW, operand_type, false);
+		} break;
+		case tok_bits_rshift:
+		{
+			return get_op_based_on_type(SHRDW, operand_type, false);
+		} break;
+		case tok_logical_is:
+		{
+			return get_op_based_on_type(EQDW, operand_type, true);
+		} break;
+		case tok_logical_isnot:
+		{
+			return get_op_based_on_type(NEDW, operand_type, true);
+		} break;
+		case '<':
+		{
+			return get_op_based_on_type(LTDW, operand_type, true);
+		} break;
+		case tok_logical_lequal:
+		{
+			return get_op_based_on_type(LEDW, operand_type, true);
+		} break;
+		case '>':
+		{
+			return get_op_based_on_type(GTDW, operand_type, true);
 		} break;
+		case tok_logical_gequal:
+		{
+			return get_op_based_on_type(GEDW, operand_type, true);
+		} break;
+		default:
+		{
+			assert(false);
+		} break;
+	}
+	return NOP;
+}
+
+// Gives NOP if values of the type don't need narrowing after a binary op
+OP get_narrowing_op(const Type_Info *type)
+{
+	if(type->type != T_INT)
+		return NOP;
+	switch(type->size)
+	{
+		case 8:  return NARROWB;
+		case 16: return NARROWW;
+		default: return NOP;
+	}
+}
+
+// What the load (or a store of the same width) keeps of a cell
+u64 narrow_cell(u64 cell, OP load)
+{
+	switch(load)
+	{
+		case LOADB:  return (u64)(i64)(i8)cell;
+		case LOADW:  return (u64)(i64)(i16)cell;
+		case LOADDW: return (u64)(i64)(i32)cell;
+		case LOADF:  return (u32)cell;
+		default:     return cell;
+	}
+}
+
+void generate_binary_op(Token_Value op, Bytecode *bytecode, const Type_Info *operand_type)
+{
+	OP binary = get_binary_op(op, operand_type);
+	push_byte(binary, bytecode);
+	// Comparisons give a b32, anything else has the operands' type
+	OP narrow = get_narrowing_op(operand_type);
+	if(narrow != NOP && !(binary >= EQDW && binary <= GED))
+		push_byte(narrow, bytecode);
+}
+
+// @NOTE: generates condition as control flow, it jumps to one of the patches
+// added to jumps when the condition is jumps_if and falls through when it
+// isn't. The right side of && and || only runs when the left one doesn't
+// decide it. Anything else is evaluated and tested, a comparison followed by
+// its JZ or JNZ is fused into one compare and branch later
+static void generate_branch(Node *condition, Bytecode *bytecode, b32 jumps_if, int **jumps)
+{
+	if(condition->type == ND_BINARY)
+	{
+		Token_Value op = condition->binary.op->value;
+		if(op == tok_logical_and || op == tok_logical_or)
+		{
+			// false decides an &&, true decides an ||
+			b32 decides = op == tok_logical_or;
+			if(jumps_if == decides)
+			{
+				generate_branch(condition->binary.left, bytecode, jumps_if, jumps);
+				generate_branch(condition->binary.right, bytecode, jumps_if, jumps);
+			}
+			else
+			{
+				int *decided = NULL;
+				generate_branch(condition->binary.left, bytecode, decides, &decided);
+				generate_branch(condition->binary.right, bytecode, jumps_if, jumps);
+				for(int i = 0; i < arrlen(decided); ++i)
+					patch_jump_here(decided[i], bytecode);
+				arrfree(decided);
+			}
+			return;
+		}
+	}
+	generate_expression(condition, bytecode);
+	arrput(*jumps, push_jump(jumps_if ? JNZ : JZ, bytecode));
+}
+
+void generate_binary_expression(Node *binary, Bytecode *bytecode)
+{
+	Token_Value op = binary->binary.op->value;
+	if(op == tok_logical_and || op == tok_logical_or)
+	{
+		// As a value it's a branch to a 0 or a 1, the paths meet with it on the stack
+		int *jumps = NULL;
+		generate_branch(binary, bytecode, false, &jumps);
+		pushop_int(bytecode, 1);
+		int end = push_jump(JMP, bytecode);
+		for(int i = 0; i < arrlen(jumps); ++i)
+			patch_jump_here(jumps[i], bytecode);
+		arrfree(jumps);
+		pushop_int(bytecode, 0);
+		patch_jump_here(end, bytecode);
+		return;
+	}
+	if(is_assignment_op(op))
+	{
+		Node *left = binary->binary.left;
+		int offset;
+		Alloc alloc = find_field_alloc(left, &offset);
+		b32 is_field = left->type == ND_FIELD;
+		if(left->type_info->type == T_STRUCT)
+		{
+			int from_offset;
+			Alloc from = find_field_alloc(binary->binary.right, &from_offset);
+			copy_struct(left->type_info, from, from_offset, alloc, offset, bytecode);
+			return;
+		}
+		if(op != '=')
+		{
+			if(is_field)
+				load_field(alloc, offset, bytecode, left->type_info);
+			else
+				load_value(alloc, bytecode, left->type_info);
+			generate_expression(binary->binary.right, bytecode);
+			generate_binary_op(get_assignment_base_op(op), bytecode, left->type_info);
+		}
+		else
+		{
+			generate_expression(binary->binary.right, bytecode);
+		}
+		if(is_field)
+			store_field(alloc, offset, bytecode, left->type_info);
+		else
+			store_to(alloc, bytecode, left->type_info);
+		return;
+	}
+
+	generate_expression(binary->binary.left, bytecode);
+	generate_expression(binary->binary.right, bytecode);
+	// Comparisons give a b32, the instruction depends on what's being compared
+	generate_binary_op(op, bytecode, binary->binary.left->type_info);
+}
+
+void generate_literal(Node *literal, Bytecode *bytecode)
+{
+	const Type_Info *type = literal->type_info;
+	if(type->type == T_FLOAT)
+	{
+		f64 value = literal->literal._f64;
+		if(type->size == 32)
+		{
+			f32 narrow = (f32)value;
+			push_byte(PUSHF, bytecode);
+			push_dword(*(u32 *)&narrow, bytecode);
+		}
+		else
+		{
+			push_byte(PUSHD, bytecode);
+			push_qword(*(u64 *)&value, bytecode);
+		}
+		return;
+	}
+
+	// Narrow the constant to its type first so the sign extension gives back
+	// what a store of that width would keep
+	i64 value = literal->literal._i64;
+	switch(type->size)
+	{
+		case 8:  value = (i8)value;  break;
+		case 16: value = (i16)value; break;
+		case 32: value = (i32)value; break;
+	}
+	pushop_int(bytecode, value);
+}
+
+// @NOTE: generates the expressions of a body, only the last one is allowed to
+// leave its value on the stack and only if keep_value is set
+void generate_body(Node **expressions, Bytecode *bytecode, b32 keep_value)
+{
+	int count = ArrLen(expressions);
+	for(int i = 0; i < count; ++i)
+	{
+		Node *expr = expressions[i];
+		generate_expression(expr, bytecode);
+		if(is_value_expression(expr) && (i != count - 1 || !keep_value))
+			push_byte(POP, bytecode);
 	}
 }
 
+typedef struct
+{
+	i64 value;       // narrowed to the switch's type
+	char *string;    // for string switches
+	int case_index;
+} Switch_Label;
+
+typedef struct
+{
+	Switch_Label *labels;  // stb_ds array, integers are sorted
+	int **case_jumps;      // stb_ds arrays per case, code offsets to patch with where its body starts
+	int *default_jumps;    // stb_ds array
+	Alloc value;           // where the value is kept while it's compared
+	const Type_Info *type;
+} Switch_Lowering;
+
+static int compare_switch_labels(const void *a, const void *b)
+{
+	const Switch_Label *x = a, *y = b;
+	return x->value < y->value ? -1 : x->value > y->value;
+}
+
+// FNV-1a with the seed mixed into where it starts, the high half is folded
+// into the low one since tables only look at the low bits
+u32 hash_string(const char *string, u32 seed)
+{
+	u32 hash = 2166136261u ^ seed;
+	for(; *string; ++string)
+	{
+		hash ^= (u8)*string;
+		hash *= 16777619u;
+	}
+	return hash ^ (hash >> 16);
+}
+
+// @NOTE: looks for a seed that puts every string in its own slot of a power
+// of two table, starting with the smallest one that fits them and going up to
+// 8 times that. Without a perfect one it gives the seed with the fewest
+// collisions, strings that share a slot are compared one after the other
+u32 find_string_hash(char **strings, int count, u32 *mask)
+{
+	u32 size = 1;
+	while(size < (u32)count)
+		size *= 2;
+
+	u8 *used = alloc_temp_memory(size * 8);
+	u32 best_seed = 0;
+	int best_collisions = count + 1;
+	*mask = size - 1;
+	for(u32 table = size; table <= size * 8; table *= 2)
+	{
+		for(u32 seed = 0; seed < SWITCH_HASH_SEEDS; ++seed)
+		{
+			memset(used, 0, table);
+			int collisions = 0;
+			for(int i = 0; i < count; ++i)
+			{
+				u32 slot = hash_string(strings[i], seed) & (table - 1);
+				collisions += used[slot];
+				used[slot] = 1;
+			}
+			if(collisions < best_collisions)
+			{
+				best_collisions = collisions;
+				best_seed = seed;
+				*mask = table - 1;
+			}
+			if(collisions == 0)
+				return seed;
+		}
+	}
+	return best_seed;
+}
+
+static b32 is_dense(Switch_Lowering *sw, int first, int count)
+{
+	if(count < SWITCH_TABLE_MIN_CASES)
+		return false;
+	u64 range = (u64)sw->labels[first + count - 1].value - (u64)sw->labels[first].value + 1;
+	return range <= SWITCH_MAX_TABLE && (u64)count * 100 >= range * SWITCH_TABLE_DENSITY;
+}
+
+// SWITCH over the labels [first, first + count), what's in between goes to the default
+static void push_switch_table(Switch_Lowering *sw, int first, int count, Bytecode *bytecode)
+{
+	i64 low = sw->labels[first].value;
+	u32 entries = (u32)((u64)sw->labels[first + count - 1].value - (u64)low + 1);
+	push_byte(SWITCH, bytecode);
+	push_qword(low, bytecode);
+	push_dword(entries, bytecode);
+	arrput(sw->default_jumps, bytecode->i);
+	push_dword(0, bytecode);
+	int label = first;
+	for(u32 i = 0; i < entries; ++i)
+	{
+		int **jumps = &sw->default_jumps;
+		if((u64)sw->labels[label].value == (u64)low + i)
+			jumps = &sw->case_jumps[sw->labels[label++].case_index];
+		arrput(*jumps, bytecode->i);
+		push_dword(0, bytecode);
+	}
+}
+
+// @NOTE: a balanced binary search over the sorted labels, pieces that are
+// dense become a jump table and small ones are compared one by one. Every path
+// ends in a jump, nothing falls through
+static void generate_int_dispatch(Switch_Lowering *sw, int first, int count, Bytecode *bytecode)
+{
+	if(is_dense(sw, first, count))
+	{
+		load_value(sw->value, bytecode, sw->type);
+		push_switch_table(sw, first, count, bytecode);
+		return;
+	}
+	if(count <= SWITCH_LINEAR_CASES)
+	{
+		for(int i = first; i < first + count; ++i)
+		{
+			load_value(sw->value, bytecode, sw->type);
+			pushop_int(bytecode, sw->labels[i].value);
+			generate_binary_op(tok_logical_is, bytecode, sw->type);
+			arrput(sw->case_jumps[sw->labels[i].case_index], push_jump(JNZ, bytecode));
+		}
+		arrput(sw->default_jumps, push_jump(JMP, bytecode));
+		return;
+	}
+
+	int half = count / 2;
+	load_value(sw->value, bytecode, sw->type);
+	pushop_int(bytecode, sw->labels[first + half].value);
+	generate_binary_op('<', bytecode, sw->type);
+	int upper = push_jump(JZ, bytecode);
+	generate_int_dispatch(sw, first, half, bytecode);
+	patch_jump_here(upper, bytecode);
+	generate_int_dispatch(sw, first + half, count - half, bytecode);
+}
+
+static void push_string_compare(Switch_Lowering *sw, Switch_Label *label, Bytecode *bytecode)
+{
+	load_value(sw->value, bytecode, sw->type);
+	push_byte(PUSHS, bytecode);
+	push_dword(add_string_constant(label->string), bytecode);
+	push_byte(EQS, bytecode);
+	arrput(sw->case_jumps[label->case_index], push_jump(JNZ, bytecode));
+}
+
+// @NOTE: the hash picks a slot of a jump table and only the strings in that
+// slot are compared, with a perfect hash that's one comparison
+static void generate_string_dispatch(Switch_Lowering *sw, Bytecode *bytecode)
+{
+	int count = arrlen(sw->labels);
+	if(count < SWITCH_HASH_MIN_CASES)
+	{
+		for(int i = 0; i < count; ++i)
+			push_string_compare(sw, &sw->labels[i], bytecode);
+		arrput(sw->default_jumps, push_jump(JMP, bytecode));
+		return;
+	}
+
+	char **strings = alloc_temp_memory(sizeof(char *) * count);
+	for(int i = 0; i < count; ++i)
+		strings[i] = sw->labels[i].string;
+	u32 mask;
+	u32 seed = find_string_hash(strings, count, &mask);
+
+	int slot_count = mask + 1;
+	int **slot_jumps = alloc_temp_memory(sizeof(int *) * slot_count);
+	memset(slot_jumps, 0, sizeof(int *) * slot_count);
+	load_value(sw->value, bytecode, sw->type);
+	push_byte(HASHS, bytecode);
+	push_dword(seed, bytecode);
+	push_dword(mask, bytecode);
+	push_byte(SWITCH, bytecode);
+	push_qword(0, bytecode);
+	push_dword(slot_count, bytecode);
+	arrput(sw->default_jumps, bytecode->i);
+	push_dword(0, bytecode);
+	for(int slot = 0; slot < slot_count; ++slot)
+	{
+		arrput(slot_jumps[slot], bytecode->i);
+		push_dword(0, bytecode);
+	}
+
+	for(int slot = 0; slot < slot_count; ++slot)
+	{
+		int *jumps = slot_jumps[slot];
+		b32 empty = true;
+		for(int i = 0; i < count; ++i)
+			empty = empty && (hash_string(strings[i], seed) & mask) != (u32)slot;
+		if(empty)
+		{
+			for(int j = 0; j < arrlen(jumps); ++j)
+				arrput(sw->default_jumps, jumps[j]);
+			arrfree(jumps);
+			continue;
+		}
+		for(int j = 0; j < arrlen(jumps); ++j)
+			patch_jump_here(jumps[j], bytecode);
+		arrfree(jumps);
+		for(int i = 0; i < count; ++i)
+		{
+			if((hash_string(strings[i], seed) & mask) == (u32)slot)
+				push_string_compare(sw, &sw->labels[i], bytecode);
+		}
+		arrput(sw->default_jumps, push_jump(JMP, bytecode));
+	}
+}
+
+// Case bodies are scopes of their own, like a body
+static void generate_case_body(Node *body, Bytecode *bytecode)
+{
+	body_depth++;
+	generate_expression(body, bytecode);
+	if(is_value_expression(body))
+		push_byte(POP, bytecode);
+	body_depth--;
+}
+
+// @NOTE: the dispatch comes first and jumps to one of the bodies, which
+// follow in order with the else last. A whole integer range that's dense
+// switches on the value as it is, anything else keeps the value in a slot of
+// its own so every comparison can load it. Storing also narrows it to its type
+static void generate_switch(Node *expression, Bytecode *bytecode)
+{
+	Node **cases = expression->switch_.cases;
+	int case_count = ArrLen(cases);
+	Switch_Lowering sw = {.type = expression->switch_.value->type_info};
+	sw.case_jumps = alloc_temp_memory(sizeof(int *) * (case_count + 1));
+	memset(sw.case_jumps, 0, sizeof(int *) * (case_count + 1));
+	for(int c = 0; c < case_count; ++c)
+	{
+		Node **labels = cases[c]->case_.labels;
+		for(int l = 0; l < ArrLen(labels); ++l)
+		{
+			Switch_Label label = {.case_index = c};
+			if(labels[l]->type == ND_STRING)
+				label.string = labels[l]->token->string;
+			else
+				label.value = (i64)get_literal_value(labels[l]);
+			arrput(sw.labels, label);
+		}
+	}
+	int count = arrlen(sw.labels);
+	if(sw.type->type == T_INT)
+		qsort(sw.labels, count, sizeof(Switch_Label), compare_switch_labels);
+
+	generate_expression(expression->switch_.value, bytecode);
+	if(count == 0)
+		push_byte(POP, bytecode);
+	else if(sw.type->type == T_INT && sw.type->size == 64 && is_dense(&sw, 0, count))
+		push_switch_table(&sw, 0, count, bytecode);
+	else
+	{
+		sw.value.slot = scope_allocations[current_scope]++;
+		sw.value.is_global = false;
+		store_to(sw.value, bytecode, sw.type);
+		if(sw.type->type == T_STRING)
+			generate_string_dispatch(&sw, bytecode);
+		else
+			generate_int_dispatch(&sw, 0, count, bytecode);
+	}
+
+	int *ends = NULL;
+	for(int c = 0; c < case_count; ++c)
+	{
+		for(int j = 0; j < arrlen(sw.case_jumps[c]); ++j)
+			patch_jump_here(sw.case_jumps[c][j], bytecode);
+		arrfree(sw.case_jumps[c]);
+		generate_case_body(cases[c]->case_.body, bytecode);
+		arrput(ends, push_jump(JMP, bytecode));
+	}
+	for(int j = 0; j < arrlen(sw.default_jumps); ++j)
+		patch_jump_here(sw.default_jumps[j], bytecode);
+	if(expression->switch_.otherwise)
+		generate_case_body(expression->switch_.otherwise, bytecode);
+	for(int j = 0; j < arrlen(ends); ++j)
+		patch_jump_here(ends[j], bytecode);
+	arrfree(ends);
+	arrfree(sw.default_jumps);
+	arrfree(sw.labels);
+}
+
+static void generate_statement(Node *expression, Bytecode *bytecode)
+{
+	generate_expression(expression, bytecode);
+	if(is_value_expression(expression))
+		push_byte(POP, bytecode);
+}
+
+// @NOTE: the loop is rotated, the condition is tested once in front of it and
+// then again at the bottom where it jumps back to the body, so an iteration
+// only runs the one conditional jump. Counted loops (an i64 local stepped by a
+// constant and compared with <) get that jump and the step fused into a
+// LOOPQW by fuse_superinstructions
+static void generate_for(Node *expression, Bytecode *bytecode)
+{
+	// The init's declarations belong to the loop, never to the globals
+	body_depth++;
+	if(expression->for_.init)
+		generate_statement(expression->for_.init, bytecode);
+	int *exits = NULL;
+	generate_branch(expression->for_.condition, bytecode, false, &exits);
+
+	int top = bytecode->i;
+	generate_statement(expression->for_.body, bytecode);
+	if(expression->for_.step)
+		generate_statement(expression->for_.step, bytecode);
+	int *loops = NULL;
+	generate_branch(expression->for_.condition, bytecode, true, &loops);
+	for(int i = 0; i < arrlen(loops); ++i)
+		patch_dword(top, loops[i], bytecode);
+	for(int i = 0; i < arrlen(exits); ++i)
+		patch_jump_here(exits[i], bytecode);
+	arrfree(loops);
+	arrfree(exits);
+	body_depth--;
+}
+
+// @NOTE: a call is in tail position if what the function returns is what the
+// call returns, it's the last expression of the body or of a body that's
+// itself in tail position. Ifs and switches don't have values so their bodies
+// only count in functions that don't return one
+static void mark_tail_calls(Node *expression, b32 has_value)
+{
+	switch(expression->type)
+	{
+		case ND_CALL:
+		{
+			if((expression->type_info != NULL) == has_value)
+				expression->fn_call.is_tail = true;
+		} break;
+		case ND_BODY:
+		{
+			int count = ArrLen(expression->body.expressions);
+			if(count > 0)
+				mark_tail_calls(expression->body.expressions[count - 1], has_value);
+		} break;
+		case ND_IF:
+		{
+			if(!has_value)
+				mark_tail_calls(expression->if_.then, has_value);
+		} break;
+		case ND_SWITCH:
+		{
+			if(has_value)
+				break;
+			for(int i = 0; i < ArrLen(expression->switch_.cases); ++i)
+				mark_tail_calls(expression->switch_.cases[i]->case_.body, has_value);
+			if(expression->switch_.otherwise)
+				mark_tail_calls(expression->switch_.otherwise, has_value);
+		} break;
+		default: break;
+	}
+}
+
+void generate_function(Node *fn)
+{
+	int index = arrlen(functions);
+	Function function = {};
+	function.name = perm_strdup(fn->func.name->string);
+	function.arg_count = ArrLen(fn->func.arguments);
+	function.ret = fn->type_info->fn.ret;
+	arrput(functions, function);
+	// Registered before the body is generated so it can call itself
+	shput(function_table, functions[index].name, index);
+
+	Alloc_Table *saved_locals = local_table;
+	int saved_depth = body_depth;
+	int saved_index = function_index;
+	function_index = index;
+	local_table = NULL;
+	shdefault(local_table, -1);
+	body_depth = 0;
+	current_scope++;
+	scope_allocations[current_scope] = 0;
+
+	// Arguments are the first slots of the frame, the caller puts them there
+	for(int i = 0; i < function.arg_count; ++i)
+	{
+		Node *arg = fn->func.arguments[i];
+		shput(local_table, arg->fn_arg.identifier->string, scope_allocations[current_scope]++);
+	}
+
+	Bytecode code = make_bytecode(INITIAL_BYTECODE_SIZE);
+	Node *body = fn->func.body;
+	if(codegen_options.tail_calls)
+		mark_tail_calls(body, function.ret != NULL);
+	body_depth++;
+	generate_body(body->body.expressions, &code, function.ret != NULL);
+	body_depth--;
+	push_byte(RET, &code);
+	push_byte(function.ret != NULL, &code);
+	finish_bytecode(&code);
+
+	functions[index].code = code;
+	functions[index].frame_size = scope_allocations[current_scope];
+	functions[index].max_stack = compute_max_stack(&code);
+	optimize_function(&functions[index]);
+
+	current_scope--;
+	shfree(local_table);
+	local_table = saved_locals;
+	body_depth = saved_depth;
+	function_index = saved_index;
+}
+
 void generate_expression(Node *expression, Bytecode *bytecode)
 {
+	// Structs aren't values, a struct by itself doesn't do anything
+	if((expression->type == ND_ID || expression->type == ND_FIELD) &&
+			expression->type_info->type == T_STRUCT)
+		return;
+
 	switch(expression->type)
 	{
 		case ND_ID:
 		{
-			int alloc = find_alloc(expression->token->string);
-			assert(alloc != -1);
+			Alloc alloc = find_alloc(expression->token->string);
+			if(alloc.slot == -1)
+			{
+				// Named functions are constants, their value is their index
+				int fn = find_function(expression->token->string);
+				assert(fn != -1);
+				pushop_int(bytecode, fn);
+				break;
+			}
 			load_value(alloc, bytecode, expression->type_info);
 		} break;
 		case ND_DECL:
 		{
+			if(expression->type_info->type == T_STRUCT)
+			{
+				generate_struct_declaration(expression, bytecode);
+				break;
+			}
 			generate_expression(expression->decl.expr, bytecode);
-			store_value(bytecode, expression->decl.operand->token->string,
-					expression->type_info);
+			store_value(bytecode, expression->decl.operand->token, expression->type_info);
+		} break;
+		case ND_FIELD:
+		{
+			int offset;
+			Alloc alloc = find_field_alloc(expression, &offset);
+			load_field(alloc, offset, bytecode, expression->type_info);
+		} break;
+		case ND_STRUCT:
+		{
+			// Only a type, the analyzer already laid it out
 		} break;
 		case ND_LITERAL:
 		{
-			switch(expression->literal.type)
+			generate_literal(expression, bytecode);
+		} break;
+		case ND_STRING:
+		{
+			push_byte(PUSHS, bytecode);
+			push_dword(add_string_constant(expression->token->string), bytecode);
+		} break;
+		case ND_BINARY:
+		{
+			generate_binary_expression(expression, bytecode);
+		} break;
+		case ND_BODY:
+		{
+			body_depth++;
+			generate_body(expression->body.expressions, bytecode, expression->type_info != NULL);
+			body_depth--;
+		} break;
+		case ND_IF:
+		{
+			int *skips = NULL;
+			generate_branch(expression->if_.condition, bytecode, false, &skips);
+			generate_expression(expression->if_.then, bytecode);
+			if(is_value_expression(expression->if_.then))
+				push_byte(POP, bytecode);
+			for(int i = 0; i < arrlen(skips); ++i)
+				patch_jump_here(skips[i], bytecode);
+			arrfree(skips);
+		} break;
+		case ND_SWITCH:
+		{
+			generate_switch(expression, bytecode);
+		} break;
+		case ND_FOR:
+		{
+			generate_for(expression, bytecode);
+		} break;
+		case ND_CALL:
+		{
+			Node **args = expression->fn_call.arguments;
+			int arg_count = ArrLen(args);
+			for(int i = 0; i < arg_count; ++i)
 			{
-				case LIT_CHAR:
-				{
-					pushop_byte(bytecode, expression->literal._i64);
-				} break;
-				case LIT_INT:
-				{
-					pushop_qword(bytecode, expression->literal._i64);
-				} break;
-				case LIT_DOUBLE:
+				generate_expression(args[i], bytecode);
+			}
+
+			Node *operand = expression->fn_call.operand;
+			int fn = -1;
+			if(operand->type == ND_ID && find_alloc(operand->token->string).slot == -1)
+				fn = find_function(operand->token->string);
+
+			if(fn != -1 && expression->fn_call.is_tail && fn == function_index)
+			{
+				// Calling itself last is a loop, the arguments go where its caller put them
+				for(int i = arg_count - 1; i >= 0; --i)
 				{
-					pushop_qword(bytecode, expression->literal._f64);
-				} break;
-				default:
-				assert(false);
+					push_byte(STOREQW, bytecode);
+					push_word(i, bytecode);
+				}
+				push_byte(JMP, bytecode);
+				push_dword(0, bytecode);
+			}
+			else if(fn != -1 && expression->fn_call.is_tail)
+			{
+				push_byte(TAILCALL, bytecode);
+				push_dword(fn, bytecode);
+				push_byte(RET, bytecode);
+				push_byte(expression->type_info != NULL, bytecode);
+			}
+			else if(fn != -1)
+			{
+				push_byte(CALL, bytecode);
+				push_dword(fn, bytecode);
+			}
+			else
+			{
+				generate_expression(operand, bytecode);
+				push_byte(CALLI, bytecode);
+				push_byte(arg_count, bytecode);
+				push_byte(expression->type_info != NULL, bytecode);
 			}
 		} break;
-		case ND_BINARY:
+		case ND_FN:
 		{
-			generate_binary_expression(expression, bytecode);
+			generate_function(expression);
+		} break;
+		default:
+		{
+			assert(false);
 		} break;
 	}
 }
 
+// @NOTE: compiles the top level expressions of a line into an anonymous function,
+// its return value is the value of the last expression, if that has one
+Function generate_bytecode(Node *tree)
+{
+	Function line = {.name = "<line>", .code = make_bytecode(INITIAL_BYTECODE_SIZE)};
+	current_scope = 1;
+	scope_allocations[current_scope] = 0;
+	body_depth = 0;
+	function_index = -1;
+	shfree(local_table);
+	shdefault(local_table, -1);
+
+	Node **expressions = tree->root.expressions;
+	int count = ArrLen(expressions);
+	Node *last = count > 0 ? expressions[count - 1] : NULL;
+	if(last && is_value_expression(last))
+		line.ret = last->type_info;
+
+	generate_body(expressions, &line.code, line.ret != NULL);
+	push_byte(RET, &line.code);
+	push_byte(line.ret != NULL, &line.code);
+	finish_bytecode(&line.code);
+
+	line.frame_size = scope_allocations[current_scope];
+	line.max_stack = compute_max_stack(&line.code);
+	optimize_function(&line);
+	current_scope = 0;
+	shfree(local_table);
+	return line;
+}
+
+int get_instruction_size(u8 *at)
+{
+	if(at[0] == SWITCH)
+		return 1 + op_info[SWITCH].operand_size + 4 * read_dword(at + 9);
+	return 1 + op_info[at[0]].operand_size;
+}
+
+// @NOTE: gives how many code offsets the instruction at can jump to, they're
+// 32 bits each one after the other starting first bytes after the opcode.
+// A SWITCH's default offset comes right before its entries
+int get_jump_operands(u8 *at, int *first)
+{
+	*first = 1;
+	if(is_jump(at[0]))
+		return 1;
+	if(at[0] == SWITCH)
+	{
+		*first = 13;
+		return read_dword(at + 9) + 1;
+	}
+	return 0;
+}
+
+// @NOTE: gives the size of the instruction at, and how many values it takes
+// off and puts on the operand stack
+int get_stack_effect(u8 *at, int *pops, int *pushes)
+{
+	OP op = at[0];
+	*pops = op_info[op].pops;
+	*pushes = op_info[op].pushes;
+	switch(op)
+	{
+		case CALL:
+		case TAILCALL:
+		{
+			Function *fn = &functions[read_dword(at + 1)];
+			*pops = fn->arg_count;
+			*pushes = fn->ret != NULL;
+		} break;
+		case CALLI:
+		{
+			*pops = at[1] + 1;
+			*pushes = at[2];
+		} break;
+		case RET:
+		{
+			*pops = at[1];
+			*pushes = 0;
+		} break;
+		default: break;
+	}
+	return get_instruction_size(at);
+}
+
+// @NOTE: walks every path through the code, the generator keeps the stack
+// depth the same wherever paths meet so one depth per offset is enough.
+// Gives the depth before each offset (-1 where it can't be reached), in temp memory
+int *compute_stack_depths(Bytecode *bytecode, int *max_depth)
+{
+	int *depths = alloc_temp_memory(sizeof(int) * (bytecode->i + 1));
+	for(int i = 0; i <= bytecode->i; ++i)
+		depths[i] = -1;
+
+	int *work = NULL;
+	arrput(work, 0);
+	depths[0] = 0;
+	int max = 0;
+	while(arrlen(work) > 0)
+	{
+		int at = arrpop(work);
+		while(at < bytecode->i)
+		{
+			u8 *ip = bytecode->bytecode + at;
+			int pops, pushes;
+			int size = get_stack_effect(ip, &pops, &pushes);
+			int depth = depths[at] - pops + pushes;
+			assert(depths[at] >= pops);
+			if(depth > max)
+				max = depth;
+
+			OP op = ip[0];
+			if(op == RET)
+				break;
+			int first;
+			int jump_count = get_jump_operands(ip, &first);
+			for(int i = 0; i < jump_count; ++i)
+			{
+				int target = read_dword(ip + first + 4 * i);
+				if(depths[target] == -1)
+				{
+					depths[target] = depth;
+					arrput(work, target);
+				}
+				assert(depths[target] == depth);
+			}
+			if(op == JMP || op == SWITCH)
+				break;
+
+			int next = at + size;
+			if(depths[next] != -1)
+			{
+				assert(depths[next] == depth);
+				break;
+			}
+			depths[next] = depth;
+			at = next;
+		}
+	}
+	arrfree(work);
+	if(max_depth)
+		*max_depth = max;
+	return depths;
+}
+
+int compute_max_stack(Bytecode *bytecode)
+{
+	int max;
+	compute_stack_depths(bytecode, &max);
+	return max;
+}
+
+// @NOTE: the passes that run on generated code, the peephole rules work on
+// plain instructions so they go before fusing. Calls are inlined first so the
+// rest of the passes see the callee's code with the caller's arguments
+void optimize_function(Function *fn)
+{
+	if(codegen_options.inline_calls)
+	{
+		Inline_Stats stats = inline_calls(fn);
+		if(codegen_options.print_optimizations)
+			print_inline_stats(fn, stats);
+		arrfree(stats.inlined);
+	}
+	if(codegen_options.ssa)
+		optimize_ssa(fn);
+	if(codegen_options.peephole)
+	{
+		Peephole_Stats stats = peephole_optimize(fn);
+		if(codegen_options.print_optimizations)
+			print_peephole_stats(fn, stats);
+	}
+	if(codegen_options.reuse_slots)
+	{
+		Slot_Stats stats = allocate_slots(fn);
+		if(codegen_options.print_optimizations && stats.frame_before)
+			print_slot_stats(fn, stats);
+	}
+	if(codegen_options.inline_calls)
+		keep_inline_body(fn);
+	if(codegen_options.superinstructions)
+	{
+		int fused = fuse_superinstructions(fn);
+		if(codegen_options.print_optimizations && fused)
+			printf("fn %s: %d superinstructions\n", fn->name, fused);
+	}
+	demote_tail_calls(&fn->code);
+}
+
+// @NOTE: the passes can move code in between a TAILCALL and its RET (ex. the
+// SSA passes storing the result to a slot), those go back to being CALLs
+void demote_tail_calls(Bytecode *bytecode)
+{
+	for(int at = 0; at < bytecode->i; at += get_instruction_size(bytecode->bytecode + at))
+	{
+		u8 *ip = bytecode->bytecode + at;
+		if(ip[0] != TAILCALL)
+			continue;
+		u8 *next = ip + get_instruction_size(ip);
+		b32 returns = functions[read_dword(ip + 1)].ret != NULL;
+		if(next >= bytecode->bytecode + bytecode->i || next[0] != RET || next[1] != returns)
+			ip[0] = CALL;
+	}
+}
+
+// Gives a flag per offset (plus one for the end) saying if a jump goes there, in temp memory
+b32 *find_jump_targets(Bytecode *bytecode)
+{
+	b32 *targets = alloc_temp_memory(sizeof(b32) * (bytecode->i + 1));
+	memset(targets, 0, sizeof(b32) * (bytecode->i + 1));
+	for(int at = 0; at < bytecode->i; at += get_instruction_size(bytecode->bytecode + at))
+	{
+		int first;
+		int count = get_jump_operands(bytecode->bytecode + at, &first);
+		for(int i = 0; i < count; ++i)
+			targets[read_dword(bytecode->bytecode + at + first + 4 * i)] = true;
+	}
+	return targets;
+}
+
+// @NOTE: passes that rewrite code copy jumps with their old targets, this points
+// them at the new offsets once everything has moved
+void relocate_jumps(Bytecode *bytecode, int *new_offsets)
+{
+	for(int at = 0; at < bytecode->i; at += get_instruction_size(bytecode->bytecode + at))
+	{
+		int first;
+		int count = get_jump_operands(bytecode->bytecode + at, &first);
+		for(int i = 0; i < count; ++i)
+		{
+			int operand = at + first + 4 * i;
+			patch_dword(new_offsets[read_dword(bytecode->bytecode + operand)], operand, bytecode);
+		}
+	}
+}
+
+static OP get_fused_op(OP op, b32 immediate)
+{
+	if(!immediate)
+	{
+		switch(op)
+		{
+			case ADDQW: return ADDQW_LL;
+			case SUBQW: return SUBQW_LL;
+			case MULQW: return MULQW_LL;
+			default: return NOP;
+		}
+	}
+	switch(op)
+	{
+		case ADDQW: return ADDQW_LI;
+		case SUBQW: return SUBQW_LI;
+		case MULQW: return MULQW_LI;
+		case EQQW:  return EQQW_LI;
+		case NEQW:  return NEQW_LI;
+		case LTQW:  return LTQW_LI;
+		case LEQW:  return LEQW_LI;
+		case GTQW:  return GTQW_LI;
+		case GEQW:  return GEQW_LI;
+		default: return NOP;
+	}
+}
+
+// Gives the plain op a superinstruction ends in, ex. ADDQW for ADDQW_LI
+OP get_superinstruction_base(OP op)
+{
+	switch(op)
+	{
+		case ADDQW_LL: case ADDQW_LI: return ADDQW;
+		case SUBQW_LL: case SUBQW_LI: return SUBQW;
+		case MULQW_LL: case MULQW_LI: return MULQW;
+		case EQQW_LI: return EQQW;
+		case NEQW_LI: return NEQW;
+		case LTQW_LI: return LTQW;
+		case LEQW_LI: return LEQW;
+		case GTQW_LI: return GTQW;
+		case GEQW_LI: return GEQW;
+		default: return NOP;
+	}
+}
+
+b32 is_jump(OP op)
+{
+	return op == JMP || op == JZ || op == JNZ || (op >= JEQDW && op <= JNGED) ||
+		op == LOOPQW_LI || op == LOOPQW_LL;
+}
+
+// Anything that leaves a basic block: jumps, jump tables and returns
+b32 ends_block(OP op)
+{
+	return is_jump(op) || op == SWITCH || op == RET;
+}
+
+// Gives the comparison a compare and branch makes and whether it jumps when
+// that holds or when it doesn't, NOP if op isn't one
+OP get_branch_compare(OP op, b32 *jumps_if)
+{
+	*jumps_if = true;
+	if(op >= JEQDW && op <= JGED)
+		return EQDW + (op - JEQDW);
+	*jumps_if = false;
+	if(op >= JNLTF && op <= JNGED)
+		return LTF + (op - JNLTF) / 2 * 4 + (op - JNLTF) % 2;
+	return NOP;
+}
+
+// The compare and branch that jumps when compare gives jumps_if
+OP get_compare_branch(OP compare, b32 jumps_if)
+{
+	if(jumps_if)
+		return JEQDW + (compare - EQDW);
+	int kind = (compare - EQDW) / 4;
+	int width = (compare - EQDW) % 4;
+	// EQ and NE are each other's opposite even with a NaN, the ordered ones
+	// only are for integers: LT and GE, LE and GT
+	if(kind < 2)
+		return JEQDW + (kind ^ 1) * 4 + width;
+	if(width < 2)
+		return JEQDW + (7 - kind) * 4 + width;
+	return JNLTF + (kind - 2) * 2 + (width - 2);
+}
+
+static b32 get_small_push(u8 *at, i32 *value)
+{
+	switch(at[0])
+	{
+		case PUSHB:  *value = (i8)at[1]; return true;
+		case PUSHW:  *value = (i16)read_word(at + 1); return true;
+		case PUSHDW: *value = (i32)read_dword(at + 1); return true;
+		default: return false;
+	}
+}
+
+// @NOTE: the bottom of a counted loop, LOADQW s, PUSH step, ADDQW or SUBQW,
+// TEEQW s (or STOREQW s, LOADQW s), PUSH limit or LOADQW m, LTQW (or LEQW
+// with a PUSH) and JNZ. Writes the LOOPQW it becomes to result and gives the
+// size of what it replaces, 0 if the code at doesn't look like that
+static int fuse_counted_loop(Bytecode *code, int at, b32 *targets, Bytecode *result)
+{
+	u8 *ins[8];
+	int count = 0;
+	for(int next = at; count < 8 && next < code->i && (count == 0 || !targets[next]); ++count)
+	{
+		ins[count] = code->bytecode + next;
+		next += get_instruction_size(ins[count]);
+		if(ins[count][0] == JNZ)
+		{
+			count++;
+			break;
+		}
+	}
+	if(count < 7)
+		return 0;
+
+	i32 step;
+	u16 slot = read_word(ins[0] + 1);
+	if(ins[0][0] != LOADQW || !get_small_push(ins[1], &step))
+		return 0;
+	if(ins[2][0] == SUBQW && step != INT32_MIN)
+		step = -step;
+	else if(ins[2][0] != ADDQW)
+		return 0;
+
+	int compared = 4;
+	if(ins[3][0] == STOREQW && ins[4][0] == LOADQW && read_word(ins[4] + 1) == slot)
+		compared = 5;
+	else if(ins[3][0] != TEEQW)
+		return 0;
+	if(read_word(ins[3] + 1) != slot || compared + 3 != count)
+		return 0;
+
+	u8 *limit = ins[compared];
+	u8 *compare = ins[compared + 1];
+	u8 *jump = ins[compared + 2];
+	if(jump[0] != JNZ)
+		return 0;
+	i32 immediate;
+	b32 is_immediate = get_small_push(limit, &immediate);
+	if(!is_immediate && limit[0] != LOADQW)
+		return 0;
+	// i <= k is i < k + 1 as long as k + 1 doesn't wrap
+	if(compare[0] == LEQW && is_immediate && immediate != INT32_MAX)
+		immediate++;
+	else if(compare[0] != LTQW)
+		return 0;
+
+	push_byte(is_immediate ? LOOPQW_LI : LOOPQW_LL, result);
+	push_dword(read_dword(jump + 1), result);
+	push_word(slot, result);
+	push_dword((u32)step, result);
+	if(is_immediate)
+		push_dword((u32)immediate, result);
+	else
+		push_word(read_word(limit + 1), result);
+	return (int)(jump - ins[0]) + get_instruction_size(jump);
+}
+
+// @NOTE: rewrites fn's code with the superinstructions, picked from what the
+// sequence profiler shows the generator emits the most. Nothing is fused over a
+// jump target. Gives how many were made
+int fuse_superinstructions(Function *fn)
+{
+	Bytecode *code = &fn->code;
+	b32 *targets = find_jump_targets(code);
+	int *new_offsets = alloc_temp_memory(sizeof(int) * (code->i + 1));
+	Bytecode result = make_bytecode(code->i);
+	int fused = 0;
+
+	int at = 0;
+	while(at < code->i)
+	{
+		u8 *first = code->bytecode + at;
+		new_offsets[at] = result.i;
+		int second_at = at + get_instruction_size(first);
+		int loop_size = fuse_counted_loop(code, at, targets, &result);
+		if(loop_size)
+		{
+			at += loop_size;
+			fused++;
+			continue;
+		}
+		if(first[0] == LOADQW && second_at < code->i && !targets[second_at])
+		{
+			u8 *second = code->bytecode + second_at;
+			int third_at = second_at + get_instruction_size(second);
+			b32 immediate = second[0] == PUSHB || second[0] == PUSHW || second[0] == PUSHDW;
+			OP fused_op = NOP;
+			if(third_at < code->i && !targets[third_at] && (immediate || second[0] == LOADQW))
+				fused_op = get_fused_op(code->bytecode[third_at], immediate);
+			if(fused_op != NOP)
+			{
+				push_byte(fused_op, &result);
+				push_word(read_word(first + 1), &result);
+				switch(second[0])
+				{
+					case LOADQW: push_word(read_word(second + 1), &result); break;
+					case PUSHB:  push_dword((i32)(i8)second[1], &result); break;
+					case PUSHW:  push_dword((i32)(i16)read_word(second + 1), &result); break;
+					case PUSHDW: push_dword(read_dword(second + 1), &result); break;
+					default: assert(false);
+				}
+				at = third_at + get_instruction_size(code->bytecode + third_at);
+				fused++;
+				continue;
+			}
+		}
+		// A comparison and the JZ or JNZ that tests it -> compare and branch
+		if(first[0] >= EQDW && first[0] <= GED && second_at < code->i && !targets[second_at])
+		{
+			u8 *second = code->bytecode + second_at;
+			if(second[0] == JZ || second[0] == JNZ)
+			{
+				push_byte(get_compare_branch(first[0], second[0] == JNZ), &result);
+				push_dword(read_dword(second + 1), &result);
+				at = second_at + get_instruction_size(second);
+				fused++;
+				continue;
+			}
+		}
+		int size = get_instruction_size(first);
+		reserve_bytecode(size, &result);
+		memcpy(result.bytecode + result.i, first, size);
+		result.i += size;
+		at += size;
+	}
+	new_offsets[code->i] = result.i;
+	relocate_jumps(&result, new_offsets);
+	finish_bytecode(&result);
+
+	free_bytecode(code);
+	*code = result;
+	fn->max_stack = compute_max_stack(code);
+	return fused;
+}
+
+void disassemble(Bytecode *bytecode, FILE *out)
+{
+	int i = 0;
+	while(i < bytecode->i)
+	{
+		u8 op = bytecode->bytecode[i];
+		if(op >= OP_COUNT)
+		{
+			fprintf(out, "%6d  <invalid op %d>\n", i, op);
+			return;
+		}
+		u8 *operand = bytecode->bytecode + i + 1;
+		fprintf(out, "%6d  %-8s", i, op_info[op].name);
+		if(op == LOOPQW_LI || op == LOOPQW_LL)
+		{
+			fprintf(out, " %u %d %+d", read_dword(operand), read_word(operand + 4), (i32)read_dword(operand + 6));
+			if(op == LOOPQW_LI)
+				fprintf(out, " < %d\n", (i32)read_dword(operand + 10));
+			else
+				fprintf(out, " < %d\n", read_word(operand + 10));
+			i += get_instruction_size(bytecode->bytecode + i);
+			continue;
+		}
+		if(op >= FLOADB && op <= GFSTORED)
+		{
+			fprintf(out, " %d +%d\n", read_word(operand), read_word(operand + 2));
+			i += get_instruction_size(bytecode->bytecode + i);
+			continue;
+		}
+		if(op >= ADDQW_LL && op <= GEQW_LI)
+		{
+			if(op <= MULQW_LL)
+				fprintf(out, " %d %d\n", read_word(operand), read_word(operand + 2));
+			else
+				fprintf(out, " %d %d\n", read_word(operand), (i32)read_dword(operand + 2));
+			i += get_instruction_size(bytecode->bytecode + i);
+			continue;
+		}
+		if(op == SWITCH)
+		{
+			u32 count = read_dword(operand + 8);
+			fprintf(out, " %lld %u default %u:", (long long)read_qword(operand), count, read_dword(operand + 12));
+			for(u32 e = 0; e < count; ++e)
+				fprintf(out, " %u", read_dword(operand + 16 + 4 * e));
+			fputc('\n', out);
+			i += get_instruction_size(bytecode->bytecode + i);
+			continue;
+		}
+		if(op == HASHS)
+		{
+			fprintf(out, " seed %u mask %u\n", read_dword(operand), read_dword(operand + 4));
+			i += get_instruction_size(bytecode->bytecode + i);
+			continue;
+		}
+		switch(op_info[op].operand_size)
+		{
+			case 1: fprintf(out, " %d", operand[0]); break;
+			case 2: fprintf(out, " %d", read_word(operand)); break;
+			case 4: fprintf(out, " %u", read_dword(operand)); break;
+			case 8: fprintf(out, " %llu", (unsigned long long)read_qword(operand)); break;
+		}
+		// Show the value the push gives, not the raw immediate
+		switch(op)
+		{
+			case PUSHB:  fprintf(out, " (%d)", (i8)operand[0]); break;
+			case PUSHW:  fprintf(out, " (%d)", (i16)read_word(operand)); break;
+			case PUSHDW: fprintf(out, " (%d)", (i32)read_dword(operand)); break;
+			case PUSHQW: fprintf(out, " (%lld)", (long long)read_qword(operand)); break;
+			case PUSHF:
+			{
+				u32 bits = read_dword(operand);
+				f32 value;
+				memcpy(&value, &bits, 4);
+				fprintf(out, " (%g)", value);
+			} break;
+			case PUSHD:
+			{
+				u64 bits = read_qword(operand);
+				f64 value;
+				memcpy(&value, &bits, 8);
+				fprintf(out, " (%g)", value);
+			} break;
+		}
+		if(op == CALLI)
+			fprintf(out, " (%d args, returns %d)", operand[0], operand[1]);
+		else if(op == PUSHS)
+			fprintf(out, " \"%s\"", string_pool[read_dword(operand)]);
+		else if(op == CALL || op == TAILCALL)
+			fprintf(out, " %s", functions[read_dword(operand)].name);
+		fputc('\n', out);
+		i += get_instruction_size(bytecode->bytecode + i);
+	}
+}
@@ -6,9 +6,16 @@
 #include "Parser.h"
 #include "Analyzer.h"
 
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Bytecode operands are stored little endian"
+#endif
+
 // @NOTE: instructions are ordered in a way to be able to be generated by adding
 // to the base one, ex. LOADB + 2 is LOADDW, don't reorder them in a way that messes
 // this up
+//
+// Operands follow the opcode byte unaligned in native (little endian) byte order,
+// so they're written and read with a single memcpy each
 typedef enum : uint8_t
 {
 	NOP,
@@ -27,9 +34,18 @@ typedef enum : uint8_t
 	STOREF,   // store float (32 bits)
 	STORED,   // store double (64 bits)
 
+	// store without popping, the value left on the stack is the one that was stored
+	TEEB,
+	TEEW,
+	TEEDW,
+	TEEQW,
+	TEEF,
+	TEED,
+
+	// integer pushes sign extend their immediate, constants use the smallest one that fits
 	PUSHB,   // push byte on stack (as int)
 	PUSHW,   // push word (16 bits) on stack (as int)
-	PUSHDW,  // push double word (32 bits) on stack
+	PUSHDW,  // push double word (32 bits) on stack (as int)
 	PUSHQW,  // push quad word (64 bits) on stack
 	PUSHF,   // push float (32 bits) on stack
 	PUSHD,   // push double (64 bits) on stack
@@ -53,22 +69,336 @@ typedef enum : uint8_t
 	DIVQW,
 	DIVF,
 	DIVD,
+
+	// integer only ops, there's no float version so they come in pairs
+	MODDW,
+	MODQW,
+
+	ANDDW,
+	ANDQW,
+
+	ORDW,
+	ORQW,
+
+	XORDW,
+	XORQW,
+
+	SHLDW,
+	SHLQW,
+
+	SHRDW,
+	SHRQW,
+
+	// comparisons pop 2 values and push a b32
+	EQDW,
+	EQQW,
+	EQF,
+	EQD,
+
+	NEDW,
+	NEQW,
+	NEF,
+	NED,
+
+	LTDW,
+	LTQW,
+	LTF,
+	LTD,
+
+	LEDW,
+	LEQW,
+	LEF,
+	LED,
+
+	GTDW,
+	GTQW,
+	GTF,
+	GTD,
+
+	GEDW,
+	GEQW,
+	GEF,
+	GED,
+
+	GLOAD,   // load global slot (whole 64 bit cell)
+	GSTORE,  // store global slot (whole 64 bit cell)
+
+	PUSHS,   // push string from the constant pool, operand is the pool index (32 bits)
+	POP,     // throw away the top of the stack
+	EQS,     // pop 2 strings and push a b32 saying if they have the same characters
+	HASHS,   // pop a string and push its hash_string with the 32 bit seed, anded with the 32 bit mask
+
+	JMP,     // jump to the 32 bit code offset
+	JZ,      // pop and jump to the 32 bit code offset if it's 0
+	JNZ,     // pop and jump to the 32 bit code offset if it isn't 0
+
+	// compare and branch, fuse_superinstructions makes them out of a comparison
+	// and the JZ or JNZ after it. They pop 2 values and jump to the 32 bit code
+	// offset if the comparison holds, in the same order as the comparisons so
+	// JEQDW + (op - EQDW) gives the one for op
+	JEQDW,
+	JEQQW,
+	JEQF,
+	JEQD,
+
+	JNEDW,
+	JNEQW,
+	JNEF,
+	JNED,
+
+	JLTDW,
+	JLTQW,
+	JLTF,
+	JLTD,
+
+	JLEDW,
+	JLEQW,
+	JLEF,
+	JLED,
+
+	JGTDW,
+	JGTQW,
+	JGTF,
+	JGTD,
+
+	JGEDW,
+	JGEQW,
+	JGEF,
+	JGED,
+
+	// jump if the float comparison doesn't hold, which isn't the opposite
+	// comparison when one side is NaN. Integers flip to the opposite one instead
+	JNLTF,
+	JNLTD,
+	JNLEF,
+	JNLED,
+	JNGTF,
+	JNGTD,
+	JNGEF,
+	JNGED,
+
+	// jump table, pops an integer and jumps to the 32 bit code offset at
+	// (value - low) in the table, or to the default one if that's outside it.
+	// Operands are low (64 bits), the entry count (32 bits), the default offset
+	// (32 bits) and then the entries, so the size depends on the count
+	SWITCH,
+
+	CALL,    // call the function at the 32 bit index, arguments are on the stack
+	CALLI,   // pop a function index and call it, operands are the argument count (8 bits)
+	         // and if the function returns a value (8 bits)
+	RET,     // return, the 8 bit operand says if there's a value on the stack to return
+	// a CALL in tail position, the generator only puts one right before a RET
+	// that returns what it gives back. The callee takes over the caller's frame
+	// and returns straight to the caller's caller, engines that can't do that run
+	// it as a CALL and the RET after it returns
+	TAILCALL,
+
+	// superinstructions, fuse_superinstructions makes them out of the most common
+	// sequences. _LL ops take two 16 bit slots and replace LOADQW a, LOADQW b, op.
+	// _LI ops take a 16 bit slot and a 32 bit immediate (sign extended) and
+	// replace LOADQW a, PUSH imm, op
+	ADDQW_LL,
+	SUBQW_LL,
+	MULQW_LL,
+
+	ADDQW_LI,
+	SUBQW_LI,
+	MULQW_LI,
+	EQQW_LI,
+	NEQW_LI,
+	LTQW_LI,
+	LEQW_LI,
+	GTQW_LI,
+	GEQW_LI,
+
+	// counted loop backedges, fuse_superinstructions makes them out of the step
+	// and the compare and branch at the bottom of a rotated for loop. They add
+	// the 32 bit step (sign extended) to the 16 bit slot, store it and jump to
+	// the 32 bit code offset if the new value is less than the limit. The target
+	// comes first like every other jump's, then the slot, the step and the limit,
+	// a 32 bit immediate (sign extended) for _LI and a 16 bit slot for _LL
+	LOOPQW_LI,
+	LOOPQW_LL,
+
+	// struct fields, operands are the 16 bit slot the struct starts at and the
+	// field's 16 bit byte offset from there. Loads extend like LOAD does, stores
+	// only write the field's bytes so the fields around it are left alone
+	FLOADB,
+	FLOADW,
+	FLOADDW,
+	FLOADQW,
+	FLOADF,
+	FLOADD,
+
+	FSTOREB,
+	FSTOREW,
+	FSTOREDW,
+	FSTOREQW,
+	FSTOREF,
+	FSTORED,
+
+	// same for a struct in the global slots
+	GFLOADB,
+	GFLOADW,
+	GFLOADDW,
+	GFLOADQW,
+	GFLOADF,
+	GFLOADD,
+
+	GFSTOREB,
+	GFSTOREW,
+	GFSTOREDW,
+	GFSTOREQW,
+	GFSTOREF,
+	GFSTORED,
+
+	// i8 and i16 math is done with the DW ops, these narrow its result to the
+	// low 8 or 16 bits and sign extend it back, the value a store and a load
+	// of the type would leave
+	NARROWB,
+	NARROWW,
+
+	OP_COUNT,
 } OP;
 
+typedef struct
+{
+	const char *name;
+	int operand_size; // in bytes
+	int pops;         // -1 if it depends on the operands
+	int pushes;       // -1 if it depends on the operands
+} OP_Info;
+
+// @NOTE: code buffers start small and double as needed, finish_bytecode
+// shrinks them to the size that was used. A buffer can also be built in memory
+// the caller owns (ex. a mapped output file), that one is never grown or freed
+// and running out of it is an error
 typedef struct
 {
 	u8 *bytecode;
 	int i;
+	int capacity;
+	b32 external;
 } Bytecode;
 
+#define INITIAL_BYTECODE_SIZE 64
+#define MAX_BYTECODE_SIZE (1 << 30)
+
+// @NOTE: how switches are lowered, see generate_switch. Integer cases that
+// cover at least SWITCH_TABLE_DENSITY percent of their range get a jump table,
+// the rest is split in half with a comparison until a piece is dense or small
+// enough to compare case by case. Strings with enough cases hash to a table
+#define SWITCH_TABLE_MIN_CASES 4
+#define SWITCH_TABLE_DENSITY   40
+#define SWITCH_MAX_TABLE       4096
+#define SWITCH_LINEAR_CASES    3
+#define SWITCH_HASH_MIN_CASES  4
+#define SWITCH_HASH_SEEDS      256
+
+// @NOTE: every piece of code is a function, including the code for a REPL
+// line, locals (and arguments, which come first) are slots in the frame
+typedef struct
+{
+	char *name;
+	Bytecode code;
+	int arg_count;
+	int frame_size;
+	int max_stack;        // deepest the operand stack gets inside the function
+	const Type_Info *ret; // NULL if the function doesn't return a value
+
+	// Unfused copy of code, only kept for functions small enough to inline, see Inline.c
+	Bytecode inline_body;
+
+	// Register form, only there once translate_to_registers has run
+	Bytecode registers;
+	int register_count;   // frame_size plus a register per operand stack depth
+
+	// Pre-decoded form of code, only there once decode_function has run
+	struct _Decoded_Instruction *decoded;
+
+	// Native code, only there once jit_function has compiled it
+	void *native;
+	int native_size;
+
+	// Only counted by the tiered engine, see Tier.c
+	u32 call_count;
+	u32 backedge_count;
+	b32 tiered; // went through tier_up, whether it could be compiled or not
+
+	// stb_ds hash map of its loops' traces, only the tracing engine makes them, see Trace.c
+	struct _Trace_Table *traces;
+} Function;
+
 typedef struct
 {
 	char *key;
 	int value;
 } Alloc_Table;
 
-Bytecode generate_bytecode(Node *tree);
+typedef struct
+{
+	b32 fold_constants;     // run fold_constants on the tree before generating it
+	b32 peephole;           // run peephole_optimize on everything generated
+	b32 superinstructions;  // run fuse_superinstructions on everything generated
+	b32 reuse_slots;        // run allocate_slots on everything generated
+	b32 ssa;                // run the SSA passes on everything generated, see optimize_ssa
+	b32 inline_calls;       // run inline_calls on everything generated, see Inline.h
+	b32 tail_calls;         // calls in tail position reuse the frame, see mark_tail_calls
+	b32 evaluate_calls;     // fold_constants runs pure calls with constant arguments, see Eval.h
+	b32 dump_ir;
+	b32 print_optimizations;
+} Codegen_Options;
+
+typedef struct
+{
+	int alloc_count;
+	u16 global_allocations;
+	int function_count;
+	int string_count;
+} Bytecode_Checkpoint;
+
+extern OP_Info op_info[OP_COUNT];
+extern Codegen_Options codegen_options;
+extern Function *functions;  // stb_ds array, lives for the whole session
+extern char **string_pool;   // stb_ds array, lives for the whole session
+
+void init_bytecode();
+Bytecode make_bytecode(int initial_capacity);
+Bytecode bytecode_from_memory(void *memory, int capacity);
+void reserve_bytecode(int size, Bytecode *bytecode);
+void finish_bytecode(Bytecode *bytecode);
+Function generate_bytecode(Node *tree);
 void generate_expression(Node *expression, Bytecode *bytecode);
+OP get_binary_op(Token_Value op, const Type_Info *operand_type);
+OP get_narrowing_op(const Type_Info *type);
+u64 narrow_cell(u64 cell, OP load);
+void free_bytecode(Bytecode *bytecode);
+int find_function(char *name);
+int get_function_index(Function *fn);
+u16 read_word(u8 *at);
+u32 read_dword(u8 *at);
+u64 read_qword(u8 *at);
+int get_instruction_size(u8 *at);
+int get_jump_operands(u8 *at, int *first);
+int get_stack_effect(u8 *at, int *pops, int *pushes);
+b32 *find_jump_targets(Bytecode *bytecode);
+void relocate_jumps(Bytecode *bytecode, int *new_offsets);
+int fuse_superinstructions(Function *fn);
+void optimize_function(Function *fn);
+void demote_tail_calls(Bytecode *bytecode);
+OP get_superinstruction_base(OP op);
+b32 is_jump(OP op);
+int get_field_width(OP op);
+b32 ends_block(OP op);
+u32 hash_string(const char *string, u32 seed);
+u32 find_string_hash(char **strings, int count, u32 *mask);
+OP get_branch_compare(OP op, b32 *jumps_if);
+OP get_compare_branch(OP compare, b32 jumps_if);
+int *compute_stack_depths(Bytecode *bytecode, int *max_depth);
+int compute_max_stack(Bytecode *bytecode);
+void pushop_int(Bytecode *bytecode, i64 value);
+void disassemble(Bytecode *bytecode, FILE *out);
+Bytecode_Checkpoint get_bytecode_checkpoint();
+void restore_bytecode_checkpoint(Bytecode_Checkpoint checkpoint);
 
 #endif // _BYTECODE_H
-
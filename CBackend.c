@@ -0,0 +1,1106 @@
+#include "CBackend.h"
+#include "stb_ds.h"
+#include <assert.h>
+#include <stdarg.h>
+#include <math.h>
+#include <ctype.h>
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <sys/wait.h>
+#endif
+
+// @NOTE: written at the start of the generated C, so every program carries its
+// own copy and builds don't share a file. Everything in it is static, the
+// limits and the messages are the VM's so a compiled script fails the same way
+// an interpreted one does
+static const char *c_runtime =
+"// ApocScript runtime\n"
+"\n"
+"#include <stdint.h>\n"
+"#include <stdio.h>\n"
+"#include <string.h>\n"
+"#include <setjmp.h>\n"
+"\n"
+"#define APOC_MAX_FRAMES  (1 << 16)\n"
+"#define APOC_LOCALS_SIZE (1 << 20)\n"
+"\n"
+"typedef void (*Apoc_Function)(void);\n"
+"\n"
+"static jmp_buf *apoc_recovery;\n"
+"static int apoc_frames;      // calls deep, the line is frame 0\n"
+"static int64_t apoc_locals;  // slots the VM would have in use\n"
+"\n"
+"// A runtime error ends the line, the next one still runs\n"
+"static void apoc_error(const char *error)\n"
+"{\n"
+"\tprintf(\"\\n\\nRuntime error: %s\\n\\n\", error);\n"
+"\tlongjmp(*apoc_recovery, 1);\n"
+"}\n"
+"\n"
+"static void apoc_run_line(void (*line)(void), int slots)\n"
+"{\n"
+"\tjmp_buf recovery;\n"
+"\tapoc_recovery = &recovery;\n"
+"\tif(setjmp(recovery) == 0)\n"
+"\t{\n"
+"\t\tapoc_frames = 0;\n"
+"\t\tapoc_locals = slots;\n"
+"\t\tline();\n"
+"\t}\n"
+"}\n"
+"\n"
+"static inline void apoc_enter(int slots)\n"
+"{\n"
+"\tif(apoc_frames + 1 >= APOC_MAX_FRAMES)\n"
+"\t\tapoc_error(\"Stack overflow, too many nested calls\");\n"
+"\tif(apoc_locals + slots > APOC_LOCALS_SIZE)\n"
+"\t\tapoc_error(\"Stack overflow\");\n"
+"\tapoc_frames++;\n"
+"\tapoc_locals += slots;\n"
+"}\n"
+"\n"
+"static inline void apoc_leave(int slots)\n"
+"{\n"
+"\tapoc_frames--;\n"
+"\tapoc_locals -= slots;\n"
+"}\n"
+"\n"
+"// Ints of 32 bits and less are computed as 32 bits and wrap, i8 and i16 results are narrowed after\n"
+"static inline int32_t apoc_add_i32(int32_t a, int32_t b) { return (int32_t)((uint32_t)a + (uint32_t)b); }\n"
+"static inline int32_t apoc_sub_i32(int32_t a, int32_t b) { return (int32_t)((uint32_t)a - (uint32_t)b); }\n"
+"static inline int32_t apoc_mul_i32(int32_t a, int32_t b) { return (int32_t)((uint32_t)a * (uint32_t)b); }\n"
+"static inline int32_t apoc_shl_i32(int32_t a, int32_t b) { return (int32_t)((uint32_t)a << ((uint32_t)b & 31)); }\n"
+"static inline int32_t apoc_shr_i32(int32_t a, int32_t b) { return a >> ((uint32_t)b & 31); }\n"
+"static inline int64_t apoc_add_i64(int64_t a, int64_t b) { return (int64_t)((uint64_t)a + (uint64_t)b); }\n"
+"static inline int64_t apoc_sub_i64(int64_t a, int64_t b) { return (int64_t)((uint64_t)a - (uint64_t)b); }\n"
+"static inline int64_t apoc_mul_i64(int64_t a, int64_t b) { return (int64_t)((uint64_t)a * (uint64_t)b); }\n"
+"static inline int64_t apoc_shl_i64(int64_t a, int64_t b) { return (int64_t)((uint64_t)a << ((uint64_t)b & 63)); }\n"
+"static inline int64_t apoc_shr_i64(int64_t a, int64_t b) { return a >> ((uint64_t)b & 63); }\n"
+"\n"
+"// MIN / -1 traps on x86, -1 is a wrapping negate instead\n"
+"static inline int32_t apoc_div_i32(int32_t a, int32_t b)\n"
+"{\n"
+"\tif(b == 0)\n"
+"\t\tapoc_error(\"Integer division by zero\");\n"
+"\treturn b == -1 ? (int32_t)(0u - (uint32_t)a) : a / b;\n"
+"}\n"
+"\n"
+"static inline int32_t apoc_mod_i32(int32_t a, int32_t b)\n"
+"{\n"
+"\tif(b == 0)\n"
+"\t\tapoc_error(\"Integer division by zero\");\n"
+"\treturn b == -1 ? 0 : a % b;\n"
+"}\n"
+"\n"
+"static inline int64_t apoc_div_i64(int64_t a, int64_t b)\n"
+"{\n"
+"\tif(b == 0)\n"
+"\t\tapoc_error(\"Integer division by zero\");\n"
+"\treturn b == -1 ? (int64_t)(0 - (uint64_t)a) : a / b;\n"
+"}\n"
+"\n"
+"static inline int64_t apoc_mod_i64(int64_t a, int64_t b)\n"
+"{\n"
+"\tif(b == 0)\n"
+"\t\tapoc_error(\"Integer division by zero\");\n"
+"\treturn b == -1 ? 0 : a % b;\n"
+"}\n"
+"\n"
+"// Float constants that can't be written as literals (infinities and NaNs)\n"
+"static inline float apoc_f32_bits(uint32_t bits) { float f; memcpy(&f, &bits, sizeof(f)); return f; }\n"
+"static inline double apoc_f64_bits(uint64_t bits) { double d; memcpy(&d, &bits, sizeof(d)); return d; }\n"
+"\n"
+"// The compiler's hash_string, string switches look up the case with it\n"
+"static inline uint32_t apoc_hash_string(const char *string, uint32_t seed)\n"
+"{\n"
+"\tuint32_t hash = 2166136261u ^ seed;\n"
+"\tfor(; *string; ++string)\n"
+"\t{\n"
+"\t\thash ^= (uint8_t)*string;\n"
+"\t\thash *= 16777619u;\n"
+"\t}\n"
+"\treturn hash ^ (hash >> 16);\n"
+"}\n"
+"\n"
+"static void apoc_print_int(int64_t value) { printf(\"%lld\\n\", (long long)value); }\n"
+"static void apoc_print_float(double value) { printf(\"%g\\n\", value); }\n"
+"static void apoc_print_bool(int32_t value) { printf(\"%s\\n\", value ? \"true\" : \"false\"); }\n"
+"static void apoc_print_string(const char *value) { printf(\"%s\\n\", value); }\n"
+"\n";
+
+static C_Program program;
+
+static void c_vappend(char **buffer, const char *format, va_list args)
+{
+	va_list copy;
+	va_copy(copy, args);
+	int size = vsnprintf(NULL, 0, format, copy);
+	va_end(copy);
+
+	// vsnprintf writes the terminator too, it's dropped again after
+	char *at = arraddnptr(*buffer, size + 1);
+	vsnprintf(at, size + 1, format, args);
+	arrsetlen(*buffer, arrlen(*buffer) - 1);
+}
+
+static void c_append(char **buffer, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	c_vappend(buffer, format, args);
+	va_end(args);
+}
+
+// Writes an indented line of code to the function
+static void c_line(C_Function *f, const char *format, ...)
+{
+	for(int i = 0; i < f->indent; ++i)
+		arrput(f->text, '\t');
+
+	va_list args;
+	va_start(args, format);
+	c_vappend(&f->text, format, args);
+	va_end(args);
+	arrput(f->text, '\n');
+}
+
+// Formats into temporary memory, for pieces of expressions
+static char *c_format(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int size = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+
+	char *result = alloc_temp_memory(size + 1);
+	va_start(args, format);
+	vsnprintf(result, size + 1, format, args);
+	va_end(args);
+	return result;
+}
+
+// The type an expression of type gives, what the VM computes it as
+static const char *c_value_type(const Type_Info *type)
+{
+	switch(type->type)
+	{
+		case T_INT:    return type->size == 64 ? "int64_t" : "int32_t";
+		case T_BOOL:   return "int32_t";
+		case T_FLOAT:  return type->size == 32 ? "float" : "double";
+		case T_STRING: return "const char *";
+		case T_FN:     return "int64_t";
+		case T_STRUCT: return c_format("s_%s", type->name);
+		default:
+		{
+			assert(false);
+		} break;
+	}
+	return NULL;
+}
+
+// The type of a local or an argument of type, stores to it narrow like the VM's do
+static const char *c_slot_type(const Type_Info *type)
+{
+	if(type->type == T_INT && type->size == 8)
+		return "int8_t";
+	if(type->type == T_INT && type->size == 16)
+		return "int16_t";
+	return c_value_type(type);
+}
+
+// Declarations put the name after the type, pointers don't need a space in between
+static char *c_declare(const char *type, const char *name)
+{
+	int len = VStrLen((char *)type);
+	return c_format(type[len - 1] == '*' ? "%s%s" : "%s %s", type, name);
+}
+
+// Fields go in the order the layout put them in, so C lays the struct out the same way
+static void c_struct(const Type_Info *type)
+{
+	c_append(&program.types, "typedef struct\n{\n");
+	for(int i = 0; i < type->struct_.field_count; ++i)
+	{
+		Struct_Field *field = &type->struct_.fields[i];
+		c_append(&program.types, "\t%s;\n", c_declare(c_slot_type(field->type), c_format("f_%s", field->name)));
+	}
+	c_append(&program.types, "} s_%s;\n\n", type->name);
+}
+
+static const char *c_int_suffix(const Type_Info *type)
+{
+	return type->size == 64 ? "i64" : "i32";
+}
+
+static char *c_literal(Node *literal)
+{
+	const Type_Info *type = literal->type_info;
+	if(type->type == T_FLOAT)
+	{
+		f64 value = literal->literal._f64;
+		char *result;
+		if(type->size == 32)
+		{
+			f32 narrow = (f32)value;
+			if(!isfinite(narrow))
+				return c_format("apoc_f32_bits(0x%08Xu)", *(u32 *)&narrow);
+			result = c_format("%.9g", (f64)narrow);
+		}
+		else
+		{
+			if(!isfinite(value))
+				return c_format("apoc_f64_bits(0x%016llXull)", *(unsigned long long *)&value);
+			result = c_format("%.17g", value);
+		}
+
+		// Has to look like a float literal to the C compiler
+		if(strpbrk(result, ".e") == NULL)
+			result = c_format("%s.0", result);
+		if(type->size == 32)
+			result = c_format("%sf", result);
+		return result[0] == '-' ? c_format("(%s)", result) : result;
+	}
+
+	// Narrowed like generate_literal does it
+	i64 value = literal->literal._i64;
+	switch(type->size)
+	{
+		case 8:  value = (i8)value;  break;
+		case 16: value = (i16)value; break;
+		case 32: value = (i32)value; break;
+	}
+	if(value == INT64_MIN)
+		return "INT64_MIN";
+	if(value == INT32_MIN)
+		return "INT32_MIN";
+	char *result = c_format(value >= INT32_MIN && value <= INT32_MAX ? "%lld" : "%lldLL", (long long)value);
+	return value < 0 ? c_format("(%s)", result) : result;
+}
+
+static char *c_string_literal(char *string)
+{
+	char *text = NULL;
+	arrput(text, '"');
+	for(char *c = string; *c; ++c)
+	{
+		switch(*c)
+		{
+			case '"':  c_append(&text, "\\\""); break;
+			case '\\': c_append(&text, "\\\\"); break;
+			case '\n': c_append(&text, "\\n");  break;
+			case '\t': c_append(&text, "\\t");  break;
+			// Trigraphs
+			case '?':  c_append(&text, "\\?");  break;
+			default:
+			{
+				u8 byte = *c;
+				if(byte < ' ' || byte >= 127)
+					c_append(&text, "\\%03o", byte);
+				else
+					arrput(text, *c);
+			} break;
+		}
+	}
+	arrput(text, '"');
+	arrput(text, 0);
+
+	char *result = c_format("%s", text);
+	arrfree(text);
+	return result;
+}
+
+// The C name of a variable, NULL if the name is a function
+static char *c_variable(C_Function *f, char *name)
+{
+	if(shget(f->locals, name) != -1)
+		return c_format("l_%s", name);
+	if(shget(program.global_table, name) != -1)
+		return c_format("g_%s", name);
+	return NULL;
+}
+
+// The C for a variable or a field of one, something that can be assigned to
+static char *c_place(C_Function *f, Node *expr)
+{
+	if(expr->type == ND_FIELD)
+		return c_format("%s.f_%s", c_place(f, expr->field.operand), expr->field.name->string);
+	return c_variable(f, expr->token->string);
+}
+
+// @NOTE: whether running expr can change a variable that was already read.
+// Calls always could, they can assign to globals
+static b32 writes_variables(Node *expr)
+{
+	switch(expr->type)
+	{
+		case ND_CALL: return true;
+		case ND_BINARY:
+		{
+			return is_assignment_op(expr->binary.op->value) ||
+				writes_variables(expr->binary.left) || writes_variables(expr->binary.right);
+		} break;
+		case ND_BODY:
+		{
+			for(int i = 0; i < ArrLen(expr->body.expressions); ++i)
+			{
+				if(writes_variables(expr->body.expressions[i]))
+					return true;
+			}
+		} break;
+		case ND_IF:
+		{
+			return writes_variables(expr->if_.condition) || writes_variables(expr->if_.then);
+		} break;
+		case ND_DECL:
+		{
+			return expr->decl.expr && writes_variables(expr->decl.expr);
+		} break;
+		case ND_SWITCH:
+		{
+			if(writes_variables(expr->switch_.value))
+				return true;
+			for(int i = 0; i < ArrLen(expr->switch_.cases); ++i)
+			{
+				if(writes_variables(expr->switch_.cases[i]->case_.body))
+					return true;
+			}
+			return expr->switch_.otherwise && writes_variables(expr->switch_.otherwise);
+		} break;
+		case ND_FOR: return true;
+		default: break;
+	}
+	return false;
+}
+
+static char *c_temp(C_Function *f, const Type_Info *type, char *value)
+{
+	char *name = c_format("t%d", f->temp_count++);
+	c_line(f, "%s = %s;", c_declare(c_value_type(type), name), value);
+	return name;
+}
+
+static char *c_value(C_Function *f, Node *expr);
+static void c_statement(C_Function *f, Node *expr);
+
+// @NOTE: both sides are already evaluated. Anything that can fail is put in a
+// temporary so it happens in order with the rest, everything else is left as
+// an expression for the next thing to use
+static char *c_binary(C_Function *f, Token_Value op, const Type_Info *type, char *left, char *right)
+{
+	if(is_comparison_op(op))
+	{
+		const char *compare = NULL;
+		switch((int)op)
+		{
+			case '<':                compare = "<";  break;
+			case '>':                compare = ">";  break;
+			case tok_logical_lequal: compare = "<="; break;
+			case tok_logical_gequal: compare = ">="; break;
+			case tok_logical_is:     compare = "=="; break;
+			case tok_logical_isnot:  compare = "!="; break;
+		}
+		return c_format("(int32_t)(%s %s %s)", left, compare, right);
+	}
+
+	b32 is_float = type->type == T_FLOAT;
+	const char *helper = NULL;
+	const char *infix = NULL;
+	switch((int)op)
+	{
+		case '+': helper = "add"; infix = "+"; break;
+		case '-': helper = "sub"; infix = "-"; break;
+		case '*': helper = "mul"; infix = "*"; break;
+		case '/': helper = "div"; infix = "/"; break;
+		case '%': helper = "mod"; break;
+		case tok_bits_lshift: helper = "shl"; break;
+		case tok_bits_rshift: helper = "shr"; break;
+		case '&': infix = "&"; break;
+		case '|': infix = "|"; break;
+		case '^': infix = "^"; break;
+		default:
+		{
+			assert(false);
+		} break;
+	}
+
+	char *result;
+	if(is_float || helper == NULL)
+		result = c_format("(%s %s %s)", left, infix, right);
+	else
+		result = c_format("apoc_%s_%s(%s, %s)", helper, c_int_suffix(type), left, right);
+	// i8 and i16 math is narrowed like the VM's NARROW ops do it
+	if(type->type == T_INT && type->size < 32)
+		result = c_format("(%s)%s", c_slot_type(type), result);
+	if(op == '/' || op == '%')
+		return c_temp(f, type, result);
+	return result;
+}
+
+// @NOTE: the right side of && and || only runs when the left one doesn't
+// decide it. C's own operators do that when the right side is an expression
+// and nothing else, otherwise the lines it wrote out are moved inside an if
+static char *c_logical(C_Function *f, Node *expr)
+{
+	b32 is_and = expr->binary.op->value == tok_logical_and;
+	char *left = c_value(f, expr->binary.left);
+	int text_at = arrlen(f->text);
+	char *right = c_value(f, expr->binary.right);
+	int written = arrlen(f->text) - text_at;
+	if(written == 0)
+		return c_format("(int32_t)(%s %s %s)", left, is_and ? "&&" : "||", right);
+
+	char *lines = alloc_temp_memory(written);
+	memcpy(lines, f->text + text_at, written);
+	arrsetlen(f->text, text_at);
+	char *result = c_temp(f, expr->type_info, left);
+	c_line(f, is_and ? "if(%s)" : "if(!%s)", result);
+	c_line(f, "{");
+	// Every line gets one more level of indentation
+	for(int i = 0; i < written; ++i)
+	{
+		if(i == 0 || lines[i - 1] == '\n')
+			arrput(f->text, '\t');
+		arrput(f->text, lines[i]);
+	}
+	f->indent++;
+	c_line(f, "%s = %s;", result, right);
+	f->indent--;
+	c_line(f, "}");
+	return result;
+}
+
+// Evaluates args (and operand after them if it's called through a variable),
+// returns the call
+static char *c_call_expression(C_Function *f, Node *call)
+{
+	Node **args = call->fn_call.arguments;
+	int arg_count = ArrLen(args);
+	Node *operand = call->fn_call.operand;
+	char *callee = NULL;
+	if(operand->type == ND_ID && c_variable(f, operand->token->string) == NULL)
+		callee = c_format("fn_%s", operand->token->string);
+
+	char **values = alloc_temp_memory(sizeof(char *) * (arg_count + 1));
+	for(int i = 0; i < arg_count; ++i)
+	{
+		values[i] = c_value(f, args[i]);
+
+		// Whatever comes after can't change what was passed
+		b32 changed_later = callee == NULL && writes_variables(operand);
+		for(int j = i + 1; j < arg_count && !changed_later; ++j)
+			changed_later = writes_variables(args[j]);
+		if(changed_later)
+			values[i] = c_temp(f, args[i]->type_info, values[i]);
+	}
+
+	if(callee == NULL)
+	{
+		const Type_Info *fn_type = operand->type_info;
+		char *signature = c_format("%s (*)(", fn_type->fn.ret ? c_value_type(fn_type->fn.ret) : "void");
+		for(int i = 0; i < fn_type->fn.argument_count; ++i)
+			signature = c_format(i == 0 ? "%s%s" : "%s, %s", signature, c_slot_type(fn_type->fn.arguments[i]));
+		signature = c_format("%s%s)", signature, fn_type->fn.argument_count ? "" : "void");
+		callee = c_format("((%s)apoc_functions[%s])", signature, c_value(f, operand));
+	}
+
+	char *result = c_format("%s(", callee);
+	for(int i = 0; i < arg_count; ++i)
+		result = c_format(i == 0 ? "%s%s" : "%s, %s", result, values[i]);
+	return c_format("%s)", result);
+}
+
+// @NOTE: bodies that give a value write it to a temporary declared before the
+// block, their locals end with the block like they do in the analyzer
+static char *c_body_value(C_Function *f, Node *body)
+{
+	Node **exprs = body->body.expressions;
+	int count = ArrLen(exprs);
+	char *result = c_format("t%d", f->temp_count++);
+	c_line(f, "%s;", c_declare(c_value_type(body->type_info), result));
+	c_line(f, "{");
+	f->indent++;
+	f->body_depth++;
+	for(int i = 0; i < count - 1; ++i)
+		c_statement(f, exprs[i]);
+	c_line(f, "%s = %s;", result, c_value(f, exprs[count - 1]));
+	f->body_depth--;
+	f->indent--;
+	c_line(f, "}");
+	return result;
+}
+
+// Gives the C expression for the value of expr, whatever has to run first is
+// written out before it
+static char *c_value(C_Function *f, Node *expr)
+{
+	switch(expr->type)
+	{
+		case ND_LITERAL:
+		{
+			return c_literal(expr);
+		} break;
+		case ND_STRING:
+		{
+			return c_string_literal(expr->token->string);
+		} break;
+		case ND_ID:
+		{
+			char *variable = c_variable(f, expr->token->string);
+			if(variable)
+				return variable;
+
+			// Named functions are constants, their value is their index
+			int fn = find_function(expr->token->string);
+			assert(fn != -1);
+			return c_format("%d", fn);
+		} break;
+		case ND_BINARY:
+		{
+			assert(!is_assignment_op(expr->binary.op->value));
+			if(expr->binary.op->value == tok_logical_and || expr->binary.op->value == tok_logical_or)
+				return c_logical(f, expr);
+			char *left = c_value(f, expr->binary.left);
+			if(writes_variables(expr->binary.right))
+				left = c_temp(f, expr->binary.left->type_info, left);
+			char *right = c_value(f, expr->binary.right);
+			return c_binary(f, expr->binary.op->value, expr->binary.left->type_info, left, right);
+		} break;
+		case ND_FIELD:
+		{
+			return c_place(f, expr);
+		} break;
+		case ND_BODY:
+		{
+			return c_body_value(f, expr);
+		} break;
+		case ND_CALL:
+		{
+			return c_temp(f, expr->type_info, c_call_expression(f, expr));
+		} break;
+		default:
+		{
+			assert(false);
+		} break;
+	}
+	return NULL;
+}
+
+// declared is set when the local was already declared before an if, see c_if
+static void c_declaration(C_Function *f, Node *decl, b32 declared)
+{
+	char *name = decl->decl.operand->token->string;
+	const Type_Info *type = decl->type_info;
+	// A struct without a value starts out zeroed, a copy is a C struct assignment
+	char *value = decl->decl.expr ? c_value(f, decl->decl.expr) : c_format("(s_%s){0}", type->name);
+	if(f->is_line && f->body_depth == 0)
+	{
+		name = perm_strdup(name);
+		shput(program.global_table, name, 1);
+		c_append(&program.globals, "static %s;\n", c_declare(c_value_type(type), c_format("g_%s", name)));
+		c_line(f, "g_%s = %s;", name, value);
+		return;
+	}
+
+	shput(f->locals, name, 1);
+	if(declared)
+		c_line(f, "l_%s = %s;", name, value);
+	else
+		c_line(f, "%s = %s;", c_declare(c_slot_type(type), c_format("l_%s", name)), value);
+}
+
+static void c_assignment(C_Function *f, Node *binary)
+{
+	Token_Value op = binary->binary.op->value;
+	Node *left = binary->binary.left;
+	Node *right = binary->binary.right;
+	char *target = c_place(f, left);
+	assert(target);
+	if(op == '=')
+	{
+		c_line(f, "%s = %s;", target, c_value(f, right));
+		return;
+	}
+
+	char *current = target;
+	if(writes_variables(right))
+		current = c_temp(f, left->type_info, current);
+	char *value = c_binary(f, get_assignment_base_op(op), left->type_info, current, c_value(f, right));
+	c_line(f, "%s = %s;", target, value);
+}
+
+// @NOTE: the then part of an if isn't a scope of its own in the analyzer, a
+// declaration that's all there is to it stays visible after the if. Its local
+// is declared in front so C sees it there too, the VM leaves whatever was in
+// the slot when the if isn't taken, here it's 0
+static void c_if(C_Function *f, Node *expr)
+{
+	Node *then = expr->if_.then;
+	b32 hoisted = then->type == ND_DECL && !(f->is_line && f->body_depth == 0);
+	if(hoisted)
+	{
+		char *name = then->decl.operand->token->string;
+		c_line(f, "%s = %s;", c_declare(c_slot_type(then->type_info), c_format("l_%s", name)),
+				then->type_info->type == T_STRUCT ? "{0}" : "0");
+	}
+
+	c_line(f, "if(%s)", c_value(f, expr->if_.condition));
+	if(then->type == ND_BODY)
+	{
+		c_statement(f, then);
+		return;
+	}
+
+	c_line(f, "{");
+	f->indent++;
+	if(hoisted)
+		c_declaration(f, then, true);
+	else
+		c_statement(f, then);
+	f->indent--;
+	c_line(f, "}");
+}
+
+// Case bodies are scopes of their own like they are in the analyzer
+static void c_case_body(C_Function *f, Node *body)
+{
+	f->indent++;
+	if(body->type == ND_BODY)
+		c_statement(f, body);
+	else
+	{
+		c_line(f, "{");
+		f->indent++;
+		f->body_depth++;
+		c_statement(f, body);
+		f->body_depth--;
+		f->indent--;
+		c_line(f, "}");
+	}
+	c_line(f, "break;");
+	f->indent--;
+}
+
+// @NOTE: integers are left to the C compiler's switch. Strings pick the case
+// the same way generate_switch does, hashing to a slot with the seed it finds
+// and comparing to the strings in it, and then switch on the case's index
+static void c_switch(C_Function *f, Node *expr)
+{
+	Node **cases = expr->switch_.cases;
+	const Type_Info *type = expr->switch_.value->type_info;
+	char *value = c_value(f, expr->switch_.value);
+	if(type->type == T_STRING)
+	{
+		value = c_temp(f, type, value);
+		char **strings = NULL;
+		int *string_cases = NULL;
+		for(int c = 0; c < ArrLen(cases); ++c)
+		{
+			for(int l = 0; l < ArrLen(cases[c]->case_.labels); ++l)
+			{
+				arrput(strings, cases[c]->case_.labels[l]->token->string);
+				arrput(string_cases, c);
+			}
+		}
+
+		int count = arrlen(strings);
+		char *index = c_format("t%d", f->temp_count++);
+		c_line(f, "int %s = -1;", index);
+		if(count < SWITCH_HASH_MIN_CASES)
+		{
+			for(int i = 0; i < count; ++i)
+				c_line(f, "%sif(strcmp(%s, %s) == 0) %s = %d;", i ? "else " : "", value,
+						c_string_literal(strings[i]), index, string_cases[i]);
+		}
+		else
+		{
+			u32 mask;
+			u32 seed = find_string_hash(strings, count, &mask);
+			c_line(f, "switch(apoc_hash_string(%s, %uu) & %uu)", value, seed, mask);
+			c_line(f, "{");
+			f->indent++;
+			for(u32 slot = 0; slot <= mask; ++slot)
+			{
+				b32 empty = true;
+				for(int i = 0; i < count; ++i)
+				{
+					if((hash_string(strings[i], seed) & mask) != slot)
+						continue;
+					if(empty)
+					{
+						c_line(f, "case %u:", slot);
+						f->indent++;
+					}
+					c_line(f, "%sif(strcmp(%s, %s) == 0) %s = %d;", empty ? "" : "else ", value,
+							c_string_literal(strings[i]), index, string_cases[i]);
+					empty = false;
+				}
+				if(!empty)
+				{
+					c_line(f, "break;");
+					f->indent--;
+				}
+			}
+			f->indent--;
+			c_line(f, "}");
+		}
+		arrfree(strings);
+		arrfree(string_cases);
+		value = index;
+	}
+	else if(type->size < 32)
+		value = c_format("(%s)(%s)", c_slot_type(type), value);
+
+	c_line(f, "switch(%s)", value);
+	c_line(f, "{");
+	f->indent++;
+	for(int c = 0; c < ArrLen(cases); ++c)
+	{
+		Node **labels = cases[c]->case_.labels;
+		if(type->type == T_STRING)
+			c_line(f, "case %d:", c);
+		else
+		{
+			for(int l = 0; l < ArrLen(labels); ++l)
+				c_line(f, "case %s:", c_literal(labels[l]));
+		}
+		c_case_body(f, cases[c]->case_.body);
+	}
+	if(expr->switch_.otherwise)
+	{
+		c_line(f, "default:");
+		c_case_body(f, expr->switch_.otherwise);
+	}
+	f->indent--;
+	c_line(f, "}");
+}
+
+// The condition is written out inside the loop so whatever it needs is
+// worked out again every time, the block around it scopes the init
+static void c_for(C_Function *f, Node *expr)
+{
+	c_line(f, "{");
+	f->indent++;
+	f->body_depth++;
+	if(expr->for_.init)
+		c_statement(f, expr->for_.init);
+	c_line(f, "while(1)");
+	c_line(f, "{");
+	f->indent++;
+	c_line(f, "if(!(%s)) break;", c_value(f, expr->for_.condition));
+	c_statement(f, expr->for_.body);
+	if(expr->for_.step)
+		c_statement(f, expr->for_.step);
+	f->indent--;
+	c_line(f, "}");
+	f->body_depth--;
+	f->indent--;
+	c_line(f, "}");
+}
+
+static void c_function(Node *fn);
+
+// @NOTE: a call in tail position leaves the frame before it's made so deep
+// recursion doesn't pile frames up, the C compiler turns the call into a jump.
+// A call to the function itself assigns the arguments and jumps back to the
+// start, like the bytecode does
+static void c_tail_call(C_Function *f, Node *call)
+{
+	Node *operand = call->fn_call.operand;
+	char *name = f->fn->func.name->string;
+	int frame_size = functions[find_function(name)].frame_size;
+	if(operand->type == ND_ID && strcmp(operand->token->string, name) == 0 &&
+			c_variable(f, name) == NULL)
+	{
+		Node **args = call->fn_call.arguments;
+		int arg_count = ArrLen(args);
+		char **values = alloc_temp_memory(sizeof(char *) * (arg_count + 1));
+		for(int i = 0; i < arg_count; ++i)
+			values[i] = c_temp(f, args[i]->type_info, c_value(f, args[i]));
+		for(int i = 0; i < arg_count; ++i)
+			c_line(f, "l_%s = %s;", f->fn->func.arguments[i]->fn_arg.identifier->string, values[i]);
+		c_line(f, "goto tail_call;");
+		f->tail_loop = true;
+		return;
+	}
+
+	char *result = c_call_expression(f, call);
+	c_line(f, "apoc_leave(%d);", frame_size);
+	if(call->type_info)
+		c_line(f, "return %s;", result);
+	else
+	{
+		c_line(f, "%s;", result);
+		c_line(f, "return;");
+	}
+}
+
+// Writes out expr for what it does, its value isn't needed
+static void c_statement(C_Function *f, Node *expr)
+{
+	switch(expr->type)
+	{
+		case ND_DECL:
+		{
+			c_declaration(f, expr, false);
+		} break;
+		case ND_BINARY:
+		{
+			if(is_assignment_op(expr->binary.op->value))
+				c_assignment(f, expr);
+			else
+				// Anything in it that could fail was already written out
+				c_value(f, expr);
+		} break;
+		case ND_BODY:
+		{
+			c_line(f, "{");
+			f->indent++;
+			f->body_depth++;
+			for(int i = 0; i < ArrLen(expr->body.expressions); ++i)
+				c_statement(f, expr->body.expressions[i]);
+			f->body_depth--;
+			f->indent--;
+			c_line(f, "}");
+		} break;
+		case ND_IF:
+		{
+			c_if(f, expr);
+		} break;
+		case ND_SWITCH:
+		{
+			c_switch(f, expr);
+		} break;
+		case ND_FOR:
+		{
+			c_for(f, expr);
+		} break;
+		case ND_CALL:
+		{
+			if(f->fn && expr->fn_call.is_tail)
+				c_tail_call(f, expr);
+			else
+				c_line(f, "%s;", c_call_expression(f, expr));
+		} break;
+		case ND_FN:
+		{
+			c_function(expr);
+		} break;
+		case ND_STRUCT:
+		{
+			c_struct(expr->type_info);
+		} break;
+		// Reading a value doesn't do anything
+		default: break;
+	}
+}
+
+static C_Function make_c_function(b32 is_line)
+{
+	C_Function result = {.indent = 1, .is_line = is_line};
+	shdefault(result.locals, -1);
+	return result;
+}
+
+static void free_c_function(C_Function *f)
+{
+	arrfree(f->text);
+	shfree(f->locals);
+}
+
+// Appends what the C function wrote to the program's text
+static void c_flush(char **buffer, C_Function *f)
+{
+	if(arrlen(f->text))
+		memcpy(arraddnptr(*buffer, arrlen(f->text)), f->text, arrlen(f->text));
+}
+
+static void c_function(Node *fn)
+{
+	int index = find_function(fn->func.name->string);
+	assert(index != -1);
+	Function *function = &functions[index];
+	const Type_Info *type = fn->type_info;
+
+	C_Function f = make_c_function(false);
+	f.body_depth = 1;
+	f.fn = fn;
+
+	char *signature = c_format("static %s fn_%s(", type->fn.ret ? c_value_type(type->fn.ret) : "void", function->name);
+	for(int i = 0; i < type->fn.argument_count; ++i)
+	{
+		char *name = fn->func.arguments[i]->fn_arg.identifier->string;
+		shput(f.locals, name, 1);
+		signature = c_format(i == 0 ? "%s%s" : "%s, %s", signature,
+				c_declare(c_slot_type(type->fn.arguments[i]), c_format("l_%s", name)));
+	}
+	signature = c_format("%s%s)", signature, type->fn.argument_count ? "" : "void");
+	c_append(&program.prototypes, "%s;\n", signature);
+
+	c_append(&f.text, "%s\n{\n", signature);
+	c_line(&f, "apoc_enter(%d);", function->frame_size);
+	int body_start = arrlen(f.text);
+	Node **exprs = fn->func.body->body.expressions;
+	int count = ArrLen(exprs);
+	for(int i = 0; i < count; ++i)
+	{
+		if(i == count - 1 && type->fn.ret && exprs[i]->type == ND_CALL && exprs[i]->fn_call.is_tail)
+		{
+			c_tail_call(&f, exprs[i]);
+		}
+		else if(i == count - 1 && type->fn.ret)
+		{
+			char *result = c_value(&f, exprs[i]);
+			c_line(&f, "apoc_leave(%d);", function->frame_size);
+			c_line(&f, "return %s;", result);
+		}
+		else
+		{
+			c_statement(&f, exprs[i]);
+		}
+	}
+	if(type->fn.ret == NULL)
+		c_line(&f, "apoc_leave(%d);", function->frame_size);
+	c_append(&f.text, "}\n\n");
+	if(f.tail_loop)
+	{
+		const char *label = "tail_call:;\n";
+		int length = strlen(label);
+		arrinsn(f.text, body_start, length);
+		memcpy(f.text + body_start, label, length);
+	}
+
+	c_flush(&program.functions, &f);
+	free_c_function(&f);
+}
+
+static void c_print(C_Function *f, const Type_Info *type, char *value)
+{
+	switch(type->type)
+	{
+		case T_INT:    c_line(f, "apoc_print_int(%s);", value); break;
+		case T_FLOAT:  c_line(f, "apoc_print_float(%s);", value); break;
+		case T_BOOL:   c_line(f, "apoc_print_bool(%s);", value); break;
+		case T_STRING: c_line(f, "apoc_print_string(%s);", value); break;
+		case T_FN:     c_line(f, "printf(\"fn %%s\\n\", apoc_function_names[%s]);", value); break;
+		default:
+		{
+			assert(false);
+		} break;
+	}
+}
+
+// @NOTE: called once a line has compiled, line_fn is its bytecode which is
+// where the frame sizes the runtime counts come from
+void c_emit_line(Node *tree, Function *line_fn, char *source, int source_len)
+{
+	if(program.global_table == NULL)
+		shdefault(program.global_table, -1);
+
+	int line = ++program.line_count;
+	C_Function f = make_c_function(true);
+
+	// The source as a comment, a trailing backslash would carry it over to the next line
+	while(source_len > 0 && (isspace(source[source_len - 1]) || source[source_len - 1] == '\\'))
+		source_len--;
+	c_append(&f.text, "// %.*s\nstatic void apoc_line_%d(void)\n{\n", source_len, source, line);
+
+	Node **exprs = tree->root.expressions;
+	int count = ArrLen(exprs);
+	for(int i = 0; i < count; ++i)
+	{
+		if(i == count - 1 && line_fn->ret)
+			c_print(&f, line_fn->ret, c_value(&f, exprs[i]));
+		else
+			c_statement(&f, exprs[i]);
+	}
+	c_append(&f.text, "}\n\n");
+
+	c_flush(&program.lines, &f);
+	free_c_function(&f);
+	c_append(&program.main, "\tapoc_run_line(apoc_line_%d, %d);\n", line, line_fn->frame_size);
+}
+
+b32 c_write_program(const char *path)
+{
+	FILE *out = fopen(path, "wb");
+	if(out == NULL)
+	{
+		printf("Couldn't write %s\n", path);
+		return false;
+	}
+
+	fprintf(out, "// Compiled from ApocScript, builds with any C99 compiler\n\n");
+	fputs(c_runtime, out);
+	fwrite(program.types, 1, arrlen(program.types), out);
+	fwrite(program.globals, 1, arrlen(program.globals), out);
+	fprintf(out, "\n");
+	fwrite(program.prototypes, 1, arrlen(program.prototypes), out);
+
+	// Function values are indexes into these, in the order the functions were defined
+	fprintf(out, "\nstatic const Apoc_Function apoc_functions[] = {");
+	for(int i = 0; i < arrlen(functions); ++i)
+		fprintf(out, "(Apoc_Function)fn_%s, ", functions[i].name);
+	fprintf(out, "NULL};\nstatic const char *apoc_function_names[] = {");
+	for(int i = 0; i < arrlen(functions); ++i)
+		fprintf(out, "\"%s\", ", functions[i].name);
+	fprintf(out, "NULL};\n\n");
+
+	fwrite(program.functions, 1, arrlen(program.functions), out);
+	fwrite(program.lines, 1, arrlen(program.lines), out);
+	fprintf(out, "int main(void)\n{\n");
+	fwrite(program.main, 1, arrlen(program.main), out);
+	fprintf(out, "\treturn 0;\n}\n");
+	fclose(out);
+	return true;
+}
+
+// Runs argv (NULL terminated) without a shell and waits for it, gives its exit status
+static int c_run(char **argv)
+{
+#if defined(_WIN32)
+	return (int)_spawnvp(_P_WAIT, argv[0], (const char *const *)argv);
+#else
+	pid_t pid = fork();
+	if(pid == -1)
+		return -1;
+	if(pid == 0)
+	{
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+	int status;
+	if(waitpid(pid, &status, 0) == -1 || !WIFEXITED(status))
+		return -1;
+	return WEXITSTATUS(status);
+#endif
+}
+
+// @NOTE: the compiler is $CC if it's set, cc otherwise. $CC is split on
+// whitespace so it can carry flags (ex. "ccache gcc"), nothing goes through a
+// shell so the paths are passed on exactly as they are
+b32 c_build_program(const char *c_path, const char *executable)
+{
+	const char *compiler = getenv("CC");
+	if(compiler == NULL || compiler[0] == 0)
+		compiler = "cc";
+
+	char **argv = NULL;
+	char *words = c_format("%s", compiler);
+	for(char *word = strtok(words, " \t"); word; word = strtok(NULL, " \t"))
+		arrput(argv, word);
+	if(arrlen(argv) == 0)
+		arrput(argv, "cc");
+	arrput(argv, "-std=c99");
+	arrput(argv, "-O2");
+	arrput(argv, "-o");
+	arrput(argv, (char *)executable);
+	arrput(argv, (char *)c_path);
+	arrput(argv, NULL);
+
+	int status = c_run(argv);
+	if(status != 0)
+		printf("Building %s failed, %s exited with %d\n", executable, argv[0], status);
+	arrfree(argv);
+	return status == 0;
+}
@@ -0,0 +1,49 @@
+#ifndef _CBACKEND_H
+#define _CBACKEND_H
+
+#include "Basic.h"
+#include "Parser.h"
+#include "Analyzer.h"
+#include "Bytecode.h"
+
+// @NOTE: the ahead of time backend. Instead of running, every line that
+// compiles becomes a C function that main calls in order, and every function
+// becomes a C function. It's all written out as one C99 file that starts with
+// the runtime and handed to the system's C compiler. Values keep the
+// representation the VM gives them, so ints up to 32 bits are computed as
+// wrapping 32 bit ints and i8 and i16 results are narrowed to their type,
+// locals and arguments narrow when they're stored like the VM's cells do. The
+// generated code keeps the VM's left to right evaluation order and reports the
+// same runtime errors through the runtime. Like the ELF backend, a line that
+// fails at runtime isn't rolled back, see Elf.h
+typedef struct
+{
+	char *text;           // stb_ds array, the C for the function so far
+	int indent;
+	int temp_count;
+	int body_depth;       // declarations at depth 0 of a line are globals
+	b32 is_line;
+	Alloc_Table *locals;  // names declared in the function, there's no shadowing so one table is enough
+	Node *fn;             // the fn that's being written, NULL for a line
+	b32 tail_loop;        // a call to itself in tail position jumps back to the start
+} C_Function;
+
+typedef struct
+{
+	// stb_ds arrays of C text, written out in this order
+	char *types;
+	char *globals;
+	char *prototypes;
+	char *functions;
+	char *lines;
+	char *main;
+
+	int line_count;
+	Alloc_Table *global_table; // names of the globals the lines declared
+} C_Program;
+
+void c_emit_line(Node *tree, Function *line_fn, char *source, int source_len);
+b32 c_write_program(const char *path);
+b32 c_build_program(const char *c_path, const char *executable);
+
+#endif // _CBACKEND_H
@@ -0,0 +1,1107 @@
+#include "Elf.h"
+#include "Error.h"
+#include "stb_ds.h"
+#include <assert.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+static Elf_Unit *function_units; // stb_ds array, by function index
+static Elf_Unit *line_units;     // stb_ds array, in the order the lines run
+
+// @NOTE: compiles fn (a function or a line) now, while its bytecode is still
+// around. A function that's defined again after a line was rolled back just
+// replaces the unit at its index
+void elf_compile_function(Function *fn)
+{
+	Elf_Unit unit = {.compiled = true};
+	Jit_Stats stats = jit_compile_relocatable(fn, &unit.code, &unit.relocations);
+	if(stats.fallback)
+	{
+		arrfree(unit.relocations);
+		if(stats.op >= 0)
+			report_error(NULL, "fn %s can't be compiled to native code, %s (%s)", fn->name, stats.fallback, op_info[stats.op].name);
+		else
+			report_error(NULL, "fn %s can't be compiled to native code, %s", fn->name, stats.fallback);
+	}
+
+	int index = get_function_index(fn);
+	if(index < 0)
+	{
+		unit.ret = fn->ret;
+		arrput(line_units, unit);
+		return;
+	}
+
+	while(arrlen(function_units) <= index)
+	{
+		Elf_Unit empty = {};
+		arrput(function_units, empty);
+	}
+	if(function_units[index].compiled)
+	{
+		free_bytecode(&function_units[index].code);
+		arrfree(function_units[index].relocations);
+	}
+	function_units[index] = unit;
+}
+
+#if JIT_SUPPORTED
+
+#include <fcntl.h>
+
+typedef enum
+{
+	SECTION_TEXT,
+	SECTION_RODATA,
+	SECTION_DATA,
+	SECTION_BSS, // never written, only its size (i) counts
+
+	SECTION_COUNT,
+} Elf_Section_Kind;
+
+// A 64 bit address at offset in section, target's start plus addend
+typedef struct
+{
+	Elf_Section_Kind section;
+	int offset;
+	Elf_Section_Kind target;
+	i64 addend;
+} Elf_Fixup;
+
+typedef struct
+{
+	const char *name;
+	Elf_Section_Kind section;
+	int offset;
+	int size;
+	b32 is_function;
+	b32 is_global;
+} Elf_Name;
+
+typedef struct
+{
+	Bytecode sections[SECTION_COUNT];
+	Elf_Fixup *fixups;    // stb_ds array
+	Elf_Name *names;      // stb_ds array, the symbols
+	int *labels;          // stb_ds array, .text offset per label, -1 until it's placed
+	Jit_Fixup *label_uses; // stb_ds array, rel32s in .text that point at a label
+} Elf_Builder;
+
+// Where things the runtime needs ended up
+typedef struct
+{
+	int *strings;   // per string_pool entry
+	int messages[JIT_ERROR_COUNT];
+	int newline, true_text, false_text, fn_text, error_text, error_end;
+	int names;      // pointers to the function names
+	int ten, low, high;
+
+	int runtime, recovery, entries;
+	int globals, locals, stack;
+} Elf_Layout;
+
+// The runtime's routines, labels in .text
+typedef struct
+{
+	int write, write_string, copy_digits;
+	int print_string, print_bool, print_function, print_int, print_f32, print_f64;
+	int error, run_line;
+} Elf_Runtime;
+
+static Bytecode *elf_text(Elf_Builder *b)
+{
+	return &b->sections[SECTION_TEXT];
+}
+
+static int elf_align(Elf_Builder *b, Elf_Section_Kind section, int alignment, u8 fill)
+{
+	Bytecode *c = &b->sections[section];
+	while(c->i % alignment)
+	{
+		if(section == SECTION_BSS)
+			c->i++;
+		else
+			push_byte(fill, c);
+	}
+	return c->i;
+}
+
+static void elf_fixup(Elf_Builder *b, Elf_Section_Kind section, int offset, Elf_Section_Kind target, i64 addend)
+{
+	Elf_Fixup fixup = {.section = section, .offset = offset, .target = target, .addend = addend};
+	arrput(b->fixups, fixup);
+}
+
+// mov reg, address of target plus addend
+static void elf_address(Elf_Builder *b, X64_Register reg, Elf_Section_Kind target, i64 addend)
+{
+	emit_mov_imm64(elf_text(b), reg, 0);
+	elf_fixup(b, SECTION_TEXT, elf_text(b)->i - 8, target, addend);
+}
+
+// A pointer in .data or .rodata
+static void elf_pointer(Elf_Builder *b, Elf_Section_Kind section, Elf_Section_Kind target, i64 addend)
+{
+	Bytecode *c = &b->sections[section];
+	elf_fixup(b, section, c->i, target, addend);
+	push_qword(0, c);
+}
+
+static int elf_string(Elf_Builder *b, const char *string)
+{
+	Bytecode *c = &b->sections[SECTION_RODATA];
+	int offset = c->i;
+	for(const char *at = string; *at; ++at)
+		push_byte(*at, c);
+	push_byte(0, c);
+	return offset;
+}
+
+static int elf_name(Elf_Builder *b, const char *name, Elf_Section_Kind section, int offset, int size, b32 is_function)
+{
+	Elf_Name result = {.name = name, .section = section, .offset = offset, .size = size, .is_function = is_function};
+	arrput(b->names, result);
+	return arrlen(b->names) - 1;
+}
+
+static int elf_label(Elf_Builder *b)
+{
+	arrput(b->labels, -1);
+	return arrlen(b->labels) - 1;
+}
+
+static void elf_place(Elf_Builder *b, int label)
+{
+	b->labels[label] = elf_text(b)->i;
+}
+
+static void elf_rel32(Elf_Builder *b, int label)
+{
+	Jit_Fixup use = {.at = elf_text(b)->i, .target = label};
+	arrput(b->label_uses, use);
+	push_dword(0, elf_text(b));
+}
+
+// jmp or jcc (condition -1 for jmp) to label
+static void elf_jump(Elf_Builder *b, int condition, int label)
+{
+	Bytecode *c = elf_text(b);
+	if(condition < 0)
+		push_byte(0xE9, c);
+	else
+	{
+		push_byte(0x0F, c);
+		push_byte(0x80 + condition, c);
+	}
+	elf_rel32(b, label);
+}
+
+static void elf_call(Elf_Builder *b, int label)
+{
+	push_byte(0xE8, elf_text(b));
+	elf_rel32(b, label);
+}
+
+// Starts a routine at a 16 byte boundary, gives its symbol to pass to elf_end
+static int elf_begin(Elf_Builder *b, const char *name, int label)
+{
+	int offset = elf_align(b, SECTION_TEXT, 16, 0xCC);
+	if(label >= 0)
+		elf_place(b, label);
+	return elf_name(b, name, SECTION_TEXT, offset, 0, true);
+}
+
+static void elf_end(Elf_Builder *b, int name)
+{
+	b->names[name].size = elf_text(b)->i - b->names[name].offset;
+}
+
+// A few encodings the routines use a lot
+static void x64_byte_store(Bytecode *c, X64_Register base, int disp, u8 value)
+{
+	emit_x64(c, 0, false, 0xC6, 0, mem_operand(base, disp));
+	push_byte(value, c);
+}
+
+static void x64_imm8(Bytecode *c, int extension, b32 w, X64_Register reg, i8 value)
+{
+	emit_x64(c, 0, w, 0x83, extension, reg_operand(reg));
+	push_byte((u8)value, c);
+}
+
+static void x64_mov32(Bytecode *c, X64_Register reg, u32 value)
+{
+	emit_x64(c, 0, false, 0xC7, 0, reg_operand(reg));
+	push_dword(value, c);
+}
+
+static void x64_bytes(Bytecode *c, u8 a, u8 b)
+{
+	push_byte(a, c);
+	push_byte(b, c);
+}
+
+#define X64_ADD 0
+#define X64_SUB 5
+#define X64_CMP 7
+#define X64_CC_S  0x8
+#define X64_CC_NS 0x9
+
+static void elf_emit_output_routines(Elf_Builder *b, Elf_Layout *layout, Elf_Runtime *rt)
+{
+	Bytecode *c = elf_text(b);
+
+	// write(1, rdi, rsi)
+	int name = elf_begin(b, "apoc_write", rt->write);
+	emit_mov(c, reg_operand(RDX), reg_operand(RSI));
+	emit_mov(c, reg_operand(RSI), reg_operand(RDI));
+	x64_mov32(c, RDI, 1);
+	x64_mov32(c, RAX, 1);
+	x64_bytes(c, 0x0F, 0x05);
+	push_byte(0xC3, c);
+	elf_end(b, name);
+
+	// Writes the zero terminated string at rdi
+	name = elf_begin(b, "apoc_write_string", rt->write_string);
+	{
+		int loop = elf_label(b), done = elf_label(b);
+		emit_mov(c, reg_operand(RSI), reg_operand(RDI));
+		elf_place(b, loop);
+		emit_x64(c, 0, false, 0x80, X64_CMP, mem_operand(RSI, 0));
+		push_byte(0, c);
+		elf_jump(b, CC_E, done);
+		emit_x64(c, 0, true, 0xFF, 0, reg_operand(RSI));
+		elf_jump(b, -1, loop);
+		elf_place(b, done);
+		emit_x64(c, 0, true, 0x2B, RSI, reg_operand(RDI));
+		elf_jump(b, -1, rt->write);
+	}
+	elf_end(b, name);
+
+	// Copies rcx (at least 1) bytes from rsi to rbp, leaves both after what was copied
+	name = elf_begin(b, "apoc_copy_digits", rt->copy_digits);
+	{
+		int loop = elf_label(b);
+		elf_place(b, loop);
+		emit_x64(c, 0, false, 0x8A, RAX, mem_operand(RSI, 0));
+		emit_x64(c, 0, false, 0x88, RAX, mem_operand(RBP, 0));
+		emit_x64(c, 0, true, 0xFF, 0, reg_operand(RSI));
+		emit_x64(c, 0, true, 0xFF, 0, reg_operand(RBP));
+		emit_x64(c, 0, true, 0xFF, 1, reg_operand(RCX));
+		elf_jump(b, CC_NE, loop);
+		push_byte(0xC3, c);
+	}
+	elf_end(b, name);
+
+	name = elf_begin(b, "apoc_print_string", rt->print_string);
+	elf_call(b, rt->write_string);
+	elf_address(b, RDI, SECTION_RODATA, layout->newline);
+	x64_mov32(c, RSI, 1);
+	elf_jump(b, -1, rt->write);
+	elf_end(b, name);
+
+	name = elf_begin(b, "apoc_print_bool", rt->print_bool);
+	{
+		int is_false = elf_label(b);
+		emit_x64(c, 0, false, 0x85, RDI, reg_operand(RDI));
+		elf_jump(b, CC_E, is_false);
+		elf_address(b, RDI, SECTION_RODATA, layout->true_text);
+		x64_mov32(c, RSI, 5);
+		elf_jump(b, -1, rt->write);
+		elf_place(b, is_false);
+		elf_address(b, RDI, SECTION_RODATA, layout->false_text);
+		x64_mov32(c, RSI, 6);
+		elf_jump(b, -1, rt->write);
+	}
+	elf_end(b, name);
+
+	// Function values are indexes, printed as fn and the name
+	name = elf_begin(b, "apoc_print_function", rt->print_function);
+	emit_push(c, RBX);
+	emit_mov(c, reg_operand(RBX), reg_operand(RDI));
+	elf_address(b, RDI, SECTION_RODATA, layout->fn_text);
+	x64_mov32(c, RSI, 3);
+	elf_call(b, rt->write);
+	elf_address(b, RAX, SECTION_RODATA, layout->names);
+	emit_x64(c, 0, true, 0xC1, 4, reg_operand(RBX));
+	push_byte(3, c);
+	emit_x64(c, 0, true, 0x03, RAX, reg_operand(RBX));
+	emit_mov(c, reg_operand(RDI), mem_operand(RAX, 0));
+	emit_pop(c, RBX);
+	elf_jump(b, -1, rt->print_string);
+	elf_end(b, name);
+
+	// printf's %lld, the digits go backwards into a buffer on the stack
+	name = elf_begin(b, "apoc_print_int", rt->print_int);
+	{
+		int positive = elf_label(b), digit = elf_label(b), done = elf_label(b);
+		emit_push(c, RBX);
+		x64_imm8(c, X64_SUB, true, RSP, 32);
+		emit_mov(c, reg_operand(RBX), reg_operand(RDI));
+		emit_x64(c, 0, true, 0x8D, RSI, mem_operand(RSP, 31));
+		x64_byte_store(c, RSI, 0, '\n');
+		emit_mov(c, reg_operand(RAX), reg_operand(RDI));
+		emit_x64(c, 0, true, 0x85, RAX, reg_operand(RAX));
+		elf_jump(b, X64_CC_NS, positive);
+		emit_x64(c, 0, true, 0xF7, 3, reg_operand(RAX));
+		elf_place(b, positive);
+		x64_mov32(c, RCX, 10);
+		elf_place(b, digit);
+		emit_x64(c, 0, false, 0x33, RDX, reg_operand(RDX));
+		emit_x64(c, 0, true, 0xF7, 6, reg_operand(RCX));
+		emit_x64(c, 0, false, 0x80, X64_ADD, reg_operand(RDX));
+		push_byte('0', c);
+		emit_x64(c, 0, true, 0xFF, 1, reg_operand(RSI));
+		emit_x64(c, 0, false, 0x88, RDX, mem_operand(RSI, 0));
+		emit_x64(c, 0, true, 0x85, RAX, reg_operand(RAX));
+		elf_jump(b, CC_NE, digit);
+		emit_x64(c, 0, true, 0x85, RBX, reg_operand(RBX));
+		elf_jump(b, X64_CC_NS, done);
+		emit_x64(c, 0, true, 0xFF, 1, reg_operand(RSI));
+		x64_byte_store(c, RSI, 0, '-');
+		elf_place(b, done);
+		emit_mov(c, reg_operand(RDI), reg_operand(RSI));
+		emit_x64(c, 0, true, 0x8D, RSI, mem_operand(RSP, 32));
+		emit_x64(c, 0, true, 0x2B, RSI, reg_operand(RDI));
+		elf_call(b, rt->write);
+		x64_imm8(c, X64_ADD, true, RSP, 32);
+		emit_pop(c, RBX);
+		push_byte(0xC3, c);
+	}
+	elf_end(b, name);
+
+	// f32s are printed as the double they convert to, like printf does with them
+	name = elf_begin(b, "apoc_print_f32", rt->print_f32);
+	emit_x64(c, 0x66, false, 0x0F6E, XMM0, reg_operand(RDI));
+	emit_x64(c, 0xF3, false, 0x0F5A, XMM0, reg_operand(XMM0));
+	emit_x64(c, 0x66, true, 0x0F7E, XMM0, reg_operand(RDI));
+	elf_jump(b, -1, rt->print_f64);
+	elf_end(b, name);
+}
+
+// @NOTE: printf's %g for the double in rdi. The x87 unit works out the 6
+// significant digits: |v| is scaled by a power of 10 into [100000, 1000000)
+// in extended precision and rounded to an integer, powers up to 10^27 are
+// exact there so the digits only differ from printf's for values that are
+// within an extended precision rounding of halfway between two outputs.
+// Then it's the same choice printf makes, fixed notation for exponents -4 to
+// 5 and scientific otherwise, with the trailing zeros taken off
+static void elf_emit_print_f64(Elf_Builder *b, Elf_Layout *layout, Elf_Runtime *rt)
+{
+	Bytecode *c = elf_text(b);
+	int name = elf_begin(b, "apoc_print_f64", rt->print_f64);
+
+	int no_sign = elf_label(b), finite = elf_label(b), infinity = elf_label(b), nonzero = elf_label(b);
+	int scale = elf_label(b), positive_power = elf_label(b), power_loop = elf_label(b), power_done = elf_label(b);
+	int divide = elf_label(b), scaled = elf_label(b), too_small = elf_label(b), too_big = elf_label(b);
+	int digits = elf_label(b), digit_loop = elf_label(b), trim = elf_label(b), trimmed = elf_label(b);
+	int small = elf_label(b), zeros = elf_label(b), zeros_done = elf_label(b);
+	int exponential = elf_label(b), exponent = elf_label(b), exponent_sign = elf_label(b), two_digits = elf_label(b);
+	int finish = elf_label(b);
+
+	// rbx is the value, rbp where the next character goes, r12 the exponent,
+	// r8 the significant digits and r9 where they are. The stack has the
+	// output at 0, a cell for the x87 unit at 32 and 40 and the digits at 48
+	emit_push(c, RBX);
+	emit_push(c, RBP);
+	emit_push(c, R12);
+	x64_imm8(c, X64_SUB, true, RSP, 64);
+	emit_mov(c, reg_operand(RBX), reg_operand(RDI));
+	emit_mov(c, reg_operand(RBP), reg_operand(RSP));
+
+	// printf shows the sign of NaNs too
+	emit_x64(c, 0, true, 0x85, RBX, reg_operand(RBX));
+	elf_jump(b, X64_CC_NS, no_sign);
+	x64_byte_store(c, RBP, 0, '-');
+	emit_x64(c, 0, true, 0xFF, 0, reg_operand(RBP));
+	elf_place(b, no_sign);
+
+	emit_mov(c, reg_operand(RAX), reg_operand(RBX));
+	emit_x64(c, 0, true, 0xC1, 5, reg_operand(RAX));
+	push_byte(52, c);
+	emit_x64(c, 0, false, 0x81, 4, reg_operand(RAX));
+	push_dword(0x7FF, c);
+	emit_x64(c, 0, false, 0x81, X64_CMP, reg_operand(RAX));
+	push_dword(0x7FF, c);
+	elf_jump(b, CC_NE, finite);
+	emit_mov(c, reg_operand(RAX), reg_operand(RBX));
+	emit_x64(c, 0, true, 0xC1, 4, reg_operand(RAX));
+	push_byte(12, c);
+	elf_jump(b, CC_E, infinity);
+	x64_byte_store(c, RBP, 0, 'n');
+	x64_byte_store(c, RBP, 1, 'a');
+	x64_byte_store(c, RBP, 2, 'n');
+	x64_imm8(c, X64_ADD, true, RBP, 3);
+	elf_jump(b, -1, finish);
+	elf_place(b, infinity);
+	x64_byte_store(c, RBP, 0, 'i');
+	x64_byte_store(c, RBP, 1, 'n');
+	x64_byte_store(c, RBP, 2, 'f');
+	x64_imm8(c, X64_ADD, true, RBP, 3);
+	elf_jump(b, -1, finish);
+
+	elf_place(b, finite);
+	emit_mov(c, reg_operand(RAX), reg_operand(RBX));
+	emit_x64(c, 0, true, 0xD1, 4, reg_operand(RAX));
+	elf_jump(b, CC_NE, nonzero);
+	x64_byte_store(c, RBP, 0, '0');
+	emit_x64(c, 0, true, 0xFF, 0, reg_operand(RBP));
+	elf_jump(b, -1, finish);
+
+	// The exponent starts as log10 |v| rounded, scaling fixes it up if it's off by one
+	elf_place(b, nonzero);
+	emit_x64(c, 0, true, 0xD1, 5, reg_operand(RAX));
+	emit_mov(c, mem_operand(RSP, 32), reg_operand(RAX));
+	x64_bytes(c, 0xD9, 0xEC);                            // fldlg2
+	emit_x64(c, 0, false, 0xDD, 0, mem_operand(RSP, 32)); // fld qword
+	x64_bytes(c, 0xD9, 0xF1);                            // fyl2x
+	emit_x64(c, 0, false, 0xDB, 3, mem_operand(RSP, 40)); // fistp dword
+	emit_x64(c, 0, true, 0x63, R12, mem_operand(RSP, 40));
+
+	// st0 = |v| * 10^(5 - exponent)
+	elf_place(b, scale);
+	emit_x64(c, 0, false, 0xDD, 0, mem_operand(RSP, 32));
+	x64_bytes(c, 0xD9, 0xE8);                            // fld1
+	x64_mov32(c, RCX, 5);
+	emit_x64(c, 0, false, 0x2B, RCX, reg_operand(R12));
+	emit_mov(c, reg_operand(RAX), reg_operand(RCX));
+	emit_x64(c, 0, false, 0x85, RAX, reg_operand(RAX));
+	elf_jump(b, X64_CC_NS, positive_power);
+	emit_x64(c, 0, false, 0xF7, 3, reg_operand(RAX));
+	elf_place(b, positive_power);
+	elf_address(b, RDX, SECTION_RODATA, layout->ten);
+	elf_place(b, power_loop);
+	emit_x64(c, 0, false, 0x85, RAX, reg_operand(RAX));
+	elf_jump(b, CC_E, power_done);
+	emit_x64(c, 0, false, 0xDC, 1, mem_operand(RDX, 0)); // fmul qword
+	emit_x64(c, 0, false, 0xFF, 1, reg_operand(RAX));
+	elf_jump(b, -1, power_loop);
+	elf_place(b, power_done);
+	emit_x64(c, 0, false, 0x85, RCX, reg_operand(RCX));
+	elf_jump(b, X64_CC_S, divide);
+	x64_bytes(c, 0xDE, 0xC9);                            // fmulp st1, st0
+	elf_jump(b, -1, scaled);
+	elf_place(b, divide);
+	x64_bytes(c, 0xDE, 0xF9);                            // fdivp st1, st0
+	elf_place(b, scaled);
+	elf_address(b, RDX, SECTION_RODATA, layout->low);
+	emit_x64(c, 0, false, 0xDD, 0, mem_operand(RDX, 0));
+	x64_bytes(c, 0xDF, 0xF1);                            // fcomip st0, st1
+	elf_jump(b, CC_A, too_small);
+	elf_address(b, RDX, SECTION_RODATA, layout->high);
+	emit_x64(c, 0, false, 0xDD, 0, mem_operand(RDX, 0));
+	x64_bytes(c, 0xDF, 0xF1);
+	elf_jump(b, 0x6, too_big);                           // jbe
+	emit_x64(c, 0, false, 0xDB, 3, mem_operand(RSP, 40)); // rounds to even like printf
+	// 999999.5 and up round to 1000000, that's 100000 with the next exponent
+	emit_x64(c, 0, false, 0x81, X64_CMP, mem_operand(RSP, 40));
+	push_dword(1000000, c);
+	elf_jump(b, CC_NE, digits);
+	emit_x64(c, 0, false, 0xC7, 0, mem_operand(RSP, 40));
+	push_dword(100000, c);
+	emit_x64(c, 0, true, 0xFF, 0, reg_operand(R12));
+	elf_jump(b, -1, digits);
+	elf_place(b, too_small);
+	x64_bytes(c, 0xDD, 0xD8);                            // fstp st0
+	emit_x64(c, 0, true, 0xFF, 1, reg_operand(R12));
+	elf_jump(b, -1, scale);
+	elf_place(b, too_big);
+	x64_bytes(c, 0xDD, 0xD8);
+	emit_x64(c, 0, true, 0xFF, 0, reg_operand(R12));
+	elf_jump(b, -1, scale);
+
+	// The 6 digits as text, then the trailing zeros come off
+	elf_place(b, digits);
+	emit_x64(c, 0, false, 0x8B, RAX, mem_operand(RSP, 40));
+	x64_mov32(c, RCX, 10);
+	emit_x64(c, 0, true, 0x8D, RSI, mem_operand(RSP, 54));
+	x64_mov32(c, RDI, 6);
+	elf_place(b, digit_loop);
+	emit_x64(c, 0, false, 0x33, RDX, reg_operand(RDX));
+	emit_x64(c, 0, false, 0xF7, 6, reg_operand(RCX));
+	emit_x64(c, 0, false, 0x80, X64_ADD, reg_operand(RDX));
+	push_byte('0', c);
+	emit_x64(c, 0, true, 0xFF, 1, reg_operand(RSI));
+	emit_x64(c, 0, false, 0x88, RDX, mem_operand(RSI, 0));
+	emit_x64(c, 0, false, 0xFF, 1, reg_operand(RDI));
+	elf_jump(b, CC_NE, digit_loop);
+	emit_mov(c, reg_operand(R9), reg_operand(RSI));
+	emit_x64(c, 0, true, 0x8D, R8, mem_operand(RSP, 54));
+	elf_place(b, trim);
+	emit_x64(c, 0, false, 0x80, X64_CMP, mem_operand(R8, -1));
+	push_byte('0', c);
+	elf_jump(b, CC_NE, trimmed);
+	emit_x64(c, 0, true, 0xFF, 1, reg_operand(R8));
+	elf_jump(b, -1, trim);
+	elf_place(b, trimmed);
+	emit_x64(c, 0, true, 0x2B, R8, reg_operand(R9));
+
+	x64_imm8(c, X64_CMP, true, R12, -4);
+	elf_jump(b, CC_L, exponential);
+	x64_imm8(c, X64_CMP, true, R12, 5);
+	elf_jump(b, CC_G, exponential);
+	emit_x64(c, 0, true, 0x85, R12, reg_operand(R12));
+	elf_jump(b, X64_CC_S, small);
+
+	// Exponent 0 to 5, the digits up to the point and whatever is left after it
+	emit_mov(c, reg_operand(RSI), reg_operand(R9));
+	emit_x64(c, 0, true, 0x8D, RCX, mem_operand(R12, 1));
+	elf_call(b, rt->copy_digits);
+	emit_x64(c, 0, true, 0x8D, RAX, mem_operand(R12, 1));
+	emit_x64(c, 0, true, 0x3B, R8, reg_operand(RAX));
+	elf_jump(b, CC_LE, finish);
+	x64_byte_store(c, RBP, 0, '.');
+	emit_x64(c, 0, true, 0xFF, 0, reg_operand(RBP));
+	emit_mov(c, reg_operand(RCX), reg_operand(R8));
+	emit_x64(c, 0, true, 0x2B, RCX, reg_operand(RAX));
+	elf_call(b, rt->copy_digits);
+	elf_jump(b, -1, finish);
+
+	// Exponent -4 to -1, 0. and zeros before the digits
+	elf_place(b, small);
+	x64_byte_store(c, RBP, 0, '0');
+	x64_byte_store(c, RBP, 1, '.');
+	x64_imm8(c, X64_ADD, true, RBP, 2);
+	emit_mov(c, reg_operand(RCX), reg_operand(R12));
+	emit_x64(c, 0, true, 0xF7, 3, reg_operand(RCX));
+	emit_x64(c, 0, true, 0xFF, 1, reg_operand(RCX));
+	elf_place(b, zeros);
+	emit_x64(c, 0, true, 0x85, RCX, reg_operand(RCX));
+	elf_jump(b, CC_E, zeros_done);
+	x64_byte_store(c, RBP, 0, '0');
+	emit_x64(c, 0, true, 0xFF, 0, reg_operand(RBP));
+	emit_x64(c, 0, true, 0xFF, 1, reg_operand(RCX));
+	elf_jump(b, -1, zeros);
+	elf_place(b, zeros_done);
+	emit_mov(c, reg_operand(RSI), reg_operand(R9));
+	emit_mov(c, reg_operand(RCX), reg_operand(R8));
+	elf_call(b, rt->copy_digits);
+	elf_jump(b, -1, finish);
+
+	// d.ddddde+XX, the exponent has at least 2 digits
+	elf_place(b, exponential);
+	emit_mov(c, reg_operand(RSI), reg_operand(R9));
+	x64_mov32(c, RCX, 1);
+	elf_call(b, rt->copy_digits);
+	x64_imm8(c, X64_CMP, true, R8, 1);
+	elf_jump(b, CC_E, exponent);
+	x64_byte_store(c, RBP, 0, '.');
+	emit_x64(c, 0, true, 0xFF, 0, reg_operand(RBP));
+	emit_mov(c, reg_operand(RCX), reg_operand(R8));
+	emit_x64(c, 0, true, 0xFF, 1, reg_operand(RCX));
+	elf_call(b, rt->copy_digits);
+	elf_place(b, exponent);
+	x64_byte_store(c, RBP, 0, 'e');
+	x64_byte_store(c, RBP, 1, '+');
+	emit_x64(c, 0, true, 0x85, R12, reg_operand(R12));
+	elf_jump(b, X64_CC_NS, exponent_sign);
+	x64_byte_store(c, RBP, 1, '-');
+	emit_x64(c, 0, true, 0xF7, 3, reg_operand(R12));
+	elf_place(b, exponent_sign);
+	x64_imm8(c, X64_ADD, true, RBP, 2);
+	emit_mov(c, reg_operand(RAX), reg_operand(R12));
+	x64_imm8(c, X64_CMP, false, RAX, 100);
+	elf_jump(b, CC_B, two_digits);
+	emit_x64(c, 0, false, 0x33, RDX, reg_operand(RDX));
+	x64_mov32(c, RCX, 100);
+	emit_x64(c, 0, false, 0xF7, 6, reg_operand(RCX));
+	emit_x64(c, 0, false, 0x80, X64_ADD, reg_operand(RAX));
+	push_byte('0', c);
+	emit_x64(c, 0, false, 0x88, RAX, mem_operand(RBP, 0));
+	emit_x64(c, 0, true, 0xFF, 0, reg_operand(RBP));
+	emit_mov(c, reg_operand(RAX), reg_operand(RDX));
+	elf_place(b, two_digits);
+	emit_x64(c, 0, false, 0x33, RDX, reg_operand(RDX));
+	x64_mov32(c, RCX, 10);
+	emit_x64(c, 0, false, 0xF7, 6, reg_operand(RCX));
+	emit_x64(c, 0, false, 0x80, X64_ADD, reg_operand(RAX));
+	push_byte('0', c);
+	emit_x64(c, 0, false, 0x88, RAX, mem_operand(RBP, 0));
+	emit_x64(c, 0, false, 0x80, X64_ADD, reg_operand(RDX));
+	push_byte('0', c);
+	emit_x64(c, 0, false, 0x88, RDX, mem_operand(RBP, 1));
+	x64_imm8(c, X64_ADD, true, RBP, 2);
+
+	elf_place(b, finish);
+	x64_byte_store(c, RBP, 0, '\n');
+	emit_x64(c, 0, true, 0xFF, 0, reg_operand(RBP));
+	emit_mov(c, reg_operand(RDI), reg_operand(RSP));
+	emit_mov(c, reg_operand(RSI), reg_operand(RBP));
+	emit_x64(c, 0, true, 0x2B, RSI, reg_operand(RDI));
+	elf_call(b, rt->write);
+	x64_imm8(c, X64_ADD, true, RSP, 64);
+	emit_pop(c, R12);
+	emit_pop(c, RBP);
+	emit_pop(c, RBX);
+	push_byte(0xC3, c);
+	elf_end(b, name);
+}
+
+// @NOTE: a line runs through apoc_run_line, which keeps its stack pointer in
+// apoc_recovery. A runtime error prints its message and returns from
+// apoc_run_line with edx set, like a longjmp back to the REPL's recovery
+static void elf_emit_line_runner(Elf_Builder *b, Elf_Layout *layout, Elf_Runtime *rt)
+{
+	Bytecode *c = elf_text(b);
+	int name = elf_begin(b, "apoc_error", rt->error);
+	emit_mov(c, reg_operand(RBX), reg_operand(RDI));
+	elf_address(b, RDI, SECTION_RODATA, layout->error_text);
+	x64_mov32(c, RSI, 17);
+	elf_call(b, rt->write);
+	emit_mov(c, reg_operand(RDI), reg_operand(RBX));
+	elf_call(b, rt->write_string);
+	elf_address(b, RDI, SECTION_RODATA, layout->error_end);
+	x64_mov32(c, RSI, 2);
+	elf_call(b, rt->write);
+	elf_address(b, RAX, SECTION_DATA, layout->recovery);
+	emit_mov(c, reg_operand(RSP), mem_operand(RAX, 0));
+	x64_mov32(c, RDX, 1);
+	push_byte(0xC3, c);
+	elf_end(b, name);
+
+	// Calls the line in rax with the arguments of a Jit_Entry already in place
+	name = elf_begin(b, "apoc_run_line", rt->run_line);
+	elf_address(b, R11, SECTION_DATA, layout->recovery);
+	emit_mov(c, mem_operand(R11, 0), reg_operand(RSP));
+	elf_address(b, R11, SECTION_DATA, layout->runtime + offsetof(Jit_Runtime, depth));
+	emit_x64(c, 0, false, 0xC7, 0, mem_operand(R11, 0));
+	push_dword((u32)-1, c);
+	x64_imm8(c, X64_SUB, true, RSP, 8);
+	emit_x64(c, 0, false, 0xFF, 2, reg_operand(RAX));
+	x64_imm8(c, X64_ADD, true, RSP, 8);
+	emit_x64(c, 0, false, 0x33, RDX, reg_operand(RDX));
+	push_byte(0xC3, c);
+	elf_end(b, name);
+}
+
+// Strings, messages and constants, then the runtime's data and the VM's memory
+static void elf_lay_out_data(Elf_Builder *b, Elf_Layout *layout)
+{
+	layout->strings = alloc_temp_memory(sizeof(int) * (arrlen(string_pool) + 1));
+	for(int i = 0; i < arrlen(string_pool); ++i)
+		layout->strings[i] = elf_string(b, string_pool[i]);
+	for(int i = 0; i < JIT_ERROR_COUNT; ++i)
+		layout->messages[i] = elf_string(b, jit_error_messages[i]);
+	layout->newline = elf_string(b, "\n");
+	layout->true_text = elf_string(b, "true\n");
+	layout->false_text = elf_string(b, "false\n");
+	layout->fn_text = elf_string(b, "fn ");
+	layout->error_text = elf_string(b, "\n\nRuntime error: ");
+	layout->error_end = elf_string(b, "\n\n");
+
+	int *names = alloc_temp_memory(sizeof(int) * (arrlen(functions) + 1));
+	for(int i = 0; i < arrlen(functions); ++i)
+		names[i] = elf_string(b, functions[i].name);
+	layout->names = elf_align(b, SECTION_RODATA, 8, 0);
+	for(int i = 0; i < arrlen(functions); ++i)
+		elf_pointer(b, SECTION_RODATA, SECTION_RODATA, names[i]);
+
+	f64 constants[3] = {10.0, 100000.0, 1000000.0};
+	layout->ten = b->sections[SECTION_RODATA].i;
+	layout->low = layout->ten + 8;
+	layout->high = layout->ten + 16;
+	for(int i = 0; i < 3; ++i)
+		push_qword(*(u64 *)&constants[i], &b->sections[SECTION_RODATA]);
+
+	// The VM's memory, sized like the interpreter's so the same programs run out of it
+	Bytecode *bss = &b->sections[SECTION_BSS];
+	layout->globals = bss->i;
+	bss->i += VM_GLOBALS_SIZE * sizeof(u64);
+	layout->locals = bss->i;
+	bss->i += VM_LOCALS_SIZE * sizeof(u64);
+	layout->stack = bss->i;
+	bss->i += VM_STACK_SIZE * sizeof(u64);
+
+	Bytecode *data = &b->sections[SECTION_DATA];
+	layout->runtime = data->i;
+	push_qword(0, data); // vm, there's none
+	elf_pointer(b, SECTION_DATA, SECTION_BSS, layout->globals);
+	layout->entries = (int)sizeof(Jit_Runtime) + 8;
+	elf_pointer(b, SECTION_DATA, SECTION_DATA, layout->entries);
+	elf_pointer(b, SECTION_DATA, SECTION_BSS, layout->locals + VM_LOCALS_SIZE * sizeof(u64));
+	elf_pointer(b, SECTION_DATA, SECTION_BSS, layout->stack + VM_STACK_SIZE * sizeof(u64));
+	push_qword((u32)-1, data);
+	assert(data->i == sizeof(Jit_Runtime));
+	layout->recovery = data->i;
+	push_qword(0, data);
+	assert(data->i == layout->entries);
+	// The entries are filled in once the functions are placed
+	for(int i = 0; i < arrlen(functions); ++i)
+		push_qword(0, data);
+
+	elf_name(b, "apoc_runtime", SECTION_DATA, layout->runtime, sizeof(Jit_Runtime), false);
+	elf_name(b, "apoc_recovery", SECTION_DATA, layout->recovery, 8, false);
+	elf_name(b, "apoc_entries", SECTION_DATA, layout->entries, arrlen(functions) * 8, false);
+	elf_name(b, "apoc_function_names", SECTION_RODATA, layout->names, arrlen(functions) * 8, false);
+	elf_name(b, "apoc_globals", SECTION_BSS, layout->globals, VM_GLOBALS_SIZE * sizeof(u64), false);
+	elf_name(b, "apoc_locals", SECTION_BSS, layout->locals, VM_LOCALS_SIZE * sizeof(u64), false);
+	elf_name(b, "apoc_stack", SECTION_BSS, layout->stack, VM_STACK_SIZE * sizeof(u64), false);
+}
+
+// Copies a compiled function or line into .text, its relocations become fixups
+static int elf_place_unit(Elf_Builder *b, Elf_Layout *layout, Elf_Runtime *rt, Elf_Unit *unit, const char *name)
+{
+	int symbol = elf_begin(b, name, -1);
+	Bytecode *c = elf_text(b);
+	int base = c->i;
+	for(int i = 0; i < unit->code.i; ++i)
+		push_byte(unit->code.bytecode[i], c);
+	for(int i = 0; i < arrlen(unit->relocations); ++i)
+	{
+		Jit_Relocation relocation = unit->relocations[i];
+		switch(relocation.kind)
+		{
+			case JIT_RELOCATION_STRING:
+			{
+				elf_fixup(b, SECTION_TEXT, base + relocation.at, SECTION_RODATA, layout->strings[relocation.index]);
+			} break;
+			case JIT_RELOCATION_MESSAGE:
+			{
+				elf_fixup(b, SECTION_TEXT, base + relocation.at, SECTION_RODATA, layout->messages[relocation.index]);
+			} break;
+			case JIT_RELOCATION_ERROR:
+			{
+				// The runtime comes first, so its labels are already placed
+				elf_fixup(b, SECTION_TEXT, base + relocation.at, SECTION_TEXT, b->labels[rt->error]);
+			} break;
+		}
+	}
+	elf_end(b, symbol);
+	return base;
+}
+
+static void elf_emit_start(Elf_Builder *b, Elf_Layout *layout, Elf_Runtime *rt, int *line_offsets)
+{
+	Bytecode *c = elf_text(b);
+	int name = elf_begin(b, "_start", -1);
+	b->names[name].is_global = true;
+	for(int i = 0; i < arrlen(line_units); ++i)
+	{
+		elf_address(b, RDI, SECTION_BSS, layout->locals);
+		elf_address(b, RSI, SECTION_BSS, layout->stack);
+		elf_address(b, RDX, SECTION_DATA, layout->runtime);
+		x64_mov32(c, RCX, (u32)-1);
+		elf_address(b, RAX, SECTION_TEXT, line_offsets[i]);
+		elf_call(b, rt->run_line);
+
+		const Type_Info *ret = line_units[i].ret;
+		if(ret == NULL)
+			continue;
+		int failed = elf_label(b);
+		emit_x64(c, 0, false, 0x85, RDX, reg_operand(RDX));
+		elf_jump(b, CC_NE, failed);
+		emit_mov(c, reg_operand(RDI), reg_operand(RAX));
+		switch(ret->type)
+		{
+			case T_INT:    elf_call(b, rt->print_int); break;
+			case T_BOOL:   elf_call(b, rt->print_bool); break;
+			case T_STRING: elf_call(b, rt->print_string); break;
+			case T_FN:     elf_call(b, rt->print_function); break;
+			case T_FLOAT:  elf_call(b, ret->size == 32 ? rt->print_f32 : rt->print_f64); break;
+			default:
+			{
+				assert(false);
+			} break;
+		}
+		elf_place(b, failed);
+	}
+	// exit(0)
+	x64_mov32(c, RAX, 60);
+	emit_x64(c, 0, false, 0x33, RDI, reg_operand(RDI));
+	x64_bytes(c, 0x0F, 0x05);
+	elf_end(b, name);
+}
+
+static void elf_build(Elf_Builder *b, int *entry)
+{
+	for(int i = 0; i < SECTION_COUNT; ++i)
+		b->sections[i] = make_bytecode(INITIAL_BYTECODE_SIZE);
+
+	Elf_Layout layout = {};
+	elf_lay_out_data(b, &layout);
+
+	Elf_Runtime rt = {};
+	int *labels = (int *)&rt;
+	for(int i = 0; i < (int)(sizeof(rt) / sizeof(int)); ++i)
+		labels[i] = elf_label(b);
+	elf_emit_output_routines(b, &layout, &rt);
+	elf_emit_print_f64(b, &layout, &rt);
+	elf_emit_line_runner(b, &layout, &rt);
+
+	for(int i = 0; i < arrlen(functions); ++i)
+	{
+		int offset = elf_place_unit(b, &layout, &rt, &function_units[i], functions[i].name);
+		elf_fixup(b, SECTION_DATA, layout.entries + i * 8, SECTION_TEXT, offset);
+	}
+	int *line_offsets = alloc_temp_memory(sizeof(int) * (arrlen(line_units) + 1));
+	for(int i = 0; i < arrlen(line_units); ++i)
+	{
+		char *name = alloc_temp_memory(32);
+		sprintf(name, "apoc_line_%d", i + 1);
+		line_offsets[i] = elf_place_unit(b, &layout, &rt, &line_units[i], name);
+	}
+	*entry = elf_align(b, SECTION_TEXT, 16, 0xCC);
+	elf_emit_start(b, &layout, &rt, line_offsets);
+
+	for(int i = 0; i < arrlen(b->label_uses); ++i)
+	{
+		Jit_Fixup use = b->label_uses[i];
+		assert(b->labels[use.target] >= 0);
+		patch_dword(b->labels[use.target] - (use.at + 4), use.at, elf_text(b));
+	}
+}
+
+static void elf_free_builder(Elf_Builder *b)
+{
+	for(int i = 0; i < SECTION_COUNT; ++i)
+		free_bytecode(&b->sections[i]);
+	arrfree(b->fixups);
+	arrfree(b->names);
+	arrfree(b->labels);
+	arrfree(b->label_uses);
+}
+
+// @NOTE: file layout, the headers, .text and .rodata share the first page
+// aligned segment (read and execute), .data and .bss the second one (read and
+// write). Symbol tables and section headers come last, an object file has the
+// same sections with relocations in place of the segments
+typedef struct
+{
+	Elf64_Section *sections; // stb_ds array, 0 is the null section
+	char *section_names;     // stb_ds array
+	int kind_index[SECTION_COUNT];
+} Elf_Sections;
+
+static int elf_add_section(Elf_Sections *s, const char *name, u32 type, u64 flags, u64 align)
+{
+	Elf64_Section section = {.name = arrlen(s->section_names), .type = type, .flags = flags, .addralign = align};
+	for(const char *at = name; *at; ++at)
+		arrput(s->section_names, *at);
+	arrput(s->section_names, 0);
+	arrput(s->sections, section);
+	return arrlen(s->sections) - 1;
+}
+
+// The file is mapped zeroed, padding only moves past the bytes
+static void elf_pad(Bytecode *file, u64 offset)
+{
+	reserve_bytecode((int)(offset - file->i), file);
+	file->i = (int)offset;
+}
+
+b32 elf_write(const char *path, b32 executable)
+{
+	Elf_Builder b = {};
+	int entry = 0;
+	elf_build(&b, &entry);
+
+	// Where everything goes in the file and, for an executable, in memory
+	u64 offsets[SECTION_COUNT] = {};
+	u64 addresses[SECTION_COUNT] = {};
+	int segment_count = executable ? 3 : 0;
+	u64 headers = sizeof(Elf64_Header) + segment_count * sizeof(Elf64_Segment);
+	offsets[SECTION_TEXT] = executable ? ELF_PAGE_SIZE : (headers + 15) & ~15;
+	offsets[SECTION_RODATA] = (offsets[SECTION_TEXT] + b.sections[SECTION_TEXT].i + 15) & ~15;
+	u64 code_end = offsets[SECTION_RODATA] + b.sections[SECTION_RODATA].i;
+	offsets[SECTION_DATA] = executable ? (code_end + ELF_PAGE_SIZE - 1) & ~(u64)(ELF_PAGE_SIZE - 1) : (code_end + 15) & ~15;
+	offsets[SECTION_BSS] = (offsets[SECTION_DATA] + b.sections[SECTION_DATA].i + 63) & ~63;
+	if(executable)
+	{
+		for(int i = 0; i < SECTION_COUNT; ++i)
+			addresses[i] = ELF_BASE_ADDRESS + offsets[i];
+	}
+
+	Elf_Sections s = {};
+	Elf64_Section null_section = {};
+	arrput(s.sections, null_section);
+	arrput(s.section_names, 0);
+	s.kind_index[SECTION_TEXT] = elf_add_section(&s, ".text", 1, 2 | 4, 16);
+	s.kind_index[SECTION_RODATA] = elf_add_section(&s, ".rodata", 1, 2, 16);
+	s.kind_index[SECTION_DATA] = elf_add_section(&s, ".data", 1, 1 | 2, 16);
+	s.kind_index[SECTION_BSS] = elf_add_section(&s, ".bss", 8, 1 | 2, 64);
+	for(int i = 0; i < SECTION_COUNT; ++i)
+	{
+		Elf64_Section *section = &s.sections[s.kind_index[i]];
+		section->addr = addresses[i];
+		section->offset = offsets[i];
+		section->size = b.sections[i].i;
+	}
+
+	// Symbols: the null one, one per section for relocations, the locals and then the globals
+	Elf64_Symbol *symbols = NULL;
+	char *names = NULL;
+	arrput(names, 0);
+	Elf64_Symbol null_symbol = {};
+	arrput(symbols, null_symbol);
+	int section_symbols[SECTION_COUNT];
+	for(int i = 0; i < SECTION_COUNT; ++i)
+	{
+		Elf64_Symbol symbol = {.info = 3, .shndx = s.kind_index[i], .value = addresses[i]};
+		section_symbols[i] = arrlen(symbols);
+		arrput(symbols, symbol);
+	}
+	for(int global = 0; global < 2; ++global)
+	{
+		for(int i = 0; i < arrlen(b.names); ++i)
+		{
+			Elf_Name name = b.names[i];
+			if(name.is_global != global)
+				continue;
+			Elf64_Symbol symbol = {.name = arrlen(names), .info = (global << 4) | (name.is_function ? 2 : 1),
+				.shndx = s.kind_index[name.section], .value = addresses[name.section] + name.offset, .size = name.size};
+			for(const char *at = name.name; *at; ++at)
+				arrput(names, *at);
+			arrput(names, 0);
+			arrput(symbols, symbol);
+		}
+	}
+	int first_global = arrlen(symbols) - 1;
+
+	// An executable gets its addresses written in, an object keeps them as relocations
+	Elf64_Rela *relocations[SECTION_COUNT] = {};
+	for(int i = 0; i < arrlen(b.fixups); ++i)
+	{
+		Elf_Fixup fixup = b.fixups[i];
+		if(executable)
+		{
+			u64 address = addresses[fixup.target] + fixup.addend;
+			memcpy(b.sections[fixup.section].bytecode + fixup.offset, &address, 8);
+		}
+		else
+		{
+			Elf64_Rela relocation = {.offset = fixup.offset,
+				.info = (u64)section_symbols[fixup.target] << 32 | 1, // R_X86_64_64
+				.addend = fixup.addend};
+			arrput(relocations[fixup.section], relocation);
+		}
+	}
+
+	int symtab = elf_add_section(&s, ".symtab", 2, 0, 8);
+	int strtab = elf_add_section(&s, ".strtab", 3, 0, 1);
+	s.sections[symtab].link = strtab;
+	s.sections[symtab].info = first_global;
+	s.sections[symtab].entsize = sizeof(Elf64_Symbol);
+	s.sections[symtab].size = arrlen(symbols) * sizeof(Elf64_Symbol);
+	s.sections[strtab].size = arrlen(names);
+	int rela[SECTION_COUNT] = {};
+	const char *rela_names[SECTION_COUNT] = {".rela.text", ".rela.rodata", ".rela.data", NULL};
+	for(int i = 0; i < SECTION_COUNT; ++i)
+	{
+		if(arrlen(relocations[i]) == 0)
+			continue;
+		rela[i] = elf_add_section(&s, rela_names[i], 4, 0x40, 8);
+		s.sections[rela[i]].link = symtab;
+		s.sections[rela[i]].info = s.kind_index[i];
+		s.sections[rela[i]].entsize = sizeof(Elf64_Rela);
+		s.sections[rela[i]].size = arrlen(relocations[i]) * sizeof(Elf64_Rela);
+	}
+	int shstrtab = elf_add_section(&s, ".shstrtab", 3, 0, 1);
+	s.sections[shstrtab].size = arrlen(s.section_names);
+
+	// Everything that isn't loaded goes after .data, in the order the sections were added
+	u64 at = offsets[SECTION_BSS];
+	for(int i = s.kind_index[SECTION_BSS] + 1; i < arrlen(s.sections); ++i)
+	{
+		at = (at + s.sections[i].addralign - 1) & ~(s.sections[i].addralign - 1);
+		s.sections[i].offset = at;
+		at += s.sections[i].size;
+	}
+	u64 section_headers = (at + 7) & ~7;
+
+	Elf64_Header header = {
+		.ident = {0x7F, 'E', 'L', 'F', 2, 1, 1},
+		.type = executable ? 2 : 1,
+		.machine = 62, // x86-64
+		.version = 1,
+		.entry = executable ? addresses[SECTION_TEXT] + entry : 0,
+		.phoff = executable ? sizeof(Elf64_Header) : 0,
+		.shoff = section_headers,
+		.ehsize = sizeof(Elf64_Header),
+		.phentsize = executable ? sizeof(Elf64_Segment) : 0,
+		.phnum = segment_count,
+		.shentsize = sizeof(Elf64_Section),
+		.shnum = arrlen(s.sections),
+		.shstrndx = shstrtab,
+	};
+
+	// The whole file is laid out, so it's built straight into the mapped output
+	u64 file_size = section_headers + arrlen(s.sections) * sizeof(Elf64_Section);
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, executable ? 0755 : 0644);
+	void *map = MAP_FAILED;
+	if(fd != -1 && ftruncate(fd, file_size) == 0)
+		map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+	{
+		printf("Couldn't write %s\n", path);
+		if(fd != -1)
+			close(fd);
+		elf_free_builder(&b);
+		return false;
+	}
+	Bytecode file = bytecode_from_memory(map, (int)file_size);
+	push_bytes(&header, sizeof(header), &file);
+	if(executable)
+	{
+		Elf64_Segment segments[3] = {
+			{.type = 1, .flags = 4 | 1, .offset = 0, .vaddr = ELF_BASE_ADDRESS, .paddr = ELF_BASE_ADDRESS,
+				.filesz = code_end, .memsz = code_end, .align = ELF_PAGE_SIZE},
+			{.type = 1, .flags = 4 | 2, .offset = offsets[SECTION_DATA], .vaddr = addresses[SECTION_DATA],
+				.paddr = addresses[SECTION_DATA], .filesz = b.sections[SECTION_DATA].i,
+				.memsz = addresses[SECTION_BSS] + b.sections[SECTION_BSS].i - addresses[SECTION_DATA], .align = ELF_PAGE_SIZE},
+			// PT_GNU_STACK, the stack isn't executable
+			{.type = 0x6474E551, .flags = 4 | 2, .align = 16},
+		};
+		push_bytes(segments, sizeof(segments), &file);
+	}
+
+	for(int i = SECTION_TEXT; i <= SECTION_DATA; ++i)
+	{
+		elf_pad(&file, offsets[i]);
+		push_bytes(b.sections[i].bytecode, b.sections[i].i, &file);
+	}
+	for(int i = s.kind_index[SECTION_BSS] + 1; i < arrlen(s.sections); ++i)
+	{
+		elf_pad(&file, s.sections[i].offset);
+		if(i == symtab)
+			push_bytes(symbols, sizeof(Elf64_Symbol) * arrlen(symbols), &file);
+		else if(i == strtab)
+			push_bytes(names, arrlen(names), &file);
+		else if(i == shstrtab)
+			push_bytes(s.section_names, arrlen(s.section_names), &file);
+		else
+		{
+			for(int kind = 0; kind < SECTION_COUNT; ++kind)
+			{
+				if(rela[kind] == i)
+					push_bytes(relocations[kind], sizeof(Elf64_Rela) * arrlen(relocations[kind]), &file);
+			}
+		}
+	}
+	elf_pad(&file, section_headers);
+	push_bytes(s.sections, sizeof(Elf64_Section) * arrlen(s.sections), &file);
+	assert(file.i == (int)file_size);
+	free_bytecode(&file);
+	munmap(map, file_size);
+	close(fd);
+	if(executable)
+		chmod(path, 0755);
+
+	for(int i = 0; i < SECTION_COUNT; ++i)
+		arrfree(relocations[i]);
+	arrfree(symbols);
+	arrfree(names);
+	arrfree(s.sections);
+	arrfree(s.section_names);
+	elf_free_builder(&b);
+	return true;
+}
+
+#else
+
+b32 elf_write(const char *path, b32 executable)
+{
+	printf("Native code is only generated on x86-64 Linux, %s wasn't written\n", path);
+	return false;
+}
+
+#endif // JIT_SUPPORTED
@@ -0,0 +1,98 @@
+#ifndef _ELF_H
+#define _ELF_H
+
+#include "Basic.h"
+#include "Bytecode.h"
+#include "Jit.h"
+
+// @NOTE: the native ahead of time backend. Functions and lines are compiled
+// with the JIT's code generator as they come in (jit_compile_relocatable) and
+// at the end everything is laid out with a small runtime written straight in
+// machine code: _start runs the lines in order and prints what they give,
+// runtime errors end the line and the next one runs, and output goes through
+// the write system call. No C compiler, assembler or linker is needed, the
+// output is either a static executable for x86-64 Linux or a relocatable object
+// that links into one on its own (ld file.o). The runtime uses no libc at all.
+//
+// Every line is compiled before any of them runs, so a line that fails at
+// runtime can't be rolled back the way the REPL does it. Globals it declared
+// stay declared, later lines that use them still run and see what was stored
+// before the error (0 if nothing was). In the VM those lines are compile errors
+// (ex. x := 1 / z, then x prints 0 here and is an undefined identifier there)
+#define ELF_BASE_ADDRESS 0x400000
+#define ELF_PAGE_SIZE    0x1000
+
+typedef struct
+{
+	Bytecode code;
+	Jit_Relocation *relocations; // stb_ds array
+	const Type_Info *ret;        // what a line prints, NULL for functions and lines without a value
+	b32 compiled;
+} Elf_Unit;
+
+// The ELF64 structures, little endian
+typedef struct
+{
+	u8  ident[16];
+	u16 type;
+	u16 machine;
+	u32 version;
+	u64 entry;
+	u64 phoff;
+	u64 shoff;
+	u32 flags;
+	u16 ehsize;
+	u16 phentsize;
+	u16 phnum;
+	u16 shentsize;
+	u16 shnum;
+	u16 shstrndx;
+} Elf64_Header;
+
+typedef struct
+{
+	u32 type;
+	u32 flags;
+	u64 offset;
+	u64 vaddr;
+	u64 paddr;
+	u64 filesz;
+	u64 memsz;
+	u64 align;
+} Elf64_Segment;
+
+typedef struct
+{
+	u32 name;
+	u32 type;
+	u64 flags;
+	u64 addr;
+	u64 offset;
+	u64 size;
+	u32 link;
+	u32 info;
+	u64 addralign;
+	u64 entsize;
+} Elf64_Section;
+
+typedef struct
+{
+	u32 name;
+	u8  info;
+	u8  other;
+	u16 shndx;
+	u64 value;
+	u64 size;
+} Elf64_Symbol;
+
+typedef struct
+{
+	u64 offset;
+	u64 info;
+	i64 addend;
+} Elf64_Rela;
+
+void elf_compile_function(Function *fn);
+b32 elf_write(const char *path, b32 executable);
+
+#endif // _ELF_H
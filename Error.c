@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <vadefs.h>
 
+jmp_buf *error_recovery = NULL;
+
 void report_error(Token *token, const char *error_msg, ...)
 {
 	char print_buffer[4096] = {};
@@ -13,6 +15,7 @@ void report_error(Token *token, const char *error_msg, ...)
 	va_end(args);
 
 	printf("\n\n%s\n\n", print_buffer);
+	if(error_recovery)
+		longjmp(*error_recovery, 1);
 	exit(1);
 }
-
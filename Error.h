@@ -4,9 +4,12 @@
 
 #include "Basic.h"
 #include "Parser.h"
+#include <setjmp.h>
 
+// @NOTE: when set, errors jump back here instead of exiting so a session can
+// throw away the bad line and keep going
+extern jmp_buf *error_recovery;
 
 void report_error(Token *token, const char *error_msg, ...);
 
 #endif // _ERRORS_H
-
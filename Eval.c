@@ -0,0 +1,303 @@
+#include "Eval.h"
+#include "Fold.h"
+#include "Peephole.h"
+#include "stb_ds.h"
+
+// Calls can only go to functions that exist already or to ones that are
+// generated inside them, so the ones that call each other are seen once
+static b32 check_pure(int index, b32 *visited)
+{
+	if(visited[index])
+		return true;
+	visited[index] = true;
+
+	Bytecode *code = &functions[index].code;
+	for(int at = 0; at < code->i; at += get_instruction_size(code->bytecode + at))
+	{
+		u8 *ip = code->bytecode + at;
+		switch(ip[0])
+		{
+			case GLOAD:
+			case GSTORE:
+			case GFLOADB: case GFLOADW: case GFLOADDW: case GFLOADQW: case GFLOADF: case GFLOADD:
+			case GFSTOREB: case GFSTOREW: case GFSTOREDW: case GFSTOREQW: case GFSTOREF: case GFSTORED:
+			case CALLI:
+			{
+				return false;
+			} break;
+			case CALL:
+			case TAILCALL:
+			{
+				if(!check_pure(read_dword(ip + 1), visited))
+					return false;
+			} break;
+			default: break;
+		}
+	}
+	return true;
+}
+
+b32 is_pure_function(int index)
+{
+	int count = arrlen(functions);
+	b32 *visited = alloc_temp_memory(sizeof(b32) * count);
+	memset(visited, 0, sizeof(b32) * count);
+	return check_pure(index, visited);
+}
+
+static f32 eval_as_f32(u64 cell)
+{
+	u32 bits = (u32)cell;
+	f32 result;
+	memcpy(&result, &bits, 4);
+	return result;
+}
+
+static f64 eval_as_f64(u64 cell)
+{
+	f64 result;
+	memcpy(&result, &cell, 8);
+	return result;
+}
+
+// The math goes through the folding helpers, so a call gives back what
+// folding the same expressions would. False for what the VM reports as an
+// error (ex. integer division by zero)
+static b32 eval_binary(OP op, u64 a, u64 b, u64 *result)
+{
+	int width = 0;
+	if(op >= ADDDW && op <= DIVD)
+		width = (op - ADDDW) % 4;
+	else if(op >= EQDW && op <= GED)
+		width = (op - EQDW) % 4;
+
+	if(width == 2)
+	{
+		if(!fold_float_op(op, eval_as_f32(a), eval_as_f32(b), result))
+			return false;
+		// Comparisons give a b32, the math gives an f64 that already fits in an f32
+		if(op < EQDW)
+		{
+			f32 value = (f32)eval_as_f64(*result);
+			u32 bits;
+			memcpy(&bits, &value, 4);
+			*result = bits;
+		}
+		return true;
+	}
+	if(width == 3)
+		return fold_float_op(op, eval_as_f64(a), eval_as_f64(b), result);
+
+	i64 value;
+	if(!fold_int_op(op, (i64)a, (i64)b, &value))
+		return false;
+	*result = (u64)value;
+	return true;
+}
+
+// The arguments on top of the caller's stack become the first slots of the
+// callee, its operand stack goes right after its slots. Gives back the
+// callee's empty stack, NULL if it doesn't fit. Reusing slots can leave an
+// argument nothing reads out of the frame, it still takes up a cell here
+static u64 *enter_frame(Eval_Frame *frame, Function *callee, u64 *sp, u8 *ret_ip, u64 *end)
+{
+	u64 *locals = sp - callee->arg_count + 1;
+	int slots = callee->frame_size > callee->arg_count ? callee->frame_size : callee->arg_count;
+	if(locals + slots + callee->max_stack >= end)
+		return NULL;
+	memset(locals + callee->arg_count, 0, sizeof(u64) * (slots - callee->arg_count));
+	frame->function = callee;
+	frame->ret_ip = ret_ip;
+	frame->locals = locals;
+	frame->sp = locals - 1;
+	return locals + slots - 1;
+}
+
+// @NOTE: a plain switch over the stack code with the same semantics as
+// interpret, minus globals and function values. It starts from scratch every
+// time, nothing it does is seen outside of it
+Eval_Result evaluate_call(int index, u64 *args, u64 *result, int *instructions)
+{
+	static u64 *cells;
+	static Eval_Frame *frames;
+	if(cells == NULL)
+	{
+		cells = AllocateVirtualMemory(EVAL_MAX_CELLS * sizeof(u64));
+		frames = AllocateVirtualMemory(EVAL_MAX_FRAMES * sizeof(Eval_Frame));
+	}
+	u64 *end = cells + EVAL_MAX_CELLS;
+	*instructions = 0;
+
+	// cells[0] is never used, same as the VM's stack
+	Function *fn = &functions[index];
+	memcpy(cells + 1, args, sizeof(u64) * fn->arg_count);
+	Eval_Frame *frame = frames;
+	u64 *sp = enter_frame(frame, fn, cells + fn->arg_count, NULL, end);
+	if(sp == NULL)
+		return EVAL_OUT_OF_MEMORY;
+	u64 *locals = frame->locals;
+	u8 *code = fn->code.bytecode;
+	u8 *ip = code;
+
+	for(;;)
+	{
+		if(++*instructions > EVAL_MAX_INSTRUCTIONS)
+			return EVAL_OUT_OF_INSTRUCTIONS;
+
+		OP op = ip[0];
+		u8 *next = ip + get_instruction_size(ip);
+		if((op >= ADDDW && op <= SHRQW) || (op >= EQDW && op <= GED))
+		{
+			u64 b = *sp--;
+			if(!eval_binary(op, *sp, b, sp))
+				return EVAL_ERROR;
+			ip = next;
+			continue;
+		}
+		if(op >= JEQDW && op <= JNGED)
+		{
+			b32 jumps_if;
+			OP compare = get_branch_compare(op, &jumps_if);
+			u64 holds;
+			sp -= 2;
+			if(!eval_binary(compare, sp[1], sp[2], &holds))
+				return EVAL_ERROR;
+			ip = holds == (u64)jumps_if ? code + read_dword(ip + 1) : next;
+			continue;
+		}
+		if(op >= ADDQW_LL && op <= GEQW_LI)
+		{
+			u64 a = locals[read_word(ip + 1)];
+			u64 b = op <= MULQW_LL ? locals[read_word(ip + 3)] : (u64)(i64)(i32)read_dword(ip + 3);
+			if(!eval_binary(get_superinstruction_base(op), a, b, ++sp))
+				return EVAL_ERROR;
+			ip = next;
+			continue;
+		}
+
+		switch(op)
+		{
+			case NOP: break;
+
+			case LOADB: case LOADW: case LOADDW: case LOADQW: case LOADF: case LOADD:
+			{
+				*++sp = narrow_cell(locals[read_word(ip + 1)], op);
+			} break;
+			// Stores and tees keep what a load of the same width would
+			case STOREB: case STOREW: case STOREDW: case STOREQW: case STOREF: case STORED:
+			{
+				locals[read_word(ip + 1)] = narrow_cell(*sp--, LOADB + (op - STOREB));
+			} break;
+			case TEEB: case TEEW: case TEEDW: case TEEQW: case TEEF: case TEED:
+			{
+				*sp = locals[read_word(ip + 1)] = narrow_cell(*sp, LOADB + (op - TEEB));
+			} break;
+			case NARROWB: case NARROWW:
+			{
+				*sp = narrow_cell(*sp, LOADB + (op - NARROWB));
+			} break;
+
+			// A field is the bytes at its offset, loads extend them like LOAD does
+			case FLOADB: case FLOADW: case FLOADDW: case FLOADQW: case FLOADF: case FLOADD:
+			{
+				u64 cell = 0;
+				memcpy(&cell, (u8 *)(locals + read_word(ip + 1)) + read_word(ip + 3), get_field_width(op));
+				*++sp = narrow_cell(cell, LOADB + (op - FLOADB));
+			} break;
+			case FSTOREB: case FSTOREW: case FSTOREDW: case FSTOREQW: case FSTOREF: case FSTORED:
+			{
+				u64 cell = *sp--;
+				memcpy((u8 *)(locals + read_word(ip + 1)) + read_word(ip + 3), &cell, get_field_width(op));
+			} break;
+
+			case PUSHB:  *++sp = (u64)(i64)(i8)ip[1]; break;
+			case PUSHW:  *++sp = (u64)(i64)(i16)read_word(ip + 1); break;
+			case PUSHDW: *++sp = (u64)(i64)(i32)read_dword(ip + 1); break;
+			case PUSHF:  *++sp = read_dword(ip + 1); break;
+			case PUSHQW:
+			case PUSHD:  *++sp = read_qword(ip + 1); break;
+
+			case GLOAD:
+			case GSTORE:
+			case CALLI:
+			{
+				return EVAL_IMPURE;
+			} break;
+
+			case PUSHS: *++sp = (u64)string_pool[read_dword(ip + 1)]; break;
+			case POP:   --sp; break;
+			case EQS:
+			{
+				char *b = (char *)*sp--;
+				char *a = (char *)*sp;
+				*sp = a == b || strcmp(a, b) == 0;
+			} break;
+			case HASHS: *sp = hash_string((char *)*sp, read_dword(ip + 1)) & read_dword(ip + 5); break;
+
+			case JMP: next = code + read_dword(ip + 1); break;
+			case JZ:
+			{
+				if(*sp-- == 0)
+					next = code + read_dword(ip + 1);
+			} break;
+			case JNZ:
+			{
+				if(*sp-- != 0)
+					next = code + read_dword(ip + 1);
+			} break;
+			case SWITCH:
+			{
+				u64 entry = *sp-- - read_qword(ip + 1);
+				next = code + read_dword(ip + (entry < read_dword(ip + 9) ? 17 + 4 * (u32)entry : 13));
+			} break;
+			case LOOPQW_LI:
+			case LOOPQW_LL:
+			{
+				u16 slot = read_word(ip + 5);
+				i64 value = (i64)(locals[slot] + (u64)(i64)(i32)read_dword(ip + 7));
+				locals[slot] = (u64)value;
+				i64 limit = op == LOOPQW_LI ? (i32)read_dword(ip + 11) : (i64)locals[read_word(ip + 11)];
+				if(value < limit)
+					next = code + read_dword(ip + 1);
+			} break;
+
+			// The RET after a TAILCALL returns what it gives back
+			case CALL:
+			case TAILCALL:
+			{
+				Function *callee = &functions[read_dword(ip + 1)];
+				if(frame + 1 == frames + EVAL_MAX_FRAMES)
+					return EVAL_OUT_OF_MEMORY;
+				sp = enter_frame(frame + 1, callee, sp, next, end);
+				if(sp == NULL)
+					return EVAL_OUT_OF_MEMORY;
+				frame++;
+				locals = frame->locals;
+				code = callee->code.bytecode;
+				next = code;
+			} break;
+			case RET:
+			{
+				u64 value = ip[1] ? *sp : 0;
+				if(frame == frames)
+				{
+					*result = value;
+					return EVAL_DONE;
+				}
+				sp = frame->sp;
+				next = frame->ret_ip;
+				frame--;
+				locals = frame->locals;
+				code = frame->function->code.bytecode;
+				if(ip[1])
+					*++sp = value;
+			} break;
+
+			default:
+			{
+				return EVAL_IMPURE;
+			} break;
+		}
+		ip = next;
+	}
+}
@@ -0,0 +1,41 @@
+#ifndef _EVAL_H
+#define _EVAL_H
+
+#include "Basic.h"
+#include "Bytecode.h"
+
+// @NOTE: folding replaces a call to a pure function with constant arguments by
+// what it returns, that's worked out here by running the callee's code in a
+// sandbox of its own. A function is pure if nothing it can run touches a
+// global or calls through a function value, the sandbox has no globals and
+// gives up on those too. It never reports an error, anything it can't finish
+// (a runtime error, running out of instructions or memory) is left for the VM
+// to run, so a call that never returns still doesn't return at run time.
+//
+// Memory is counted in cells: every frame's slots and its operand stack, the
+// arguments of a call turn into the callee's first slots in place
+#define EVAL_MAX_INSTRUCTIONS (1 << 20)
+#define EVAL_MAX_CELLS        (1 << 16)
+#define EVAL_MAX_FRAMES       (1 << 10)
+
+typedef enum
+{
+	EVAL_DONE,
+	EVAL_IMPURE,
+	EVAL_ERROR,             // what the VM would report as a runtime error
+	EVAL_OUT_OF_INSTRUCTIONS,
+	EVAL_OUT_OF_MEMORY,
+} Eval_Result;
+
+typedef struct
+{
+	Function *function;
+	u8 *ret_ip;
+	u64 *locals;
+	u64 *sp;  // the caller's stack pointer once the arguments are popped
+} Eval_Frame;
+
+b32 is_pure_function(int index);
+Eval_Result evaluate_call(int index, u64 *args, u64 *result, int *instructions);
+
+#endif // _EVAL_H
@@ -0,0 +1,391 @@
+#include "Fold.h"
+#include "Peephole.h"
+#include "Eval.h"
+#include "stb_ds.h"
+
+// @NOTE: locals can't shadow anything, so a name is enough to find what it
+// refers to. A name that's assigned anywhere in the line isn't treated as
+// immutable anywhere in it, that's conservative for locals in sibling scopes
+// that happen to share the name but it's never wrong
+static void collect_assigned(Fold_Context *ctx, Node *expr)
+{
+	if(expr == NULL)
+		return;
+
+	switch(expr->type)
+	{
+		case ND_ROOT:
+		{
+			for(int i = 0; i < ArrLen(expr->root.expressions); ++i)
+				collect_assigned(ctx, expr->root.expressions[i]);
+		} break;
+		case ND_BODY:
+		{
+			for(int i = 0; i < ArrLen(expr->body.expressions); ++i)
+				collect_assigned(ctx, expr->body.expressions[i]);
+		} break;
+		case ND_FN:
+		{
+			collect_assigned(ctx, expr->func.body);
+		} break;
+		case ND_IF:
+		{
+			collect_assigned(ctx, expr->if_.condition);
+			collect_assigned(ctx, expr->if_.then);
+		} break;
+		case ND_FOR:
+		{
+			collect_assigned(ctx, expr->for_.init);
+			collect_assigned(ctx, expr->for_.condition);
+			collect_assigned(ctx, expr->for_.step);
+			collect_assigned(ctx, expr->for_.body);
+		} break;
+		case ND_SWITCH:
+		{
+			collect_assigned(ctx, expr->switch_.value);
+			for(int i = 0; i < ArrLen(expr->switch_.cases); ++i)
+				collect_assigned(ctx, expr->switch_.cases[i]->case_.body);
+			collect_assigned(ctx, expr->switch_.otherwise);
+		} break;
+		case ND_BINARY:
+		{
+			if(is_assignment_op(expr->binary.op->value))
+				arrput(ctx->assigned, get_field_root(expr->binary.left)->token->string);
+			collect_assigned(ctx, expr->binary.left);
+			collect_assigned(ctx, expr->binary.right);
+		} break;
+		case ND_DECL:
+		{
+			collect_assigned(ctx, expr->decl.expr);
+		} break;
+		case ND_CALL:
+		{
+			collect_assigned(ctx, expr->fn_call.operand);
+			for(int i = 0; i < ArrLen(expr->fn_call.arguments); ++i)
+				collect_assigned(ctx, expr->fn_call.arguments[i]);
+		} break;
+		default: break;
+	}
+}
+
+static b32 is_assigned(Fold_Context *ctx, char *name)
+{
+	for(int i = 0; i < arrlen(ctx->assigned); ++i)
+	{
+		if(VStrCmp(ctx->assigned[i], name))
+			return true;
+	}
+	return false;
+}
+
+static Node *make_literal(Token *token, const Type_Info *type, u64 value)
+{
+	Node *result = alloc_node();
+	result->type = ND_LITERAL;
+	result->token = token;
+	result->literal._u64 = value;
+	result->literal.type = type->type == T_FLOAT ? LIT_DOUBLE : LIT_INT;
+	result->type_info = type;
+	return result;
+}
+
+// f32 ops are done in single precision, same as the VM does them
+b32 fold_float_op(OP op, f64 a, f64 b, u64 *result)
+{
+	f32 a32 = (f32)a;
+	f32 b32 = (f32)b;
+	f64 value;
+	switch(op)
+	{
+		case ADDF: value = (f32)(a32 + b32); break;
+		case SUBF: value = (f32)(a32 - b32); break;
+		case MULF: value = (f32)(a32 * b32); break;
+		case DIVF: value = (f32)(a32 / b32); break;
+		case ADDD: value = a + b; break;
+		case SUBD: value = a - b; break;
+		case MULD: value = a * b; break;
+		case DIVD: value = a / b; break;
+
+		case EQF: *result = a32 == b32; return true;
+		case NEF: *result = a32 != b32; return true;
+		case LTF: *result = a32 <  b32; return true;
+		case LEF: *result = a32 <= b32; return true;
+		case GTF: *result = a32 >  b32; return true;
+		case GEF: *result = a32 >= b32; return true;
+		case EQD: *result = a == b; return true;
+		case NED: *result = a != b; return true;
+		case LTD: *result = a <  b; return true;
+		case LED: *result = a <= b; return true;
+		case GTD: *result = a >  b; return true;
+		case GED: *result = a >= b; return true;
+		default: return false;
+	}
+	*result = *(u64 *)&value;
+	return true;
+}
+
+// Returns the literal the expression folds to, or NULL if it has to be left
+// for the VM (ex. integer division by zero is a runtime error)
+static Node *fold_binary(Node *expr)
+{
+	Node *left = expr->binary.left;
+	Node *right = expr->binary.right;
+	if(left->type != ND_LITERAL || right->type != ND_LITERAL)
+		return NULL;
+
+	const Type_Info *operand_type = left->type_info;
+	OP op = get_binary_op(expr->binary.op->value, operand_type);
+	u64 a = get_literal_value(left);
+	u64 b = get_literal_value(right);
+	u64 value;
+	if(operand_type->type == T_FLOAT)
+	{
+		if(!fold_float_op(op, *(f64 *)&a, *(f64 *)&b, &value))
+			return NULL;
+	}
+	else
+	{
+		i64 result;
+		if(!fold_int_op(op, (i64)a, (i64)b, &result))
+			return NULL;
+		value = (u64)result;
+	}
+
+	// i8 and i16 math is narrowed after it's done in 32 bits, the literal
+	// narrows to its type the same way
+	return make_literal(expr->token, expr->type_info, value);
+}
+
+// The cell the literal's push leaves on the stack, an f32 is in the low 32 bits
+static u64 get_literal_cell(Node *literal)
+{
+	u64 value = get_literal_value(literal);
+	if(literal->type_info->type == T_FLOAT && literal->type_info->size == 32)
+	{
+		f32 narrow = (f32)*(f64 *)&value;
+		return *(u32 *)&narrow;
+	}
+	return value;
+}
+
+// @NOTE: only functions from earlier lines can be run, the ones a line defines
+// aren't generated until folding is done with it. Returns the literal the call
+// gives back, or NULL if it has to be left for the VM
+static Node *fold_call(Fold_Context *ctx, Node *call)
+{
+	Node *operand = call->fn_call.operand;
+	const Type_Info *ret = call->type_info;
+	if(operand->type != ND_ID || ret == NULL ||
+			(ret->type != T_INT && ret->type != T_FLOAT && ret->type != T_BOOL))
+		return NULL;
+	int index = find_function(operand->token->string);
+	if(index == -1)
+		return NULL;
+
+	Node **arguments = call->fn_call.arguments;
+	int arg_count = ArrLen(arguments);
+	u64 *args = alloc_temp_memory(sizeof(u64) * (arg_count + 1));
+	for(int i = 0; i < arg_count; ++i)
+	{
+		if(arguments[i]->type != ND_LITERAL)
+			return NULL;
+		args[i] = get_literal_cell(arguments[i]);
+	}
+	if(!is_pure_function(index))
+		return NULL;
+
+	u64 value;
+	int instructions;
+	if(evaluate_call(index, args, &value, &instructions) != EVAL_DONE)
+	{
+		ctx->stats.gave_up++;
+		return NULL;
+	}
+
+	if(ret->type == T_FLOAT && ret->size == 32)
+	{
+		f64 wide = *(f32 *)&value;
+		value = *(u64 *)&wide;
+	}
+	return make_literal(call->token, ret, value);
+}
+
+static Node *find_constant(Fold_Context *ctx, char *name)
+{
+	for(int i = arrlen(ctx->constants) - 1; i >= 0; --i)
+	{
+		if(VStrCmp(ctx->constants[i].name, name))
+			return ctx->constants[i].value;
+	}
+	return NULL;
+}
+
+static Node *fold_expression(Fold_Context *ctx, Node *expr);
+
+static void fold_body(Fold_Context *ctx, Node **expressions)
+{
+	int first_constant = arrlen(ctx->constants);
+	int conditional = ctx->conditional;
+	ctx->conditional = 0;
+	ctx->depth++;
+	for(int i = 0; i < ArrLen(expressions); ++i)
+		expressions[i] = fold_expression(ctx, expressions[i]);
+	ctx->depth--;
+	ctx->conditional = conditional;
+	arrsetlen(ctx->constants, first_constant);
+}
+
+static void fold_declaration(Fold_Context *ctx, Node *decl)
+{
+	// Structs can be declared without a value
+	if(decl->decl.expr == NULL)
+		return;
+
+	decl->decl.expr = fold_expression(ctx, decl->decl.expr);
+	Node *init = decl->decl.expr;
+	// A declaration that's the then of an if is in the enclosing scope but
+	// might never run
+	if(init->type != ND_LITERAL || ctx->conditional > 0)
+		return;
+
+	char *name = decl->decl.operand->token->string;
+	// Globals can be assigned by any later line, only :: makes them immutable
+	b32 is_immutable = decl->decl.is_const || (ctx->depth > 0 && !is_assigned(ctx, name));
+	if(!is_immutable)
+		return;
+
+	// The value is what a load gives back after the store narrowed it
+	u64 value = get_literal_value(init);
+	if(ctx->depth == 0)
+	{
+		Symbol *symbol = get_symbol(name);
+		symbol->has_value = true;
+		symbol->value = value;
+	}
+	else
+	{
+		Fold_Constant constant = {.name = name, .value = make_literal(init->token, init->type_info, value)};
+		arrput(ctx->constants, constant);
+	}
+}
+
+static Node *fold_expression(Fold_Context *ctx, Node *expr)
+{
+	switch(expr->type)
+	{
+		case ND_FN:
+		{
+			fold_body(ctx, expr->func.body->body.expressions);
+		} break;
+		case ND_BODY:
+		{
+			fold_body(ctx, expr->body.expressions);
+		} break;
+		case ND_IF:
+		{
+			expr->if_.condition = fold_expression(ctx, expr->if_.condition);
+			ctx->conditional++;
+			expr->if_.then = fold_expression(ctx, expr->if_.then);
+			ctx->conditional--;
+		} break;
+		case ND_SWITCH:
+		{
+			expr->switch_.value = fold_expression(ctx, expr->switch_.value);
+			ctx->conditional++;
+			for(int i = 0; i < ArrLen(expr->switch_.cases); ++i)
+			{
+				Node *case_ = expr->switch_.cases[i];
+				case_->case_.body = fold_expression(ctx, case_->case_.body);
+			}
+			if(expr->switch_.otherwise)
+				expr->switch_.otherwise = fold_expression(ctx, expr->switch_.otherwise);
+			ctx->conditional--;
+		} break;
+		case ND_FOR:
+		{
+			// A scope of its own like a body, the step and the body might never run
+			int first_constant = arrlen(ctx->constants);
+			ctx->depth++;
+			if(expr->for_.init)
+				expr->for_.init = fold_expression(ctx, expr->for_.init);
+			expr->for_.condition = fold_expression(ctx, expr->for_.condition);
+			ctx->conditional++;
+			if(expr->for_.step)
+				expr->for_.step = fold_expression(ctx, expr->for_.step);
+			expr->for_.body = fold_expression(ctx, expr->for_.body);
+			ctx->conditional--;
+			ctx->depth--;
+			arrsetlen(ctx->constants, first_constant);
+		} break;
+		case ND_DECL:
+		{
+			fold_declaration(ctx, expr);
+		} break;
+		case ND_CALL:
+		{
+			for(int i = 0; i < ArrLen(expr->fn_call.arguments); ++i)
+				expr->fn_call.arguments[i] = fold_expression(ctx, expr->fn_call.arguments[i]);
+
+			Node *value = codegen_options.evaluate_calls ? fold_call(ctx, expr) : NULL;
+			if(value)
+			{
+				ctx->stats.evaluated++;
+				return value;
+			}
+		} break;
+		case ND_BINARY:
+		{
+			// The left side of an assignment is where the value goes, not a use
+			if(!is_assignment_op(expr->binary.op->value))
+				expr->binary.left = fold_expression(ctx, expr->binary.left);
+			expr->binary.right = fold_expression(ctx, expr->binary.right);
+
+			Node *folded = is_assignment_op(expr->binary.op->value) ? NULL : fold_binary(expr);
+			if(folded)
+			{
+				ctx->stats.folded++;
+				return folded;
+			}
+		} break;
+		case ND_ID:
+		{
+			Node *constant = find_constant(ctx, expr->token->string);
+			if(constant)
+			{
+				ctx->stats.propagated++;
+				return make_literal(expr->token, constant->type_info, constant->literal._u64);
+			}
+
+			Symbol *symbol = get_symbol(expr->token->string);
+			if(symbol && symbol->has_value)
+			{
+				ctx->stats.propagated++;
+				return make_literal(expr->token, expr->type_info, symbol->value);
+			}
+		} break;
+		default: break;
+	}
+	return expr;
+}
+
+Fold_Stats fold_constants(Node *root)
+{
+	Fold_Context ctx = {};
+	collect_assigned(&ctx, root);
+	Node **expressions = root->root.expressions;
+	for(int i = 0; i < ArrLen(expressions); ++i)
+		expressions[i] = fold_expression(&ctx, expressions[i]);
+
+	arrfree(ctx.constants);
+	arrfree(ctx.assigned);
+	return ctx.stats;
+}
+
+void print_fold_stats(Fold_Stats stats)
+{
+	printf("fold: %d expressions folded, %d constants propagated, %d calls evaluated", stats.folded,
+			stats.propagated, stats.evaluated);
+	if(stats.gave_up)
+		printf(" (%d given up on)", stats.gave_up);
+	printf("\n");
+}
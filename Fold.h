@@ -0,0 +1,42 @@
+#ifndef _FOLD_H
+#define _FOLD_H
+
+#include "Basic.h"
+#include "Parser.h"
+#include "Analyzer.h"
+#include "Bytecode.h"
+
+// @NOTE: runs between analyze_ast and generate_bytecode. Binary expressions
+// over literals become a literal with the value the VM would compute, and
+// immutable declarations with a constant initializer are propagated into their
+// uses. Immutable is either declared with :: or a local nothing assigns to.
+// Calls to pure functions with literal arguments become what they return, see Eval.h
+
+typedef struct
+{
+	char *name;
+	Node *value; // A literal, already narrowed to the declared type
+} Fold_Constant;
+
+typedef struct
+{
+	int folded;     // binary expressions replaced with a literal
+	int propagated; // identifiers replaced with a constant's value
+	int evaluated;  // calls replaced with what they return, see Eval.h
+	int gave_up;    // calls that could have been but didn't finish in the sandbox
+} Fold_Stats;
+
+typedef struct
+{
+	Fold_Constant *constants; // stb_ds array, the locals in scope, innermost last
+	char **assigned;          // stb_ds array, every name on the left of an assignment
+	int depth;                // 0 is the global scope
+	int conditional;          // inside an if without a body of its own
+	Fold_Stats stats;
+} Fold_Context;
+
+Fold_Stats fold_constants(Node *root);
+b32 fold_float_op(OP op, f64 a, f64 b, u64 *result);
+void print_fold_stats(Fold_Stats stats);
+
+#endif // _FOLD_H
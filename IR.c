@@ -0,0 +1,2027 @@
+#include "IR.h"
+#include "Fold.h"
+#include "Peephole.h"
+#include "stb_ds.h"
+
+static const char *ir_kind_names[IR_KIND_COUNT] = {
+	[IR_CONST]  = "const",
+	[IR_UNDEF]  = "undef",
+	[IR_PARAM]  = "param",
+	[IR_STRING] = "string",
+	[IR_PHI]    = "phi",
+	[IR_BINARY] = "binary",
+	[IR_NARROW] = "narrow",
+	[IR_GLOAD]  = "gload",
+	[IR_GSTORE] = "gstore",
+	[IR_CALL]   = "call",
+	[IR_CALLI]  = "calli",
+	[IR_JUMP]   = "jump",
+	[IR_BRANCH] = "branch",
+	[IR_RET]    = "ret",
+};
+
+static IR_Pass ir_passes[] = {
+	{"sccp",     ir_sccp},
+	{"simplify", ir_simplify_cfg},
+	{"gvn",      ir_gvn},
+	{"dce",      ir_dce},
+};
+#define IR_PASS_COUNT (int)(sizeof(ir_passes) / sizeof(ir_passes[0]))
+
+static b32 is_terminator(IR_Kind kind)
+{
+	return kind == IR_JUMP || kind == IR_BRANCH || kind == IR_RET;
+}
+
+static b32 is_compare_op(OP op)
+{
+	return op >= EQDW && op <= GED;
+}
+
+static b32 is_commutative_op(OP op)
+{
+	return (op >= ADDDW && op <= ADDD) || (op >= MULDW && op <= MULD) ||
+		(op >= ANDDW && op <= XORQW) || (op >= EQDW && op <= NED);
+}
+
+// Integer division traps on 0, anything else is free of side effects
+static b32 may_trap(IR_Function *ir, IR_Value *value)
+{
+	if(value->kind != IR_BINARY)
+		return false;
+	if(value->op != DIVDW && value->op != DIVQW && value->op != MODDW && value->op != MODQW)
+		return false;
+	IR_Value *divisor = &ir->values[value->args[1]];
+	if(divisor->kind != IR_CONST)
+		return true;
+	return value->op == DIVDW || value->op == MODDW ? (i32)divisor->imm == 0 : divisor->imm == 0;
+}
+
+static b32 has_side_effects(IR_Function *ir, IR_Value *value)
+{
+	switch(value->kind)
+	{
+		case IR_GSTORE:
+		case IR_CALL:
+		case IR_CALLI:
+		case IR_JUMP:
+		case IR_BRANCH:
+		case IR_RET:
+			return true;
+		default:
+			return may_trap(ir, value);
+	}
+}
+
+// Values the lowering pushes where they're used instead of keeping them around
+static b32 is_rematerializable(IR_Value *value)
+{
+	return value->kind == IR_CONST || value->kind == IR_UNDEF ||
+		value->kind == IR_PARAM || value->kind == IR_STRING;
+}
+
+static const Type_Info *get_op_type(OP op)
+{
+	if(is_compare_op(op))
+		return get_type("b32");
+	if(op >= MODDW && op <= SHRQW)
+		return get_type((op - MODDW) % 2 == 0 ? "i32" : "i64");
+	static char *arithmetic[] = {"i32", "i64", "f32", "f64"};
+	return get_type(arithmetic[(op - ADDDW) % 4]);
+}
+
+static const Type_Info *get_load_type(OP load)
+{
+	static char *types[] = {"i8", "i16", "i32", "i64", "f32", "f64"};
+	return get_type(types[load - LOADB]);
+}
+
+static int get_narrow_width(OP load)
+{
+	switch(load)
+	{
+		case LOADB:  return 8;
+		case LOADW:  return 16;
+		case LOADDW: return 32;
+		default:     return 64;
+	}
+}
+
+static int add_value(IR_Function *ir, int block, IR_Kind kind, OP op, const Type_Info *type, u64 imm)
+{
+	IR_Value value = {.kind = kind, .op = op, .type = type, .block = block, .imm = imm};
+	arrput(ir->values, value);
+	int id = arrlen(ir->values) - 1;
+	arrput(ir->blocks[block].values, id);
+	return id;
+}
+
+static void add_arg(IR_Function *ir, int value, int arg)
+{
+	arrput(ir->values[value].args, arg);
+}
+
+// Moves a value that's already in a block to just before the entry's terminator
+static void move_to_entry(IR_Function *ir, int id)
+{
+	IR_Block *from = &ir->blocks[ir->values[id].block];
+	for(int i = 0; i < arrlen(from->values); ++i)
+	{
+		if(from->values[i] == id)
+		{
+			arrdel(from->values, i);
+			break;
+		}
+	}
+	IR_Block *entry = &ir->blocks[0];
+	arrins(entry->values, arrlen(entry->values) - 1, id);
+	ir->values[id].block = 0;
+}
+
+static int get_terminator(IR_Function *ir, int block)
+{
+	IR_Block *b = &ir->blocks[block];
+	return b->values[arrlen(b->values) - 1];
+}
+
+// A block is in its successor's preds once per edge, occurrence picks between
+// the two edges of a branch with the same block on both sides
+static int find_pred_index(IR_Function *ir, int block, int pred, int occurrence)
+{
+	IR_Block *b = &ir->blocks[block];
+	for(int i = 0; i < arrlen(b->preds); ++i)
+	{
+		if(b->preds[i] == pred && occurrence-- == 0)
+			return i;
+	}
+	assert(false);
+	return -1;
+}
+
+static int get_edge_pred_index(IR_Function *ir, int block, int succ)
+{
+	IR_Block *b = &ir->blocks[block];
+	int occurrence = succ == 1 && b->succs[0] == b->succs[1];
+	return find_pred_index(ir, b->succs[succ], block, occurrence);
+}
+
+static void remove_pred(IR_Function *ir, int block, int index)
+{
+	IR_Block *b = &ir->blocks[block];
+	arrdel(b->preds, index);
+	for(int i = 0; i < arrlen(b->values); ++i)
+	{
+		IR_Value *value = &ir->values[b->values[i]];
+		if(value->kind == IR_PHI)
+			arrdel(value->args, index);
+	}
+}
+
+// Drops dead values out of the blocks' lists
+static void compact_blocks(IR_Function *ir)
+{
+	for(int b = 0; b < arrlen(ir->blocks); ++b)
+	{
+		IR_Block *block = &ir->blocks[b];
+		int kept = 0;
+		for(int i = 0; i < arrlen(block->values); ++i)
+		{
+			if(!ir->values[block->values[i]].dead)
+				block->values[kept++] = block->values[i];
+		}
+		arrsetlen(block->values, kept);
+	}
+}
+
+static int resolve(int *replace, int id)
+{
+	while(replace[id] != -1)
+		id = replace[id];
+	return id;
+}
+
+// replace[id] is what the value turns into, or -1 to keep it. The replaced
+// values are dropped, everything that used them uses the replacement
+static void apply_replacements(IR_Function *ir, int *replace)
+{
+	for(int i = 0; i < arrlen(ir->values); ++i)
+	{
+		IR_Value *value = &ir->values[i];
+		if(replace[i] != -1)
+		{
+			value->dead = true;
+			continue;
+		}
+		for(int a = 0; a < arrlen(value->args); ++a)
+			value->args[a] = resolve(replace, value->args[a]);
+	}
+	compact_blocks(ir);
+}
+
+static int *make_replacements(IR_Function *ir)
+{
+	int *replace = NULL;
+	arrsetlen(replace, arrlen(ir->values));
+	for(int i = 0; i < arrlen(replace); ++i)
+		replace[i] = -1;
+	return replace;
+}
+
+static void kill_block(IR_Function *ir, int block)
+{
+	IR_Block *b = &ir->blocks[block];
+	// Second edge first, its occurrence in the successor's preds is found by position
+	for(int s = b->succ_count - 1; s >= 0; --s)
+	{
+		int pred_index = get_edge_pred_index(ir, block, s);
+		remove_pred(ir, b->succs[s], pred_index);
+	}
+	for(int i = 0; i < arrlen(b->values); ++i)
+		ir->values[b->values[i]].dead = true;
+	arrsetlen(b->values, 0);
+	b->succ_count = 0;
+	b->dead = true;
+}
+
+int count_ir_instructions(IR_Function *ir)
+{
+	int count = 0;
+	for(int b = 0; b < arrlen(ir->blocks); ++b)
+	{
+		if(!ir->blocks[b].dead)
+			count += arrlen(ir->blocks[b].values);
+	}
+	return count;
+}
+
+// ---------------------------------------------------------------------------
+// Construction, with the algorithm from "Simple and Efficient Construction of
+// Static Single Assignment Form" (Braun et al.). Blocks are filled in code
+// order and a block is sealed once all of its preds are filled, reads in a
+// block that isn't sealed yet get a phi that's completed when it is
+// ---------------------------------------------------------------------------
+
+typedef struct
+{
+	IR_Function *ir;
+	int slot_count;     // variables below this are frame slots, the rest operand stack depths
+	int variable_count;
+	int *defs;          // [block * variable_count + variable], -1 if the block doesn't define it
+	b32 *sealed;
+	b32 *filled;
+	int **incomplete;   // per block, phis that get their arguments when it's sealed
+} IR_Builder;
+
+static int read_variable(IR_Builder *builder, int block, int variable);
+
+static void write_variable(IR_Builder *builder, int block, int variable, int value)
+{
+	builder->defs[block * builder->variable_count + variable] = value;
+}
+
+static int add_phi(IR_Builder *builder, int block, int variable)
+{
+	IR_Function *ir = builder->ir;
+	IR_Value phi = {.kind = IR_PHI, .type = get_type("i64"), .block = block, .imm = variable};
+	arrput(ir->values, phi);
+	int id = arrlen(ir->values) - 1;
+
+	IR_Block *b = &ir->blocks[block];
+	int at = 0;
+	while(at < arrlen(b->values) && ir->values[b->values[at]].kind == IR_PHI)
+		at++;
+	arrins(b->values, at, id);
+	return id;
+}
+
+static void add_phi_operands(IR_Builder *builder, int phi)
+{
+	IR_Function *ir = builder->ir;
+	int block = ir->values[phi].block;
+	int variable = (int)ir->values[phi].imm;
+	for(int i = 0; i < arrlen(ir->blocks[block].preds); ++i)
+	{
+		int value = read_variable(builder, ir->blocks[block].preds[i], variable);
+		add_arg(ir, phi, value);
+	}
+}
+
+static int read_variable(IR_Builder *builder, int block, int variable)
+{
+	int def = builder->defs[block * builder->variable_count + variable];
+	if(def != -1)
+		return def;
+
+	IR_Function *ir = builder->ir;
+	int value;
+	if(!builder->sealed[block])
+	{
+		value = add_phi(builder, block, variable);
+		arrput(builder->incomplete[block], value);
+	}
+	else if(arrlen(ir->blocks[block].preds) == 1)
+	{
+		value = read_variable(builder, ir->blocks[block].preds[0], variable);
+	}
+	else
+	{
+		// Written before the operands are read so a loop back to here finds it
+		value = add_phi(builder, block, variable);
+		write_variable(builder, block, variable, value);
+		add_phi_operands(builder, value);
+	}
+	write_variable(builder, block, variable, value);
+	return value;
+}
+
+static void seal_block(IR_Builder *builder, int block)
+{
+	for(int i = 0; i < arrlen(builder->incomplete[block]); ++i)
+		add_phi_operands(builder, builder->incomplete[block][i]);
+	arrfree(builder->incomplete[block]);
+	builder->sealed[block] = true;
+}
+
+static void seal_ready_successors(IR_Builder *builder, int block)
+{
+	IR_Function *ir = builder->ir;
+	IR_Block *b = &ir->blocks[block];
+	for(int s = 0; s < b->succ_count; ++s)
+	{
+		int succ = b->succs[s];
+		if(builder->sealed[succ])
+			continue;
+		b32 ready = true;
+		for(int p = 0; p < arrlen(ir->blocks[succ].preds); ++p)
+			ready = ready && builder->filled[ir->blocks[succ].preds[p]];
+		if(ready)
+			seal_block(builder, succ);
+	}
+}
+
+static b32 is_narrowed(IR_Function *ir, int id, OP load, int depth)
+{
+	IR_Value *value = &ir->values[id];
+	switch(value->kind)
+	{
+		case IR_CONST:
+		{
+			return narrow_cell(value->imm, load) == value->imm;
+		} break;
+		case IR_NARROW:
+		{
+			if(load == LOADF || value->op == LOADF)
+				return load == value->op;
+			return get_narrow_width(value->op) <= get_narrow_width(load);
+		} break;
+		case IR_BINARY:
+		{
+			// Comparisons give 0 or 1, DW ops sign extend and F ops zero extend
+			if(is_compare_op(value->op))
+				return true;
+			if(load == LOADDW)
+				return (value->op >= ADDDW && value->op <= DIVD && (value->op - ADDDW) % 4 == 0) ||
+					(value->op >= MODDW && value->op <= SHRQW && (value->op - MODDW) % 2 == 0);
+			if(load == LOADF)
+				return value->op >= ADDDW && value->op <= DIVD && (value->op - ADDDW) % 4 == 2;
+			return false;
+		} break;
+		case IR_PHI:
+		{
+			if(depth <= 0)
+				return false;
+			for(int i = 0; i < arrlen(value->args); ++i)
+			{
+				if(value->args[i] != id && !is_narrowed(ir, value->args[i], load, depth - 1))
+					return false;
+			}
+			return true;
+		} break;
+		default: return false;
+	}
+}
+
+static int add_narrow(IR_Function *ir, int block, int id, OP load)
+{
+	if(load == LOADQW || load == LOADD || is_narrowed(ir, id, load, 0))
+		return id;
+	if(ir->values[id].kind == IR_CONST)
+		return add_value(ir, block, IR_CONST, NOP, get_load_type(load), narrow_cell(ir->values[id].imm, load));
+	int result = add_value(ir, block, IR_NARROW, load, get_load_type(load), 0);
+	add_arg(ir, result, id);
+	return result;
+}
+
+static int add_binary(IR_Function *ir, int block, OP op, int a, int b)
+{
+	int result = add_value(ir, block, IR_BINARY, op, get_op_type(op), 0);
+	add_arg(ir, result, a);
+	add_arg(ir, result, b);
+	return result;
+}
+
+// Phis that only merge one value (or themselves) are that value
+static b32 remove_trivial_phis(IR_Function *ir)
+{
+	b32 removed_any = false;
+	b32 changed = true;
+	while(changed)
+	{
+		changed = false;
+		int *replace = make_replacements(ir);
+		for(int i = 0; i < arrlen(ir->values); ++i)
+		{
+			IR_Value *value = &ir->values[i];
+			if(value->dead || value->kind != IR_PHI)
+				continue;
+			int same = -1;
+			b32 trivial = true;
+			for(int a = 0; a < arrlen(value->args); ++a)
+			{
+				int arg = resolve(replace, value->args[a]);
+				if(arg == i || arg == same)
+					continue;
+				if(same != -1)
+				{
+					trivial = false;
+					break;
+				}
+				same = arg;
+			}
+			// A phi of nothing but itself is in code that can't be reached
+			// from the entry, it never gets used
+			if(trivial && same != -1)
+			{
+				replace[i] = same;
+				changed = true;
+			}
+		}
+		if(changed)
+		{
+			apply_replacements(ir, replace);
+			removed_any = true;
+		}
+		arrfree(replace);
+	}
+	return removed_any;
+}
+
+b32 build_ir(Function *fn, IR_Function *ir)
+{
+	*ir = (IR_Function){.fn = fn};
+	Bytecode *code = &fn->code;
+	int max_depth;
+	int *depths = compute_stack_depths(code, &max_depth);
+	b32 *targets = find_jump_targets(code);
+
+	// Block 0 is an empty entry that jumps to the first block of code, that
+	// one can be a jump target and the entry can't
+	int *block_at = alloc_temp_memory(sizeof(int) * (code->i + 1));
+	for(int i = 0; i <= code->i; ++i)
+		block_at[i] = -1;
+	IR_Block entry = {.offset = -1, .succ_count = 1, .succs = {1}};
+	arrput(ir->blocks, entry);
+	b32 starts_block = true;
+	for(int at = 0; at < code->i; at += get_instruction_size(code->bytecode + at))
+	{
+		if(starts_block || targets[at])
+		{
+			IR_Block block = {.offset = at, .dead = depths[at] == -1};
+			block_at[at] = arrlen(ir->blocks);
+			arrput(ir->blocks, block);
+		}
+		OP op = code->bytecode[at];
+		// Blocks have at most two successors, jump tables are left to the stack code
+		if(op == SWITCH)
+			return false;
+		starts_block = is_jump(op) || op == RET;
+	}
+
+	// Successors, then preds from the blocks that can be reached
+	for(int b = 1; b < arrlen(ir->blocks); ++b)
+	{
+		IR_Block *block = &ir->blocks[b];
+		int end = b + 1 < arrlen(ir->blocks) ? ir->blocks[b + 1].offset : code->i;
+		int last = block->offset;
+		for(int at = block->offset; at < end; at += get_instruction_size(code->bytecode + at))
+			last = at;
+		OP op = code->bytecode[last];
+		if(block->dead)
+			continue;
+		if(op == JMP)
+		{
+			block->succs[block->succ_count++] = block_at[read_dword(code->bytecode + last + 1)];
+		}
+		else if(op != RET)
+		{
+			// Falling off the end of the code only happens with a RET last
+			if(end >= code->i)
+				return false;
+			block->succs[block->succ_count++] = block_at[end];
+			if(is_jump(op))
+				block->succs[block->succ_count++] = block_at[read_dword(code->bytecode + last + 1)];
+			// A branch goes to its first successor for anything but 0, the
+			// ones that jump for that have the target first
+			b32 jumps_if = false;
+			if(op == JNZ || op == LOOPQW_LI || op == LOOPQW_LL ||
+					(get_branch_compare(op, &jumps_if) != NOP && jumps_if))
+			{
+				int fallthrough = block->succs[0];
+				block->succs[0] = block->succs[1];
+				block->succs[1] = fallthrough;
+			}
+		}
+	}
+	for(int b = 0; b < arrlen(ir->blocks); ++b)
+	{
+		IR_Block *block = &ir->blocks[b];
+		if(block->dead)
+			continue;
+		for(int s = 0; s < block->succ_count; ++s)
+			arrput(ir->blocks[block->succs[s]].preds, b);
+	}
+
+	int block_count = arrlen(ir->blocks);
+	IR_Builder builder = {.ir = ir, .slot_count = fn->frame_size};
+	builder.variable_count = fn->frame_size + max_depth;
+	builder.defs = NULL;
+	arrsetlen(builder.defs, block_count * builder.variable_count);
+	for(int i = 0; i < arrlen(builder.defs); ++i)
+		builder.defs[i] = -1;
+	builder.sealed = alloc_temp_memory(sizeof(b32) * block_count);
+	builder.filled = alloc_temp_memory(sizeof(b32) * block_count);
+	builder.incomplete = alloc_temp_memory(sizeof(int *) * block_count);
+	memset(builder.sealed, 0, sizeof(b32) * block_count);
+	memset(builder.filled, 0, sizeof(b32) * block_count);
+	memset(builder.incomplete, 0, sizeof(int *) * block_count);
+
+	// Arguments are in the first slots, the rest of the frame is whatever was there
+	int undef = add_value(ir, 0, IR_UNDEF, NOP, get_type("i64"), 0);
+	for(int slot = 0; slot < fn->frame_size; ++slot)
+	{
+		int value = undef;
+		if(slot < fn->arg_count)
+			value = add_value(ir, 0, IR_PARAM, NOP, get_type("i64"), slot);
+		write_variable(&builder, 0, slot, value);
+	}
+	add_value(ir, 0, IR_JUMP, NOP, NULL, 0);
+	builder.sealed[0] = true;
+	builder.filled[0] = true;
+	seal_ready_successors(&builder, 0);
+
+	b32 ok = true;
+	int *stack = NULL;
+	for(int b = 1; b < block_count && ok; ++b)
+	{
+		IR_Block *block = &ir->blocks[b];
+		if(block->dead)
+			continue;
+		int start = block->offset;
+		int end = b + 1 < block_count ? ir->blocks[b + 1].offset : code->i;
+
+		arrsetlen(stack, 0);
+		for(int i = 0; i < depths[start]; ++i)
+			arrput(stack, read_variable(&builder, b, builder.slot_count + i));
+
+		b32 terminated = false;
+		for(int at = start; at < end && ok; at += get_instruction_size(code->bytecode + at))
+		{
+			u8 *ip = code->bytecode + at;
+			OP op = ip[0];
+			if(is_jump(op) || op == RET)
+			{
+				int cond = op == JZ || op == JNZ ? arrpop(stack) : -1;
+				b32 jumps_if;
+				OP compare = get_branch_compare(op, &jumps_if);
+				if(compare != NOP)
+				{
+					int right = arrpop(stack);
+					int left = arrpop(stack);
+					cond = add_binary(ir, b, compare, left, right);
+				}
+				if(op == LOOPQW_LI || op == LOOPQW_LL)
+				{
+					int slot = read_word(ip + 5);
+					int step = add_value(ir, b, IR_CONST, NOP, get_type("i64"), (u64)(i64)(i32)read_dword(ip + 7));
+					int next = add_binary(ir, b, ADDQW, read_variable(&builder, b, slot), step);
+					write_variable(&builder, b, slot, next);
+					int limit = op == LOOPQW_LL ? read_variable(&builder, b, read_word(ip + 11)) :
+						add_value(ir, b, IR_CONST, NOP, get_type("i64"), (u64)(i64)(i32)read_dword(ip + 11));
+					cond = add_binary(ir, b, LTQW, next, limit);
+				}
+				int value = op == RET && ip[1] ? arrpop(stack) : -1;
+				for(int i = 0; i < arrlen(stack); ++i)
+					write_variable(&builder, b, builder.slot_count + i, stack[i]);
+				IR_Kind kind = op == JMP ? IR_JUMP : op == RET ? IR_RET : IR_BRANCH;
+				int terminator = add_value(ir, b, kind, NOP, NULL, 0);
+				if(cond != -1)
+					add_arg(ir, terminator, cond);
+				if(value != -1)
+					add_arg(ir, terminator, value);
+				terminated = true;
+				continue;
+			}
+
+			if(op >= LOADB && op <= LOADD)
+			{
+				int value = read_variable(&builder, b, read_word(ip + 1));
+				arrput(stack, add_narrow(ir, b, value, op));
+			}
+			else if(op >= STOREB && op <= STORED)
+			{
+				int value = add_narrow(ir, b, arrpop(stack), LOADB + (op - STOREB));
+				write_variable(&builder, b, read_word(ip + 1), value);
+			}
+			else if(op >= TEEB && op <= TEED)
+			{
+				int value = add_narrow(ir, b, arrpop(stack), LOADB + (op - TEEB));
+				write_variable(&builder, b, read_word(ip + 1), value);
+				arrput(stack, value);
+			}
+			else if(op >= PUSHB && op <= PUSHD)
+			{
+				u64 cell;
+				const Type_Info *type = get_type("i64");
+				switch(op)
+				{
+					case PUSHB:  cell = (u64)(i64)(i8)ip[1]; break;
+					case PUSHW:  cell = (u64)(i64)(i16)read_word(ip + 1); break;
+					case PUSHDW: cell = (u64)(i64)(i32)read_dword(ip + 1); break;
+					case PUSHF:  cell = read_dword(ip + 1); type = get_type("f32"); break;
+					case PUSHD:  cell = read_qword(ip + 1); type = get_type("f64"); break;
+					default:     cell = read_qword(ip + 1); break;
+				}
+				arrput(stack, add_value(ir, b, IR_CONST, NOP, type, cell));
+			}
+			else if(op >= ADDDW && op <= GED)
+			{
+				int right = arrpop(stack);
+				int left = arrpop(stack);
+				arrput(stack, add_binary(ir, b, op, left, right));
+			}
+			else if(op >= ADDQW_LL && op <= MULQW_LL)
+			{
+				int left = read_variable(&builder, b, read_word(ip + 1));
+				int right = read_variable(&builder, b, read_word(ip + 3));
+				arrput(stack, add_binary(ir, b, get_superinstruction_base(op), left, right));
+			}
+			else if(op >= ADDQW_LI && op <= GEQW_LI)
+			{
+				int left = read_variable(&builder, b, read_word(ip + 1));
+				int right = add_value(ir, b, IR_CONST, NOP, get_type("i64"), (u64)(i64)(i32)read_dword(ip + 3));
+				arrput(stack, add_binary(ir, b, get_superinstruction_base(op), left, right));
+			}
+			else
+			{
+				switch(op)
+				{
+					case NOP: break;
+					case POP:
+					{
+						(void)arrpop(stack);
+					} break;
+					case NARROWB:
+					case NARROWW:
+					{
+						int value = add_narrow(ir, b, arrpop(stack), LOADB + (op - NARROWB));
+						arrput(stack, value);
+					} break;
+					case GLOAD:
+					{
+						arrput(stack, add_value(ir, b, IR_GLOAD, NOP, get_type("i64"), read_word(ip + 1)));
+					} break;
+					case GSTORE:
+					{
+						int value = add_value(ir, b, IR_GSTORE, NOP, NULL, read_word(ip + 1));
+						add_arg(ir, value, arrpop(stack));
+					} break;
+					case PUSHS:
+					{
+						arrput(stack, add_value(ir, b, IR_STRING, NOP, get_type("string"), read_dword(ip + 1)));
+					} break;
+					case CALL:
+					case CALLI:
+					case TAILCALL:
+					{
+						int arg_count;
+						b32 returns;
+						u32 index = 0;
+						if(op != CALLI)
+						{
+							index = read_dword(ip + 1);
+							arg_count = functions[index].arg_count;
+							returns = functions[index].ret != NULL;
+						}
+						else
+						{
+							arg_count = ip[1];
+							returns = ip[2];
+						}
+						const Type_Info *type = NULL;
+						if(returns)
+							type = op != CALLI ? functions[index].ret : get_type("i64");
+						int value = add_value(ir, b, op != CALLI ? IR_CALL : IR_CALLI, op != CALLI ? op : NOP,
+								type, op != CALLI ? index : (u64)returns);
+						// Arguments in push order, CALLI's function is on top of them
+						int popped = arg_count + (op == CALLI);
+						for(int i = arrlen(stack) - popped; i < arrlen(stack); ++i)
+							add_arg(ir, value, stack[i]);
+						arrsetlen(stack, arrlen(stack) - popped);
+						if(returns)
+							arrput(stack, value);
+					} break;
+					default:
+					{
+						ok = false;
+					} break;
+				}
+			}
+		}
+
+		if(!terminated && ok)
+		{
+			for(int i = 0; i < arrlen(stack); ++i)
+				write_variable(&builder, b, builder.slot_count + i, stack[i]);
+			add_value(ir, b, IR_JUMP, NOP, NULL, 0);
+		}
+		builder.filled[b] = true;
+		seal_ready_successors(&builder, b);
+	}
+
+	for(int b = 0; b < block_count; ++b)
+		arrfree(builder.incomplete[b]);
+	arrfree(builder.defs);
+	arrfree(stack);
+	if(!ok)
+		return false;
+
+	// Dead blocks don't take part in anything from here on
+	for(int b = 0; b < block_count; ++b)
+	{
+		if(ir->blocks[b].dead)
+			ir->blocks[b].succ_count = 0;
+	}
+	remove_trivial_phis(ir);
+	for(int i = 0; i < arrlen(ir->values); ++i)
+	{
+		IR_Value *value = &ir->values[i];
+		if(value->dead || value->kind != IR_PHI)
+			continue;
+		for(int a = 0; a < arrlen(value->args); ++a)
+		{
+			if(value->args[a] != i && ir->values[value->args[a]].type)
+			{
+				value->type = ir->values[value->args[a]].type;
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+// Dead code elimination, everything that doesn't feed a side effect goes
+// ---------------------------------------------------------------------------
+
+b32 ir_dce(IR_Function *ir)
+{
+	int count = arrlen(ir->values);
+	b32 *live = alloc_temp_memory(sizeof(b32) * count);
+	memset(live, 0, sizeof(b32) * count);
+	int *work = NULL;
+	for(int b = 0; b < arrlen(ir->blocks); ++b)
+	{
+		IR_Block *block = &ir->blocks[b];
+		for(int i = 0; i < arrlen(block->values) && !block->dead; ++i)
+		{
+			int id = block->values[i];
+			if(has_side_effects(ir, &ir->values[id]))
+			{
+				live[id] = true;
+				arrput(work, id);
+			}
+		}
+	}
+	while(arrlen(work) > 0)
+	{
+		IR_Value *value = &ir->values[arrpop(work)];
+		for(int a = 0; a < arrlen(value->args); ++a)
+		{
+			int arg = value->args[a];
+			if(!live[arg])
+			{
+				live[arg] = true;
+				arrput(work, arg);
+			}
+		}
+	}
+	arrfree(work);
+
+	b32 changed = false;
+	for(int b = 0; b < arrlen(ir->blocks); ++b)
+	{
+		IR_Block *block = &ir->blocks[b];
+		for(int i = 0; i < arrlen(block->values); ++i)
+		{
+			int id = block->values[i];
+			if(!live[id])
+			{
+				ir->values[id].dead = true;
+				changed = true;
+			}
+		}
+	}
+	if(changed)
+		compact_blocks(ir);
+	return changed;
+}
+
+// ---------------------------------------------------------------------------
+// Sparse conditional constant propagation (Wegman and Zadeck). Values start
+// out unknown and only ever go down to a constant and then to overdefined,
+// blocks and edges are only looked at once something shows they can run
+// ---------------------------------------------------------------------------
+
+typedef enum
+{
+	LATTICE_TOP,      // nothing known yet
+	LATTICE_CONST,
+	LATTICE_BOTTOM,   // more than one value
+} Lattice_State;
+
+typedef struct
+{
+	IR_Function *ir;
+	u8 *state;
+	u64 *constant;
+	int **users;       // per value, stb_ds
+	b32 *executable;   // per block
+	int *edge_base;    // per block, where its preds start in edge_executable
+	b32 *edge_executable;
+	int *flow;         // pairs of block, pred index
+	int *ssa;
+} SCCP;
+
+// @NOTE: folds a binary op on two cells the way the VM would compute it,
+// false if it has to be left for the VM (integer division by zero)
+b32 fold_cells(OP op, u64 a, u64 b, u64 *result)
+{
+	b32 is_float = (op >= ADDDW && op <= DIVD && (op - ADDDW) % 4 >= 2) ||
+		(is_compare_op(op) && (op - EQDW) % 4 >= 2);
+	if(is_float)
+	{
+		// The VM keeps f32 in the low bits of the cell and f64 as the whole cell
+		b32 single = (op - (is_compare_op(op) ? EQDW : ADDDW)) % 4 == 2;
+		f64 left, right;
+		if(single)
+		{
+			f32 l, r;
+			u32 lb = (u32)a, rb = (u32)b;
+			memcpy(&l, &lb, 4);
+			memcpy(&r, &rb, 4);
+			left = l;
+			right = r;
+		}
+		else
+		{
+			memcpy(&left, &a, 8);
+			memcpy(&right, &b, 8);
+		}
+		u64 folded;
+		if(!fold_float_op(op, left, right, &folded))
+			return false;
+		if(single && !is_compare_op(op))
+		{
+			f64 wide;
+			memcpy(&wide, &folded, 8);
+			f32 narrow = (f32)wide;
+			u32 bits;
+			memcpy(&bits, &narrow, 4);
+			folded = bits;
+		}
+		*result = folded;
+		return true;
+	}
+
+	i64 folded;
+	if(!fold_int_op(op, (i64)a, (i64)b, &folded))
+		return false;
+	*result = (u64)folded;
+	return true;
+}
+
+static b32 fold_value(SCCP *sccp, IR_Value *value, u64 *result)
+{
+	if(value->kind == IR_NARROW)
+	{
+		*result = narrow_cell(sccp->constant[value->args[0]], value->op);
+		return true;
+	}
+	return fold_cells(value->op, sccp->constant[value->args[0]], sccp->constant[value->args[1]], result);
+}
+
+static void mark_edge(SCCP *sccp, int block, int succ)
+{
+	int target = sccp->ir->blocks[block].succs[succ];
+	int pred_index = get_edge_pred_index(sccp->ir, block, succ);
+	arrput(sccp->flow, target);
+	arrput(sccp->flow, pred_index);
+}
+
+static void visit_value(SCCP *sccp, int id)
+{
+	IR_Function *ir = sccp->ir;
+	IR_Value *value = &ir->values[id];
+	u8 state = LATTICE_BOTTOM;
+	u64 constant = 0;
+	switch(value->kind)
+	{
+		case IR_CONST:
+		{
+			state = LATTICE_CONST;
+			constant = value->imm;
+		} break;
+		case IR_PHI:
+		{
+			state = LATTICE_TOP;
+			int base = sccp->edge_base[value->block];
+			for(int a = 0; a < arrlen(value->args) && state != LATTICE_BOTTOM; ++a)
+			{
+				if(!sccp->edge_executable[base + a])
+					continue;
+				int arg = value->args[a];
+				u8 arg_state = sccp->state[arg];
+				if(arg_state == LATTICE_TOP)
+					continue;
+				if(arg_state == LATTICE_BOTTOM || (state == LATTICE_CONST && constant != sccp->constant[arg]))
+				{
+					state = LATTICE_BOTTOM;
+				}
+				else
+				{
+					state = LATTICE_CONST;
+					constant = sccp->constant[arg];
+				}
+			}
+		} break;
+		case IR_BINARY:
+		case IR_NARROW:
+		{
+			state = LATTICE_CONST;
+			for(int a = 0; a < arrlen(value->args); ++a)
+			{
+				u8 arg_state = sccp->state[value->args[a]];
+				if(arg_state == LATTICE_BOTTOM)
+					state = LATTICE_BOTTOM;
+				else if(arg_state == LATTICE_TOP && state != LATTICE_BOTTOM)
+					state = LATTICE_TOP;
+			}
+			if(state == LATTICE_CONST && !fold_value(sccp, value, &constant))
+				state = LATTICE_BOTTOM;
+		} break;
+		case IR_JUMP:
+		{
+			mark_edge(sccp, value->block, 0);
+			return;
+		} break;
+		case IR_BRANCH:
+		{
+			u8 cond = sccp->state[value->args[0]];
+			if(cond == LATTICE_BOTTOM)
+			{
+				mark_edge(sccp, value->block, 0);
+				mark_edge(sccp, value->block, 1);
+			}
+			else if(cond == LATTICE_CONST)
+			{
+				mark_edge(sccp, value->block, sccp->constant[value->args[0]] != 0 ? 0 : 1);
+			}
+			return;
+		} break;
+		default: break;
+	}
+
+	if(state == sccp->state[id] && (state != LATTICE_CONST || constant == sccp->constant[id]))
+		return;
+	sccp->state[id] = state;
+	sccp->constant[id] = constant;
+	for(int u = 0; u < arrlen(sccp->users[id]); ++u)
+		arrput(sccp->ssa, sccp->users[id][u]);
+}
+
+b32 ir_sccp(IR_Function *ir)
+{
+	int value_count = arrlen(ir->values);
+	int block_count = arrlen(ir->blocks);
+	SCCP sccp = {.ir = ir};
+	sccp.state = alloc_temp_memory(value_count);
+	sccp.constant = alloc_temp_memory(sizeof(u64) * value_count);
+	sccp.users = alloc_temp_memory(sizeof(int *) * value_count);
+	sccp.executable = alloc_temp_memory(sizeof(b32) * block_count);
+	sccp.edge_base = alloc_temp_memory(sizeof(int) * block_count);
+	memset(sccp.state, LATTICE_TOP, value_count);
+	memset(sccp.users, 0, sizeof(int *) * value_count);
+	memset(sccp.executable, 0, sizeof(b32) * block_count);
+
+	int edge_count = 0;
+	for(int b = 0; b < block_count; ++b)
+	{
+		sccp.edge_base[b] = edge_count;
+		edge_count += arrlen(ir->blocks[b].preds);
+		for(int i = 0; i < arrlen(ir->blocks[b].values); ++i)
+		{
+			int id = ir->blocks[b].values[i];
+			for(int a = 0; a < arrlen(ir->values[id].args); ++a)
+				arrput(sccp.users[ir->values[id].args[a]], id);
+		}
+	}
+	sccp.edge_executable = alloc_temp_memory(sizeof(b32) * (edge_count + 1));
+	memset(sccp.edge_executable, 0, sizeof(b32) * (edge_count + 1));
+
+	sccp.executable[0] = true;
+	for(int i = 0; i < arrlen(ir->blocks[0].values); ++i)
+		visit_value(&sccp, ir->blocks[0].values[i]);
+	while(arrlen(sccp.flow) > 0 || arrlen(sccp.ssa) > 0)
+	{
+		while(arrlen(sccp.flow) > 0)
+		{
+			int pred_index = arrpop(sccp.flow);
+			int block = arrpop(sccp.flow);
+			int edge = sccp.edge_base[block] + pred_index;
+			if(sccp.edge_executable[edge])
+				continue;
+			sccp.edge_executable[edge] = true;
+
+			IR_Block *b = &ir->blocks[block];
+			b32 first_visit = !sccp.executable[block];
+			sccp.executable[block] = true;
+			for(int i = 0; i < arrlen(b->values); ++i)
+			{
+				int id = b->values[i];
+				if(first_visit || ir->values[id].kind == IR_PHI)
+					visit_value(&sccp, id);
+			}
+		}
+		while(arrlen(sccp.ssa) > 0)
+		{
+			int id = arrpop(sccp.ssa);
+			if(sccp.executable[ir->values[id].block])
+				visit_value(&sccp, id);
+		}
+	}
+
+	b32 changed = false;
+	// Blocks nothing can reach go first, then the branches that only go one way
+	for(int b = 1; b < block_count; ++b)
+	{
+		if(!ir->blocks[b].dead && !sccp.executable[b])
+		{
+			kill_block(ir, b);
+			changed = true;
+		}
+	}
+	for(int b = 0; b < block_count; ++b)
+	{
+		IR_Block *block = &ir->blocks[b];
+		if(block->dead)
+			continue;
+		int terminator = get_terminator(ir, b);
+		IR_Value *value = &ir->values[terminator];
+		if(value->kind != IR_BRANCH || sccp.state[value->args[0]] != LATTICE_CONST)
+			continue;
+		int taken = sccp.constant[value->args[0]] != 0 ? 0 : 1;
+		int not_taken = 1 - taken;
+		remove_pred(ir, block->succs[not_taken], get_edge_pred_index(ir, b, not_taken));
+		block->succs[0] = block->succs[taken];
+		block->succ_count = 1;
+		value->kind = IR_JUMP;
+		arrsetlen(value->args, 0);
+		changed = true;
+	}
+
+	// Values that turned out constant become constants, in the entry so they
+	// dominate every use
+	int *constants = NULL;
+	for(int b = 0; b < block_count; ++b)
+	{
+		IR_Block *block = &ir->blocks[b];
+		for(int i = 0; i < arrlen(block->values); ++i)
+		{
+			int id = block->values[i];
+			IR_Value *value = &ir->values[id];
+			if(value->kind != IR_PHI && value->kind != IR_BINARY && value->kind != IR_NARROW)
+				continue;
+			if(sccp.state[id] == LATTICE_CONST)
+				arrput(constants, id);
+		}
+	}
+	for(int i = 0; i < arrlen(constants); ++i)
+	{
+		IR_Value *value = &ir->values[constants[i]];
+		value->kind = IR_CONST;
+		value->imm = sccp.constant[constants[i]];
+		value->op = NOP;
+		arrsetlen(value->args, 0);
+		move_to_entry(ir, constants[i]);
+		changed = true;
+	}
+	arrfree(constants);
+
+	for(int i = 0; i < value_count; ++i)
+		arrfree(sccp.users[i]);
+	arrfree(sccp.flow);
+	arrfree(sccp.ssa);
+	return changed;
+}
+
+// ---------------------------------------------------------------------------
+// Global value numbering over the dominator tree. A pure value that computes
+// the same thing as one in a dominating block is replaced with it
+// ---------------------------------------------------------------------------
+
+// No padding, the table hashes and compares the bytes
+typedef struct
+{
+	int kind;
+	int op;
+	int a;
+	int b;
+	u64 imm;
+} IR_Value_Key;
+
+typedef struct
+{
+	IR_Value_Key key;
+	int value;
+} IR_Value_Table;
+
+// Reverse postorder of the blocks the entry reaches
+static int *get_reverse_postorder(IR_Function *ir)
+{
+	int block_count = arrlen(ir->blocks);
+	b32 *visited = alloc_temp_memory(sizeof(b32) * block_count);
+	memset(visited, 0, sizeof(b32) * block_count);
+	int *order = NULL;
+	int *stack = NULL; // pairs of block, next successor
+	arrput(stack, 0);
+	arrput(stack, 0);
+	visited[0] = true;
+	while(arrlen(stack) > 0)
+	{
+		int top = arrlen(stack) - 2;
+		int block = stack[top];
+		int next = stack[top + 1];
+		if(next < ir->blocks[block].succ_count)
+		{
+			stack[top + 1]++;
+			int succ = ir->blocks[block].succs[next];
+			if(!visited[succ])
+			{
+				visited[succ] = true;
+				arrput(stack, succ);
+				arrput(stack, 0);
+			}
+		}
+		else
+		{
+			arrput(order, block);
+			arrsetlen(stack, top);
+		}
+	}
+	arrfree(stack);
+	for(int i = 0; i < arrlen(order) / 2; ++i)
+	{
+		int swap = order[i];
+		order[i] = order[arrlen(order) - 1 - i];
+		order[arrlen(order) - 1 - i] = swap;
+	}
+	return order;
+}
+
+// "A Simple, Fast Dominance Algorithm" (Cooper, Harvey and Kennedy), gives
+// the immediate dominator of each block or -1 if the entry doesn't reach it
+static int *compute_dominators(IR_Function *ir, int *order)
+{
+	int block_count = arrlen(ir->blocks);
+	int *idom = alloc_temp_memory(sizeof(int) * block_count);
+	int *position = alloc_temp_memory(sizeof(int) * block_count);
+	for(int b = 0; b < block_count; ++b)
+	{
+		idom[b] = -1;
+		position[b] = -1;
+	}
+	for(int i = 0; i < arrlen(order); ++i)
+		position[order[i]] = i;
+
+	idom[0] = 0;
+	b32 changed = true;
+	while(changed)
+	{
+		changed = false;
+		for(int i = 1; i < arrlen(order); ++i)
+		{
+			int block = order[i];
+			int new_idom = -1;
+			for(int p = 0; p < arrlen(ir->blocks[block].preds); ++p)
+			{
+				int pred = ir->blocks[block].preds[p];
+				if(idom[pred] == -1)
+					continue;
+				if(new_idom == -1)
+				{
+					new_idom = pred;
+					continue;
+				}
+				int a = pred, b = new_idom;
+				while(a != b)
+				{
+					while(position[a] > position[b])
+						a = idom[a];
+					while(position[b] > position[a])
+						b = idom[b];
+				}
+				new_idom = a;
+			}
+			if(idom[block] != new_idom)
+			{
+				idom[block] = new_idom;
+				changed = true;
+			}
+		}
+	}
+	return idom;
+}
+
+static b32 is_numberable(IR_Value *value)
+{
+	switch(value->kind)
+	{
+		case IR_CONST:
+		case IR_PARAM:
+		case IR_STRING:
+		case IR_BINARY:
+		case IR_NARROW:
+			return true;
+		default:
+			return false;
+	}
+}
+
+typedef struct
+{
+	IR_Function *ir;
+	IR_Value_Table *table;
+	int **children;
+	int *replace;
+	b32 changed;
+} GVN;
+
+static void number_block(GVN *gvn, int block)
+{
+	IR_Function *ir = gvn->ir;
+	IR_Value_Key *added = NULL;
+	IR_Block *b = &ir->blocks[block];
+	for(int i = 0; i < arrlen(b->values); ++i)
+	{
+		int id = b->values[i];
+		IR_Value *value = &ir->values[id];
+		for(int a = 0; a < arrlen(value->args); ++a)
+			value->args[a] = resolve(gvn->replace, value->args[a]);
+		if(!is_numberable(value))
+			continue;
+
+		// A narrow of something that's already narrow is that something
+		if(value->kind == IR_NARROW && is_narrowed(ir, value->args[0], value->op, 4))
+		{
+			gvn->replace[id] = value->args[0];
+			gvn->changed = true;
+			continue;
+		}
+
+		IR_Value_Key key;
+		memset(&key, 0, sizeof(key));
+		key.kind = value->kind;
+		key.op = value->op;
+		key.imm = value->imm;
+		key.a = arrlen(value->args) > 0 ? value->args[0] : -1;
+		key.b = arrlen(value->args) > 1 ? value->args[1] : -1;
+		if(value->kind == IR_BINARY && is_commutative_op(value->op) && key.a > key.b)
+		{
+			int swap = key.a;
+			key.a = key.b;
+			key.b = swap;
+		}
+		// Constants of different types can share bits, they aren't the same value
+		if(value->kind == IR_CONST)
+			key.a = value->type->type * 256 + value->type->size;
+
+		int found = hmgeti(gvn->table, key);
+		if(found != -1)
+		{
+			gvn->replace[id] = gvn->table[found].value;
+			gvn->changed = true;
+		}
+		else
+		{
+			hmput(gvn->table, key, id);
+			arrput(added, key);
+		}
+	}
+
+	for(int c = 0; c < arrlen(gvn->children[block]); ++c)
+		number_block(gvn, gvn->children[block][c]);
+
+	for(int i = 0; i < arrlen(added); ++i)
+		(void)hmdel(gvn->table, added[i]);
+	arrfree(added);
+}
+
+b32 ir_gvn(IR_Function *ir)
+{
+	int block_count = arrlen(ir->blocks);
+	int *order = get_reverse_postorder(ir);
+	int *idom = compute_dominators(ir, order);
+
+	GVN gvn = {.ir = ir};
+	gvn.children = alloc_temp_memory(sizeof(int *) * block_count);
+	memset(gvn.children, 0, sizeof(int *) * block_count);
+	for(int i = 1; i < arrlen(order); ++i)
+		arrput(gvn.children[idom[order[i]]], order[i]);
+	gvn.replace = make_replacements(ir);
+
+	// Phi arguments come from the end of the preds, a pred that's only
+	// numbered after the phi's block could have replaced them
+	number_block(&gvn, 0);
+	if(gvn.changed)
+		apply_replacements(ir, gvn.replace);
+
+	for(int b = 0; b < block_count; ++b)
+		arrfree(gvn.children[b]);
+	hmfree(gvn.table);
+	arrfree(gvn.replace);
+	arrfree(order);
+	return gvn.changed;
+}
+
+// ---------------------------------------------------------------------------
+// CFG simplification: trivial phis go, branches with the same block on both
+// sides become jumps, blocks nothing reaches are removed, a block that's
+// only reached from a jump is merged into it and empty blocks are skipped
+// ---------------------------------------------------------------------------
+
+static b32 has_phis(IR_Function *ir, int block)
+{
+	IR_Block *b = &ir->blocks[block];
+	return arrlen(b->values) > 0 && ir->values[b->values[0]].kind == IR_PHI;
+}
+
+static void replace_pred(IR_Function *ir, int block, int old_pred, int new_pred)
+{
+	IR_Block *b = &ir->blocks[block];
+	for(int i = 0; i < arrlen(b->preds); ++i)
+	{
+		if(b->preds[i] == old_pred)
+			b->preds[i] = new_pred;
+	}
+}
+
+static b32 simplify_once(IR_Function *ir)
+{
+	b32 changed = remove_trivial_phis(ir);
+	int block_count = arrlen(ir->blocks);
+	for(int b = 0; b < block_count; ++b)
+	{
+		IR_Block *block = &ir->blocks[b];
+		if(block->dead)
+			continue;
+
+		if(b != 0 && arrlen(block->preds) == 0)
+		{
+			kill_block(ir, b);
+			changed = true;
+			continue;
+		}
+
+		IR_Value *terminator = &ir->values[get_terminator(ir, b)];
+		if(terminator->kind == IR_BRANCH && block->succs[0] == block->succs[1])
+		{
+			remove_pred(ir, block->succs[1], find_pred_index(ir, block->succs[1], b, 1));
+			terminator->kind = IR_JUMP;
+			arrsetlen(terminator->args, 0);
+			block->succ_count = 1;
+			changed = true;
+		}
+		if(terminator->kind != IR_JUMP)
+			continue;
+
+		int succ = block->succs[0];
+		IR_Block *next = &ir->blocks[succ];
+		if(succ != b && succ != 0 && arrlen(next->preds) == 1 && !has_phis(ir, succ))
+		{
+			// The jump goes and the successor's code carries on from here
+			terminator->dead = true;
+			arrsetlen(block->values, arrlen(block->values) - 1);
+			for(int i = 0; i < arrlen(next->values); ++i)
+			{
+				arrput(block->values, next->values[i]);
+				ir->values[next->values[i]].block = b;
+			}
+			block->succ_count = next->succ_count;
+			block->succs[0] = next->succs[0];
+			block->succs[1] = next->succs[1];
+			for(int s = 0; s < next->succ_count; ++s)
+			{
+				if(s == 1 && next->succs[1] == next->succs[0])
+					break;
+				replace_pred(ir, next->succs[s], succ, b);
+			}
+			arrsetlen(next->values, 0);
+			arrsetlen(next->preds, 0);
+			next->succ_count = 0;
+			next->dead = true;
+			changed = true;
+			continue;
+		}
+
+		// An empty block that just jumps on, its preds can jump straight there
+		if(b != 0 && arrlen(block->values) == 1 && succ != b && !has_phis(ir, succ))
+		{
+			for(int p = 0; p < arrlen(block->preds); ++p)
+			{
+				int pred = block->preds[p];
+				IR_Block *from = &ir->blocks[pred];
+				for(int s = 0; s < from->succ_count; ++s)
+				{
+					if(from->succs[s] == b)
+					{
+						from->succs[s] = succ;
+						break;
+					}
+				}
+				arrput(ir->blocks[succ].preds, pred);
+			}
+			remove_pred(ir, succ, find_pred_index(ir, succ, b, 0));
+			ir->values[block->values[0]].dead = true;
+			arrsetlen(block->values, 0);
+			arrsetlen(block->preds, 0);
+			block->succ_count = 0;
+			block->dead = true;
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+b32 ir_simplify_cfg(IR_Function *ir)
+{
+	b32 changed = false;
+	while(simplify_once(ir))
+		changed = true;
+	return changed;
+}
+
+// ---------------------------------------------------------------------------
+// Lowering back to stack code. A value that's used once, later in the same
+// block, stays on the operand stack for its user when the order works out,
+// constants, arguments and strings are pushed where they're used and the
+// rest (phis included) get a slot of their own. Phis are filled in on the
+// edges into their block, all sources are pushed before any is stored so
+// phis that read each other get the old values. A branch's zero edge gets
+// its copies after the last block so the edges can't clobber each other
+// ---------------------------------------------------------------------------
+
+typedef struct
+{
+	IR_Function *ir;
+	Bytecode code;
+	int *uses;
+	b32 *on_stack;   // stays on the operand stack for its only user
+	int *slots;      // -1 if the value doesn't have one
+	int slot_count;
+	int scratch;     // for narrowing values that stay on the stack, -1 until needed
+	int *labels;     // per block
+	int *patches;    // pairs of dword offset, block
+	int *edges;      // pairs of JZ target offset, block whose zero edge goes there
+	b32 failed;
+} Lowering;
+
+// How many of the value's first arguments are already on the stack, the rest
+// get pushed by the lowering. Gives -1 if the stack isn't in an order that works
+static int get_stacked_prefix(Lowering *lowering, IR_Value *value, int *stack)
+{
+	int count = arrlen(value->args);
+	int prefix = 0;
+	while(prefix < count && lowering->on_stack[value->args[prefix]])
+		prefix++;
+	for(int a = prefix; a < count; ++a)
+	{
+		if(lowering->on_stack[value->args[a]])
+			return -1;
+	}
+	if(arrlen(stack) < prefix)
+		return -1;
+	for(int a = 0; a < prefix; ++a)
+	{
+		if(stack[arrlen(stack) - prefix + a] != value->args[a])
+			return -1;
+	}
+	return prefix;
+}
+
+// Walks the block like the VM would, values that can't stay on the stack
+// for their user get a slot instead until everything lines up
+static void plan_block(Lowering *lowering, int block)
+{
+	IR_Function *ir = lowering->ir;
+	IR_Block *b = &ir->blocks[block];
+	int *stack = NULL;
+	b32 retry = true;
+	while(retry)
+	{
+		retry = false;
+		arrsetlen(stack, 0);
+		for(int i = 0; i < arrlen(b->values) && !retry; ++i)
+		{
+			int id = b->values[i];
+			IR_Value *value = &ir->values[id];
+			if(value->kind == IR_PHI || is_rematerializable(value))
+				continue;
+			int prefix = get_stacked_prefix(lowering, value, stack);
+			if(prefix == -1)
+			{
+				for(int a = 0; a < arrlen(value->args); ++a)
+					lowering->on_stack[value->args[a]] = false;
+				retry = true;
+				break;
+			}
+			arrsetlen(stack, arrlen(stack) - prefix);
+			if(lowering->on_stack[id])
+				arrput(stack, id);
+		}
+	}
+	assert(arrlen(stack) == 0);
+	arrfree(stack);
+}
+
+static void push_ir_value(Lowering *lowering, int id)
+{
+	IR_Value *value = &lowering->ir->values[id];
+	Bytecode *code = &lowering->code;
+	switch(value->kind)
+	{
+		case IR_CONST:
+		{
+			if(value->type->type == T_FLOAT && value->type->size == 32)
+			{
+				push_byte(PUSHF, code);
+				push_dword((u32)value->imm, code);
+			}
+			else if(value->type->type == T_FLOAT)
+			{
+				push_byte(PUSHD, code);
+				push_qword(value->imm, code);
+			}
+			else
+			{
+				pushop_int(code, (i64)value->imm);
+			}
+		} break;
+		case IR_UNDEF:
+		{
+			pushop_int(code, 0);
+		} break;
+		case IR_PARAM:
+		{
+			// Arguments keep their slots and nothing else is stored there
+			push_byte(LOADQW, code);
+			push_word((u16)value->imm, code);
+		} break;
+		case IR_STRING:
+		{
+			push_byte(PUSHS, code);
+			push_dword((u32)value->imm, code);
+		} break;
+		default:
+		{
+			assert(lowering->slots[id] != -1);
+			push_byte(LOADQW, code);
+			push_word(lowering->slots[id], code);
+		} break;
+	}
+}
+
+static void push_ir_jump(Lowering *lowering, OP op, int block)
+{
+	int at = push_jump(op, &lowering->code);
+	arrput(lowering->patches, at);
+	arrput(lowering->patches, block);
+}
+
+// Sets the phis of the edge's target, a JMP there follows
+static void lower_edge(Lowering *lowering, int block, int succ)
+{
+	IR_Function *ir = lowering->ir;
+	int target = ir->blocks[block].succs[succ];
+	int pred_index = get_edge_pred_index(ir, block, succ);
+	IR_Block *t = &ir->blocks[target];
+	int *copies = NULL;
+	for(int i = 0; i < arrlen(t->values) && ir->values[t->values[i]].kind == IR_PHI; ++i)
+	{
+		int phi = t->values[i];
+		int source = ir->values[phi].args[pred_index];
+		if(source == phi || (!is_rematerializable(&ir->values[source]) &&
+					lowering->slots[source] == lowering->slots[phi]))
+			continue;
+		push_ir_value(lowering, source);
+		arrput(copies, phi);
+	}
+	for(int i = arrlen(copies) - 1; i >= 0; --i)
+	{
+		push_byte(STOREQW, &lowering->code);
+		push_word(lowering->slots[copies[i]], &lowering->code);
+	}
+	arrfree(copies);
+	push_ir_jump(lowering, JMP, target);
+}
+
+static void lower_block(Lowering *lowering, int block)
+{
+	IR_Function *ir = lowering->ir;
+	Bytecode *code = &lowering->code;
+	IR_Block *b = &ir->blocks[block];
+	lowering->labels[block] = code->i;
+	int *stack = NULL;
+	for(int i = 0; i < arrlen(b->values); ++i)
+	{
+		int id = b->values[i];
+		IR_Value *value = &ir->values[id];
+		if(value->kind == IR_PHI || is_rematerializable(value))
+			continue;
+
+		int prefix = get_stacked_prefix(lowering, value, stack);
+		assert(prefix != -1);
+		arrsetlen(stack, arrlen(stack) - prefix);
+		for(int a = prefix; a < arrlen(value->args); ++a)
+			push_ir_value(lowering, value->args[a]);
+
+		b32 stored = false;
+		switch(value->kind)
+		{
+			case IR_BINARY:
+			{
+				push_byte(value->op, code);
+			} break;
+			case IR_NARROW:
+			{
+				// One that stays on the stack is narrowed there if it's a byte or
+				// a word, anything else goes through a scratch slot with a TEE
+				OP store = STOREB + (value->op - LOADB);
+				if(lowering->slots[id] != -1)
+				{
+					push_byte(store, code);
+					push_word(lowering->slots[id], code);
+					stored = true;
+				}
+				else if(value->op == LOADB || value->op == LOADW)
+					push_byte(NARROWB + (value->op - LOADB), code);
+				else
+				{
+					if(lowering->scratch == -1)
+						lowering->scratch = lowering->slot_count++;
+					push_byte(TEEB + (value->op - LOADB), code);
+					push_word(lowering->scratch, code);
+				}
+			} break;
+			case IR_GLOAD:
+			{
+				push_byte(GLOAD, code);
+				push_word((u16)value->imm, code);
+			} break;
+			case IR_GSTORE:
+			{
+				push_byte(GSTORE, code);
+				push_word((u16)value->imm, code);
+			} break;
+			case IR_CALL:
+			{
+				push_byte(value->op, code);
+				push_dword((u32)value->imm, code);
+			} break;
+			case IR_CALLI:
+			{
+				push_byte(CALLI, code);
+				push_byte(arrlen(value->args) - 1, code);
+				push_byte((u8)value->imm, code);
+			} break;
+			case IR_RET:
+			{
+				push_byte(RET, code);
+				push_byte(arrlen(value->args) > 0, code);
+			} break;
+			case IR_JUMP:
+			{
+				lower_edge(lowering, block, 0);
+			} break;
+			case IR_BRANCH:
+			{
+				if(!has_phis(ir, b->succs[1]))
+				{
+					push_ir_jump(lowering, JZ, b->succs[1]);
+					lower_edge(lowering, block, 0);
+				}
+				else
+				{
+					// The copies for the other edge go after all the blocks so
+					// the next block can still be the one that's fallen into
+					arrput(lowering->edges, push_jump(JZ, code));
+					arrput(lowering->edges, block);
+					lower_edge(lowering, block, 0);
+				}
+			} break;
+			default:
+			{
+				lowering->failed = true;
+			} break;
+		}
+
+		if(value->type == NULL || stored)
+			continue;
+		if(lowering->on_stack[id])
+		{
+			arrput(stack, id);
+		}
+		else if(lowering->slots[id] != -1)
+		{
+			push_byte(STOREQW, code);
+			push_word(lowering->slots[id], code);
+		}
+		else
+		{
+			push_byte(POP, code);
+		}
+	}
+	arrfree(stack);
+}
+
+b32 lower_ir(IR_Function *ir, Function *fn)
+{
+	// Everything left is used or has a side effect, the stack plan counts on it
+	ir_dce(ir);
+	int value_count = arrlen(ir->values);
+	int block_count = arrlen(ir->blocks);
+	Lowering lowering = {.ir = ir, .slot_count = fn->arg_count, .scratch = -1};
+	lowering.uses = alloc_temp_memory(sizeof(int) * value_count);
+	lowering.on_stack = alloc_temp_memory(sizeof(b32) * value_count);
+	lowering.slots = alloc_temp_memory(sizeof(int) * value_count);
+	lowering.labels = alloc_temp_memory(sizeof(int) * block_count);
+	int *user_block = alloc_temp_memory(sizeof(int) * value_count);
+	memset(lowering.uses, 0, sizeof(int) * value_count);
+	for(int i = 0; i < value_count; ++i)
+	{
+		lowering.slots[i] = -1;
+		user_block[i] = -1;
+		lowering.on_stack[i] = false;
+	}
+
+	// Phi uses count as being in another block so those never stay on the stack
+	for(int b = 0; b < block_count; ++b)
+	{
+		IR_Block *block = &ir->blocks[b];
+		for(int i = 0; i < arrlen(block->values); ++i)
+		{
+			IR_Value *value = &ir->values[block->values[i]];
+			for(int a = 0; a < arrlen(value->args); ++a)
+			{
+				int arg = value->args[a];
+				lowering.uses[arg]++;
+				user_block[arg] = value->kind == IR_PHI ? -2 : b;
+			}
+		}
+	}
+	for(int b = 0; b < block_count; ++b)
+	{
+		IR_Block *block = &ir->blocks[b];
+		for(int i = 0; i < arrlen(block->values); ++i)
+		{
+			int id = block->values[i];
+			IR_Value *value = &ir->values[id];
+			if(value->type == NULL || is_rematerializable(value))
+				continue;
+			lowering.on_stack[id] = value->kind != IR_PHI && lowering.uses[id] == 1 && user_block[id] == b;
+		}
+	}
+
+	for(int b = 0; b < block_count; ++b)
+	{
+		if(!ir->blocks[b].dead)
+			plan_block(&lowering, b);
+	}
+	int *phi_user = alloc_temp_memory(sizeof(int) * value_count);
+	for(int i = 0; i < value_count; ++i)
+		phi_user[i] = -1;
+	for(int b = 0; b < block_count; ++b)
+	{
+		IR_Block *block = &ir->blocks[b];
+		for(int i = 0; i < arrlen(block->values) && !block->dead; ++i)
+		{
+			int id = block->values[i];
+			IR_Value *value = &ir->values[id];
+			if(value->kind != IR_PHI)
+				continue;
+			lowering.slots[id] = lowering.slot_count++;
+			for(int a = 0; a < arrlen(value->args); ++a)
+				phi_user[value->args[a]] = id;
+		}
+	}
+	for(int b = 0; b < block_count; ++b)
+	{
+		IR_Block *block = &ir->blocks[b];
+		for(int i = 0; i < arrlen(block->values) && !block->dead; ++i)
+		{
+			int id = block->values[i];
+			IR_Value *value = &ir->values[id];
+			if(value->type == NULL || is_rematerializable(value) || lowering.on_stack[id] ||
+					value->kind == IR_PHI || lowering.uses[id] == 0)
+				continue;
+			lowering.slots[id] = lowering.slot_count++;
+
+			// A value that only goes to a phi in the block this one jumps to
+			// can be stored in the phi's slot, as long as nothing after it in
+			// this block still wants the phi's old value
+			int phi = phi_user[id];
+			if(lowering.uses[id] != 1 || phi == -1 || ir->values[phi].block == b ||
+					ir->values[get_terminator(ir, b)].kind != IR_JUMP)
+				continue;
+			b32 phi_used_after = false;
+			for(int j = i + 1; j < arrlen(block->values); ++j)
+			{
+				IR_Value *later = &ir->values[block->values[j]];
+				for(int a = 0; a < arrlen(later->args); ++a)
+					phi_used_after = phi_used_after || later->args[a] == phi;
+			}
+			// The other phis' copies on the edge read the old value too
+			IR_Block *target = &ir->blocks[ir->values[phi].block];
+			int pred_index = get_edge_pred_index(ir, b, 0);
+			for(int j = 0; j < arrlen(target->values); ++j)
+			{
+				IR_Value *other = &ir->values[target->values[j]];
+				if(other->kind == IR_PHI)
+					phi_used_after = phi_used_after || other->args[pred_index] == phi;
+			}
+			if(!phi_used_after)
+			{
+				lowering.slots[id] = lowering.slots[phi];
+				lowering.slot_count--;
+			}
+		}
+	}
+
+	lowering.code = make_bytecode(INITIAL_BYTECODE_SIZE);
+	for(int b = 0; b < block_count && !lowering.failed; ++b)
+	{
+		if(!ir->blocks[b].dead)
+			lower_block(&lowering, b);
+	}
+	for(int i = 0; i < arrlen(lowering.edges); i += 2)
+	{
+		patch_jump_here(lowering.edges[i], &lowering.code);
+		lower_edge(&lowering, lowering.edges[i + 1], 1);
+	}
+	arrfree(lowering.edges);
+	for(int i = 0; i < arrlen(lowering.patches); i += 2)
+		patch_dword(lowering.labels[lowering.patches[i + 1]], lowering.patches[i], &lowering.code);
+	arrfree(lowering.patches);
+
+	// Slots are 16 bits
+	if(lowering.failed || lowering.slot_count > 0xFFFF)
+	{
+		free_bytecode(&lowering.code);
+		return false;
+	}
+	finish_bytecode(&lowering.code);
+	free_bytecode(&fn->code);
+	fn->code = lowering.code;
+	fn->frame_size = lowering.slot_count;
+	fn->max_stack = compute_max_stack(&fn->code);
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+
+void print_ir(IR_Function *ir, FILE *out)
+{
+	fprintf(out, "ssa %s:\n", ir->fn->name);
+	for(int b = 0; b < arrlen(ir->blocks); ++b)
+	{
+		IR_Block *block = &ir->blocks[b];
+		if(block->dead)
+			continue;
+		fprintf(out, "  b%d:", b);
+		if(arrlen(block->preds) > 0)
+		{
+			fprintf(out, " ; preds");
+			for(int p = 0; p < arrlen(block->preds); ++p)
+				fprintf(out, " b%d", block->preds[p]);
+		}
+		fprintf(out, "\n");
+		for(int i = 0; i < arrlen(block->values); ++i)
+		{
+			int id = block->values[i];
+			IR_Value *value = &ir->values[id];
+			fprintf(out, "    ");
+			if(value->type)
+				fprintf(out, "v%d: %s = ", id, value->type->name);
+			fprintf(out, "%s", value->kind == IR_BINARY ? op_info[value->op].name : ir_kind_names[value->kind]);
+			if(value->kind == IR_NARROW)
+				fprintf(out, " %s", op_info[value->op].name);
+			switch(value->kind)
+			{
+				case IR_CONST:  fprintf(out, " %lld", (long long)value->imm); break;
+				case IR_PARAM:
+				case IR_GLOAD:
+				case IR_GSTORE:
+				case IR_STRING: fprintf(out, " %llu", (unsigned long long)value->imm); break;
+				case IR_CALL:   fprintf(out, " %s", functions[value->imm].name); break;
+				default: break;
+			}
+			for(int a = 0; a < arrlen(value->args); ++a)
+			{
+				if(value->kind == IR_PHI)
+					fprintf(out, " [v%d, b%d]", value->args[a], block->preds[a]);
+				else
+					fprintf(out, " v%d", value->args[a]);
+			}
+			for(int s = 0; s < block->succ_count && is_terminator(value->kind); ++s)
+				fprintf(out, " b%d", block->succs[s]);
+			fprintf(out, "\n");
+		}
+	}
+}
+
+void free_ir(IR_Function *ir)
+{
+	for(int i = 0; i < arrlen(ir->values); ++i)
+		arrfree(ir->values[i].args);
+	for(int b = 0; b < arrlen(ir->blocks); ++b)
+	{
+		arrfree(ir->blocks[b].values);
+		arrfree(ir->blocks[b].preds);
+	}
+	arrfree(ir->values);
+	arrfree(ir->blocks);
+}
+
+// @NOTE: builds the SSA form, runs the passes until none of them changes
+// anything (or IR_MAX_ROUNDS) and lowers it back in place of fn's code. If
+// the code has something the IR can't express fn is left as it was
+void optimize_ssa(Function *fn)
+{
+	b32 print = codegen_options.print_optimizations;
+	IR_Function ir;
+	i64 start = VLibClockNs();
+	int frame_before = fn->frame_size;
+	int code_before = count_instructions(&fn->code);
+	if(!build_ir(fn, &ir))
+	{
+		if(print)
+			printf("fn %s: ssa: can't be expressed, left as it is\n", fn->name);
+		free_ir(&ir);
+		return;
+	}
+	i64 build_ns = VLibClockNs() - start;
+	int built = count_ir_instructions(&ir);
+
+	IR_Pass_Stats stats[IR_PASS_COUNT] = {};
+	for(int round = 0; round < IR_MAX_ROUNDS; ++round)
+	{
+		b32 changed = false;
+		for(int p = 0; p < IR_PASS_COUNT; ++p)
+		{
+			int before = count_ir_instructions(&ir);
+			i64 pass_start = VLibClockNs();
+			changed |= ir_passes[p].run(&ir);
+			stats[p].ns += VLibClockNs() - pass_start;
+			stats[p].runs++;
+			stats[p].instructions_removed += before - count_ir_instructions(&ir);
+		}
+		if(!changed)
+			break;
+	}
+	if(codegen_options.dump_ir)
+		print_ir(&ir, stdout);
+
+	b32 lowered = lower_ir(&ir, fn);
+	if(print)
+	{
+		printf("fn %s: ssa built with %d instructions (%.1f us)\n", fn->name, built, build_ns / 1000.0);
+		for(int p = 0; p < IR_PASS_COUNT; ++p)
+			printf("  %-8s %4d instructions removed in %d runs (%.1f us)\n", ir_passes[p].name,
+					stats[p].instructions_removed, stats[p].runs, stats[p].ns / 1000.0);
+		if(lowered)
+			printf("  lowered: %d -> %d instructions, %d -> %d slots\n", code_before,
+					count_instructions(&fn->code), frame_before, fn->frame_size);
+		else
+			printf("  couldn't be lowered, left as it is\n");
+	}
+	free_ir(&ir);
+}
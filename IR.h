@@ -0,0 +1,89 @@
+#ifndef _IR_H
+#define _IR_H
+
+#include "Basic.h"
+#include "Bytecode.h"
+
+// @NOTE: SSA form of a function's stack code. Frame slots and operand stack
+// depths become values, every value is defined once and a block that's
+// reached from more than one place merges them with phis. Values are typed
+// with the width the bytecode computes them at (i32 for the DW ops, b32 for
+// comparisons and so on), raw cells like arguments and globals are i64
+typedef enum
+{
+	IR_CONST,   // imm is the cell, the same bits the push leaves on the stack
+	IR_UNDEF,   // a slot that's read before anything was stored in it
+	IR_PARAM,   // imm is the argument index
+	IR_STRING,  // imm is the string pool index
+	IR_PHI,     // one argument per predecessor, in the order of the block's preds
+	IR_BINARY,  // op is the stack op that computes it, ADDDW through GED
+	IR_NARROW,  // op is the load (LOADB, LOADW, LOADDW or LOADF) that would narrow args[0]
+	IR_GLOAD,   // imm is the global slot
+	IR_GSTORE,  // imm is the global slot, args[0] is stored there
+	IR_CALL,    // imm is the function index, args are the arguments, op is CALL or TAILCALL
+	IR_CALLI,   // args are the arguments then the function, imm says if it returns a value
+
+	// Terminators, every block ends with exactly one
+	IR_JUMP,
+	IR_BRANCH,  // goes to succs[0] if args[0] isn't 0 and to succs[1] if it is
+	IR_RET,     // args[0] is the returned value, if there is one
+
+	IR_KIND_COUNT,
+} IR_Kind;
+
+typedef struct
+{
+	IR_Kind kind;
+	OP op;
+	const Type_Info *type; // NULL if there's no result
+	int block;
+	u64 imm;
+	int *args;             // stb_ds array of value ids
+	b32 dead;
+} IR_Value;
+
+typedef struct
+{
+	int *values;   // stb_ds array of value ids, phis first and the terminator last
+	int *preds;    // stb_ds array of block ids, a block shows up once per edge
+	int succs[2];
+	int succ_count;
+	int offset;    // where the block started in the stack code
+	b32 dead;
+} IR_Block;
+
+typedef struct
+{
+	Function *fn;
+	IR_Value *values; // stb_ds array, a value's id is its index
+	IR_Block *blocks; // stb_ds array, blocks[0] is the entry
+} IR_Function;
+
+typedef struct
+{
+	const char *name;
+	b32 (*run)(IR_Function *ir); // returns true if it changed anything
+} IR_Pass;
+
+typedef struct
+{
+	int runs;
+	int instructions_removed;
+	i64 ns;
+} IR_Pass_Stats;
+
+#define IR_MAX_ROUNDS 4
+
+b32 build_ir(Function *fn, IR_Function *ir);
+b32 fold_cells(OP op, u64 a, u64 b, u64 *result);
+b32 ir_dce(IR_Function *ir);
+b32 ir_sccp(IR_Function *ir);
+b32 ir_gvn(IR_Function *ir);
+b32 ir_simplify_cfg(IR_Function *ir);
+b32 lower_ir(IR_Function *ir, Function *fn);
+int count_ir_instructions(IR_Function *ir);
+void print_ir(IR_Function *ir, FILE *out);
+void free_ir(IR_Function *ir);
+void optimize_ssa(Function *fn);
+
+#endif // _IR_H
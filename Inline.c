@@ -0,0 +1,293 @@
+#include "Inline.h"
+#include "Peephole.h"
+#include "stb_ds.h"
+
+// Plain code only touches slots with loads, stores and tees, all of them
+// have the slot right after the op
+static b32 has_slot(OP op)
+{
+	return op >= LOADB && op <= TEED;
+}
+
+static b32 writes_slot(OP op)
+{
+	return op >= STOREB && op <= TEED;
+}
+
+// The cell a numeric push leaves on the stack
+static u64 get_push_cell(u8 *at)
+{
+	switch(at[0])
+	{
+		case PUSHB:  return (u64)(i64)(i8)at[1];
+		case PUSHW:  return (u64)(i64)(i16)read_word(at + 1);
+		case PUSHDW: return (u64)(i64)(i32)read_dword(at + 1);
+		case PUSHF:  return read_dword(at + 1);
+		default:     return read_qword(at + 1);
+	}
+}
+
+// A load of an argument that's always the constant, narrowed like the load would
+static void push_constant_load(OP load, u64 cell, Bytecode *out)
+{
+	switch(load)
+	{
+		case LOADB:  pushop_int(out, (i8)cell); break;
+		case LOADW:  pushop_int(out, (i16)cell); break;
+		case LOADDW: pushop_int(out, (i32)cell); break;
+		case LOADF:
+		{
+			push_byte(PUSHF, out);
+			push_dword((u32)cell, out);
+		} break;
+		case LOADD:
+		{
+			push_byte(PUSHD, out);
+			push_qword(cell, out);
+		} break;
+		default: pushop_int(out, (i64)cell); break;
+	}
+}
+
+// @NOTE: only small functions that don't call themselves keep a body to
+// inline, every path has to leave just the return value on the stack. It's
+// the code from before fuse_superinstructions, the caller's passes don't
+// know the fused ops. Struct fields are left out too, their slots would have
+// to move with the rest of the callee's
+void keep_inline_body(Function *fn)
+{
+	int index = get_function_index(fn);
+	Bytecode *code = &fn->code;
+	if(index < 0 || count_instructions(code) > INLINE_MAX_CALLEE + 1)
+		return;
+
+	int max_depth;
+	int *depths = compute_stack_depths(code, &max_depth);
+	for(int at = 0; at < code->i; at += get_instruction_size(code->bytecode + at))
+	{
+		u8 *ip = code->bytecode + at;
+		if((ip[0] == CALL || ip[0] == TAILCALL) && read_dword(ip + 1) == (u32)index)
+			return;
+		if(ip[0] == RET && depths[at] != -1 && depths[at] != ip[1])
+			return;
+		if(ip[0] >= ADDQW_LL)
+			return;
+	}
+	free_bytecode(&fn->inline_body);
+	fn->inline_body = make_bytecode(code->i);
+	memcpy(fn->inline_body.bytecode, code->bytecode, code->i);
+	fn->inline_body.i = code->i;
+}
+
+// @NOTE: the callee's slots go after the caller's, the arguments are stored
+// to them from the stack except for constant ones nothing writes to, loads of
+// those push the constant instead. A return is a jump to the end, the value
+// is left on the stack where the call would have left it. Jumps in the
+// callee's code point into a range of new_offsets of its own, after the
+// caller's offsets, so relocate_jumps fixes up both at once
+static void inline_site(Function *fn, Function *callee, u8 **constants, int constant_count,
+		int **new_offsets, Bytecode *out)
+{
+	Bytecode *body = &callee->inline_body;
+	int arg_count = callee->arg_count;
+	int first_constant = arg_count - constant_count;
+	u16 base = fn->frame_size;
+	fn->frame_size += callee->frame_size;
+
+	b32 *written = alloc_temp_memory(sizeof(b32) * (arg_count + 1));
+	memset(written, 0, sizeof(b32) * (arg_count + 1));
+	for(int at = 0; at < body->i; at += get_instruction_size(body->bytecode + at))
+	{
+		u8 *ip = body->bytecode + at;
+		if(writes_slot(ip[0]) && read_word(ip + 1) < arg_count)
+			written[read_word(ip + 1)] = true;
+	}
+
+	for(int i = first_constant - 1; i >= 0; --i)
+	{
+		push_byte(STOREQW, out);
+		push_word(base + i, out);
+	}
+	for(int i = first_constant; i < arg_count; ++i)
+	{
+		if(!written[i])
+			continue;
+		u8 *push = constants[i - first_constant];
+		int size = get_instruction_size(push);
+		reserve_bytecode(size, out);
+		memcpy(out->bytecode + out->i, push, size);
+		out->i += size;
+		push_byte(STOREQW, out);
+		push_word(base + i, out);
+	}
+
+	int range = arrlen(*new_offsets);
+	arrsetlen(*new_offsets, range + body->i + 1);
+	for(int at = 0; at < body->i; at += get_instruction_size(body->bytecode + at))
+	{
+		u8 *ip = body->bytecode + at;
+		(*new_offsets)[range + at] = out->i;
+		if(ip[0] == RET)
+		{
+			// The last one just falls through to the end
+			if(at + get_instruction_size(ip) < body->i)
+			{
+				push_byte(JMP, out);
+				push_dword(range + body->i, out);
+			}
+			continue;
+		}
+		if(has_slot(ip[0]))
+		{
+			u16 slot = read_word(ip + 1);
+			if(slot >= first_constant && slot < arg_count && !written[slot])
+				push_constant_load(ip[0], get_push_cell(constants[slot - first_constant]), out);
+			else
+			{
+				push_byte(ip[0], out);
+				push_word(base + slot, out);
+			}
+			continue;
+		}
+
+		int size = get_instruction_size(ip);
+		reserve_bytecode(size, out);
+		int copied = out->i;
+		memcpy(out->bytecode + copied, ip, size);
+		out->i += size;
+		// Its RET is a jump now, it can't take over the frame
+		if(ip[0] == TAILCALL)
+			out->bytecode[copied] = CALL;
+		int first;
+		int count = get_jump_operands(ip, &first);
+		for(int i = 0; i < count; ++i)
+			patch_dword(range + read_dword(ip + first + 4 * i), copied + first + 4 * i, out);
+	}
+	(*new_offsets)[range + body->i] = out->i;
+}
+
+// @NOTE: a call inside a loop is anything between a jump back and where it
+// jumps to
+static b32 *find_loop_code(Bytecode *code)
+{
+	b32 *in_loop = alloc_temp_memory(sizeof(b32) * (code->i + 1));
+	memset(in_loop, 0, sizeof(b32) * (code->i + 1));
+	for(int at = 0; at < code->i; at += get_instruction_size(code->bytecode + at))
+	{
+		int first;
+		int count = get_jump_operands(code->bytecode + at, &first);
+		for(int i = 0; i < count; ++i)
+		{
+			int target = read_dword(code->bytecode + at + first + 4 * i);
+			for(int l = target; l <= at; ++l)
+				in_loop[l] = true;
+		}
+	}
+	return in_loop;
+}
+
+Inline_Stats inline_calls(Function *fn)
+{
+	Bytecode *code = &fn->code;
+	Inline_Stats stats = {};
+	int size = count_instructions(code);
+	stats.budget = size * INLINE_GROWTH_PERCENT / 100;
+	if(stats.budget < INLINE_MIN_BUDGET)
+		stats.budget = INLINE_MIN_BUDGET;
+
+	b32 *targets = find_jump_targets(code);
+	b32 *in_loop = find_loop_code(code);
+	int *new_offsets = NULL; // stb_ds array
+	arrsetlen(new_offsets, code->i + 1);
+	// Offsets of the pushes right before the current instruction, they're
+	// the last arguments if it's a call
+	int *pushes = NULL;      // stb_ds array
+	Bytecode result = make_bytecode(code->i);
+
+	for(int at = 0; at < code->i;)
+	{
+		u8 *ip = code->bytecode + at;
+		int next = at + get_instruction_size(ip);
+		new_offsets[at] = result.i;
+		if(ip[0] == CALL || ip[0] == TAILCALL)
+		{
+			u32 index = read_dword(ip + 1);
+			Function *callee = &functions[index];
+			stats.sites++;
+			int constant_count = arrlen(pushes) < callee->arg_count ? arrlen(pushes) : callee->arg_count;
+			int callee_size = count_instructions(&callee->inline_body) - 1;
+			int growth = callee_size + (callee->arg_count - constant_count) - constant_count - 1;
+			int benefit = INLINE_CALL_BENEFIT + INLINE_CONSTANT_BENEFIT * constant_count;
+			if(in_loop[at])
+				benefit *= INLINE_LOOP_WEIGHT;
+			if(callee->inline_body.bytecode && fn->frame_size + callee->frame_size <= UINT16_MAX &&
+					growth <= benefit && stats.growth + growth <= stats.budget)
+			{
+				u8 **constants = alloc_temp_memory(sizeof(u8 *) * (constant_count + 1));
+				int first_push = arrlen(pushes) - constant_count;
+				for(int i = 0; i < constant_count; ++i)
+					constants[i] = code->bytecode + pushes[first_push + i];
+				// The constants' pushes were copied already, they're taken back
+				if(constant_count)
+				{
+					result.i = new_offsets[pushes[first_push]];
+					for(int i = first_push; i < arrlen(pushes); ++i)
+						new_offsets[pushes[i]] = result.i;
+					new_offsets[at] = result.i;
+				}
+				inline_site(fn, callee, constants, constant_count, &new_offsets, &result);
+				Inline_Site site = {.callee = index, .offset = at, .size = callee_size,
+					.constants = constant_count, .in_loop = in_loop[at]};
+				arrput(stats.inlined, site);
+				stats.growth += growth;
+				arrsetlen(pushes, 0);
+				at = next;
+				continue;
+			}
+		}
+
+		// Only the first of the pushes can be a jump target, the rest are
+		// sure to run right after it
+		b32 is_push = ip[0] >= PUSHB && ip[0] <= PUSHD;
+		if(!is_push || targets[at])
+			arrsetlen(pushes, 0);
+		if(is_push)
+			arrput(pushes, at);
+
+		int instruction_size = next - at;
+		reserve_bytecode(instruction_size, &result);
+		memcpy(result.bytecode + result.i, ip, instruction_size);
+		result.i += instruction_size;
+		at = next;
+	}
+	new_offsets[code->i] = result.i;
+	arrfree(pushes);
+
+	if(arrlen(stats.inlined) == 0)
+	{
+		free_bytecode(&result);
+		arrfree(new_offsets);
+		return stats;
+	}
+	relocate_jumps(&result, new_offsets);
+	arrfree(new_offsets);
+	finish_bytecode(&result);
+	free_bytecode(code);
+	*code = result;
+	fn->max_stack = compute_max_stack(code);
+	return stats;
+}
+
+void print_inline_stats(Function *fn, Inline_Stats stats)
+{
+	for(int i = 0; i < arrlen(stats.inlined); ++i)
+	{
+		Inline_Site site = stats.inlined[i];
+		printf("fn %s: inlined %s at %d (%d instructions, %d constant arguments%s)\n", fn->name,
+				functions[site.callee].name, site.offset, site.size, site.constants,
+				site.in_loop ? ", in a loop" : "");
+	}
+	if(stats.sites)
+		printf("fn %s: %d of %d calls inlined, %d instructions added of a budget of %d\n", fn->name,
+				(int)arrlen(stats.inlined), stats.sites, stats.growth, stats.budget);
+}
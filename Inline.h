@@ -0,0 +1,46 @@
+#ifndef _INLINE_H
+#define _INLINE_H
+
+#include "Basic.h"
+#include "Bytecode.h"
+
+// @NOTE: the inliner splices small functions into the code that calls them,
+// before the peephole rules and the SSA passes run on the caller so they fold
+// what the callee does with constant arguments. It works on bytecode since a
+// line's tree is gone once the line has run and most calls are to functions
+// from earlier lines. Sizes are counted in instructions.
+//
+// A site is inlined if what the code grows by is no more than what the call
+// saves: INLINE_CALL_BENEFIT for the call and return themselves, plus
+// INLINE_CONSTANT_BENEFIT for every constant argument, twice that inside a
+// loop. The growth of all of a caller's sites together is kept under
+// INLINE_GROWTH_PERCENT of its size or INLINE_MIN_BUDGET, whichever is more
+#define INLINE_MAX_CALLEE        48
+#define INLINE_CALL_BENEFIT      16
+#define INLINE_CONSTANT_BENEFIT  8
+#define INLINE_LOOP_WEIGHT       2
+#define INLINE_GROWTH_PERCENT    100
+#define INLINE_MIN_BUDGET        64
+
+typedef struct
+{
+	int callee;      // function index
+	int offset;      // of the call in the caller's code before inlining
+	int size;        // the callee's instructions
+	int constants;   // arguments that were constant
+	b32 in_loop;
+} Inline_Site;
+
+typedef struct
+{
+	int sites;              // direct calls looked at
+	int growth;             // instructions added to the caller
+	int budget;
+	Inline_Site *inlined;   // stb_ds array, the caller frees it
+} Inline_Stats;
+
+Inline_Stats inline_calls(Function *fn);
+void keep_inline_body(Function *fn);
+void print_inline_stats(Function *fn, Inline_Stats stats);
+
+#endif // _INLINE_H
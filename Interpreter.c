@@ -0,0 +1,1553 @@
+#include "Interpreter.h"
+#include "Error.h"
+#include "Tier.h"
+#include "Trace.h"
+#include <assert.h>
+
+void init_vm(VM *vm)
+{
+	*vm = (VM){};
+	vm->stack   = AllocateVirtualMemory(VM_STACK_SIZE * sizeof(u64));
+	vm->locals  = AllocateVirtualMemory(VM_LOCALS_SIZE * sizeof(u64));
+	vm->globals = AllocateVirtualMemory(VM_GLOBALS_SIZE * sizeof(u64));
+	vm->frames  = AllocateVirtualMemory(VM_MAX_FRAMES * sizeof(Call_Frame));
+	// stack[0] is never used, the stack pointer points at the top value
+	vm->stack_top = vm->stack;
+	vm->locals_top = vm->locals;
+	vm->frame_top = vm->frames;
+}
+
+// @NOTE: a runtime error jumps out of the run without unwinding it, runs that
+// moved the VM's stack tops for code they called don't get to move them back.
+// A trace that was being recorded is dropped, it's restarted from scratch
+void reset_vm_stacks(VM *vm)
+{
+	vm->stack_top = vm->stack;
+	vm->locals_top = vm->locals;
+	vm->frame_top = vm->frames;
+	vm->recording = false;
+}
+
+static inline f32 as_f32(u64 value)
+{
+	u32 bits = (u32)value;
+	f32 result;
+	memcpy(&result, &bits, 4);
+	return result;
+}
+
+static inline u64 from_f32(f32 value)
+{
+	u32 bits;
+	memcpy(&bits, &value, 4);
+	return bits;
+}
+
+static inline f64 as_f64(u64 value)
+{
+	f64 result;
+	memcpy(&result, &value, 8);
+	return result;
+}
+
+static inline u64 from_f64(f64 value)
+{
+	u64 bits;
+	memcpy(&bits, &value, 8);
+	return bits;
+}
+
+void runtime_error(const char *error)
+{
+	report_error(NULL, "Runtime error: %s", error);
+}
+
+void print_value(u64 value, const Type_Info *type)
+{
+	switch(type->type)
+	{
+		case T_INT:
+		{
+			printf("%lld\n", (long long)value);
+		} break;
+		case T_FLOAT:
+		{
+			if(type->size == 32)
+				printf("%g\n", as_f32(value));
+			else
+				printf("%g\n", as_f64(value));
+		} break;
+		case T_BOOL:
+		{
+			printf("%s\n", value ? "true" : "false");
+		} break;
+		case T_STRING:
+		{
+			printf("%s\n", (char *)value);
+		} break;
+		case T_FN:
+		{
+			printf("fn %s\n", functions[value].name);
+		} break;
+		default:
+		{
+			printf("<%s>\n", type->name);
+		} break;
+	}
+}
+
+static void record_dispatch(VM *vm, u8 *ip)
+{
+	vm->dispatch_count++;
+	vm->op_counts[*ip]++;
+	if(vm->sequences)
+		profile_op(vm->sequences, *ip);
+}
+
+static void record_register_dispatch(VM *vm, u8 *ip)
+{
+	vm->dispatch_count++;
+	vm->register_op_counts[*ip]++;
+}
+
+// @NOTE: integer results are truncated to their width and sign extended back,
+// unsigned math is used so overflow wraps instead of being undefined
+#define BINARY_DW(op) { u32 b = (u32)sp[0]; u32 a = (u32)sp[-1]; --sp; *sp = (u64)(i64)(i32)(a op b); ip += 1; DISPATCH(); }
+#define BINARY_QW(op) { u64 b = sp[0]; u64 a = sp[-1]; --sp; *sp = a op b; ip += 1; DISPATCH(); }
+#define BINARY_F(op)  { f32 b = as_f32(sp[0]); f32 a = as_f32(sp[-1]); --sp; *sp = from_f32(a op b); ip += 1; DISPATCH(); }
+#define BINARY_D(op)  { f64 b = as_f64(sp[0]); f64 a = as_f64(sp[-1]); --sp; *sp = from_f64(a op b); ip += 1; DISPATCH(); }
+#define COMPARE_DW(op) { i32 b = (i32)sp[0]; i32 a = (i32)sp[-1]; --sp; *sp = a op b; ip += 1; DISPATCH(); }
+#define COMPARE_QW(op) { i64 b = (i64)sp[0]; i64 a = (i64)sp[-1]; --sp; *sp = a op b; ip += 1; DISPATCH(); }
+#define COMPARE_F(op)  { f32 b = as_f32(sp[0]); f32 a = as_f32(sp[-1]); --sp; *sp = a op b; ip += 1; DISPATCH(); }
+#define COMPARE_D(op)  { f64 b = as_f64(sp[0]); f64 a = as_f64(sp[-1]); --sp; *sp = a op b; ip += 1; DISPATCH(); }
+
+// Jumping back to an earlier offset is a loop backedge, it's counted for
+// tiering and the tracing engine can run the rest of the loop natively from
+// there. Rotated loops jump back with a conditional jump, so those check too
+#if USE_COMPUTED_GOTO
+#define START_RECORDING_TABLE() if(vm->recording) table = record_table
+#else
+#define START_RECORDING_TABLE()
+#endif
+#define BACKEDGE(target) \
+{ \
+	if(vm->tiering) \
+		tier_backedge(frame->function); \
+	if(vm->tracing) \
+	{ \
+		Trace_Exit *exit = trace_backedge(vm, frame->function, (int)(target - code), locals, sp); \
+		if(exit) \
+		{ \
+			ip = code + exit->offset; \
+			sp += arrlen(exit->stack); \
+			DISPATCH(); \
+		} \
+		START_RECORDING_TABLE(); \
+	} \
+}
+
+// Conditional jumps, compare and branch pops both values first
+#define JUMP_IF_SIZED(condition, size) \
+{ \
+	if(condition) \
+	{ \
+		u8 *target = code + read_dword(ip + 1); \
+		if(target <= ip) \
+			BACKEDGE(target) \
+		ip = target; \
+	} \
+	else \
+		ip += size; \
+	DISPATCH(); \
+}
+#define JUMP_IF(condition) JUMP_IF_SIZED(condition, 5)
+#define JUMP_IF_NOT(condition) JUMP_IF(!(condition))
+#define COUNTED_LOOP(limit, size) \
+{ \
+	u16 slot = read_word(ip + 5); \
+	i64 value = (i64)(locals[slot] + (u64)(i64)(i32)read_dword(ip + 7)); \
+	locals[slot] = (u64)value; \
+	JUMP_IF_SIZED(value < (limit), size) \
+}
+#define BRANCH_DW(jump, op) { i32 b = (i32)sp[0]; i32 a = (i32)sp[-1]; sp -= 2; jump(a op b) }
+#define BRANCH_QW(jump, op) { i64 b = (i64)sp[0]; i64 a = (i64)sp[-1]; sp -= 2; jump(a op b) }
+#define BRANCH_F(jump, op)  { f32 b = as_f32(sp[0]); f32 a = as_f32(sp[-1]); sp -= 2; jump(a op b) }
+#define BRANCH_D(jump, op)  { f64 b = as_f64(sp[0]); f64 a = as_f64(sp[-1]); sp -= 2; jump(a op b) }
+
+#define FUSED_LL(op) { u64 a = locals[read_word(ip + 1)]; u64 b = locals[read_word(ip + 3)]; *++sp = a op b; ip += 5; DISPATCH(); }
+#define FUSED_LI(op) { u64 a = locals[read_word(ip + 1)]; u64 b = (u64)(i64)(i32)read_dword(ip + 3); *++sp = a op b; ip += 7; DISPATCH(); }
+#define FUSED_COMPARE_LI(op) { i64 a = (i64)locals[read_word(ip + 1)]; i64 b = (i32)read_dword(ip + 3); *++sp = a op b; ip += 7; DISPATCH(); }
+
+// Fields are the bytes at the offset from the struct's slot in locals or globals,
+// the type's conversion to a cell extends them like a LOAD of the same width
+#define FIELD_AT(cells) ((u8 *)((cells) + read_word(ip + 1)) + read_word(ip + 3))
+#define FIELD_LOAD(cells, type)  { type value; memcpy(&value, FIELD_AT(cells), sizeof(value)); *++sp = (u64)value; ip += 5; DISPATCH(); }
+#define FIELD_STORE(cells, type) { type value = (type)*sp--; memcpy(FIELD_AT(cells), &value, sizeof(value)); ip += 5; DISPATCH(); }
+
+#if USE_COMPUTED_GOTO
+#define TARGET(op) case op: op_##op
+#define DISPATCH() goto *table[*ip]
+#else
+#define TARGET(op) case op
+#define DISPATCH() goto dispatch
+#endif
+
+// @NOTE: runs fn to completion and gives back its return value (0 if it
+// doesn't have one). It starts above whatever is already on the VM's stacks,
+// so it can be called again while another interpret is running
+u64 interpret(VM *vm, Function *fn, u64 *args)
+{
+#if USE_COMPUTED_GOTO
+	static void *dispatch_table[OP_COUNT] = {
+		[NOP] = &&op_NOP,
+		[LOADB] = &&op_LOADB, [LOADW] = &&op_LOADW, [LOADDW] = &&op_LOADDW,
+		[LOADQW] = &&op_LOADQW, [LOADF] = &&op_LOADF, [LOADD] = &&op_LOADD,
+		[STOREB] = &&op_STOREB, [STOREW] = &&op_STOREW, [STOREDW] = &&op_STOREDW,
+		[STOREQW] = &&op_STOREQW, [STOREF] = &&op_STOREF, [STORED] = &&op_STORED,
+		[TEEB] = &&op_TEEB, [TEEW] = &&op_TEEW, [TEEDW] = &&op_TEEDW,
+		[TEEQW] = &&op_TEEQW, [TEEF] = &&op_TEEF, [TEED] = &&op_TEED,
+		[PUSHB] = &&op_PUSHB, [PUSHW] = &&op_PUSHW, [PUSHDW] = &&op_PUSHDW,
+		[PUSHQW] = &&op_PUSHQW, [PUSHF] = &&op_PUSHF, [PUSHD] = &&op_PUSHD,
+		[ADDDW] = &&op_ADDDW, [ADDQW] = &&op_ADDQW, [ADDF] = &&op_ADDF, [ADDD] = &&op_ADDD,
+		[SUBDW] = &&op_SUBDW, [SUBQW] = &&op_SUBQW, [SUBF] = &&op_SUBF, [SUBD] = &&op_SUBD,
+		[MULDW] = &&op_MULDW, [MULQW] = &&op_MULQW, [MULF] = &&op_MULF, [MULD] = &&op_MULD,
+		[DIVDW] = &&op_DIVDW, [DIVQW] = &&op_DIVQW, [DIVF] = &&op_DIVF, [DIVD] = &&op_DIVD,
+		[MODDW] = &&op_MODDW, [MODQW] = &&op_MODQW,
+		[ANDDW] = &&op_ANDDW, [ANDQW] = &&op_ANDQW,
+		[ORDW] = &&op_ORDW, [ORQW] = &&op_ORQW,
+		[XORDW] = &&op_XORDW, [XORQW] = &&op_XORQW,
+		[SHLDW] = &&op_SHLDW, [SHLQW] = &&op_SHLQW,
+		[SHRDW] = &&op_SHRDW, [SHRQW] = &&op_SHRQW,
+		[EQDW] = &&op_EQDW, [EQQW] = &&op_EQQW, [EQF] = &&op_EQF, [EQD] = &&op_EQD,
+		[NEDW] = &&op_NEDW, [NEQW] = &&op_NEQW, [NEF] = &&op_NEF, [NED] = &&op_NED,
+		[LTDW] = &&op_LTDW, [LTQW] = &&op_LTQW, [LTF] = &&op_LTF, [LTD] = &&op_LTD,
+		[LEDW] = &&op_LEDW, [LEQW] = &&op_LEQW, [LEF] = &&op_LEF, [LED] = &&op_LED,
+		[GTDW] = &&op_GTDW, [GTQW] = &&op_GTQW, [GTF] = &&op_GTF, [GTD] = &&op_GTD,
+		[GEDW] = &&op_GEDW, [GEQW] = &&op_GEQW, [GEF] = &&op_GEF, [GED] = &&op_GED,
+		[GLOAD] = &&op_GLOAD, [GSTORE] = &&op_GSTORE,
+		[PUSHS] = &&op_PUSHS, [POP] = &&op_POP, [EQS] = &&op_EQS, [HASHS] = &&op_HASHS,
+		[JMP] = &&op_JMP, [JZ] = &&op_JZ, [JNZ] = &&op_JNZ,
+		[JEQDW] = &&op_JEQDW, [JEQQW] = &&op_JEQQW, [JEQF] = &&op_JEQF, [JEQD] = &&op_JEQD,
+		[JNEDW] = &&op_JNEDW, [JNEQW] = &&op_JNEQW, [JNEF] = &&op_JNEF, [JNED] = &&op_JNED,
+		[JLTDW] = &&op_JLTDW, [JLTQW] = &&op_JLTQW, [JLTF] = &&op_JLTF, [JLTD] = &&op_JLTD,
+		[JLEDW] = &&op_JLEDW, [JLEQW] = &&op_JLEQW, [JLEF] = &&op_JLEF, [JLED] = &&op_JLED,
+		[JGTDW] = &&op_JGTDW, [JGTQW] = &&op_JGTQW, [JGTF] = &&op_JGTF, [JGTD] = &&op_JGTD,
+		[JGEDW] = &&op_JGEDW, [JGEQW] = &&op_JGEQW, [JGEF] = &&op_JGEF, [JGED] = &&op_JGED,
+		[JNLTF] = &&op_JNLTF, [JNLTD] = &&op_JNLTD, [JNLEF] = &&op_JNLEF, [JNLED] = &&op_JNLED,
+		[JNGTF] = &&op_JNGTF, [JNGTD] = &&op_JNGTD, [JNGEF] = &&op_JNGEF, [JNGED] = &&op_JNGED,
+		[SWITCH] = &&op_SWITCH,
+		[CALL] = &&op_CALL, [CALLI] = &&op_CALLI, [RET] = &&op_RET, [TAILCALL] = &&op_TAILCALL,
+		[ADDQW_LL] = &&op_ADDQW_LL, [SUBQW_LL] = &&op_SUBQW_LL, [MULQW_LL] = &&op_MULQW_LL,
+		[ADDQW_LI] = &&op_ADDQW_LI, [SUBQW_LI] = &&op_SUBQW_LI, [MULQW_LI] = &&op_MULQW_LI,
+		[EQQW_LI] = &&op_EQQW_LI, [NEQW_LI] = &&op_NEQW_LI, [LTQW_LI] = &&op_LTQW_LI,
+		[LEQW_LI] = &&op_LEQW_LI, [GTQW_LI] = &&op_GTQW_LI, [GEQW_LI] = &&op_GEQW_LI,
+		[LOOPQW_LI] = &&op_LOOPQW_LI, [LOOPQW_LL] = &&op_LOOPQW_LL,
+		[FLOADB] = &&op_FLOADB, [FLOADW] = &&op_FLOADW, [FLOADDW] = &&op_FLOADDW,
+		[FLOADQW] = &&op_FLOADQW, [FLOADF] = &&op_FLOADF, [FLOADD] = &&op_FLOADD,
+		[FSTOREB] = &&op_FSTOREB, [FSTOREW] = &&op_FSTOREW, [FSTOREDW] = &&op_FSTOREDW,
+		[FSTOREQW] = &&op_FSTOREQW, [FSTOREF] = &&op_FSTOREF, [FSTORED] = &&op_FSTORED,
+		[GFLOADB] = &&op_GFLOADB, [GFLOADW] = &&op_GFLOADW, [GFLOADDW] = &&op_GFLOADDW,
+		[GFLOADQW] = &&op_GFLOADQW, [GFLOADF] = &&op_GFLOADF, [GFLOADD] = &&op_GFLOADD,
+		[GFSTOREB] = &&op_GFSTOREB, [GFSTOREW] = &&op_GFSTOREW, [GFSTOREDW] = &&op_GFSTOREDW,
+		[GFSTOREQW] = &&op_GFSTOREQW, [GFSTOREF] = &&op_GFSTOREF, [GFSTORED] = &&op_GFSTORED,
+		[NARROWB] = &&op_NARROWB, [NARROWW] = &&op_NARROWW,
+	};
+	// Profiling and recording traces swap the whole table, so the normal dispatch has no extra check
+	static void *profile_table[OP_COUNT] = { [0 ... OP_COUNT - 1] = &&profile };
+	static void *record_table[OP_COUNT] = { [0 ... OP_COUNT - 1] = &&record };
+	void **table = vm->profiling ? profile_table : dispatch_table;
+#endif
+
+	u64 *globals = vm->globals;
+	u64 *sp = vm->stack_top;
+	Call_Frame *entry = vm->frame_top;
+	Call_Frame *frame = entry;
+	frame->function = fn;
+	frame->locals = vm->locals_top;
+	frame->ret_ip = NULL;
+	u64 *locals = frame->locals;
+	u8 *code = fn->code.bytecode;
+	u8 *ip = code;
+	Function *callee = NULL;
+
+	if(locals + fn->frame_size > vm->locals + VM_LOCALS_SIZE ||
+			sp + fn->max_stack >= vm->stack + VM_STACK_SIZE)
+		runtime_error("Stack overflow");
+	if(fn->arg_count)
+		memcpy(locals, args, sizeof(u64) * fn->arg_count);
+
+#if USE_COMPUTED_GOTO
+	DISPATCH();
+profile:
+	record_dispatch(vm, ip);
+	goto *dispatch_table[*ip];
+record:
+	trace_record(vm, frame->function, ip, sp, locals);
+	if(!vm->recording)
+		table = vm->profiling ? profile_table : dispatch_table;
+	goto *dispatch_table[*ip];
+#else
+dispatch:
+	if(vm->profiling)
+		record_dispatch(vm, ip);
+	if(vm->recording)
+		trace_record(vm, frame->function, ip, sp, locals);
+#endif
+	switch((OP)*ip)
+	{
+		TARGET(NOP): { ip += 1; DISPATCH(); }
+
+		TARGET(LOADB):  { *++sp = (u64)(i64)(i8)locals[read_word(ip + 1)];  ip += 3; DISPATCH(); }
+		TARGET(LOADW):  { *++sp = (u64)(i64)(i16)locals[read_word(ip + 1)]; ip += 3; DISPATCH(); }
+		TARGET(LOADDW): { *++sp = (u64)(i64)(i32)locals[read_word(ip + 1)]; ip += 3; DISPATCH(); }
+		TARGET(LOADQW): { *++sp = locals[read_word(ip + 1)];                 ip += 3; DISPATCH(); }
+		TARGET(LOADF):  { *++sp = (u32)locals[read_word(ip + 1)];            ip += 3; DISPATCH(); }
+		TARGET(LOADD):  { *++sp = locals[read_word(ip + 1)];                 ip += 3; DISPATCH(); }
+
+		TARGET(STOREB):  { locals[read_word(ip + 1)] = (u64)(i64)(i8)*sp--;  ip += 3; DISPATCH(); }
+		TARGET(STOREW):  { locals[read_word(ip + 1)] = (u64)(i64)(i16)*sp--; ip += 3; DISPATCH(); }
+		TARGET(STOREDW): { locals[read_word(ip + 1)] = (u64)(i64)(i32)*sp--; ip += 3; DISPATCH(); }
+		TARGET(STOREQW): { locals[read_word(ip + 1)] = *sp--;                ip += 3; DISPATCH(); }
+		TARGET(STOREF):  { locals[read_word(ip + 1)] = (u32)*sp--;           ip += 3; DISPATCH(); }
+		TARGET(STORED):  { locals[read_word(ip + 1)] = *sp--;                ip += 3; DISPATCH(); }
+
+		TARGET(TEEB):  { *sp = locals[read_word(ip + 1)] = (u64)(i64)(i8)*sp;  ip += 3; DISPATCH(); }
+		TARGET(TEEW):  { *sp = locals[read_word(ip + 1)] = (u64)(i64)(i16)*sp; ip += 3; DISPATCH(); }
+		TARGET(TEEDW): { *sp = locals[read_word(ip + 1)] = (u64)(i64)(i32)*sp; ip += 3; DISPATCH(); }
+		TARGET(TEEQW): { locals[read_word(ip + 1)] = *sp;                      ip += 3; DISPATCH(); }
+		TARGET(TEEF):  { *sp = locals[read_word(ip + 1)] = (u32)*sp;           ip += 3; DISPATCH(); }
+		TARGET(TEED):  { locals[read_word(ip + 1)] = *sp;                      ip += 3; DISPATCH(); }
+
+		TARGET(PUSHB):  { *++sp = (u64)(i64)(i8)ip[1];               ip += 2; DISPATCH(); }
+		TARGET(PUSHW):  { *++sp = (u64)(i64)(i16)read_word(ip + 1);  ip += 3; DISPATCH(); }
+		TARGET(PUSHDW): { *++sp = (u64)(i64)(i32)read_dword(ip + 1); ip += 5; DISPATCH(); }
+		TARGET(PUSHQW): { *++sp = read_qword(ip + 1);                ip += 9; DISPATCH(); }
+		TARGET(PUSHF):  { *++sp = read_dword(ip + 1);                ip += 5; DISPATCH(); }
+		TARGET(PUSHD):  { *++sp = read_qword(ip + 1);                ip += 9; DISPATCH(); }
+
+		TARGET(ADDDW): BINARY_DW(+)
+		TARGET(ADDQW): BINARY_QW(+)
+		TARGET(ADDF):  BINARY_F(+)
+		TARGET(ADDD):  BINARY_D(+)
+
+		TARGET(SUBDW): BINARY_DW(-)
+		TARGET(SUBQW): BINARY_QW(-)
+		TARGET(SUBF):  BINARY_F(-)
+		TARGET(SUBD):  BINARY_D(-)
+
+		TARGET(MULDW): BINARY_DW(*)
+		TARGET(MULQW): BINARY_QW(*)
+		TARGET(MULF):  BINARY_F(*)
+		TARGET(MULD):  BINARY_D(*)
+
+		// INT_MIN / -1 traps on x86, -1 is done as a (wrapping) negate instead
+		TARGET(DIVDW):
+		{
+			i32 b = (i32)sp[0];
+			i32 a = (i32)sp[-1];
+			if(b == 0)
+				runtime_error("Integer division by zero");
+			--sp;
+			*sp = (u64)(i64)(b == -1 ? (i32)(0u - (u32)a) : a / b);
+			ip += 1;
+			DISPATCH();
+		}
+		TARGET(DIVQW):
+		{
+			i64 b = (i64)sp[0];
+			i64 a = (i64)sp[-1];
+			if(b == 0)
+				runtime_error("Integer division by zero");
+			--sp;
+			*sp = b == -1 ? 0 - (u64)a : (u64)(a / b);
+			ip += 1;
+			DISPATCH();
+		}
+		TARGET(DIVF): BINARY_F(/)
+		TARGET(DIVD): BINARY_D(/)
+
+		TARGET(MODDW):
+		{
+			i32 b = (i32)sp[0];
+			i32 a = (i32)sp[-1];
+			if(b == 0)
+				runtime_error("Integer division by zero");
+			--sp;
+			*sp = (u64)(i64)(b == -1 ? 0 : a % b);
+			ip += 1;
+			DISPATCH();
+		}
+		TARGET(MODQW):
+		{
+			i64 b = (i64)sp[0];
+			i64 a = (i64)sp[-1];
+			if(b == 0)
+				runtime_error("Integer division by zero");
+			--sp;
+			*sp = (u64)(b == -1 ? 0 : a % b);
+			ip += 1;
+			DISPATCH();
+		}
+
+		TARGET(ANDDW): BINARY_DW(&)
+		TARGET(ANDQW): BINARY_QW(&)
+		TARGET(ORDW):  BINARY_DW(|)
+		TARGET(ORQW):  BINARY_QW(|)
+		TARGET(XORDW): BINARY_DW(^)
+		TARGET(XORQW): BINARY_QW(^)
+
+		TARGET(SHLDW): { u32 b = (u32)sp[0]; u32 a = (u32)sp[-1]; --sp; *sp = (u64)(i64)(i32)(a << (b & 31)); ip += 1; DISPATCH(); }
+		TARGET(SHLQW): { u64 b = sp[0]; u64 a = sp[-1]; --sp; *sp = a << (b & 63); ip += 1; DISPATCH(); }
+		TARGET(SHRDW): { u32 b = (u32)sp[0]; i32 a = (i32)sp[-1]; --sp; *sp = (u64)(i64)(a >> (b & 31)); ip += 1; DISPATCH(); }
+		TARGET(SHRQW): { u64 b = sp[0]; i64 a = (i64)sp[-1]; --sp; *sp = (u64)(a >> (b & 63)); ip += 1; DISPATCH(); }
+
+		TARGET(EQDW): COMPARE_DW(==)
+		TARGET(EQQW): COMPARE_QW(==)
+		TARGET(EQF):  COMPARE_F(==)
+		TARGET(EQD):  COMPARE_D(==)
+
+		TARGET(NEDW): COMPARE_DW(!=)
+		TARGET(NEQW): COMPARE_QW(!=)
+		TARGET(NEF):  COMPARE_F(!=)
+		TARGET(NED):  COMPARE_D(!=)
+
+		TARGET(LTDW): COMPARE_DW(<)
+		TARGET(LTQW): COMPARE_QW(<)
+		TARGET(LTF):  COMPARE_F(<)
+		TARGET(LTD):  COMPARE_D(<)
+
+		TARGET(LEDW): COMPARE_DW(<=)
+		TARGET(LEQW): COMPARE_QW(<=)
+		TARGET(LEF):  COMPARE_F(<=)
+		TARGET(LED):  COMPARE_D(<=)
+
+		TARGET(GTDW): COMPARE_DW(>)
+		TARGET(GTQW): COMPARE_QW(>)
+		TARGET(GTF):  COMPARE_F(>)
+		TARGET(GTD):  COMPARE_D(>)
+
+		TARGET(GEDW): COMPARE_DW(>=)
+		TARGET(GEQW): COMPARE_QW(>=)
+		TARGET(GEF):  COMPARE_F(>=)
+		TARGET(GED):  COMPARE_D(>=)
+
+		TARGET(ADDQW_LL): FUSED_LL(+)
+		TARGET(SUBQW_LL): FUSED_LL(-)
+		TARGET(MULQW_LL): FUSED_LL(*)
+		TARGET(ADDQW_LI): FUSED_LI(+)
+		TARGET(SUBQW_LI): FUSED_LI(-)
+		TARGET(MULQW_LI): FUSED_LI(*)
+		TARGET(EQQW_LI): FUSED_COMPARE_LI(==)
+		TARGET(NEQW_LI): FUSED_COMPARE_LI(!=)
+		TARGET(LTQW_LI): FUSED_COMPARE_LI(<)
+		TARGET(LEQW_LI): FUSED_COMPARE_LI(<=)
+		TARGET(GTQW_LI): FUSED_COMPARE_LI(>)
+		TARGET(GEQW_LI): FUSED_COMPARE_LI(>=)
+		TARGET(LOOPQW_LI): COUNTED_LOOP((i32)read_dword(ip + 11), 15)
+		TARGET(LOOPQW_LL): COUNTED_LOOP((i64)locals[read_word(ip + 11)], 13)
+
+		TARGET(GLOAD):  { *++sp = globals[read_word(ip + 1)]; ip += 3; DISPATCH(); }
+		TARGET(GSTORE): { globals[read_word(ip + 1)] = *sp--; ip += 3; DISPATCH(); }
+
+		TARGET(FLOADB):    FIELD_LOAD(locals, i8)
+		TARGET(FLOADW):    FIELD_LOAD(locals, i16)
+		TARGET(FLOADDW):   FIELD_LOAD(locals, i32)
+		TARGET(FLOADQW):   FIELD_LOAD(locals, u64)
+		TARGET(FLOADF):    FIELD_LOAD(locals, u32)
+		TARGET(FLOADD):    FIELD_LOAD(locals, u64)
+		TARGET(FSTOREB):   FIELD_STORE(locals, u8)
+		TARGET(FSTOREW):   FIELD_STORE(locals, u16)
+		TARGET(FSTOREDW):  FIELD_STORE(locals, u32)
+		TARGET(FSTOREQW):  FIELD_STORE(locals, u64)
+		TARGET(FSTOREF):   FIELD_STORE(locals, u32)
+		TARGET(FSTORED):   FIELD_STORE(locals, u64)
+		TARGET(GFLOADB):   FIELD_LOAD(globals, i8)
+		TARGET(GFLOADW):   FIELD_LOAD(globals, i16)
+		TARGET(GFLOADDW):  FIELD_LOAD(globals, i32)
+		TARGET(GFLOADQW):  FIELD_LOAD(globals, u64)
+		TARGET(GFLOADF):   FIELD_LOAD(globals, u32)
+		TARGET(GFLOADD):   FIELD_LOAD(globals, u64)
+		TARGET(GFSTOREB):  FIELD_STORE(globals, u8)
+		TARGET(GFSTOREW):  FIELD_STORE(globals, u16)
+		TARGET(GFSTOREDW): FIELD_STORE(globals, u32)
+		TARGET(GFSTOREQW): FIELD_STORE(globals, u64)
+		TARGET(GFSTOREF):  FIELD_STORE(globals, u32)
+		TARGET(GFSTORED):  FIELD_STORE(globals, u64)
+		TARGET(NARROWB):   { *sp = (u64)(i64)(i8)*sp;  ip += 1; DISPATCH(); }
+		TARGET(NARROWW):   { *sp = (u64)(i64)(i16)*sp; ip += 1; DISPATCH(); }
+
+		TARGET(PUSHS): { *++sp = (u64)string_pool[read_dword(ip + 1)]; ip += 5; DISPATCH(); }
+		TARGET(POP):   { --sp; ip += 1; DISPATCH(); }
+		TARGET(EQS):
+		{
+			char *b = (char *)sp[0];
+			char *a = (char *)sp[-1];
+			--sp;
+			*sp = a == b || strcmp(a, b) == 0;
+			ip += 1;
+			DISPATCH();
+		}
+		TARGET(HASHS): { *sp = hash_string((char *)*sp, read_dword(ip + 1)) & read_dword(ip + 5); ip += 9; DISPATCH(); }
+
+		TARGET(JMP):
+		{
+			u8 *target = code + read_dword(ip + 1);
+			if(target <= ip)
+				BACKEDGE(target)
+			ip = target;
+			DISPATCH();
+		}
+		TARGET(JZ):  JUMP_IF(*sp-- == 0)
+		TARGET(JNZ): JUMP_IF(*sp-- != 0)
+
+		TARGET(JEQDW): BRANCH_DW(JUMP_IF, ==)
+		TARGET(JEQQW): BRANCH_QW(JUMP_IF, ==)
+		TARGET(JEQF):  BRANCH_F(JUMP_IF, ==)
+		TARGET(JEQD):  BRANCH_D(JUMP_IF, ==)
+
+		TARGET(JNEDW): BRANCH_DW(JUMP_IF, !=)
+		TARGET(JNEQW): BRANCH_QW(JUMP_IF, !=)
+		TARGET(JNEF):  BRANCH_F(JUMP_IF, !=)
+		TARGET(JNED):  BRANCH_D(JUMP_IF, !=)
+
+		TARGET(JLTDW): BRANCH_DW(JUMP_IF, <)
+		TARGET(JLTQW): BRANCH_QW(JUMP_IF, <)
+		TARGET(JLTF):  BRANCH_F(JUMP_IF, <)
+		TARGET(JLTD):  BRANCH_D(JUMP_IF, <)
+
+		TARGET(JLEDW): BRANCH_DW(JUMP_IF, <=)
+		TARGET(JLEQW): BRANCH_QW(JUMP_IF, <=)
+		TARGET(JLEF):  BRANCH_F(JUMP_IF, <=)
+		TARGET(JLED):  BRANCH_D(JUMP_IF, <=)
+
+		TARGET(JGTDW): BRANCH_DW(JUMP_IF, >)
+		TARGET(JGTQW): BRANCH_QW(JUMP_IF, >)
+		TARGET(JGTF):  BRANCH_F(JUMP_IF, >)
+		TARGET(JGTD):  BRANCH_D(JUMP_IF, >)
+
+		TARGET(JGEDW): BRANCH_DW(JUMP_IF, >=)
+		TARGET(JGEQW): BRANCH_QW(JUMP_IF, >=)
+		TARGET(JGEF):  BRANCH_F(JUMP_IF, >=)
+		TARGET(JGED):  BRANCH_D(JUMP_IF, >=)
+
+		TARGET(JNLTF): BRANCH_F(JUMP_IF_NOT, <)
+		TARGET(JNLTD): BRANCH_D(JUMP_IF_NOT, <)
+		TARGET(JNLEF): BRANCH_F(JUMP_IF_NOT, <=)
+		TARGET(JNLED): BRANCH_D(JUMP_IF_NOT, <=)
+		TARGET(JNGTF): BRANCH_F(JUMP_IF_NOT, >)
+		TARGET(JNGTD): BRANCH_D(JUMP_IF_NOT, >)
+		TARGET(JNGEF): BRANCH_F(JUMP_IF_NOT, >=)
+		TARGET(JNGED): BRANCH_D(JUMP_IF_NOT, >=)
+
+		// A value outside the table, below it too since that wraps around, takes the default
+		TARGET(SWITCH):
+		{
+			u64 index = *sp-- - read_qword(ip + 1);
+			u32 entry = index < read_dword(ip + 9) ? 17 + 4 * (u32)index : 13;
+			u8 *target = code + read_dword(ip + entry);
+			if(vm->tiering && target <= ip)
+				tier_backedge(frame->function);
+			ip = target;
+			DISPATCH();
+		}
+
+		TARGET(CALL):
+		{
+			callee = &functions[read_dword(ip + 1)];
+			ip += 5;
+			goto do_call;
+		}
+		TARGET(CALLI):
+		{
+			callee = &functions[*sp--];
+			ip += 3;
+			goto do_call;
+		}
+		TARGET(RET):
+		{
+			b32 has_value = ip[1];
+			u64 result = has_value ? *sp-- : 0;
+			if(frame == entry)
+			{
+				vm->stack_top = sp;
+				return result;
+			}
+			ip = frame->ret_ip;
+			frame--;
+			locals = frame->locals;
+			code = frame->function->code.bytecode;
+			if(has_value)
+				*++sp = result;
+			DISPATCH();
+		}
+		TARGET(TAILCALL):
+		{
+			callee = &functions[read_dword(ip + 1)];
+			ip += 5;
+			// Native code can't take over an interpreted frame, it's called and
+			// the RET after this returns what it gives back
+			if(vm->tiering && tier_enter(callee))
+				goto do_native_call;
+			if(locals + callee->frame_size > vm->locals + VM_LOCALS_SIZE ||
+					sp + callee->max_stack >= vm->stack + VM_STACK_SIZE)
+				runtime_error("Stack overflow");
+
+			frame->function = callee;
+			int arg_count = callee->arg_count;
+			sp -= arg_count;
+			memcpy(locals, sp + 1, sizeof(u64) * arg_count);
+			code = callee->code.bytecode;
+			ip = code;
+			DISPATCH();
+		}
+		default: break;
+	}
+	assert(false);
+	return 0;
+
+do_call:
+	if(vm->tiering && tier_enter(callee))
+		goto do_native_call;
+	{
+		u64 *callee_locals = locals + frame->function->frame_size;
+		if(frame + 1 >= vm->frames + VM_MAX_FRAMES)
+			runtime_error("Stack overflow, too many nested calls");
+		if(callee_locals + callee->frame_size > vm->locals + VM_LOCALS_SIZE ||
+				sp + callee->max_stack >= vm->stack + VM_STACK_SIZE)
+			runtime_error("Stack overflow");
+
+		frame++;
+		frame->function = callee;
+		frame->locals = callee_locals;
+		frame->ret_ip = ip;
+
+		// Arguments come off the operand stack into the first slots of the frame
+		int arg_count = callee->arg_count;
+		sp -= arg_count;
+		memcpy(callee_locals, sp + 1, sizeof(u64) * arg_count);
+
+		locals = callee_locals;
+		code = callee->code.bytecode;
+		ip = code;
+		DISPATCH();
+	}
+do_native_call:
+	{
+		sp -= callee->arg_count;
+		u64 result = tier_call_native(vm, callee, sp + 1, locals + frame->function->frame_size, frame + 1);
+		if(callee->ret)
+			*++sp = result;
+		DISPATCH();
+	}
+}
+
+#define REG_A regs[read_word(ip + 1)]
+#define REG_B regs[read_word(ip + 3)]
+#define REG_C regs[read_word(ip + 5)]
+#define R_BINARY_DW(op) { u32 a = (u32)REG_B; u32 b = (u32)REG_C; REG_A = (u64)(i64)(i32)(a op b); ip += 7; DISPATCH(); }
+#define R_BINARY_QW(op) { u64 a = REG_B; u64 b = REG_C; REG_A = a op b; ip += 7; DISPATCH(); }
+#define R_BINARY_F(op)  { f32 a = as_f32(REG_B); f32 b = as_f32(REG_C); REG_A = from_f32(a op b); ip += 7; DISPATCH(); }
+#define R_BINARY_D(op)  { f64 a = as_f64(REG_B); f64 b = as_f64(REG_C); REG_A = from_f64(a op b); ip += 7; DISPATCH(); }
+#define R_COMPARE_DW(op) { i32 a = (i32)REG_B; i32 b = (i32)REG_C; REG_A = a op b; ip += 7; DISPATCH(); }
+#define R_COMPARE_QW(op) { i64 a = (i64)REG_B; i64 b = (i64)REG_C; REG_A = a op b; ip += 7; DISPATCH(); }
+#define R_COMPARE_F(op)  { f32 a = as_f32(REG_B); f32 b = as_f32(REG_C); REG_A = a op b; ip += 7; DISPATCH(); }
+#define R_COMPARE_D(op)  { f64 a = as_f64(REG_B); f64 b = as_f64(REG_C); REG_A = a op b; ip += 7; DISPATCH(); }
+#define R_FIELD_LOAD(cells, type)  { type value; memcpy(&value, (u8 *)((cells) + read_word(ip + 3)) + read_dword(ip + 5), sizeof(value)); REG_A = (u64)value; ip += 9; DISPATCH(); }
+#define R_FIELD_STORE(cells, type) { type value = (type)regs[read_word(ip + 7)]; memcpy((u8 *)((cells) + read_word(ip + 1)) + read_dword(ip + 3), &value, sizeof(value)); ip += 9; DISPATCH(); }
+
+// @NOTE: runs the register form of fn, it has to be translated already (and so
+// does everything it calls). Same values and errors as interpret
+u64 interpret_registers(VM *vm, Function *fn, u64 *args)
+{
+#if USE_COMPUTED_GOTO
+	static void *dispatch_table[R_OP_COUNT] = {
+		[R_NOP] = &&op_R_NOP,
+		[R_MOVB] = &&op_R_MOVB, [R_MOVW] = &&op_R_MOVW, [R_MOVDW] = &&op_R_MOVDW,
+		[R_MOVQW] = &&op_R_MOVQW, [R_MOVF] = &&op_R_MOVF, [R_MOVK] = &&op_R_MOVK,
+		[R_ADDDW] = &&op_R_ADDDW, [R_ADDQW] = &&op_R_ADDQW, [R_ADDF] = &&op_R_ADDF, [R_ADDD] = &&op_R_ADDD,
+		[R_SUBDW] = &&op_R_SUBDW, [R_SUBQW] = &&op_R_SUBQW, [R_SUBF] = &&op_R_SUBF, [R_SUBD] = &&op_R_SUBD,
+		[R_MULDW] = &&op_R_MULDW, [R_MULQW] = &&op_R_MULQW, [R_MULF] = &&op_R_MULF, [R_MULD] = &&op_R_MULD,
+		[R_DIVDW] = &&op_R_DIVDW, [R_DIVQW] = &&op_R_DIVQW, [R_DIVF] = &&op_R_DIVF, [R_DIVD] = &&op_R_DIVD,
+		[R_MODDW] = &&op_R_MODDW, [R_MODQW] = &&op_R_MODQW,
+		[R_ANDDW] = &&op_R_ANDDW, [R_ANDQW] = &&op_R_ANDQW,
+		[R_ORDW] = &&op_R_ORDW, [R_ORQW] = &&op_R_ORQW,
+		[R_XORDW] = &&op_R_XORDW, [R_XORQW] = &&op_R_XORQW,
+		[R_SHLDW] = &&op_R_SHLDW, [R_SHLQW] = &&op_R_SHLQW,
+		[R_SHRDW] = &&op_R_SHRDW, [R_SHRQW] = &&op_R_SHRQW,
+		[R_EQDW] = &&op_R_EQDW, [R_EQQW] = &&op_R_EQQW, [R_EQF] = &&op_R_EQF, [R_EQD] = &&op_R_EQD,
+		[R_NEDW] = &&op_R_NEDW, [R_NEQW] = &&op_R_NEQW, [R_NEF] = &&op_R_NEF, [R_NED] = &&op_R_NED,
+		[R_LTDW] = &&op_R_LTDW, [R_LTQW] = &&op_R_LTQW, [R_LTF] = &&op_R_LTF, [R_LTD] = &&op_R_LTD,
+		[R_LEDW] = &&op_R_LEDW, [R_LEQW] = &&op_R_LEQW, [R_LEF] = &&op_R_LEF, [R_LED] = &&op_R_LED,
+		[R_GTDW] = &&op_R_GTDW, [R_GTQW] = &&op_R_GTQW, [R_GTF] = &&op_R_GTF, [R_GTD] = &&op_R_GTD,
+		[R_GEDW] = &&op_R_GEDW, [R_GEQW] = &&op_R_GEQW, [R_GEF] = &&op_R_GEF, [R_GED] = &&op_R_GED,
+		[R_GLOAD] = &&op_R_GLOAD, [R_GSTORE] = &&op_R_GSTORE,
+		[R_FLOADB] = &&op_R_FLOADB, [R_FLOADW] = &&op_R_FLOADW, [R_FLOADDW] = &&op_R_FLOADDW,
+		[R_FLOADQW] = &&op_R_FLOADQW, [R_FLOADF] = &&op_R_FLOADF, [R_FLOADD] = &&op_R_FLOADD,
+		[R_FSTOREB] = &&op_R_FSTOREB, [R_FSTOREW] = &&op_R_FSTOREW, [R_FSTOREDW] = &&op_R_FSTOREDW,
+		[R_FSTOREQW] = &&op_R_FSTOREQW, [R_FSTOREF] = &&op_R_FSTOREF, [R_FSTORED] = &&op_R_FSTORED,
+		[R_GFLOADB] = &&op_R_GFLOADB, [R_GFLOADW] = &&op_R_GFLOADW, [R_GFLOADDW] = &&op_R_GFLOADDW,
+		[R_GFLOADQW] = &&op_R_GFLOADQW, [R_GFLOADF] = &&op_R_GFLOADF, [R_GFLOADD] = &&op_R_GFLOADD,
+		[R_GFSTOREB] = &&op_R_GFSTOREB, [R_GFSTOREW] = &&op_R_GFSTOREW, [R_GFSTOREDW] = &&op_R_GFSTOREDW,
+		[R_GFSTOREQW] = &&op_R_GFSTOREQW, [R_GFSTOREF] = &&op_R_GFSTOREF, [R_GFSTORED] = &&op_R_GFSTORED,
+		[R_EQS] = &&op_R_EQS, [R_HASHS] = &&op_R_HASHS,
+		[R_JMP] = &&op_R_JMP, [R_JZ] = &&op_R_JZ, [R_JNZ] = &&op_R_JNZ, [R_SWITCH] = &&op_R_SWITCH,
+		[R_LOOPQW] = &&op_R_LOOPQW, [R_LOOPQWI] = &&op_R_LOOPQWI,
+		[R_CALL] = &&op_R_CALL, [R_CALLI] = &&op_R_CALLI,
+		[R_RET] = &&op_R_RET, [R_RET0] = &&op_R_RET0, [R_TAILCALL] = &&op_R_TAILCALL,
+	};
+	static void *profile_table[R_OP_COUNT] = { [0 ... R_OP_COUNT - 1] = &&profile };
+	void **table = vm->profiling ? profile_table : dispatch_table;
+#endif
+
+	u64 *globals = vm->globals;
+	Call_Frame *entry = vm->frame_top;
+	Call_Frame *frame = entry;
+	frame->function = fn;
+	frame->locals = vm->locals_top;
+	frame->ret_ip = NULL;
+	u64 *regs = frame->locals;
+	assert(fn->registers.bytecode);
+	u8 *code = fn->registers.bytecode;
+	u8 *ip = code;
+	Function *callee = NULL;
+	u16 base = 0;
+
+	if(regs + fn->register_count > vm->locals + VM_LOCALS_SIZE)
+		runtime_error("Stack overflow");
+	if(fn->arg_count)
+		memcpy(regs, args, sizeof(u64) * fn->arg_count);
+
+#if USE_COMPUTED_GOTO
+	DISPATCH();
+profile:
+	record_register_dispatch(vm, ip);
+	goto *dispatch_table[*ip];
+#else
+dispatch:
+	if(vm->profiling)
+		record_register_dispatch(vm, ip);
+#endif
+	switch((R_OP)*ip)
+	{
+		TARGET(R_NOP): { ip += 1; DISPATCH(); }
+
+		TARGET(R_MOVB):  { REG_A = (u64)(i64)(i8)REG_B;  ip += 5; DISPATCH(); }
+		TARGET(R_MOVW):  { REG_A = (u64)(i64)(i16)REG_B; ip += 5; DISPATCH(); }
+		TARGET(R_MOVDW): { REG_A = (u64)(i64)(i32)REG_B; ip += 5; DISPATCH(); }
+		TARGET(R_MOVQW): { REG_A = REG_B;                ip += 5; DISPATCH(); }
+		TARGET(R_MOVF):  { REG_A = (u32)REG_B;           ip += 5; DISPATCH(); }
+		TARGET(R_MOVK):  { REG_A = read_qword(ip + 3);   ip += 11; DISPATCH(); }
+
+		TARGET(R_ADDDW): R_BINARY_DW(+)
+		TARGET(R_ADDQW): R_BINARY_QW(+)
+		TARGET(R_ADDF):  R_BINARY_F(+)
+		TARGET(R_ADDD):  R_BINARY_D(+)
+
+		TARGET(R_SUBDW): R_BINARY_DW(-)
+		TARGET(R_SUBQW): R_BINARY_QW(-)
+		TARGET(R_SUBF):  R_BINARY_F(-)
+		TARGET(R_SUBD):  R_BINARY_D(-)
+
+		TARGET(R_MULDW): R_BINARY_DW(*)
+		TARGET(R_MULQW): R_BINARY_QW(*)
+		TARGET(R_MULF):  R_BINARY_F(*)
+		TARGET(R_MULD):  R_BINARY_D(*)
+
+		TARGET(R_DIVDW):
+		{
+			i32 a = (i32)REG_B;
+			i32 b = (i32)REG_C;
+			if(b == 0)
+				runtime_error("Integer division by zero");
+			REG_A = (u64)(i64)(b == -1 ? (i32)(0u - (u32)a) : a / b);
+			ip += 7;
+			DISPATCH();
+		}
+		TARGET(R_DIVQW):
+		{
+			i64 a = (i64)REG_B;
+			i64 b = (i64)REG_C;
+			if(b == 0)
+				runtime_error("Integer division by zero");
+			REG_A = b == -1 ? 0 - (u64)a : (u64)(a / b);
+			ip += 7;
+			DISPATCH();
+		}
+		TARGET(R_DIVF): R_BINARY_F(/)
+		TARGET(R_DIVD): R_BINARY_D(/)
+
+		TARGET(R_MODDW):
+		{
+			i32 a = (i32)REG_B;
+			i32 b = (i32)REG_C;
+			if(b == 0)
+				runtime_error("Integer division by zero");
+			REG_A = (u64)(i64)(b == -1 ? 0 : a % b);
+			ip += 7;
+			DISPATCH();
+		}
+		TARGET(R_MODQW):
+		{
+			i64 a = (i64)REG_B;
+			i64 b = (i64)REG_C;
+			if(b == 0)
+				runtime_error("Integer division by zero");
+			REG_A = (u64)(b == -1 ? 0 : a % b);
+			ip += 7;
+			DISPATCH();
+		}
+
+		TARGET(R_ANDDW): R_BINARY_DW(&)
+		TARGET(R_ANDQW): R_BINARY_QW(&)
+		TARGET(R_ORDW):  R_BINARY_DW(|)
+		TARGET(R_ORQW):  R_BINARY_QW(|)
+		TARGET(R_XORDW): R_BINARY_DW(^)
+		TARGET(R_XORQW): R_BINARY_QW(^)
+
+		TARGET(R_SHLDW): { u32 a = (u32)REG_B; u32 b = (u32)REG_C; REG_A = (u64)(i64)(i32)(a << (b & 31)); ip += 7; DISPATCH(); }
+		TARGET(R_SHLQW): { u64 a = REG_B; u64 b = REG_C; REG_A = a << (b & 63); ip += 7; DISPATCH(); }
+		TARGET(R_SHRDW): { i32 a = (i32)REG_B; u32 b = (u32)REG_C; REG_A = (u64)(i64)(a >> (b & 31)); ip += 7; DISPATCH(); }
+		TARGET(R_SHRQW): { i64 a = (i64)REG_B; u64 b = REG_C; REG_A = (u64)(a >> (b & 63)); ip += 7; DISPATCH(); }
+
+		TARGET(R_EQDW): R_COMPARE_DW(==)
+		TARGET(R_EQQW): R_COMPARE_QW(==)
+		TARGET(R_EQF):  R_COMPARE_F(==)
+		TARGET(R_EQD):  R_COMPARE_D(==)
+
+		TARGET(R_NEDW): R_COMPARE_DW(!=)
+		TARGET(R_NEQW): R_COMPARE_QW(!=)
+		TARGET(R_NEF):  R_COMPARE_F(!=)
+		TARGET(R_NED):  R_COMPARE_D(!=)
+
+		TARGET(R_LTDW): R_COMPARE_DW(<)
+		TARGET(R_LTQW): R_COMPARE_QW(<)
+		TARGET(R_LTF):  R_COMPARE_F(<)
+		TARGET(R_LTD):  R_COMPARE_D(<)
+
+		TARGET(R_LEDW): R_COMPARE_DW(<=)
+		TARGET(R_LEQW): R_COMPARE_QW(<=)
+		TARGET(R_LEF):  R_COMPARE_F(<=)
+		TARGET(R_LED):  R_COMPARE_D(<=)
+
+		TARGET(R_GTDW): R_COMPARE_DW(>)
+		TARGET(R_GTQW): R_COMPARE_QW(>)
+		TARGET(R_GTF):  R_COMPARE_F(>)
+		TARGET(R_GTD):  R_COMPARE_D(>)
+
+		TARGET(R_GEDW): R_COMPARE_DW(>=)
+		TARGET(R_GEQW): R_COMPARE_QW(>=)
+		TARGET(R_GEF):  R_COMPARE_F(>=)
+		TARGET(R_GED):  R_COMPARE_D(>=)
+
+		TARGET(R_GLOAD):  { REG_A = globals[read_word(ip + 3)]; ip += 5; DISPATCH(); }
+		TARGET(R_GSTORE): { globals[read_word(ip + 1)] = REG_B; ip += 5; DISPATCH(); }
+
+		TARGET(R_FLOADB):    R_FIELD_LOAD(regs, i8)
+		TARGET(R_FLOADW):    R_FIELD_LOAD(regs, i16)
+		TARGET(R_FLOADDW):   R_FIELD_LOAD(regs, i32)
+		TARGET(R_FLOADQW):   R_FIELD_LOAD(regs, u64)
+		TARGET(R_FLOADF):    R_FIELD_LOAD(regs, u32)
+		TARGET(R_FLOADD):    R_FIELD_LOAD(regs, u64)
+		TARGET(R_FSTOREB):   R_FIELD_STORE(regs, u8)
+		TARGET(R_FSTOREW):   R_FIELD_STORE(regs, u16)
+		TARGET(R_FSTOREDW):  R_FIELD_STORE(regs, u32)
+		TARGET(R_FSTOREQW):  R_FIELD_STORE(regs, u64)
+		TARGET(R_FSTOREF):   R_FIELD_STORE(regs, u32)
+		TARGET(R_FSTORED):   R_FIELD_STORE(regs, u64)
+		TARGET(R_GFLOADB):   R_FIELD_LOAD(globals, i8)
+		TARGET(R_GFLOADW):   R_FIELD_LOAD(globals, i16)
+		TARGET(R_GFLOADDW):  R_FIELD_LOAD(globals, i32)
+		TARGET(R_GFLOADQW):  R_FIELD_LOAD(globals, u64)
+		TARGET(R_GFLOADF):   R_FIELD_LOAD(globals, u32)
+		TARGET(R_GFLOADD):   R_FIELD_LOAD(globals, u64)
+		TARGET(R_GFSTOREB):  R_FIELD_STORE(globals, u8)
+		TARGET(R_GFSTOREW):  R_FIELD_STORE(globals, u16)
+		TARGET(R_GFSTOREDW): R_FIELD_STORE(globals, u32)
+		TARGET(R_GFSTOREQW): R_FIELD_STORE(globals, u64)
+		TARGET(R_GFSTOREF):  R_FIELD_STORE(globals, u32)
+		TARGET(R_GFSTORED):  R_FIELD_STORE(globals, u64)
+
+		TARGET(R_EQS):
+		{
+			char *a = (char *)REG_B;
+			char *b = (char *)REG_C;
+			REG_A = a == b || strcmp(a, b) == 0;
+			ip += 7;
+			DISPATCH();
+		}
+		TARGET(R_HASHS): { REG_A = hash_string((char *)REG_B, read_dword(ip + 5)) & read_dword(ip + 9); ip += 13; DISPATCH(); }
+
+		TARGET(R_JMP): { ip = code + read_dword(ip + 1); DISPATCH(); }
+		TARGET(R_SWITCH):
+		{
+			u64 index = REG_A - read_qword(ip + 3);
+			u32 entry = index < read_dword(ip + 11) ? 19 + 4 * (u32)index : 15;
+			ip = code + read_dword(ip + entry);
+			DISPATCH();
+		}
+		TARGET(R_LOOPQW):
+		{
+			i64 value = (i64)(REG_A + (u64)(i64)(i32)read_dword(ip + 5));
+			REG_A = (u64)value;
+			ip = value < (i64)REG_B ? code + read_dword(ip + 9) : ip + 13;
+			DISPATCH();
+		}
+		TARGET(R_LOOPQWI):
+		{
+			i64 value = (i64)(REG_A + (u64)(i64)(i32)read_dword(ip + 3));
+			REG_A = (u64)value;
+			ip = value < (i32)read_dword(ip + 7) ? code + read_dword(ip + 11) : ip + 15;
+			DISPATCH();
+		}
+		TARGET(R_JZ):
+		{
+			if(REG_A == 0)
+				ip = code + read_dword(ip + 3);
+			else
+				ip += 7;
+			DISPATCH();
+		}
+		TARGET(R_JNZ):
+		{
+			if(REG_A != 0)
+				ip = code + read_dword(ip + 3);
+			else
+				ip += 7;
+			DISPATCH();
+		}
+
+		TARGET(R_CALL):
+		{
+			callee = &functions[read_dword(ip + 1)];
+			base = read_word(ip + 5);
+			ip += 7;
+			goto do_call;
+		}
+		TARGET(R_CALLI):
+		{
+			callee = &functions[REG_A];
+			base = read_word(ip + 3);
+			ip += 5;
+			goto do_call;
+		}
+		TARGET(R_RET):
+		{
+			u64 result = REG_A;
+			if(frame == entry)
+				return result;
+			// The callee's first register is the caller's base register
+			regs[0] = result;
+			ip = frame->ret_ip;
+			frame--;
+			regs = frame->locals;
+			code = frame->function->registers.bytecode;
+			DISPATCH();
+		}
+		TARGET(R_RET0):
+		{
+			if(frame == entry)
+				return 0;
+			ip = frame->ret_ip;
+			frame--;
+			regs = frame->locals;
+			code = frame->function->registers.bytecode;
+			DISPATCH();
+		}
+		// The callee's frame starts where this one does, it returns to the same register
+		TARGET(R_TAILCALL):
+		{
+			callee = &functions[read_dword(ip + 1)];
+			u64 *args = regs + read_word(ip + 5);
+			if(regs + callee->register_count > vm->locals + VM_LOCALS_SIZE)
+				runtime_error("Stack overflow");
+			assert(callee->registers.bytecode);
+
+			frame->function = callee;
+			memmove(regs, args, sizeof(u64) * callee->arg_count);
+			code = callee->registers.bytecode;
+			ip = code;
+			DISPATCH();
+		}
+		default: break;
+	}
+	assert(false);
+	return 0;
+
+do_call:
+	{
+		u64 *callee_regs = regs + base;
+		if(frame + 1 >= vm->frames + VM_MAX_FRAMES)
+			runtime_error("Stack overflow, too many nested calls");
+		if(callee_regs + callee->register_count > vm->locals + VM_LOCALS_SIZE)
+			runtime_error("Stack overflow");
+		assert(callee->registers.bytecode);
+
+		frame++;
+		frame->function = callee;
+		frame->locals = callee_regs;
+		frame->ret_ip = ip;
+
+		regs = callee_regs;
+		code = callee->registers.bytecode;
+		ip = code;
+		DISPATCH();
+	}
+}
+
+// Handler addresses for the decoded records, filled in by interpret_decoded
+static const void **decoded_handlers;
+
+// @NOTE: the records live as long as the function does, the cost is one pass
+// over the code plus the records themselves
+Decode_Stats decode_function(Function *fn)
+{
+#if USE_COMPUTED_GOTO
+	if(!decoded_handlers)
+		interpret_decoded(NULL, NULL, NULL);
+#endif
+	Bytecode *code = &fn->code;
+	int *indexes = alloc_temp_memory(sizeof(int) * (code->i + 1));
+	int count = 0;
+	int table_records = 0;
+	for(int at = 0; at < code->i; at += get_instruction_size(code->bytecode + at))
+	{
+		indexes[at] = count++;
+		if(code->bytecode[at] == SWITCH)
+			table_records += 3 + read_dword(code->bytecode + at + 9);
+		else if(code->bytecode[at] == LOOPQW_LI || code->bytecode[at] == LOOPQW_LL)
+			table_records += 2;
+	}
+	indexes[code->i] = count;
+
+	// Jump tables go after the code, they're never dispatched to
+	if(fn->decoded)
+		VFree(fn->decoded);
+	Decoded_Instruction *result = VAlloc(sizeof(Decoded_Instruction) * (count + table_records));
+	memset(result + count, 0, sizeof(Decoded_Instruction) * table_records);
+	Decoded_Instruction *record = result;
+	Decoded_Instruction *table = result + count;
+	for(int at = 0; at < code->i; at += get_instruction_size(code->bytecode + at))
+	{
+		u8 *ip = code->bytecode + at;
+		OP op = ip[0];
+		u64 operand = 0;
+		switch(op)
+		{
+			case LOADB: case LOADW: case LOADDW: case LOADQW: case LOADF: case LOADD:
+			case STOREB: case STOREW: case STOREDW: case STOREQW: case STOREF: case STORED:
+			case TEEB: case TEEW: case TEEDW: case TEEQW: case TEEF: case TEED:
+			case GLOAD: case GSTORE:
+			{
+				operand = read_word(ip + 1);
+			} break;
+			case PUSHB:  op = PUSHQW; operand = (u64)(i64)(i8)ip[1]; break;
+			case PUSHW:  op = PUSHQW; operand = (u64)(i64)(i16)read_word(ip + 1); break;
+			case PUSHDW: op = PUSHQW; operand = (u64)(i64)(i32)read_dword(ip + 1); break;
+			case PUSHQW: op = PUSHQW; operand = read_qword(ip + 1); break;
+			case PUSHF:  op = PUSHQW; operand = read_dword(ip + 1); break;
+			case PUSHD:  op = PUSHQW; operand = read_qword(ip + 1); break;
+			case PUSHS:  op = PUSHQW; operand = (u64)string_pool[read_dword(ip + 1)]; break;
+			case CALL:
+			case TAILCALL:
+			{
+				operand = read_dword(ip + 1);
+			} break;
+			case RET:
+			{
+				operand = ip[1];
+			} break;
+			case HASHS:
+			{
+				operand = read_dword(ip + 1) | (u64)read_dword(ip + 5) << 32;
+			} break;
+			case SWITCH:
+			{
+				u32 entries = read_dword(ip + 9);
+				operand = table - result;
+				table[0].operand = read_qword(ip + 1);
+				table[1].operand = entries;
+				for(u32 i = 0; i <= entries; ++i)
+					table[2 + i].operand = indexes[read_dword(ip + 13 + 4 * i)];
+				table += 3 + entries;
+			} break;
+			case LOOPQW_LI: case LOOPQW_LL:
+			{
+				operand = table - result;
+				table[0].operand = indexes[read_dword(ip + 1)] | (u64)read_word(ip + 5) << 32;
+				table[1].operand = read_dword(ip + 7) |
+					(u64)(op == LOOPQW_LI ? read_dword(ip + 11) : read_word(ip + 11)) << 32;
+				table += 2;
+			} break;
+			case ADDQW_LL: case SUBQW_LL: case MULQW_LL:
+			{
+				operand = read_word(ip + 1) | (u64)read_word(ip + 3) << 16;
+			} break;
+			// Fields get their byte offset from the start of the cells
+			case FLOADB: case FLOADW: case FLOADDW: case FLOADQW: case FLOADF: case FLOADD:
+			case FSTOREB: case FSTOREW: case FSTOREDW: case FSTOREQW: case FSTOREF: case FSTORED:
+			case GFLOADB: case GFLOADW: case GFLOADDW: case GFLOADQW: case GFLOADF: case GFLOADD:
+			case GFSTOREB: case GFSTOREW: case GFSTOREDW: case GFSTOREQW: case GFSTOREF: case GFSTORED:
+			{
+				operand = (u64)read_word(ip + 1) * sizeof(u64) + read_word(ip + 3);
+			} break;
+			case ADDQW_LI: case SUBQW_LI: case MULQW_LI:
+			case EQQW_LI: case NEQW_LI: case LTQW_LI: case LEQW_LI: case GTQW_LI: case GEQW_LI:
+			{
+				operand = read_word(ip + 1) | (u64)read_dword(ip + 3) << 32;
+			} break;
+			default:
+			{
+				if(is_jump(op))
+					operand = indexes[read_dword(ip + 1)];
+			} break;
+		}
+		record->op = op;
+		record->operand = operand;
+		record->handler = decoded_handlers ? decoded_handlers[op] : NULL;
+		record++;
+	}
+	fn->decoded = result;
+
+	Decode_Stats stats = {.instructions = count, .bytes = sizeof(Decoded_Instruction) * (count + table_records)};
+	return stats;
+}
+
+// Fused ops have both operands packed in one: slot a in the low 16 bits, then
+// slot b in the next 16 or the immediate in the high 32
+#define DECODED_LL(op) { u64 a = locals[ip->operand & 0xFFFF]; u64 b = locals[(ip->operand >> 16) & 0xFFFF]; *++sp = a op b; ip += 1; DISPATCH(); }
+#define DECODED_LI(op) { u64 a = locals[ip->operand & 0xFFFF]; u64 b = (u64)(i64)(i32)(ip->operand >> 32); *++sp = a op b; ip += 1; DISPATCH(); }
+#define DECODED_COMPARE_LI(op) { i64 a = (i64)locals[ip->operand & 0xFFFF]; i64 b = (i32)(ip->operand >> 32); *++sp = a op b; ip += 1; DISPATCH(); }
+
+#define DECODED_FIELD_LOAD(cells, type)  { type value; memcpy(&value, (u8 *)(cells) + ip->operand, sizeof(value)); *++sp = (u64)value; ip += 1; DISPATCH(); }
+#define DECODED_FIELD_STORE(cells, type) { type value = (type)*sp--; memcpy((u8 *)(cells) + ip->operand, &value, sizeof(value)); ip += 1; DISPATCH(); }
+
+#define DECODED_JUMP_IF(condition) { ip = (condition) ? code + ip->operand : ip + 1; DISPATCH(); }
+#define DECODED_JUMP_IF_NOT(condition) DECODED_JUMP_IF(!(condition))
+
+// The operand is where its two records start, the target's record index and
+// the slot, then the step and the limit's immediate or slot
+#define DECODED_COUNTED_LOOP(limit) \
+{ \
+	Decoded_Instruction *table = code + ip->operand; \
+	u64 *counter = &locals[table[0].operand >> 32]; \
+	i64 value = (i64)(*counter + (u64)(i64)(i32)table[1].operand); \
+	*counter = (u64)value; \
+	ip = value < (limit) ? code + (u32)table[0].operand : ip + 1; \
+	DISPATCH(); \
+}
+
+#undef DISPATCH
+#if USE_COMPUTED_GOTO
+#define DISPATCH() goto *ip->handler
+#else
+#define DISPATCH() goto dispatch
+#endif
+
+// @NOTE: runs the decoded form of fn, everything it calls has to be decoded too.
+// Records are one to one with the stack instructions, so it dispatches exactly
+// as many times as interpret and doesn't profile. Called with no function it
+// only hands its handler addresses to decode_function
+u64 interpret_decoded(VM *vm, Function *fn, u64 *args)
+{
+#if USE_COMPUTED_GOTO
+	static const void *dispatch_table[OP_COUNT] = {
+		[NOP] = &&op_NOP,
+		[LOADB] = &&op_LOADB, [LOADW] = &&op_LOADW, [LOADDW] = &&op_LOADDW,
+		[LOADQW] = &&op_LOADQW, [LOADF] = &&op_LOADF, [LOADD] = &&op_LOADD,
+		[STOREB] = &&op_STOREB, [STOREW] = &&op_STOREW, [STOREDW] = &&op_STOREDW,
+		[STOREQW] = &&op_STOREQW, [STOREF] = &&op_STOREF, [STORED] = &&op_STORED,
+		[TEEB] = &&op_TEEB, [TEEW] = &&op_TEEW, [TEEDW] = &&op_TEEDW,
+		[TEEQW] = &&op_TEEQW, [TEEF] = &&op_TEEF, [TEED] = &&op_TEED,
+		[PUSHQW] = &&op_PUSHQW,
+		[ADDDW] = &&op_ADDDW, [ADDQW] = &&op_ADDQW, [ADDF] = &&op_ADDF, [ADDD] = &&op_ADDD,
+		[SUBDW] = &&op_SUBDW, [SUBQW] = &&op_SUBQW, [SUBF] = &&op_SUBF, [SUBD] = &&op_SUBD,
+		[MULDW] = &&op_MULDW, [MULQW] = &&op_MULQW, [MULF] = &&op_MULF, [MULD] = &&op_MULD,
+		[DIVDW] = &&op_DIVDW, [DIVQW] = &&op_DIVQW, [DIVF] = &&op_DIVF, [DIVD] = &&op_DIVD,
+		[MODDW] = &&op_MODDW, [MODQW] = &&op_MODQW,
+		[ANDDW] = &&op_ANDDW, [ANDQW] = &&op_ANDQW,
+		[ORDW] = &&op_ORDW, [ORQW] = &&op_ORQW,
+		[XORDW] = &&op_XORDW, [XORQW] = &&op_XORQW,
+		[SHLDW] = &&op_SHLDW, [SHLQW] = &&op_SHLQW,
+		[SHRDW] = &&op_SHRDW, [SHRQW] = &&op_SHRQW,
+		[EQDW] = &&op_EQDW, [EQQW] = &&op_EQQW, [EQF] = &&op_EQF, [EQD] = &&op_EQD,
+		[NEDW] = &&op_NEDW, [NEQW] = &&op_NEQW, [NEF] = &&op_NEF, [NED] = &&op_NED,
+		[LTDW] = &&op_LTDW, [LTQW] = &&op_LTQW, [LTF] = &&op_LTF, [LTD] = &&op_LTD,
+		[LEDW] = &&op_LEDW, [LEQW] = &&op_LEQW, [LEF] = &&op_LEF, [LED] = &&op_LED,
+		[GTDW] = &&op_GTDW, [GTQW] = &&op_GTQW, [GTF] = &&op_GTF, [GTD] = &&op_GTD,
+		[GEDW] = &&op_GEDW, [GEQW] = &&op_GEQW, [GEF] = &&op_GEF, [GED] = &&op_GED,
+		[GLOAD] = &&op_GLOAD, [GSTORE] = &&op_GSTORE,
+		[POP] = &&op_POP, [EQS] = &&op_EQS, [HASHS] = &&op_HASHS,
+		[JMP] = &&op_JMP, [JZ] = &&op_JZ, [JNZ] = &&op_JNZ,
+		[JEQDW] = &&op_JEQDW, [JEQQW] = &&op_JEQQW, [JEQF] = &&op_JEQF, [JEQD] = &&op_JEQD,
+		[JNEDW] = &&op_JNEDW, [JNEQW] = &&op_JNEQW, [JNEF] = &&op_JNEF, [JNED] = &&op_JNED,
+		[JLTDW] = &&op_JLTDW, [JLTQW] = &&op_JLTQW, [JLTF] = &&op_JLTF, [JLTD] = &&op_JLTD,
+		[JLEDW] = &&op_JLEDW, [JLEQW] = &&op_JLEQW, [JLEF] = &&op_JLEF, [JLED] = &&op_JLED,
+		[JGTDW] = &&op_JGTDW, [JGTQW] = &&op_JGTQW, [JGTF] = &&op_JGTF, [JGTD] = &&op_JGTD,
+		[JGEDW] = &&op_JGEDW, [JGEQW] = &&op_JGEQW, [JGEF] = &&op_JGEF, [JGED] = &&op_JGED,
+		[JNLTF] = &&op_JNLTF, [JNLTD] = &&op_JNLTD, [JNLEF] = &&op_JNLEF, [JNLED] = &&op_JNLED,
+		[JNGTF] = &&op_JNGTF, [JNGTD] = &&op_JNGTD, [JNGEF] = &&op_JNGEF, [JNGED] = &&op_JNGED,
+		[SWITCH] = &&op_SWITCH,
+		[CALL] = &&op_CALL, [CALLI] = &&op_CALLI, [RET] = &&op_RET, [TAILCALL] = &&op_TAILCALL,
+		[ADDQW_LL] = &&op_ADDQW_LL, [SUBQW_LL] = &&op_SUBQW_LL, [MULQW_LL] = &&op_MULQW_LL,
+		[ADDQW_LI] = &&op_ADDQW_LI, [SUBQW_LI] = &&op_SUBQW_LI, [MULQW_LI] = &&op_MULQW_LI,
+		[EQQW_LI] = &&op_EQQW_LI, [NEQW_LI] = &&op_NEQW_LI, [LTQW_LI] = &&op_LTQW_LI,
+		[LEQW_LI] = &&op_LEQW_LI, [GTQW_LI] = &&op_GTQW_LI, [GEQW_LI] = &&op_GEQW_LI,
+		[LOOPQW_LI] = &&op_LOOPQW_LI, [LOOPQW_LL] = &&op_LOOPQW_LL,
+		[FLOADB] = &&op_FLOADB, [FLOADW] = &&op_FLOADW, [FLOADDW] = &&op_FLOADDW,
+		[FLOADQW] = &&op_FLOADQW, [FLOADF] = &&op_FLOADF, [FLOADD] = &&op_FLOADD,
+		[FSTOREB] = &&op_FSTOREB, [FSTOREW] = &&op_FSTOREW, [FSTOREDW] = &&op_FSTOREDW,
+		[FSTOREQW] = &&op_FSTOREQW, [FSTOREF] = &&op_FSTOREF, [FSTORED] = &&op_FSTORED,
+		[GFLOADB] = &&op_GFLOADB, [GFLOADW] = &&op_GFLOADW, [GFLOADDW] = &&op_GFLOADDW,
+		[GFLOADQW] = &&op_GFLOADQW, [GFLOADF] = &&op_GFLOADF, [GFLOADD] = &&op_GFLOADD,
+		[GFSTOREB] = &&op_GFSTOREB, [GFSTOREW] = &&op_GFSTOREW, [GFSTOREDW] = &&op_GFSTOREDW,
+		[GFSTOREQW] = &&op_GFSTOREQW, [GFSTOREF] = &&op_GFSTOREF, [GFSTORED] = &&op_GFSTORED,
+		[NARROWB] = &&op_NARROWB, [NARROWW] = &&op_NARROWW,
+	};
+	if(!fn)
+	{
+		decoded_handlers = dispatch_table;
+		return 0;
+	}
+#endif
+
+	u64 *globals = vm->globals;
+	u64 *sp = vm->stack_top;
+	Call_Frame *entry = vm->frame_top;
+	Call_Frame *frame = entry;
+	frame->function = fn;
+	frame->locals = vm->locals_top;
+	frame->ret_ip = NULL;
+	u64 *locals = frame->locals;
+	assert(fn->decoded);
+	Decoded_Instruction *code = fn->decoded;
+	Decoded_Instruction *ip = code;
+	Function *callee = NULL;
+
+	if(locals + fn->frame_size > vm->locals + VM_LOCALS_SIZE ||
+			sp + fn->max_stack >= vm->stack + VM_STACK_SIZE)
+		runtime_error("Stack overflow");
+	if(fn->arg_count)
+		memcpy(locals, args, sizeof(u64) * fn->arg_count);
+
+#if USE_COMPUTED_GOTO
+	DISPATCH();
+#else
+dispatch:
+#endif
+	switch((OP)ip->op)
+	{
+		TARGET(NOP): { ip += 1; DISPATCH(); }
+
+		TARGET(LOADB):  { *++sp = (u64)(i64)(i8)locals[ip->operand];  ip += 1; DISPATCH(); }
+		TARGET(LOADW):  { *++sp = (u64)(i64)(i16)locals[ip->operand]; ip += 1; DISPATCH(); }
+		TARGET(LOADDW): { *++sp = (u64)(i64)(i32)locals[ip->operand]; ip += 1; DISPATCH(); }
+		TARGET(LOADQW): { *++sp = locals[ip->operand];                 ip += 1; DISPATCH(); }
+		TARGET(LOADF):  { *++sp = (u32)locals[ip->operand];            ip += 1; DISPATCH(); }
+		TARGET(LOADD):  { *++sp = locals[ip->operand];                 ip += 1; DISPATCH(); }
+
+		TARGET(STOREB):  { locals[ip->operand] = (u64)(i64)(i8)*sp--;  ip += 1; DISPATCH(); }
+		TARGET(STOREW):  { locals[ip->operand] = (u64)(i64)(i16)*sp--; ip += 1; DISPATCH(); }
+		TARGET(STOREDW): { locals[ip->operand] = (u64)(i64)(i32)*sp--; ip += 1; DISPATCH(); }
+		TARGET(STOREQW): { locals[ip->operand] = *sp--;                ip += 1; DISPATCH(); }
+		TARGET(STOREF):  { locals[ip->operand] = (u32)*sp--;           ip += 1; DISPATCH(); }
+		TARGET(STORED):  { locals[ip->operand] = *sp--;                ip += 1; DISPATCH(); }
+
+		TARGET(TEEB):  { *sp = locals[ip->operand] = (u64)(i64)(i8)*sp;  ip += 1; DISPATCH(); }
+		TARGET(TEEW):  { *sp = locals[ip->operand] = (u64)(i64)(i16)*sp; ip += 1; DISPATCH(); }
+		TARGET(TEEDW): { *sp = locals[ip->operand] = (u64)(i64)(i32)*sp; ip += 1; DISPATCH(); }
+		TARGET(TEEQW): { locals[ip->operand] = *sp;                      ip += 1; DISPATCH(); }
+		TARGET(TEEF):  { *sp = locals[ip->operand] = (u32)*sp;           ip += 1; DISPATCH(); }
+		TARGET(TEED):  { locals[ip->operand] = *sp;                      ip += 1; DISPATCH(); }
+
+		TARGET(PUSHQW): { *++sp = ip->operand; ip += 1; DISPATCH(); }
+
+		TARGET(ADDDW): BINARY_DW(+)
+		TARGET(ADDQW): BINARY_QW(+)
+		TARGET(ADDF):  BINARY_F(+)
+		TARGET(ADDD):  BINARY_D(+)
+
+		TARGET(SUBDW): BINARY_DW(-)
+		TARGET(SUBQW): BINARY_QW(-)
+		TARGET(SUBF):  BINARY_F(-)
+		TARGET(SUBD):  BINARY_D(-)
+
+		TARGET(MULDW): BINARY_DW(*)
+		TARGET(MULQW): BINARY_QW(*)
+		TARGET(MULF):  BINARY_F(*)
+		TARGET(MULD):  BINARY_D(*)
+
+		TARGET(DIVDW):
+		{
+			i32 b = (i32)sp[0];
+			i32 a = (i32)sp[-1];
+			if(b == 0)
+				runtime_error("Integer division by zero");
+			--sp;
+			*sp = (u64)(i64)(b == -1 ? (i32)(0u - (u32)a) : a / b);
+			ip += 1;
+			DISPATCH();
+		}
+		TARGET(DIVQW):
+		{
+			i64 b = (i64)sp[0];
+			i64 a = (i64)sp[-1];
+			if(b == 0)
+				runtime_error("Integer division by zero");
+			--sp;
+			*sp = b == -1 ? 0 - (u64)a : (u64)(a / b);
+			ip += 1;
+			DISPATCH();
+		}
+		TARGET(DIVF): BINARY_F(/)
+		TARGET(DIVD): BINARY_D(/)
+
+		TARGET(MODDW):
+		{
+			i32 b = (i32)sp[0];
+			i32 a = (i32)sp[-1];
+			if(b == 0)
+				runtime_error("Integer division by zero");
+			--sp;
+			*sp = (u64)(i64)(b == -1 ? 0 : a % b);
+			ip += 1;
+			DISPATCH();
+		}
+		TARGET(MODQW):
+		{
+			i64 b = (i64)sp[0];
+			i64 a = (i64)sp[-1];
+			if(b == 0)
+				runtime_error("Integer division by zero");
+			--sp;
+			*sp = (u64)(b == -1 ? 0 : a % b);
+			ip += 1;
+			DISPATCH();
+		}
+
+		TARGET(ANDDW): BINARY_DW(&)
+		TARGET(ANDQW): BINARY_QW(&)
+		TARGET(ORDW):  BINARY_DW(|)
+		TARGET(ORQW):  BINARY_QW(|)
+		TARGET(XORDW): BINARY_DW(^)
+		TARGET(XORQW): BINARY_QW(^)
+
+		TARGET(SHLDW): { u32 b = (u32)sp[0]; u32 a = (u32)sp[-1]; --sp; *sp = (u64)(i64)(i32)(a << (b & 31)); ip += 1; DISPATCH(); }
+		TARGET(SHLQW): { u64 b = sp[0]; u64 a = sp[-1]; --sp; *sp = a << (b & 63); ip += 1; DISPATCH(); }
+		TARGET(SHRDW): { u32 b = (u32)sp[0]; i32 a = (i32)sp[-1]; --sp; *sp = (u64)(i64)(a >> (b & 31)); ip += 1; DISPATCH(); }
+		TARGET(SHRQW): { u64 b = sp[0]; i64 a = (i64)sp[-1]; --sp; *sp = (u64)(a >> (b & 63)); ip += 1; DISPATCH(); }
+
+		TARGET(EQDW): COMPARE_DW(==)
+		TARGET(EQQW): COMPARE_QW(==)
+		TARGET(EQF):  COMPARE_F(==)
+		TARGET(EQD):  COMPARE_D(==)
+
+		TARGET(NEDW): COMPARE_DW(!=)
+		TARGET(NEQW): COMPARE_QW(!=)
+		TARGET(NEF):  COMPARE_F(!=)
+		TARGET(NED):  COMPARE_D(!=)
+
+		TARGET(LTDW): COMPARE_DW(<)
+		TARGET(LTQW): COMPARE_QW(<)
+		TARGET(LTF):  COMPARE_F(<)
+		TARGET(LTD):  COMPARE_D(<)
+
+		TARGET(LEDW): COMPARE_DW(<=)
+		TARGET(LEQW): COMPARE_QW(<=)
+		TARGET(LEF):  COMPARE_F(<=)
+		TARGET(LED):  COMPARE_D(<=)
+
+		TARGET(GTDW): COMPARE_DW(>)
+		TARGET(GTQW): COMPARE_QW(>)
+		TARGET(GTF):  COMPARE_F(>)
+		TARGET(GTD):  COMPARE_D(>)
+
+		TARGET(GEDW): COMPARE_DW(>=)
+		TARGET(GEQW): COMPARE_QW(>=)
+		TARGET(GEF):  COMPARE_F(>=)
+		TARGET(GED):  COMPARE_D(>=)
+
+		TARGET(ADDQW_LL): DECODED_LL(+)
+		TARGET(SUBQW_LL): DECODED_LL(-)
+		TARGET(MULQW_LL): DECODED_LL(*)
+		TARGET(ADDQW_LI): DECODED_LI(+)
+		TARGET(SUBQW_LI): DECODED_LI(-)
+		TARGET(MULQW_LI): DECODED_LI(*)
+		TARGET(EQQW_LI): DECODED_COMPARE_LI(==)
+		TARGET(NEQW_LI): DECODED_COMPARE_LI(!=)
+		TARGET(LTQW_LI): DECODED_COMPARE_LI(<)
+		TARGET(LEQW_LI): DECODED_COMPARE_LI(<=)
+		TARGET(GTQW_LI): DECODED_COMPARE_LI(>)
+		TARGET(GEQW_LI): DECODED_COMPARE_LI(>=)
+		TARGET(LOOPQW_LI): DECODED_COUNTED_LOOP((i32)(table[1].operand >> 32))
+		TARGET(LOOPQW_LL): DECODED_COUNTED_LOOP((i64)locals[table[1].operand >> 32])
+
+		TARGET(GLOAD):  { *++sp = globals[ip->operand]; ip += 1; DISPATCH(); }
+		TARGET(GSTORE): { globals[ip->operand] = *sp--; ip += 1; DISPATCH(); }
+
+		TARGET(FLOADB):    DECODED_FIELD_LOAD(locals, i8)
+		TARGET(FLOADW):    DECODED_FIELD_LOAD(locals, i16)
+		TARGET(FLOADDW):   DECODED_FIELD_LOAD(locals, i32)
+		TARGET(FLOADQW):   DECODED_FIELD_LOAD(locals, u64)
+		TARGET(FLOADF):    DECODED_FIELD_LOAD(locals, u32)
+		TARGET(FLOADD):    DECODED_FIELD_LOAD(locals, u64)
+		TARGET(FSTOREB):   DECODED_FIELD_STORE(locals, u8)
+		TARGET(FSTOREW):   DECODED_FIELD_STORE(locals, u16)
+		TARGET(FSTOREDW):  DECODED_FIELD_STORE(locals, u32)
+		TARGET(FSTOREQW):  DECODED_FIELD_STORE(locals, u64)
+		TARGET(FSTOREF):   DECODED_FIELD_STORE(locals, u32)
+		TARGET(FSTORED):   DECODED_FIELD_STORE(locals, u64)
+		TARGET(GFLOADB):   DECODED_FIELD_LOAD(globals, i8)
+		TARGET(GFLOADW):   DECODED_FIELD_LOAD(globals, i16)
+		TARGET(GFLOADDW):  DECODED_FIELD_LOAD(globals, i32)
+		TARGET(GFLOADQW):  DECODED_FIELD_LOAD(globals, u64)
+		TARGET(GFLOADF):   DECODED_FIELD_LOAD(globals, u32)
+		TARGET(GFLOADD):   DECODED_FIELD_LOAD(globals, u64)
+		TARGET(GFSTOREB):  DECODED_FIELD_STORE(globals, u8)
+		TARGET(GFSTOREW):  DECODED_FIELD_STORE(globals, u16)
+		TARGET(GFSTOREDW): DECODED_FIELD_STORE(globals, u32)
+		TARGET(GFSTOREQW): DECODED_FIELD_STORE(globals, u64)
+		TARGET(GFSTOREF):  DECODED_FIELD_STORE(globals, u32)
+		TARGET(GFSTORED):  DECODED_FIELD_STORE(globals, u64)
+		TARGET(NARROWB):   { *sp = (u64)(i64)(i8)*sp;  ip += 1; DISPATCH(); }
+		TARGET(NARROWW):   { *sp = (u64)(i64)(i16)*sp; ip += 1; DISPATCH(); }
+
+		TARGET(POP): { --sp; ip += 1; DISPATCH(); }
+		TARGET(EQS):
+		{
+			char *b = (char *)sp[0];
+			char *a = (char *)sp[-1];
+			--sp;
+			*sp = a == b || strcmp(a, b) == 0;
+			ip += 1;
+			DISPATCH();
+		}
+		TARGET(HASHS): { *sp = hash_string((char *)*sp, (u32)ip->operand) & (u32)(ip->operand >> 32); ip += 1; DISPATCH(); }
+
+		TARGET(JMP): { ip = code + ip->operand; DISPATCH(); }
+		TARGET(JZ):  DECODED_JUMP_IF(*sp-- == 0)
+		TARGET(JNZ): DECODED_JUMP_IF(*sp-- != 0)
+
+		TARGET(JEQDW): BRANCH_DW(DECODED_JUMP_IF, ==)
+		TARGET(JEQQW): BRANCH_QW(DECODED_JUMP_IF, ==)
+		TARGET(JEQF):  BRANCH_F(DECODED_JUMP_IF, ==)
+		TARGET(JEQD):  BRANCH_D(DECODED_JUMP_IF, ==)
+
+		TARGET(JNEDW): BRANCH_DW(DECODED_JUMP_IF, !=)
+		TARGET(JNEQW): BRANCH_QW(DECODED_JUMP_IF, !=)
+		TARGET(JNEF):  BRANCH_F(DECODED_JUMP_IF, !=)
+		TARGET(JNED):  BRANCH_D(DECODED_JUMP_IF, !=)
+
+		TARGET(JLTDW): BRANCH_DW(DECODED_JUMP_IF, <)
+		TARGET(JLTQW): BRANCH_QW(DECODED_JUMP_IF, <)
+		TARGET(JLTF):  BRANCH_F(DECODED_JUMP_IF, <)
+		TARGET(JLTD):  BRANCH_D(DECODED_JUMP_IF, <)
+
+		TARGET(JLEDW): BRANCH_DW(DECODED_JUMP_IF, <=)
+		TARGET(JLEQW): BRANCH_QW(DECODED_JUMP_IF, <=)
+		TARGET(JLEF):  BRANCH_F(DECODED_JUMP_IF, <=)
+		TARGET(JLED):  BRANCH_D(DECODED_JUMP_IF, <=)
+
+		TARGET(JGTDW): BRANCH_DW(DECODED_JUMP_IF, >)
+		TARGET(JGTQW): BRANCH_QW(DECODED_JUMP_IF, >)
+		TARGET(JGTF):  BRANCH_F(DECODED_JUMP_IF, >)
+		TARGET(JGTD):  BRANCH_D(DECODED_JUMP_IF, >)
+
+		TARGET(JGEDW): BRANCH_DW(DECODED_JUMP_IF, >=)
+		TARGET(JGEQW): BRANCH_QW(DECODED_JUMP_IF, >=)
+		TARGET(JGEF):  BRANCH_F(DECODED_JUMP_IF, >=)
+		TARGET(JGED):  BRANCH_D(DECODED_JUMP_IF, >=)
+
+		TARGET(JNLTF): BRANCH_F(DECODED_JUMP_IF_NOT, <)
+		TARGET(JNLTD): BRANCH_D(DECODED_JUMP_IF_NOT, <)
+		TARGET(JNLEF): BRANCH_F(DECODED_JUMP_IF_NOT, <=)
+		TARGET(JNLED): BRANCH_D(DECODED_JUMP_IF_NOT, <=)
+		TARGET(JNGTF): BRANCH_F(DECODED_JUMP_IF_NOT, >)
+		TARGET(JNGTD): BRANCH_D(DECODED_JUMP_IF_NOT, >)
+		TARGET(JNGEF): BRANCH_F(DECODED_JUMP_IF_NOT, >=)
+		TARGET(JNGED): BRANCH_D(DECODED_JUMP_IF_NOT, >=)
+
+		// The operand is where the table's records start: low, entry count,
+		// default and then the entries, each one a record index
+		TARGET(SWITCH):
+		{
+			Decoded_Instruction *table = code + ip->operand;
+			u64 index = *sp-- - table[0].operand;
+			ip = code + (index < table[1].operand ? table[3 + index].operand : table[2].operand);
+			DISPATCH();
+		}
+
+		TARGET(CALL):
+		{
+			callee = &functions[ip->operand];
+			ip += 1;
+			goto do_call;
+		}
+		TARGET(CALLI):
+		{
+			callee = &functions[*sp--];
+			ip += 1;
+			goto do_call;
+		}
+		TARGET(RET):
+		{
+			b32 has_value = ip->operand;
+			u64 result = has_value ? *sp-- : 0;
+			if(frame == entry)
+			{
+				vm->stack_top = sp;
+				return result;
+			}
+			ip = frame->ret_ip;
+			frame--;
+			locals = frame->locals;
+			code = frame->function->decoded;
+			if(has_value)
+				*++sp = result;
+			DISPATCH();
+		}
+		TARGET(TAILCALL):
+		{
+			callee = &functions[ip->operand];
+			if(locals + callee->frame_size > vm->locals + VM_LOCALS_SIZE ||
+					sp + callee->max_stack >= vm->stack + VM_STACK_SIZE)
+				runtime_error("Stack overflow");
+			assert(callee->decoded);
+
+			frame->function = callee;
+			int arg_count = callee->arg_count;
+			sp -= arg_count;
+			memcpy(locals, sp + 1, sizeof(u64) * arg_count);
+			code = callee->decoded;
+			ip = code;
+			DISPATCH();
+		}
+		default: break;
+	}
+	assert(false);
+	return 0;
+
+do_call:
+	{
+		u64 *callee_locals = locals + frame->function->frame_size;
+		if(frame + 1 >= vm->frames + VM_MAX_FRAMES)
+			runtime_error("Stack overflow, too many nested calls");
+		if(callee_locals + callee->frame_size > vm->locals + VM_LOCALS_SIZE ||
+				sp + callee->max_stack >= vm->stack + VM_STACK_SIZE)
+			runtime_error("Stack overflow");
+		assert(callee->decoded);
+
+		frame++;
+		frame->function = callee;
+		frame->locals = callee_locals;
+		frame->ret_ip = ip;
+
+		int arg_count = callee->arg_count;
+		sp -= arg_count;
+		memcpy(callee_locals, sp + 1, sizeof(u64) * arg_count);
+
+		locals = callee_locals;
+		code = callee->decoded;
+		ip = code;
+		DISPATCH();
+	}
+}
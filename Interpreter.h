@@ -0,0 +1,88 @@
+#ifndef _INTERPRETER_H
+#define _INTERPRETER_H
+
+#include "Basic.h"
+#include "Bytecode.h"
+#include "Register.h"
+#include "Profiler.h"
+
+// @NOTE: computed goto is a GNU extension, everything else dispatches with a switch
+#if !defined(USE_COMPUTED_GOTO)
+#if defined(__GNUC__) || defined(__clang__)
+#define USE_COMPUTED_GOTO 1
+#else
+#define USE_COMPUTED_GOTO 0
+#endif
+#endif
+
+#define VM_STACK_SIZE   (1 << 20) // in values
+#define VM_LOCALS_SIZE  (1 << 20) // in values
+#define VM_GLOBALS_SIZE (1 << 16) // a global slot is 16 bits
+#define VM_MAX_FRAMES   (1 << 16)
+
+typedef struct
+{
+	Function *function;
+	void *ret_ip;   // a code pointer or a Decoded_Instruction, depending on the VM
+	u64 *locals;
+} Call_Frame;
+
+// @NOTE: every value is a 64 bit cell, ints are kept sign extended, f32s are
+// in the low 32 bits, strings are pointers and functions are indexes
+typedef struct
+{
+	u64 *stack;      // Operand stack, grows up
+	u64 *locals;     // Frames sit next to each other, arguments first. The
+	                 // register VM uses these as its registers
+	u64 *globals;
+	Call_Frame *frames;
+
+	// Where the next interpret starts, nested runs stack on top of each other
+	u64 *stack_top;
+	u64 *locals_top;
+	Call_Frame *frame_top;
+
+	// Calls and loop backedges are counted per function and hot functions are
+	// switched to native code, see Tier.c
+	b32 tiering;
+
+	// Hot loops are recorded and run as native traces, see Trace.c. recording
+	// is on while the interpreter shows every op it runs to the recorder
+	b32 tracing;
+	b32 recording;
+
+	// Only counted when profiling is on, the normal dispatch doesn't pay for it
+	b32 profiling;
+	u64 dispatch_count;
+	u64 op_counts[OP_COUNT];
+	u64 register_op_counts[R_OP_COUNT];
+	Op_Profile *sequences; // stack code only, NULL if it's not wanted
+} VM;
+
+// @NOTE: stack code decoded ahead of time into fixed size records, one per
+// instruction. Pushes of every kind become one push of the final value, jump
+// targets are record indexes and the handler is the address the interpreter
+// jumps to, so running it doesn't touch the byte stream at all
+typedef struct _Decoded_Instruction
+{
+	const void *handler; // NULL when dispatching with a switch
+	u64 operand;         // slot, value, target record or function index
+	u8 op;
+} Decoded_Instruction;
+
+typedef struct
+{
+	int instructions;
+	int bytes; // size of the records, against the code's size
+} Decode_Stats;
+
+void init_vm(VM *vm);
+void reset_vm_stacks(VM *vm);
+u64 interpret(VM *vm, Function *fn, u64 *args);
+u64 interpret_registers(VM *vm, Function *fn, u64 *args);
+u64 interpret_decoded(VM *vm, Function *fn, u64 *args);
+Decode_Stats decode_function(Function *fn);
+void print_value(u64 value, const Type_Info *type);
+void runtime_error(const char *error);
+
+#endif // _INTERPRETER_H
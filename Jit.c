@@ -0,0 +1,1210 @@
+#include "Jit.h"
+#include "Error.h"
+#include "Tier.h"
+#include <assert.h>
+#include <stddef.h>
+
+static Jit_Runtime runtime;
+
+// Set while jit_compile_relocatable runs, addresses in this process are
+// recorded here instead of being written into the code
+static Jit_Relocation **relocating;
+
+static struct
+{
+	u8 *code;       // JIT_CODE_SIZE reserved, pages are only writable while a function is copied in
+	int used;
+	void **entries; // JIT_MAX_FUNCTIONS of them
+	int page_size;
+} jit;
+
+#if JIT_SUPPORTED
+
+// @NOTE: every function that doesn't have native code is entered through
+// here, it runs the stack code with interpret from the frame the native caller
+// set up. Everything the interpreted function calls is interpreted too, unless
+// it's tiering and the function gets hot enough to be compiled
+static u64 jit_interpreter_entry(u64 *locals, u64 *stack, Jit_Runtime *rt, i32 index)
+{
+	Function *fn = &functions[index];
+	if(rt->vm->tiering && tier_enter(fn))
+		return ((Jit_Entry)fn->native)(locals, stack, rt, index);
+	if(rt->depth + 1 >= VM_MAX_FRAMES)
+		runtime_error("Stack overflow, too many nested calls");
+
+	VM *vm = rt->vm;
+	u64 *stack_top = vm->stack_top;
+	u64 *locals_top = vm->locals_top;
+	Call_Frame *frame_top = vm->frame_top;
+	vm->stack_top = stack;
+	vm->locals_top = locals;
+	vm->frame_top = vm->frames + rt->depth + 1;
+
+	// interpret copies the arguments in itself, they can't be copied onto themselves
+	u64 args[256];
+	memcpy(args, locals, sizeof(u64) * fn->arg_count);
+	u64 result = interpret(vm, fn, args);
+
+	vm->stack_top = stack_top;
+	vm->locals_top = locals_top;
+	vm->frame_top = frame_top;
+	return result;
+}
+
+const char *jit_error_messages[JIT_ERROR_COUNT] = {
+	[JIT_ERROR_DIVISION] = "Integer division by zero",
+	[JIT_ERROR_FRAMES]   = "Stack overflow, too many nested calls",
+	[JIT_ERROR_STACK]    = "Stack overflow",
+};
+
+// @NOTE: in the generated code rbx holds the locals, r12 the operand stack
+// base, r13 the globals, r14 the Jit_Runtime and r15 the entry table. Operand
+// stack depth d lives in cached_registers[d - 1] if it's one of the first
+// JIT_CACHED_DEPTHS and in r12[d] if it isn't. Depths are the same at every
+// instruction however it's reached, so the mapping is fixed and nothing has
+// to be reconciled at jumps. rax, rcx and rdx are scratch
+static const X64_Register cached_registers[JIT_CACHED_DEPTHS] = {RSI, RDI, R8, R9, R10, R11};
+
+// A jump table entry, it's written as the target's distance from the table's start
+typedef struct
+{
+	int at;
+	int table;
+	int target; // bytecode offset
+} Jit_Table_Entry;
+
+typedef struct
+{
+	Bytecode out;
+	Function *fn;
+	int *native_offsets;   // per bytecode offset
+	Jit_Fixup *jumps;      // stb_ds array
+	Jit_Fixup *errors;     // stb_ds array
+	Jit_Table_Entry *table_entries; // stb_ds array
+} Jit_Compiler;
+
+X64_Operand reg_operand(X64_Register reg)
+{
+	X64_Operand result = {.is_register = true, .reg = reg};
+	return result;
+}
+
+X64_Operand mem_operand(X64_Register base, i32 disp)
+{
+	X64_Operand result = {.is_register = false, .reg = base, .disp = disp};
+	return result;
+}
+
+static X64_Operand depth_operand(int depth)
+{
+	assert(depth >= 1);
+	if(depth <= JIT_CACHED_DEPTHS)
+		return reg_operand(cached_registers[depth - 1]);
+	return mem_operand(R12, depth * 8);
+}
+
+static X64_Operand slot_operand(int slot)
+{
+	return mem_operand(RBX, slot * 8);
+}
+
+static X64_Operand runtime_operand(int offset)
+{
+	return mem_operand(R14, offset);
+}
+
+static void emit_modrm(Bytecode *c, int reg, X64_Operand rm)
+{
+	reg &= 7;
+	if(rm.is_register)
+	{
+		push_byte(0xC0 | reg << 3 | (rm.reg & 7), c);
+		return;
+	}
+	// rbp and r13 always need a displacement, rsp and r12 always need a SIB
+	int base = rm.reg & 7;
+	int mod = rm.disp == 0 && base != RBP ? 0 : rm.disp >= -128 && rm.disp <= 127 ? 1 : 2;
+	push_byte(mod << 6 | reg << 3 | base, c);
+	if(base == RSP)
+		push_byte(0x24, c);
+	if(mod == 1)
+		push_byte((u8)rm.disp, c);
+	else if(mod == 2)
+		push_dword((u32)rm.disp, c);
+}
+
+// @NOTE: emits prefix, REX, opcode (up to 3 bytes, written as one number) and
+// ModRM. reg is a register or the opcode extension of a /n instruction
+void emit_x64(Bytecode *c, u8 prefix, b32 w, u32 opcode, int reg, X64_Operand rm)
+{
+	if(prefix)
+		push_byte(prefix, c);
+	u8 rex = (w ? 8 : 0) | (reg & 8 ? 4 : 0) | (rm.reg & 8 ? 1 : 0);
+	if(rex)
+		push_byte(0x40 | rex, c);
+	if(opcode > 0xFFFF)
+		push_byte(opcode >> 16, c);
+	if(opcode > 0xFF)
+		push_byte((opcode >> 8) & 0xFF, c);
+	push_byte(opcode & 0xFF, c);
+	emit_modrm(c, reg, rm);
+}
+
+void emit_push(Bytecode *c, X64_Register reg)
+{
+	if(reg & 8)
+		push_byte(0x41, c);
+	push_byte(0x50 + (reg & 7), c);
+}
+
+void emit_pop(Bytecode *c, X64_Register reg)
+{
+	if(reg & 8)
+		push_byte(0x41, c);
+	push_byte(0x58 + (reg & 7), c);
+}
+
+void emit_mov_imm64(Bytecode *c, X64_Register reg, u64 value)
+{
+	push_byte(0x48 | (reg & 8 ? 1 : 0), c);
+	push_byte(0xB8 + (reg & 7), c);
+	push_qword(value, c);
+}
+
+// A mov of an address the object writer fills in, see jit_compile_relocatable
+static void emit_relocated(Bytecode *c, X64_Register reg, Jit_Relocation_Kind kind, int index)
+{
+	emit_mov_imm64(c, reg, 0);
+	Jit_Relocation relocation = {.at = c->i - 8, .kind = kind, .index = index};
+	arrput(*relocating, relocation);
+}
+
+static void emit_call_absolute(Bytecode *c, void *target)
+{
+	emit_mov_imm64(c, RAX, (u64)target);
+	emit_x64(c, 0, false, 0xFF, 2, reg_operand(RAX));
+}
+
+// Copies a 64 bit cell, memory to memory goes through scratch
+static void emit_copy(Bytecode *c, X64_Operand dst, X64_Operand src, X64_Register scratch)
+{
+	if(dst.is_register)
+	{
+		if(!src.is_register || src.reg != dst.reg)
+			emit_x64(c, 0, true, 0x8B, dst.reg, src);
+	}
+	else if(src.is_register)
+	{
+		emit_x64(c, 0, true, 0x89, src.reg, dst);
+	}
+	else
+	{
+		emit_x64(c, 0, true, 0x8B, scratch, src);
+		emit_x64(c, 0, true, 0x89, scratch, dst);
+	}
+}
+
+void emit_mov(Bytecode *c, X64_Operand dst, X64_Operand src)
+{
+	emit_copy(c, dst, src, RAX);
+}
+
+void emit_immediate(Bytecode *c, X64_Operand dst, u64 value)
+{
+	if((i64)value == (i64)(i32)value)
+	{
+		emit_x64(c, 0, true, 0xC7, 0, dst);
+		push_dword((u32)value, c);
+	}
+	else if(dst.is_register)
+	{
+		emit_mov_imm64(c, dst.reg, value);
+	}
+	else
+	{
+		emit_mov_imm64(c, RAX, value);
+		emit_x64(c, 0, true, 0x89, RAX, dst);
+	}
+}
+
+// How each width is read out of a cell, in the order of the LOAD and STORE ops
+static const struct { u32 opcode; b32 w; } narrowing_loads[6] = {
+	{0x0FBE, true},  // movsx r64, r/m8
+	{0x0FBF, true},  // movsx r64, r/m16
+	{0x63,   true},  // movsxd r64, r/m32
+	{0x8B,   true},  // mov r64, r/m64
+	{0x8B,   false}, // mov r32, r/m32, zero extends
+	{0x8B,   true},
+};
+
+// Reads src narrowed to width (0 for bytes through 5 for doubles) into dst
+void emit_narrow(Bytecode *c, int width, X64_Operand dst, X64_Operand src)
+{
+	if(narrowing_loads[width].opcode == 0x8B && narrowing_loads[width].w)
+	{
+		emit_mov(c, dst, src);
+		return;
+	}
+	X64_Register reg = dst.is_register ? dst.reg : RAX;
+	emit_x64(c, 0, narrowing_loads[width].w, narrowing_loads[width].opcode, reg, src);
+	if(!dst.is_register)
+		emit_x64(c, 0, true, 0x89, RAX, dst);
+}
+
+// Materializes the flags as a b32 in dst
+static void emit_set_condition(Bytecode *c, X64_Condition condition, X64_Operand dst)
+{
+	emit_x64(c, 0, false, 0x0F90 + condition, 0, reg_operand(RAX));
+	X64_Register reg = dst.is_register ? dst.reg : RAX;
+	emit_x64(c, 0, false, 0x0FB6, reg, reg_operand(RAX));
+	if(!dst.is_register)
+		emit_x64(c, 0, true, 0x89, RAX, dst);
+}
+
+void emit_error_jump(Bytecode *c, Jit_Fixup **errors, X64_Condition condition, Jit_Error error)
+{
+	push_byte(0x0F, c);
+	push_byte(0x80 + condition, c);
+	Jit_Fixup fixup = {.at = c->i, .target = error};
+	arrput(*errors, fixup);
+	push_dword(0, c);
+}
+
+// One call to runtime_error per kind of error that's jumped to, at the end of the code
+void emit_error_stubs(Bytecode *c, Jit_Fixup *errors)
+{
+	int stubs[JIT_ERROR_COUNT];
+	for(int i = 0; i < JIT_ERROR_COUNT; ++i)
+		stubs[i] = -1;
+	for(int i = 0; i < arrlen(errors); ++i)
+	{
+		Jit_Fixup fixup = errors[i];
+		if(stubs[fixup.target] < 0)
+		{
+			stubs[fixup.target] = c->i;
+			if(relocating)
+			{
+				emit_relocated(c, RDI, JIT_RELOCATION_MESSAGE, fixup.target);
+				emit_relocated(c, RAX, JIT_RELOCATION_ERROR, 0);
+				emit_x64(c, 0, false, 0xFF, 2, reg_operand(RAX));
+			}
+			else
+			{
+				emit_mov_imm64(c, RDI, (u64)jit_error_messages[fixup.target]);
+				emit_call_absolute(c, runtime_error);
+			}
+		}
+		patch_dword(stubs[fixup.target] - (fixup.at + 4), fixup.at, c);
+	}
+}
+
+// Short jumps inside one op's sequence, patched with patch_short_jump
+static int emit_short_jump(Bytecode *c, int condition)
+{
+	push_byte(condition < 0 ? 0xEB : 0x70 + condition, c);
+	push_byte(0, c);
+	return c->i - 1;
+}
+
+static void patch_short_jump(Bytecode *c, int at)
+{
+	int distance = c->i - (at + 1);
+	assert(distance < 128);
+	c->bytecode[at] = (u8)distance;
+}
+
+// A short jump back to an earlier offset of the same sequence
+static void emit_short_jump_back(Bytecode *c, int condition, int target)
+{
+	int distance = target - (c->i + 2);
+	assert(distance >= -128);
+	push_byte(condition < 0 ? 0xEB : 0x70 + condition, c);
+	push_byte((u8)distance, c);
+}
+
+// a = a op b for the integer ops that have an r, r/m form. DW results are sign
+// extended back to the whole cell like the interpreter does it
+static void emit_int_binary(Bytecode *c, u32 opcode, b32 w, X64_Operand a, X64_Operand b)
+{
+	X64_Register reg = a.is_register ? a.reg : RAX;
+	if(!a.is_register)
+		emit_x64(c, 0, w, 0x8B, RAX, a);
+	emit_x64(c, 0, w, opcode, reg, b);
+	if(!w)
+		emit_x64(c, 0, true, 0x63, reg, reg_operand(reg));
+	if(!a.is_register)
+		emit_x64(c, 0, true, 0x89, RAX, a);
+}
+
+static void emit_shift(Bytecode *c, int extension, b32 w, X64_Operand a, X64_Operand b)
+{
+	// The hardware masks the count to 31 or 63 the same way the interpreter does
+	emit_x64(c, 0, false, 0x8B, RCX, b);
+	X64_Register reg = a.is_register ? a.reg : RAX;
+	if(!a.is_register)
+		emit_x64(c, 0, w, 0x8B, RAX, a);
+	emit_x64(c, 0, w, 0xD3, extension, reg_operand(reg));
+	if(!w)
+		emit_x64(c, 0, true, 0x63, reg, reg_operand(reg));
+	if(!a.is_register)
+		emit_x64(c, 0, true, 0x89, RAX, a);
+}
+
+// @NOTE: a divisor of -1 negates (or gives 0 for modulo) instead of going
+// through idiv, which would trap on the minimum value
+static void emit_division(Bytecode *c, Jit_Fixup **errors, b32 w, b32 modulo, X64_Operand a, X64_Operand b)
+{
+	emit_x64(c, 0, w, 0x8B, RCX, b);
+	emit_x64(c, 0, w, 0x85, RCX, reg_operand(RCX));
+	emit_error_jump(c, errors, CC_E, JIT_ERROR_DIVISION);
+	emit_x64(c, 0, w, 0x8B, RAX, a);
+	emit_x64(c, 0, w, 0x83, 7, reg_operand(RCX));
+	push_byte(0xFF, c);
+	int not_minus_one = emit_short_jump(c, CC_NE);
+	if(modulo)
+		emit_x64(c, 0, false, 0x33, RDX, reg_operand(RDX));
+	else
+		emit_x64(c, 0, w, 0xF7, 3, reg_operand(RAX));
+	int done = emit_short_jump(c, -1);
+	patch_short_jump(c, not_minus_one);
+	if(w)
+		push_byte(0x48, c);
+	push_byte(0x99, c); // cdq or cqo
+	emit_x64(c, 0, w, 0xF7, 7, reg_operand(RCX));
+	patch_short_jump(c, done);
+	X64_Register result = modulo ? RDX : RAX;
+	if(w)
+		emit_copy(c, a, reg_operand(result), RAX);
+	else
+	{
+		emit_x64(c, 0, true, 0x63, RAX, reg_operand(result));
+		emit_mov(c, a, reg_operand(RAX));
+	}
+}
+
+static void emit_float_binary(Bytecode *c, u32 opcode, b32 is_double, X64_Operand a, X64_Operand b)
+{
+	emit_x64(c, 0x66, is_double, 0x0F6E, XMM0, a);
+	emit_x64(c, 0x66, is_double, 0x0F6E, XMM1, b);
+	emit_x64(c, is_double ? 0xF2 : 0xF3, false, opcode, XMM0, reg_operand(XMM1));
+	// Stored through rax so an f32 result clears the top half of the cell
+	X64_Register reg = a.is_register ? a.reg : RAX;
+	emit_x64(c, 0x66, is_double, 0x0F7E, XMM0, reg_operand(reg));
+	if(!a.is_register)
+		emit_x64(c, 0, true, 0x89, RAX, a);
+}
+
+// Comparison ops come in groups of 4 widths: EQ, NE, LT, LE, GT, GE
+static const X64_Condition int_conditions[6] = {CC_E, CC_NE, CC_L, CC_LE, CC_G, CC_GE};
+
+// ucomis sets CF, ZF and PF on NaN, so > and >= (with the operands swapped
+// for < and <=) are false for it, == has to check PF and != is true for it
+static void emit_compare_flags(Bytecode *c, OP op, X64_Operand a, X64_Operand b)
+{
+	int kind = (op - EQDW) / 4;
+	int width = (op - EQDW) % 4;
+	if(width < 2)
+	{
+		b32 w = width == 1;
+		X64_Register reg = a.is_register ? a.reg : RAX;
+		if(!a.is_register)
+			emit_x64(c, 0, w, 0x8B, RAX, a);
+		emit_x64(c, 0, w, 0x3B, reg, b);
+		return;
+	}
+
+	b32 is_double = width == 3;
+	b32 swap = kind == 2 || kind == 3;
+	emit_x64(c, 0x66, is_double, 0x0F6E, XMM0, swap ? b : a);
+	emit_x64(c, 0x66, is_double, 0x0F6E, XMM1, swap ? a : b);
+	emit_x64(c, is_double ? 0x66 : 0, false, 0x0F2E, XMM0, reg_operand(XMM1));
+}
+
+static void emit_compare(Bytecode *c, OP op, X64_Operand a, X64_Operand b)
+{
+	int kind = (op - EQDW) / 4;
+	int width = (op - EQDW) % 4;
+	emit_compare_flags(c, op, a, b);
+	if(width < 2)
+	{
+		emit_set_condition(c, int_conditions[kind], a);
+		return;
+	}
+
+	switch(kind)
+	{
+		case 0:
+		{
+			emit_x64(c, 0, false, 0x0F90 + CC_E, 0, reg_operand(RAX));
+			emit_x64(c, 0, false, 0x0F90 + CC_NP, 0, reg_operand(RCX));
+			emit_x64(c, 0, false, 0x20, RCX, reg_operand(RAX));
+		} break;
+		case 1:
+		{
+			emit_x64(c, 0, false, 0x0F90 + CC_NE, 0, reg_operand(RAX));
+			emit_x64(c, 0, false, 0x0F90 + CC_P, 0, reg_operand(RCX));
+			emit_x64(c, 0, false, 0x08, RCX, reg_operand(RAX));
+		} break;
+		case 2: case 4:
+		{
+			emit_x64(c, 0, false, 0x0F90 + CC_A, 0, reg_operand(RAX));
+		} break;
+		case 3: case 5:
+		{
+			emit_x64(c, 0, false, 0x0F90 + CC_AE, 0, reg_operand(RAX));
+		} break;
+	}
+	X64_Register reg = a.is_register ? a.reg : RAX;
+	emit_x64(c, 0, false, 0x0FB6, reg, reg_operand(RAX));
+	if(!a.is_register)
+		emit_x64(c, 0, true, 0x89, RAX, a);
+}
+
+// a = a op b for every op that takes two cells and leaves one, ADDDW through GED
+void emit_binary(Bytecode *c, Jit_Fixup **errors, OP op, X64_Operand a, X64_Operand b)
+{
+	switch(op)
+	{
+		case ADDDW: case ADDQW: case SUBDW: case SUBQW: case MULDW: case MULQW:
+		case ANDDW: case ANDQW: case ORDW: case ORQW: case XORDW: case XORQW:
+		{
+			u32 opcode = 0;
+			switch(op)
+			{
+				case ADDDW: case ADDQW: opcode = 0x03; break;
+				case SUBDW: case SUBQW: opcode = 0x2B; break;
+				case MULDW: case MULQW: opcode = 0x0FAF; break;
+				case ANDDW: case ANDQW: opcode = 0x23; break;
+				case ORDW:  case ORQW:  opcode = 0x0B; break;
+				default:                opcode = 0x33; break;
+			}
+			b32 w = op == ADDQW || op == SUBQW || op == MULQW || op == ANDQW || op == ORQW || op == XORQW;
+			emit_int_binary(c, opcode, w, a, b);
+		} break;
+		case ADDF: case ADDD: case SUBF: case SUBD: case MULF: case MULD: case DIVF: case DIVD:
+		{
+			u32 opcode = 0;
+			switch(op)
+			{
+				case ADDF: case ADDD: opcode = 0x0F58; break;
+				case SUBF: case SUBD: opcode = 0x0F5C; break;
+				case MULF: case MULD: opcode = 0x0F59; break;
+				default:              opcode = 0x0F5E; break;
+			}
+			emit_float_binary(c, opcode, op == ADDD || op == SUBD || op == MULD || op == DIVD, a, b);
+		} break;
+		case DIVDW: case DIVQW: case MODDW: case MODQW:
+		{
+			emit_division(c, errors, op == DIVQW || op == MODQW, op == MODDW || op == MODQW, a, b);
+		} break;
+		case SHLDW: case SHLQW: case SHRDW: case SHRQW:
+		{
+			emit_shift(c, op == SHLDW || op == SHLQW ? 4 : 7, op == SHLQW || op == SHRQW, a, b);
+		} break;
+		default:
+		{
+			assert(op >= EQDW && op <= GED);
+			emit_compare(c, op, a, b);
+		} break;
+	}
+}
+
+// Everything the epilogue does before its ret
+static void emit_leave(Bytecode *c)
+{
+	emit_x64(c, 0, false, 0xFF, 1, runtime_operand(offsetof(Jit_Runtime, depth)));
+	emit_pop(c, R15);
+	emit_pop(c, R14);
+	emit_pop(c, R13);
+	emit_pop(c, R12);
+	emit_pop(c, RBX);
+}
+static void emit_epilogue(Bytecode *c)
+{
+	emit_leave(c);
+	push_byte(0xC3, c);
+}
+
+// @NOTE: same checks as the interpreters make when they call, in the same
+// order, so running out of frames or stack gives the same error
+static void emit_prologue(Jit_Compiler *jc)
+{
+	Bytecode *c = &jc->out;
+	Function *fn = jc->fn;
+	// 5 pushes on top of the return address leave the stack 16 byte aligned for calls
+	emit_push(c, RBX);
+	emit_push(c, R12);
+	emit_push(c, R13);
+	emit_push(c, R14);
+	emit_push(c, R15);
+	emit_mov(c, reg_operand(RBX), reg_operand(RDI));
+	emit_mov(c, reg_operand(R12), reg_operand(RSI));
+	emit_mov(c, reg_operand(R14), reg_operand(RDX));
+	emit_mov(c, reg_operand(R13), runtime_operand(offsetof(Jit_Runtime, globals)));
+	emit_mov(c, reg_operand(R15), runtime_operand(offsetof(Jit_Runtime, entries)));
+
+	emit_x64(c, 0, false, 0x8B, RAX, runtime_operand(offsetof(Jit_Runtime, depth)));
+	emit_x64(c, 0, false, 0xFF, 0, reg_operand(RAX));
+	emit_x64(c, 0, false, 0x81, 7, reg_operand(RAX));
+	push_dword(VM_MAX_FRAMES, c);
+	emit_error_jump(c, &jc->errors, CC_GE, JIT_ERROR_FRAMES);
+	emit_x64(c, 0, false, 0x89, RAX, runtime_operand(offsetof(Jit_Runtime, depth)));
+
+	emit_x64(c, 0, true, 0x8D, RAX, slot_operand(fn->frame_size));
+	emit_x64(c, 0, true, 0x3B, RAX, runtime_operand(offsetof(Jit_Runtime, locals_end)));
+	emit_error_jump(c, &jc->errors, CC_A, JIT_ERROR_STACK);
+	emit_x64(c, 0, true, 0x8D, RAX, mem_operand(R12, (fn->arg_count + fn->max_stack) * 8));
+	emit_x64(c, 0, true, 0x3B, RAX, runtime_operand(offsetof(Jit_Runtime, stack_end)));
+	emit_error_jump(c, &jc->errors, CC_AE, JIT_ERROR_STACK);
+}
+
+// @NOTE: the arguments go straight into the callee's frame, which starts where
+// this one ends. The cached depths under them are spilled to their stack cells
+// around the call since every cached register is caller saved
+static void emit_call(Jit_Compiler *jc, int depth, int index, int arg_count, b32 indirect, b32 returns)
+{
+	Bytecode *c = &jc->out;
+	int frame_size = jc->fn->frame_size;
+	int first_arg = depth - arg_count + 1 - (indirect ? 1 : 0);
+	if(indirect)
+		emit_mov(c, reg_operand(RAX), depth_operand(depth));
+	for(int i = 0; i < arg_count; ++i)
+		emit_copy(c, slot_operand(frame_size + i), depth_operand(first_arg + i), RDX);
+
+	int live = first_arg - 1;
+	for(int i = 1; i <= live && i <= JIT_CACHED_DEPTHS; ++i)
+		emit_mov(c, mem_operand(R12, i * 8), reg_operand(cached_registers[i - 1]));
+
+	emit_x64(c, 0, true, 0x8D, RDI, slot_operand(frame_size));
+	emit_x64(c, 0, true, 0x8D, RSI, mem_operand(R12, live * 8));
+	emit_mov(c, reg_operand(RDX), reg_operand(R14));
+	if(relocating)
+	{
+		// Ahead of time the table has an entry for every function and nothing is interpreted
+		if(indirect)
+		{
+			emit_x64(c, 0, false, 0x8B, RCX, reg_operand(RAX));
+			push_byte(0x41, c);
+			push_byte(0xFF, c);
+			push_byte(0x14, c);
+			push_byte(0xC7, c);
+		}
+		else
+		{
+			emit_x64(c, 0, false, 0xC7, 0, reg_operand(RCX));
+			push_dword((u32)index, c);
+			emit_x64(c, 0, false, 0xFF, 2, mem_operand(R15, index * 8));
+		}
+	}
+	else if(indirect)
+	{
+		// call [r15 + rax * 8], or the interpreter if the index is past the table
+		emit_x64(c, 0, false, 0x8B, RCX, reg_operand(RAX));
+		emit_x64(c, 0, false, 0x81, 7, reg_operand(RAX));
+		push_dword(JIT_MAX_FUNCTIONS, c);
+		int outside = emit_short_jump(c, CC_AE);
+		push_byte(0x41, c);
+		push_byte(0xFF, c);
+		push_byte(0x14, c);
+		push_byte(0xC7, c);
+		int done = emit_short_jump(c, -1);
+		patch_short_jump(c, outside);
+		emit_call_absolute(c, jit_interpreter_entry);
+		patch_short_jump(c, done);
+	}
+	else
+	{
+		emit_x64(c, 0, false, 0xC7, 0, reg_operand(RCX));
+		push_dword((u32)index, c);
+		if(index < JIT_MAX_FUNCTIONS)
+			emit_x64(c, 0, false, 0xFF, 2, mem_operand(R15, index * 8));
+		else
+			emit_call_absolute(c, jit_interpreter_entry);
+	}
+
+	for(int i = 1; i <= live && i <= JIT_CACHED_DEPTHS; ++i)
+		emit_mov(c, reg_operand(cached_registers[i - 1]), mem_operand(R12, i * 8));
+	if(returns)
+		emit_mov(c, depth_operand(first_arg), reg_operand(RAX));
+}
+
+// A rel32 jump to the native code of a bytecode offset, condition -1 is a JMP
+static void emit_jump(Jit_Compiler *jc, int condition, int target)
+{
+	Bytecode *c = &jc->out;
+	if(condition < 0)
+		push_byte(0xE9, c);
+	else
+	{
+		push_byte(0x0F, c);
+		push_byte(0x80 + condition, c);
+	}
+	Jit_Fixup fixup = {.at = c->i, .target = target};
+	arrput(jc->jumps, fixup);
+	push_dword(0, c);
+}
+
+// @NOTE: the comparison straight into a jcc, nothing is written to the stack.
+// Integers jump on the opposite condition (its low bit flipped) when they
+// jump if it doesn't hold, floats only do that for the ordered comparisons,
+// below or equal and below are also what a NaN gives
+static void emit_compare_branch(Jit_Compiler *jc, OP compare, b32 jumps_if, int depth, int target)
+{
+	Bytecode *c = &jc->out;
+	int kind = (compare - EQDW) / 4;
+	int width = (compare - EQDW) % 4;
+	emit_compare_flags(c, compare, depth_operand(depth - 1), depth_operand(depth));
+	if(width < 2)
+	{
+		emit_jump(jc, int_conditions[kind] ^ !jumps_if, target);
+		return;
+	}
+
+	assert(jumps_if || kind >= 2);
+	switch(kind)
+	{
+		case 0:
+		{
+			int unordered = emit_short_jump(c, CC_P);
+			emit_jump(jc, CC_E, target);
+			patch_short_jump(c, unordered);
+		} break;
+		case 1:
+		{
+			emit_jump(jc, CC_P, target);
+			emit_jump(jc, CC_NE, target);
+		} break;
+		case 2: case 4: emit_jump(jc, jumps_if ? CC_A : CC_BE, target); break;
+		case 3: case 5: emit_jump(jc, jumps_if ? CC_AE : CC_B, target); break;
+	}
+}
+
+// @NOTE: one short sequence per op. Gives false for anything it doesn't know,
+// the whole function is interpreted then
+// @NOTE: the arguments go to the first slots of this frame and the function
+// leaves like it would on a RET, then jumps to the callee's entry as if it was
+// called with this function's locals and stack. The callee returns straight to
+// whoever called this one
+static void emit_tail_call(Jit_Compiler *jc, int depth, int index, int arg_count)
+{
+	Bytecode *c = &jc->out;
+	int first_arg = depth - arg_count + 1;
+	for(int i = 0; i < arg_count; ++i)
+		emit_copy(c, slot_operand(i), depth_operand(first_arg + i), RDX);
+
+	emit_mov(c, reg_operand(RAX), mem_operand(R15, index * 8));
+	emit_mov(c, reg_operand(RDI), reg_operand(RBX));
+	emit_mov(c, reg_operand(RSI), reg_operand(R12));
+	emit_mov(c, reg_operand(RDX), reg_operand(R14));
+	emit_x64(c, 0, false, 0xC7, 0, reg_operand(RCX));
+	push_dword((u32)index, c);
+	emit_leave(c);
+	emit_x64(c, 0, false, 0xFF, 4, reg_operand(RAX));
+}
+
+static b32 emit_instruction(Jit_Compiler *jc, u8 *ip, int depth)
+{
+	Bytecode *c = &jc->out;
+	OP op = ip[0];
+	switch(op)
+	{
+		case NOP: break;
+
+		case LOADB: case LOADW: case LOADDW: case LOADQW: case LOADF: case LOADD:
+		{
+			emit_narrow(c, op - LOADB, depth_operand(depth + 1), slot_operand(read_word(ip + 1)));
+		} break;
+		case STOREB: case STOREW: case STOREDW: case STOREQW: case STOREF: case STORED:
+		{
+			X64_Operand slot = slot_operand(read_word(ip + 1));
+			X64_Operand value = depth_operand(depth);
+			if(op == STOREQW || op == STORED)
+				emit_mov(c, slot, value);
+			else
+			{
+				emit_narrow(c, op - STOREB, reg_operand(RAX), value);
+				emit_mov(c, slot, reg_operand(RAX));
+			}
+		} break;
+		case TEEB: case TEEW: case TEEDW: case TEEQW: case TEEF: case TEED:
+		{
+			X64_Operand slot = slot_operand(read_word(ip + 1));
+			X64_Operand value = depth_operand(depth);
+			if(op == TEEQW || op == TEED)
+				emit_mov(c, slot, value);
+			else
+			{
+				emit_narrow(c, op - TEEB, reg_operand(RAX), value);
+				emit_mov(c, slot, reg_operand(RAX));
+				emit_mov(c, value, reg_operand(RAX));
+			}
+		} break;
+
+		case PUSHB:  emit_immediate(c, depth_operand(depth + 1), (u64)(i64)(i8)ip[1]); break;
+		case PUSHW:  emit_immediate(c, depth_operand(depth + 1), (u64)(i64)(i16)read_word(ip + 1)); break;
+		case PUSHDW: emit_immediate(c, depth_operand(depth + 1), (u64)(i64)(i32)read_dword(ip + 1)); break;
+		case PUSHQW: emit_immediate(c, depth_operand(depth + 1), read_qword(ip + 1)); break;
+		case PUSHF:  emit_immediate(c, depth_operand(depth + 1), read_dword(ip + 1)); break;
+		case PUSHD:  emit_immediate(c, depth_operand(depth + 1), read_qword(ip + 1)); break;
+		case PUSHS:
+		{
+			if(relocating)
+			{
+				emit_relocated(c, RAX, JIT_RELOCATION_STRING, read_dword(ip + 1));
+				emit_mov(c, depth_operand(depth + 1), reg_operand(RAX));
+			}
+			else
+				emit_immediate(c, depth_operand(depth + 1), (u64)string_pool[read_dword(ip + 1)]);
+		} break;
+
+		case ADDDW: case ADDQW: case ADDF: case ADDD:
+		case SUBDW: case SUBQW: case SUBF: case SUBD:
+		case MULDW: case MULQW: case MULF: case MULD:
+		case DIVDW: case DIVQW: case DIVF: case DIVD:
+		case MODDW: case MODQW: case ANDDW: case ANDQW:
+		case ORDW: case ORQW: case XORDW: case XORQW:
+		case SHLDW: case SHLQW: case SHRDW: case SHRQW:
+		case EQDW: case EQQW: case EQF: case EQD:
+		case NEDW: case NEQW: case NEF: case NED:
+		case LTDW: case LTQW: case LTF: case LTD:
+		case LEDW: case LEQW: case LEF: case LED:
+		case GTDW: case GTQW: case GTF: case GTD:
+		case GEDW: case GEQW: case GEF: case GED:
+		{
+			emit_binary(c, &jc->errors, op, depth_operand(depth - 1), depth_operand(depth));
+		} break;
+
+		case ADDQW_LL: case SUBQW_LL: case MULQW_LL:
+		{
+			X64_Operand result = depth_operand(depth + 1);
+			X64_Register reg = result.is_register ? result.reg : RAX;
+			u32 opcode = op == ADDQW_LL ? 0x03 : op == SUBQW_LL ? 0x2B : 0x0FAF;
+			emit_mov(c, reg_operand(reg), slot_operand(read_word(ip + 1)));
+			emit_x64(c, 0, true, opcode, reg, slot_operand(read_word(ip + 3)));
+			emit_mov(c, result, reg_operand(reg));
+		} break;
+		case ADDQW_LI: case SUBQW_LI: case MULQW_LI:
+		{
+			X64_Operand result = depth_operand(depth + 1);
+			X64_Register reg = result.is_register ? result.reg : RAX;
+			X64_Operand slot = slot_operand(read_word(ip + 1));
+			u32 immediate = read_dword(ip + 3);
+			if(op == MULQW_LI)
+				emit_x64(c, 0, true, 0x69, reg, slot);
+			else
+			{
+				emit_mov(c, reg_operand(reg), slot);
+				emit_x64(c, 0, true, 0x81, op == ADDQW_LI ? 0 : 5, reg_operand(reg));
+			}
+			push_dword(immediate, c);
+			emit_mov(c, result, reg_operand(reg));
+		} break;
+		case EQQW_LI: case NEQW_LI: case LTQW_LI: case LEQW_LI: case GTQW_LI: case GEQW_LI:
+		{
+			emit_x64(c, 0, true, 0x81, 7, slot_operand(read_word(ip + 1)));
+			push_dword(read_dword(ip + 3), c);
+			emit_set_condition(c, int_conditions[op - EQQW_LI], depth_operand(depth + 1));
+		} break;
+
+		case NARROWB: case NARROWW:
+		{
+			emit_narrow(c, op - NARROWB, depth_operand(depth), depth_operand(depth));
+		} break;
+
+		case GLOAD:  emit_mov(c, depth_operand(depth + 1), mem_operand(R13, read_word(ip + 1) * 8)); break;
+		case GSTORE: emit_mov(c, mem_operand(R13, read_word(ip + 1) * 8), depth_operand(depth)); break;
+
+		// A field is at its byte offset from the struct's slot, in the frame or the globals
+		case FLOADB: case FLOADW: case FLOADDW: case FLOADQW: case FLOADF: case FLOADD:
+		case GFLOADB: case GFLOADW: case GFLOADDW: case GFLOADQW: case GFLOADF: case GFLOADD:
+		{
+			b32 is_global = op >= GFLOADB;
+			X64_Operand field = mem_operand(is_global ? R13 : RBX, read_word(ip + 1) * 8 + read_word(ip + 3));
+			emit_narrow(c, op - (is_global ? GFLOADB : FLOADB), depth_operand(depth + 1), field);
+		} break;
+		// Only the field's own bytes are written, anything narrower than a cell goes through al, ax or eax
+		case FSTOREB: case FSTOREW: case FSTOREDW: case FSTOREQW: case FSTOREF: case FSTORED:
+		case GFSTOREB: case GFSTOREW: case GFSTOREDW: case GFSTOREQW: case GFSTOREF: case GFSTORED:
+		{
+			b32 is_global = op >= GFLOADB;
+			X64_Operand field = mem_operand(is_global ? R13 : RBX, read_word(ip + 1) * 8 + read_word(ip + 3));
+			int width = get_field_width(op);
+			if(width == 8)
+			{
+				emit_mov(c, field, depth_operand(depth));
+				break;
+			}
+			emit_mov(c, reg_operand(RAX), depth_operand(depth));
+			if(width == 1)
+				emit_x64(c, 0, false, 0x88, RAX, field);
+			else
+				emit_x64(c, width == 2 ? 0x66 : 0, false, 0x89, RAX, field);
+		} break;
+		case POP: break;
+
+		// Byte loops over the strings, the same FNV-1a hash_string does
+		case EQS:
+		{
+			emit_mov(c, reg_operand(RAX), depth_operand(depth - 1));
+			emit_mov(c, reg_operand(RCX), depth_operand(depth));
+			int loop = c->i;
+			emit_x64(c, 0, false, 0x0FB6, RDX, mem_operand(RAX, 0));
+			emit_x64(c, 0, false, 0x3A, RDX, mem_operand(RCX, 0));
+			int differ = emit_short_jump(c, CC_NE);
+			emit_x64(c, 0, true, 0xFF, 0, reg_operand(RAX));
+			emit_x64(c, 0, true, 0xFF, 0, reg_operand(RCX));
+			emit_x64(c, 0, false, 0x85, RDX, reg_operand(RDX));
+			emit_short_jump_back(c, CC_NE, loop);
+			// Falling out of the loop is the terminator matching, ZF is set
+			patch_short_jump(c, differ);
+			emit_set_condition(c, CC_E, depth_operand(depth - 1));
+		} break;
+		case HASHS:
+		{
+			emit_mov(c, reg_operand(RCX), depth_operand(depth));
+			emit_x64(c, 0, false, 0xC7, 0, reg_operand(RAX));
+			push_dword(2166136261u ^ read_dword(ip + 1), c);
+			int loop = c->i;
+			emit_x64(c, 0, false, 0x0FB6, RDX, mem_operand(RCX, 0));
+			emit_x64(c, 0, false, 0x85, RDX, reg_operand(RDX));
+			int done = emit_short_jump(c, CC_E);
+			emit_x64(c, 0, false, 0x33, RAX, reg_operand(RDX));
+			emit_x64(c, 0, false, 0x69, RAX, reg_operand(RAX));
+			push_dword(16777619u, c);
+			emit_x64(c, 0, true, 0xFF, 0, reg_operand(RCX));
+			emit_short_jump_back(c, -1, loop);
+			patch_short_jump(c, done);
+			emit_x64(c, 0, false, 0x8B, RDX, reg_operand(RAX));
+			emit_x64(c, 0, false, 0xC1, 5, reg_operand(RDX));
+			push_byte(16, c);
+			emit_x64(c, 0, false, 0x33, RAX, reg_operand(RDX));
+			emit_x64(c, 0, false, 0x81, 4, reg_operand(RAX));
+			push_dword(read_dword(ip + 5), c);
+			emit_mov(c, depth_operand(depth), reg_operand(RAX));
+		} break;
+
+		case JMP: emit_jump(jc, -1, read_dword(ip + 1)); break;
+		case LOOPQW_LI: case LOOPQW_LL:
+		{
+			X64_Operand counter = slot_operand(read_word(ip + 5));
+			emit_mov(c, reg_operand(RAX), counter);
+			emit_x64(c, 0, true, 0x81, 0, reg_operand(RAX));
+			push_dword(read_dword(ip + 7), c);
+			emit_mov(c, counter, reg_operand(RAX));
+			if(op == LOOPQW_LI)
+			{
+				emit_x64(c, 0, true, 0x81, 7, reg_operand(RAX));
+				push_dword(read_dword(ip + 11), c);
+			}
+			else
+				emit_x64(c, 0, true, 0x3B, RAX, slot_operand(read_word(ip + 11)));
+			emit_jump(jc, CC_L, read_dword(ip + 1));
+		} break;
+		case JZ: case JNZ:
+		{
+			X64_Operand value = depth_operand(depth);
+			if(value.is_register)
+				emit_x64(c, 0, true, 0x85, value.reg, value);
+			else
+			{
+				emit_x64(c, 0, true, 0x83, 7, value);
+				push_byte(0, c);
+			}
+			emit_jump(jc, op == JZ ? CC_E : CC_NE, read_dword(ip + 1));
+		} break;
+
+		// @NOTE: rax is the value minus low, from the entry count up is the
+		// default, values below low wrap around to there too. The table follows
+		// the jump and holds rel32s from its own start, so it doesn't need
+		// relocating wherever the code ends up
+		case SWITCH:
+		{
+			i64 low = (i64)read_qword(ip + 1);
+			u32 entries = read_dword(ip + 9);
+			emit_mov(c, reg_operand(RAX), depth_operand(depth));
+			if(low == (i32)low)
+			{
+				emit_x64(c, 0, true, 0x81, 5, reg_operand(RAX));
+				push_dword((u32)low, c);
+			}
+			else
+			{
+				emit_mov_imm64(c, RCX, (u64)low);
+				emit_x64(c, 0, true, 0x2B, RAX, reg_operand(RCX));
+			}
+			emit_x64(c, 0, true, 0x81, 7, reg_operand(RAX));
+			push_dword(entries, c);
+			emit_jump(jc, CC_AE, read_dword(ip + 13));
+			// lea rcx, [rip + table], movsxd rax, [rcx + rax * 4]
+			push_byte(0x48, c);
+			push_byte(0x8D, c);
+			push_byte(0x0D, c);
+			int lea = c->i;
+			push_dword(0, c);
+			push_byte(0x48, c);
+			push_byte(0x63, c);
+			push_byte(0x04, c);
+			push_byte(0x81, c);
+			emit_x64(c, 0, true, 0x03, RAX, reg_operand(RCX));
+			emit_x64(c, 0, false, 0xFF, 4, reg_operand(RAX));
+			int table = c->i;
+			patch_dword(table - (lea + 4), lea, c);
+			for(u32 i = 0; i < entries; ++i)
+			{
+				Jit_Table_Entry entry = {.at = c->i, .table = table, .target = read_dword(ip + 17 + 4 * i)};
+				arrput(jc->table_entries, entry);
+				push_dword(0, c);
+			}
+		} break;
+
+		default:
+		{
+			b32 jumps_if;
+			OP compare = get_branch_compare(op, &jumps_if);
+			if(compare == NOP)
+				return false;
+			emit_compare_branch(jc, compare, jumps_if, depth, read_dword(ip + 1));
+		} break;
+
+		case CALL:
+		{
+			int index = read_dword(ip + 1);
+			Function *callee = &functions[index];
+			emit_call(jc, depth, index, callee->arg_count, false, callee->ret != NULL);
+		} break;
+		case TAILCALL:
+		{
+			int index = read_dword(ip + 1);
+			Function *callee = &functions[index];
+			if(index < JIT_MAX_FUNCTIONS)
+				emit_tail_call(jc, depth, index, callee->arg_count);
+			else
+				emit_call(jc, depth, index, callee->arg_count, false, callee->ret != NULL);
+		} break;
+		case CALLI:
+		{
+			emit_call(jc, depth, -1, ip[1], true, ip[2]);
+		} break;
+		case RET:
+		{
+			if(ip[1])
+				emit_mov(c, reg_operand(RAX), depth_operand(depth));
+			else
+				emit_x64(c, 0, false, 0x33, RAX, reg_operand(RAX));
+			emit_epilogue(c);
+		} break;
+	}
+	return true;
+}
+
+// Prologue, every op and the error stubs, false if there's an op it can't compile
+static b32 emit_function(Jit_Compiler *jc, Jit_Stats *stats)
+{
+	Bytecode *code = &jc->fn->code;
+	int max_depth = 0;
+	int *depths = compute_stack_depths(code, &max_depth);
+	jc->native_offsets = alloc_temp_memory(sizeof(int) * (code->i + 1));
+
+	emit_prologue(jc);
+	for(int at = 0; at < code->i; at += get_instruction_size(code->bytecode + at))
+	{
+		jc->native_offsets[at] = jc->out.i;
+		if(depths[at] < 0)
+			continue;
+		if(!emit_instruction(jc, code->bytecode + at, depths[at]))
+		{
+			stats->fallback = "an op isn't supported";
+			stats->op = code->bytecode[at];
+			break;
+		}
+	}
+
+	if(!stats->fallback)
+	{
+		emit_error_stubs(&jc->out, jc->errors);
+		for(int i = 0; i < arrlen(jc->jumps); ++i)
+		{
+			Jit_Fixup fixup = jc->jumps[i];
+			patch_dword(jc->native_offsets[fixup.target] - (fixup.at + 4), fixup.at, &jc->out);
+		}
+		for(int i = 0; i < arrlen(jc->table_entries); ++i)
+		{
+			Jit_Table_Entry entry = jc->table_entries[i];
+			patch_dword(jc->native_offsets[entry.target] - entry.table, entry.at, &jc->out);
+		}
+	}
+
+	arrfree(jc->jumps);
+	arrfree(jc->errors);
+	arrfree(jc->table_entries);
+	return stats->fallback == NULL;
+}
+
+static void init_jit()
+{
+	jit.page_size = (int)sysconf(_SC_PAGESIZE);
+	void *code = mmap(NULL, JIT_CODE_SIZE, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	jit.code = code == MAP_FAILED ? NULL : code;
+	jit.entries = AllocateVirtualMemory(JIT_MAX_FUNCTIONS * sizeof(void *));
+	for(int i = 0; i < JIT_MAX_FUNCTIONS; ++i)
+		jit.entries[i] = jit_interpreter_entry;
+}
+
+// Copies the code into the executable region, NULL if it doesn't fit
+void *jit_install_code(Bytecode *code)
+{
+	if(!jit.entries)
+		init_jit();
+	if(!jit.code)
+		return NULL;
+	int start = (jit.used + 15) & ~15;
+	if(code->i > JIT_CODE_SIZE - start)
+		return NULL;
+
+	u8 *at = jit.code + start;
+	uintptr_t first_page = (uintptr_t)at & ~(uintptr_t)(jit.page_size - 1);
+	uintptr_t end_page = ((uintptr_t)at + code->i + jit.page_size - 1) & ~(uintptr_t)(jit.page_size - 1);
+	if(mprotect((void *)first_page, end_page - first_page, PROT_READ | PROT_WRITE) != 0)
+		return NULL;
+	memcpy(at, code->bytecode, code->i);
+	if(mprotect((void *)first_page, end_page - first_page, PROT_READ | PROT_EXEC) != 0)
+		return NULL;
+	jit.used = start + code->i;
+	return at;
+}
+
+// Code space is only given back when it's the last thing installed
+void jit_release_code(void *code, int size)
+{
+	if(code && (u8 *)code + size == jit.code + jit.used)
+		jit.used = (int)((u8 *)code - jit.code);
+}
+
+#endif // JIT_SUPPORTED
+
+Jit_Stats jit_function(Function *fn)
+{
+	return jit_compile(fn, get_function_index(fn));
+}
+
+// @NOTE: compiles fn to native code and points the entry of the function at
+// index (which doesn't have to be fn, it can be a copy of it) there. Functions
+// that can't be compiled keep the interpreter as their entry, callers don't
+// need to know which one they get
+Jit_Stats jit_compile(Function *fn, int index)
+{
+	Jit_Stats stats = {.op = -1};
+	jit_free_function(fn);
+#if !JIT_SUPPORTED
+	stats.fallback = "the JIT only targets x86-64 Linux";
+	return stats;
+#else
+	if(!jit.entries)
+		init_jit();
+	if(index >= 0 && index < JIT_MAX_FUNCTIONS)
+		jit.entries[index] = jit_interpreter_entry;
+	if(!jit.code)
+	{
+		stats.fallback = "executable memory couldn't be mapped";
+		return stats;
+	}
+
+	Jit_Compiler jc = {.out = make_bytecode(fn->code.i * 8 + 64), .fn = fn};
+	if(emit_function(&jc, &stats))
+	{
+		fn->native = jit_install_code(&jc.out);
+		if(fn->native)
+		{
+			fn->native_size = jc.out.i;
+			stats.code_bytes = jc.out.i;
+			if(index >= 0 && index < JIT_MAX_FUNCTIONS)
+				jit.entries[index] = fn->native;
+		}
+		else
+			stats.fallback = "it doesn't fit in the code region";
+	}
+
+	free_bytecode(&jc.out);
+	return stats;
+#endif
+}
+
+// @NOTE: compiles fn into out for a process that isn't this one, nothing is
+// installed and the code doesn't point into this process. Strings, error
+// messages and the error handler are movs of 0 that are listed in relocations
+// for whoever lays the code out (see Elf.c), calls go through the entry table
+// in r15 which has to have every function in it
+Jit_Stats jit_compile_relocatable(Function *fn, Bytecode *out, Jit_Relocation **relocations)
+{
+	Jit_Stats stats = {.op = -1};
+#if !JIT_SUPPORTED
+	stats.fallback = "native code is only generated on x86-64 Linux";
+	return stats;
+#else
+	Jit_Compiler jc = {.out = make_bytecode(fn->code.i * 8 + 64), .fn = fn};
+	relocating = relocations;
+	if(emit_function(&jc, &stats))
+	{
+		stats.code_bytes = jc.out.i;
+		*out = jc.out;
+	}
+	else
+		free_bytecode(&jc.out);
+	relocating = NULL;
+	return stats;
+#endif
+}
+
+// @NOTE: points fn's entry back at the interpreter. Code space is only given
+// back when it's the last thing compiled, that's always the case for a REPL line
+void jit_free_function(Function *fn)
+{
+#if JIT_SUPPORTED
+	int index = get_function_index(fn);
+	if(jit.entries && index >= 0 && index < JIT_MAX_FUNCTIONS)
+		jit.entries[index] = jit_interpreter_entry;
+	jit_release_code(fn->native, fn->native_size);
+#endif
+	fn->native = NULL;
+	fn->native_size = 0;
+}
+
+// @NOTE: runs fn natively if it was compiled and with interpret if it wasn't,
+// from wherever the VM's stacks are, same values and errors either way
+u64 run_jit(VM *vm, Function *fn, u64 *args)
+{
+	if(!fn->native)
+		return interpret(vm, fn, args);
+
+	Jit_Runtime saved = runtime;
+	runtime.vm = vm;
+	runtime.globals = vm->globals;
+	runtime.entries = jit.entries;
+	runtime.locals_end = vm->locals + VM_LOCALS_SIZE;
+	runtime.stack_end = vm->stack + VM_STACK_SIZE;
+	runtime.depth = (i32)(vm->frame_top - vm->frames) - 1;
+	if(fn->arg_count)
+		memcpy(vm->locals_top, args, sizeof(u64) * fn->arg_count);
+
+	Jit_Entry entry = fn->native;
+	u64 result = entry(vm->locals_top, vm->stack_top, &runtime, get_function_index(fn));
+	runtime = saved;
+	return result;
+}
+
+void print_jit_stats(Function *fn, Jit_Stats stats)
+{
+	if(!stats.fallback)
+	{
+		printf("fn %s: %d bytes of native code for %d bytes of bytecode\n", fn->name,
+				stats.code_bytes, fn->code.i);
+	}
+	else if(stats.op >= 0)
+	{
+		printf("fn %s: interpreted, %s (%s)\n", fn->name, stats.fallback, op_info[stats.op].name);
+	}
+	else
+	{
+		printf("fn %s: interpreted, %s\n", fn->name, stats.fallback);
+	}
+}
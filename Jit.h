@@ -0,0 +1,135 @@
+#ifndef _JIT_H
+#define _JIT_H
+
+#include "Basic.h"
+#include "Bytecode.h"
+#include "Interpreter.h"
+
+// @NOTE: the JIT writes System V x86-64 code and maps it with mmap, anywhere
+// else every function falls back to the interpreter
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+#define JIT_CODE_SIZE     (64 << 20) // reserved for all native code, calls between functions are rel32
+#define JIT_MAX_FUNCTIONS (1 << 16)  // size of the entry table, functions past it are interpreted
+#define JIT_CACHED_DEPTHS 6          // operand stack depths 1 to this live in registers
+
+// @NOTE: what native code sees through r14. Every function is entered as
+// entry(locals, stack, runtime, index) with its arguments already in locals,
+// stack pointing at the cell under its first operand (the interpreter's sp)
+// and index being its place in functions (-1 for a REPL line)
+typedef struct
+{
+	VM *vm;
+	u64 *globals;
+	void **entries;   // per function index, native code or the interpreter entry
+	u64 *locals_end;
+	u64 *stack_end;
+	i32 depth;        // the running function's call frame, counted like the VM counts them
+} Jit_Runtime;
+
+typedef u64 (*Jit_Entry)(u64 *locals, u64 *stack, Jit_Runtime *runtime, i32 index);
+
+// The addresses code compiled with jit_compile_relocatable leaves out
+typedef enum
+{
+	JIT_RELOCATION_STRING,  // index is the string in string_pool
+	JIT_RELOCATION_MESSAGE, // index is a Jit_Error, its message
+	JIT_RELOCATION_ERROR,   // the runtime's error handler, it's called with the message in rdi and doesn't return
+} Jit_Relocation_Kind;
+
+typedef struct
+{
+	int at; // where the 64 bit address goes
+	Jit_Relocation_Kind kind;
+	int index;
+} Jit_Relocation;
+
+typedef struct
+{
+	const char *fallback; // why it runs in the interpreter, NULL if it was compiled
+	int op;               // the op it couldn't compile, -1 if that's not why
+	int code_bytes;
+} Jit_Stats;
+
+#if JIT_SUPPORTED
+
+// @NOTE: the x86-64 encoder, the trace compiler (Trace.c) emits through it too
+typedef enum
+{
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15,
+} X64_Register;
+
+// SSE registers go in the same ModRM fields
+#define XMM0 0
+#define XMM1 1
+
+typedef enum
+{
+	CC_B  = 0x2,
+	CC_AE = 0x3,
+	CC_E  = 0x4,
+	CC_NE = 0x5,
+	CC_BE = 0x6,
+	CC_A  = 0x7,
+	CC_P  = 0xA,
+	CC_NP = 0xB,
+	CC_L  = 0xC,
+	CC_GE = 0xD,
+	CC_LE = 0xE,
+	CC_G  = 0xF,
+} X64_Condition;
+
+typedef struct
+{
+	b32 is_register;
+	X64_Register reg; // the register, or the base of the memory operand
+	i32 disp;
+} X64_Operand;
+
+typedef enum
+{
+	JIT_ERROR_DIVISION,
+	JIT_ERROR_FRAMES,
+	JIT_ERROR_STACK,
+
+	JIT_ERROR_COUNT,
+} Jit_Error;
+
+typedef struct
+{
+	int at;     // where the rel32 is
+	int target; // bytecode offset for jumps, a Jit_Error for errors, the exit for trace guards
+} Jit_Fixup;
+
+extern const char *jit_error_messages[JIT_ERROR_COUNT];
+
+X64_Operand reg_operand(X64_Register reg);
+X64_Operand mem_operand(X64_Register base, i32 disp);
+void emit_x64(Bytecode *c, u8 prefix, b32 w, u32 opcode, int reg, X64_Operand rm);
+void emit_mov_imm64(Bytecode *c, X64_Register reg, u64 value);
+void emit_push(Bytecode *c, X64_Register reg);
+void emit_pop(Bytecode *c, X64_Register reg);
+void emit_mov(Bytecode *c, X64_Operand dst, X64_Operand src);
+void emit_immediate(Bytecode *c, X64_Operand dst, u64 value);
+void emit_narrow(Bytecode *c, int width, X64_Operand dst, X64_Operand src);
+void emit_binary(Bytecode *c, Jit_Fixup **errors, OP op, X64_Operand a, X64_Operand b);
+void emit_error_jump(Bytecode *c, Jit_Fixup **errors, X64_Condition condition, Jit_Error error);
+void emit_error_stubs(Bytecode *c, Jit_Fixup *errors);
+void *jit_install_code(Bytecode *code);
+void jit_release_code(void *code, int size);
+
+#endif // JIT_SUPPORTED
+
+Jit_Stats jit_function(Function *fn);
+Jit_Stats jit_compile(Function *fn, int index);
+Jit_Stats jit_compile_relocatable(Function *fn, Bytecode *out, Jit_Relocation **relocations);
+void jit_free_function(Function *fn);
+u64 run_jit(VM *vm, Function *fn, u64 *args);
+void print_jit_stats(Function *fn, Jit_Stats stats);
+
+#endif // _JIT_H
@@ -55,16 +55,15 @@ char char_to_escaped(char c)
 
 Token lex_token(Parsing_Buffer *buf)
 {
-	if(*buf->data == '\r')
+	// Don't skip past the newline, it's the last character in the buffer
+	while (*buf->data != '\n' && isspace(*buf->data)) {
 		advance_buffer(buf);
+	}
 	if(*buf->data == '\n')
 	{
 		Token result = {.value = tok_newline};
 		return result;
 	}
-	while (isspace(*buf->data)) {
-		advance_buffer(buf);
-	}
 	char *start = buf->data;
 	if(isdigit(*buf->data))
 	{
@@ -181,7 +180,7 @@ Token lex_token(Parsing_Buffer *buf)
 		advance_buffer(buf);
 
 	int identifier_size = buf->data - start;
-	int name[identifier_size + 1];
+	char name[identifier_size + 1];
 	memcpy(name, start, identifier_size);
 	name[identifier_size] = '\0';
 
@@ -203,6 +202,7 @@ void init_lexer()
 	shdefault(keyword_table, TOK_ERROR);
 	shput(keyword_table, "fn",         tok_func);
 	shput(keyword_table, "struct",     tok_struct);
+	shput(keyword_table, "fixed",      tok_fixed);
 	shput(keyword_table, "if",         tok_if);
 	shput(keyword_table, "for",        tok_for);
 	shput(keyword_table, "switch",     tok_switch);
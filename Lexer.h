@@ -73,6 +73,7 @@ typedef enum : signed short
 	
 	tok_char = -40,
 	tok_newline = -41,
+	tok_fixed = -42,  // struct fixed Name { ... } keeps the declared field order
 	TOK_ERROR = -99
 } Token_Value;
 
@@ -0,0 +1,288 @@
+#include "Liveness.h"
+#include "stb_ds.h"
+#include <assert.h>
+#include <limits.h>
+
+// Offsets of the slot operands of the instruction at, gives how many there are
+static int get_slot_operands(u8 *at, int *operands, b32 *writes)
+{
+	*writes = false;
+	switch(at[0])
+	{
+		case STOREB: case STOREW: case STOREDW: case STOREQW: case STOREF: case STORED:
+		case TEEB: case TEEW: case TEEDW: case TEEQW: case TEEF: case TEED:
+		{
+			*writes = true;
+			operands[0] = 1;
+			return 1;
+		}
+		case LOADB: case LOADW: case LOADDW: case LOADQW: case LOADF: case LOADD:
+		case ADDQW_LI: case SUBQW_LI: case MULQW_LI:
+		case EQQW_LI: case NEQW_LI: case LTQW_LI: case LEQW_LI: case GTQW_LI: case GEQW_LI:
+		{
+			operands[0] = 1;
+			return 1;
+		}
+		case ADDQW_LL: case SUBQW_LL: case MULQW_LL:
+		{
+			operands[0] = 1;
+			operands[1] = 3;
+			return 2;
+		}
+		// The counter is read before it's written, so it only counts as a use
+		case LOOPQW_LI:
+		{
+			operands[0] = 5;
+			return 1;
+		}
+		case LOOPQW_LL:
+		{
+			operands[0] = 5;
+			operands[1] = 11;
+			return 2;
+		}
+		default: return 0;
+	}
+}
+
+static inline b32 get_bit(u64 *set, int bit)
+{
+	return (set[bit / 64] >> (bit % 64)) & 1;
+}
+
+static inline void set_bit(u64 *set, int bit)
+{
+	set[bit / 64] |= 1ull << (bit % 64);
+}
+
+static u64 *make_set(int words)
+{
+	u64 *set = alloc_temp_memory(sizeof(u64) * words);
+	memset(set, 0, sizeof(u64) * words);
+	return set;
+}
+
+static void extend_interval(Live_Interval *interval, int at)
+{
+	if(at < interval->start)
+		interval->start = at;
+	if(at > interval->end)
+		interval->end = at;
+}
+
+// Splits the code at jump targets and after jumps and returns
+static Live_Block *find_live_blocks(Bytecode *code, int words)
+{
+	b32 *targets = find_jump_targets(code);
+	int *block_at = alloc_temp_memory(sizeof(int) * (code->i + 1));
+	Live_Block *blocks = NULL;
+	int start = 0;
+	for(int at = 0; at < code->i;)
+	{
+		OP op = code->bytecode[at];
+		int last = at;
+		at += get_instruction_size(code->bytecode + at);
+		if(at == code->i || targets[at] || ends_block(op))
+		{
+			Live_Block block = {.start = start, .end = at, .last = last};
+			block_at[start] = arrlen(blocks);
+			arrput(blocks, block);
+			start = at;
+		}
+	}
+
+	for(int b = 0; b < arrlen(blocks); ++b)
+	{
+		Live_Block *block = &blocks[b];
+		u8 *last = code->bytecode + block->last;
+		if(last[0] != JMP && last[0] != RET && last[0] != SWITCH && block->end < code->i)
+			arrput(block->succs, block_at[block->end]);
+		int first;
+		int jump_count = get_jump_operands(last, &first);
+		for(int i = 0; i < jump_count; ++i)
+		{
+			int target = read_dword(last + first + 4 * i);
+			if(target < code->i)
+				arrput(block->succs, block_at[target]);
+		}
+
+		block->uses = make_set(words);
+		block->defs = make_set(words);
+		block->live_in = make_set(words);
+		block->live_out = make_set(words);
+		for(int at = block->start; at < block->end; at += get_instruction_size(code->bytecode + at))
+		{
+			int operands[2];
+			b32 writes;
+			int count = get_slot_operands(code->bytecode + at, operands, &writes);
+			for(int i = 0; i < count; ++i)
+			{
+				int slot = read_word(code->bytecode + at + operands[i]);
+				if(writes)
+					set_bit(block->defs, slot);
+				else if(!get_bit(block->defs, slot))
+					set_bit(block->uses, slot);
+			}
+		}
+	}
+	return blocks;
+}
+
+// live_out is what the successors need, live_in adds the uses and takes out
+// what the block writes first. Blocks go backwards so it settles quickly
+static int solve_liveness(Live_Block *blocks, int words)
+{
+	int rounds = 0;
+	b32 changed = true;
+	while(changed)
+	{
+		changed = false;
+		rounds++;
+		for(int b = arrlen(blocks) - 1; b >= 0; --b)
+		{
+			Live_Block *block = &blocks[b];
+			for(int w = 0; w < words; ++w)
+			{
+				u64 out = 0;
+				for(int s = 0; s < arrlen(block->succs); ++s)
+					out |= blocks[block->succs[s]].live_in[w];
+				u64 in = block->uses[w] | (out & ~block->defs[w]);
+				changed = changed || out != block->live_out[w] || in != block->live_in[w];
+				block->live_out[w] = out;
+				block->live_in[w] = in;
+			}
+		}
+	}
+	return rounds;
+}
+
+static int compare_intervals(const void *a, const void *b)
+{
+	const Live_Interval *x = a, *y = b;
+	if(x->start != y->start)
+		return x->start < y->start ? -1 : 1;
+	return x->slot - y->slot;
+}
+
+// @NOTE: the intervals are the hull of every offset a slot is live at, in
+// code order, which is conservative for code that jumps back. A slot live at
+// the start (read before it's written on some path) starts at 0 so it never
+// inherits another value's slot. Free slots go to the lowest one first to keep
+// the frame dense. There's no limit on slots so nothing is ever spilled
+Slot_Stats allocate_slots(Function *fn)
+{
+	Slot_Stats stats = {.frame_before = fn->frame_size, .frame_after = fn->frame_size};
+	int slot_count = fn->frame_size;
+	Bytecode *code = &fn->code;
+	if(slot_count == 0)
+		return stats;
+	// Struct fields are reached by a byte offset from the struct's first slot,
+	// only whole slots are tracked here so frames with structs stay as they are
+	for(int at = 0; at < code->i; at += get_instruction_size(code->bytecode + at))
+	{
+		if(code->bytecode[at] >= FLOADB && code->bytecode[at] <= FSTORED)
+			return stats;
+	}
+
+	int words = (slot_count + 63) / 64;
+	Live_Block *blocks = find_live_blocks(code, words);
+	stats.rounds = solve_liveness(blocks, words);
+
+	Live_Interval *intervals = alloc_temp_memory(sizeof(Live_Interval) * slot_count);
+	for(int slot = 0; slot < slot_count; ++slot)
+	{
+		Live_Interval interval = {.start = INT_MAX, .end = -1, .slot = slot};
+		intervals[slot] = interval;
+	}
+	for(int slot = 0; slot < fn->arg_count; ++slot)
+		extend_interval(&intervals[slot], 0);
+	for(int b = 0; b < arrlen(blocks); ++b)
+	{
+		Live_Block *block = &blocks[b];
+		for(int slot = 0; slot < slot_count; ++slot)
+		{
+			if(get_bit(block->live_in, slot))
+				extend_interval(&intervals[slot], block->start);
+			if(get_bit(block->live_out, slot))
+				extend_interval(&intervals[slot], block->last);
+		}
+		for(int at = block->start; at < block->end; at += get_instruction_size(code->bytecode + at))
+		{
+			int operands[2];
+			b32 writes;
+			int count = get_slot_operands(code->bytecode + at, operands, &writes);
+			for(int i = 0; i < count; ++i)
+				extend_interval(&intervals[read_word(code->bytecode + at + operands[i])], at);
+		}
+		arrfree(block->succs);
+	}
+	arrfree(blocks);
+	qsort(intervals, slot_count, sizeof(Live_Interval), compare_intervals);
+
+	int *new_slots = alloc_temp_memory(sizeof(int) * slot_count);
+	int frame_size = fn->arg_count;
+	Live_Interval *active = NULL; // stb_ds array, sorted by end
+	int *free_slots = NULL;       // stb_ds array
+	for(int slot = 0; slot < slot_count; ++slot)
+		new_slots[slot] = slot < fn->arg_count ? slot : -1;
+	for(int i = 0; i < slot_count; ++i)
+	{
+		Live_Interval interval = intervals[i];
+		if(interval.end < 0)
+			continue;
+		stats.intervals++;
+
+		int expired = 0;
+		while(expired < arrlen(active) && active[expired].end < interval.start)
+			arrput(free_slots, new_slots[active[expired++].slot]);
+		if(expired)
+			arrdeln(active, 0, expired);
+
+		if(interval.slot >= fn->arg_count)
+		{
+			int lowest = -1;
+			for(int f = 0; f < arrlen(free_slots); ++f)
+			{
+				if(lowest == -1 || free_slots[f] < free_slots[lowest])
+					lowest = f;
+			}
+			if(lowest != -1)
+			{
+				new_slots[interval.slot] = free_slots[lowest];
+				arrdelswap(free_slots, lowest);
+			}
+			else
+				new_slots[interval.slot] = frame_size++;
+		}
+
+		int insert = arrlen(active);
+		while(insert > 0 && active[insert - 1].end > interval.end)
+			insert--;
+		arrins(active, insert, interval);
+	}
+	arrfree(active);
+	arrfree(free_slots);
+
+	for(int at = 0; at < code->i; at += get_instruction_size(code->bytecode + at))
+	{
+		int operands[2];
+		b32 writes;
+		int count = get_slot_operands(code->bytecode + at, operands, &writes);
+		for(int i = 0; i < count; ++i)
+		{
+			u8 *operand = code->bytecode + at + operands[i];
+			u16 slot = new_slots[read_word(operand)];
+			assert(slot != (u16)-1);
+			memcpy(operand, &slot, 2);
+		}
+	}
+	fn->frame_size = frame_size;
+	stats.frame_after = frame_size;
+	return stats;
+}
+
+void print_slot_stats(Function *fn, Slot_Stats stats)
+{
+	printf("fn %s: frame %d -> %d slots (%d used, liveness in %d rounds)\n", fn->name,
+			stats.frame_before, stats.frame_after, stats.intervals, stats.rounds);
+}
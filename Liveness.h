@@ -0,0 +1,44 @@
+#ifndef _LIVENESS_H
+#define _LIVENESS_H
+
+#include "Basic.h"
+#include "Bytecode.h"
+
+// @NOTE: code generation gives every declaration its own frame slot. This
+// finds where each slot's value is live with a backwards dataflow over the
+// basic blocks of the stack code, then hands out slots again with a linear
+// scan over the live intervals so values whose lifetimes don't overlap share
+// one. Arguments keep their slots since the caller puts them there
+typedef struct
+{
+	int start;   // first and last offset the slot's value is live at, in code order
+	int end;     // -1 if the slot is never used
+	int slot;
+} Live_Interval;
+
+typedef struct
+{
+	int start;   // [start, end) offsets of the block's instructions
+	int end;
+	int last;    // offset of its last instruction
+	int *succs;  // stb_ds array, block indexes
+
+	// Bit sets over the old slots
+	u64 *uses;   // read before they're written in the block
+	u64 *defs;
+	u64 *live_in;
+	u64 *live_out;
+} Live_Block;
+
+typedef struct
+{
+	int frame_before;
+	int frame_after;
+	int intervals;   // slots that were used at all
+	int rounds;      // dataflow iterations until nothing changed
+} Slot_Stats;
+
+Slot_Stats allocate_slots(Function *fn);
+void print_slot_stats(Function *fn, Slot_Stats stats);
+
+#endif // _LIVENESS_H
@@ -5,15 +5,47 @@
 #include "Lexer.h"
 #include "Parser.h"
 #include "Analyzer.h"
+#include "Fold.h"
 #include "Error.h"
 #include "Bytecode.h"
+#include "Peephole.h"
+#include "Inline.h"
+#include "Eval.h"
+#include "Liveness.h"
+#include "IR.h"
+#include "Register.h"
+#include "Profiler.h"
+#include "Interpreter.h"
+#include "Jit.h"
+#include "Tier.h"
+#include "Trace.h"
+#include "CBackend.h"
+#include "Elf.h"
+#include "Session.h"
+#include "Benchmark.h"
 
 #include "Lexer.c"
 #include "Memory.c"
 #include "Parser.c"
 #include "Analyzer.c"
+#include "Fold.c"
 #include "Error.c"
 #include "Bytecode.c"
+#include "Peephole.c"
+#include "Inline.c"
+#include "Eval.c"
+#include "Liveness.c"
+#include "IR.c"
+#include "Register.c"
+#include "Profiler.c"
+#include "Interpreter.c"
+#include "Jit.c"
+#include "Tier.c"
+#include "Trace.c"
+#include "CBackend.c"
+#include "Elf.c"
+#include "Session.c"
+#include "Benchmark.c"
 
 #define STB_DS_IMPLEMENTATION
 #include "stb_ds.h"
@@ -26,28 +58,107 @@ void print_tokens(Token *tokens)
 	putc('\n', stdout);
 }
 
-int main()
+int main(int argc, char **argv)
 {
-	init_memory();
-	init_lexer();
-	init_analyzer();
-	init_bytecode();
-	char *line = VAlloc(MB(10));
-	while(true)
+	Session_Options options = {};
+	b32 benchmark = false;
+	for(int i = 1; i < argc; ++i)
 	{
-		fgets(line, MB(10), stdin);
-		int line_len = strlen(line);
-		Parsing_Buffer buf = {.data = line, .end = line + line_len};
-		Token *tokens = lex_statement(&buf);
-		// print_tokens(tokens);
+		if(VStrCmp(argv[i], "-memstats"))
+			options.print_memory_stats = true;
+		else if(VStrCmp(argv[i], "-dump"))
+			options.dump_bytecode = true;
+		else if(VStrCmp(argv[i], "-registers"))
+			options.engine = ENGINE_REGISTERS;
+		else if(VStrCmp(argv[i], "-decoded"))
+			options.engine = ENGINE_DECODED;
+		else if(VStrCmp(argv[i], "-jit"))
+			options.engine = ENGINE_JIT;
+		else if(VStrCmp(argv[i], "-tiered"))
+			options.engine = ENGINE_TIERED;
+		else if(strncmp(argv[i], "-tiercalls=", 11) == 0)
+			tier_options.call_threshold = atoi(argv[i] + 11);
+		else if(strncmp(argv[i], "-tierloops=", 11) == 0)
+			tier_options.backedge_threshold = atoi(argv[i] + 11);
+		else if(VStrCmp(argv[i], "-tierbaseline"))
+			tier_options.optimize = false;
+		else if(VStrCmp(argv[i], "-tierlog"))
+			tier_options.log = true;
+		else if(VStrCmp(argv[i], "-trace"))
+			options.engine = ENGINE_TRACING;
+		else if(strncmp(argv[i], "-tracehot=", 10) == 0)
+			trace_options.hot_loop = atoi(argv[i] + 10);
+		else if(VStrCmp(argv[i], "-tracelog"))
+			trace_options.log = true;
+		else if(strncmp(argv[i], "-emitc=", 7) == 0)
+		{
+			options.engine = ENGINE_C;
+			options.c_file = argv[i] + 7;
+		}
+		else if(strncmp(argv[i], "-build=", 7) == 0)
+		{
+			options.engine = ENGINE_C;
+			options.executable = argv[i] + 7;
+		}
+		else if(strncmp(argv[i], "-emitobj=", 9) == 0)
+		{
+			options.engine = ENGINE_ELF;
+			options.elf_file = argv[i] + 9;
+		}
+		else if(strncmp(argv[i], "-emitexe=", 9) == 0)
+		{
+			options.engine = ENGINE_ELF;
+			options.elf_file = argv[i] + 9;
+			options.elf_executable = true;
+		}
+		else if(VStrCmp(argv[i], "-nofold"))
+			codegen_options.fold_constants = false;
+		else if(VStrCmp(argv[i], "-nopeephole"))
+			codegen_options.peephole = false;
+		else if(VStrCmp(argv[i], "-ssa"))
+			codegen_options.ssa = true;
+		else if(VStrCmp(argv[i], "-dumpir"))
+			codegen_options.dump_ir = true;
+		else if(VStrCmp(argv[i], "-optstats"))
+			codegen_options.print_optimizations = true;
+		else if(VStrCmp(argv[i], "-nofuse"))
+			codegen_options.superinstructions = false;
+		else if(VStrCmp(argv[i], "-noreuse"))
+			codegen_options.reuse_slots = false;
+		else if(VStrCmp(argv[i], "-noinline"))
+			codegen_options.inline_calls = false;
+		else if(VStrCmp(argv[i], "-notailcalls"))
+			codegen_options.tail_calls = false;
+		else if(VStrCmp(argv[i], "-noeval"))
+			codegen_options.evaluate_calls = false;
+		else if(VStrCmp(argv[i], "-profile"))
+			options.profile_ops = true;
+		else if(VStrCmp(argv[i], "-bench"))
+			benchmark = true;
+		else
+			printf("Unknown option %s\n", argv[i]);
+	}
 
-		Node *tree = parse_tokens(tokens);
-		analyze_ast(tree);
+	init_session(options);
+	if(benchmark)
+	{
+		run_benchmarks();
+		return 0;
+	}
 
-		free_temp_analyzer();
-		reset_temporary_memory();
-		ArrFree(tokens);
+	char *line = VAlloc(MB(10));
+	while(fgets(line, MB(10) - 1, stdin))
+	{
+		int line_len = strlen(line);
+		// The lexer expects every statement to end in a newline
+		if(line_len == 0 || line[line_len - 1] != '\n')
+		{
+			line[line_len++] = '\n';
+			line[line_len] = 0;
+		}
+		session_run_line(line, line_len);
 	}
+	end_session();
 }
 
 const char *get_token_string(Token_Value token) {
@@ -62,6 +173,7 @@ const char *get_token_string(Token_Value token) {
         case tok_func: return "function";
         case tok_arrow: return "arrow";
         case tok_struct: return "structure";
+        case tok_fixed: return "fixed";
         case tok_if: return "if";
         case tok_for: return "for";
         case tok_identifier: return "identifier";
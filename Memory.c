@@ -1,37 +1,106 @@
+
 #include "Memory.h"
 #include "Basic.h"
 #include <assert.h>
 
 #define TEMP_SIZE (GB(1))
+#define PERM_SIZE (GB(1))
+#define ANALYSIS_SIZE (MB(256))
 
-typedef struct
-{
-	void *Start;
-	void *Current;
-	i64 Size;
-} Memory_Arena;
-
+// @NOTE: temporary memory is wiped after every line, permanent memory lives
+// for the whole session (global symbols, types, function bytecode), analysis
+// memory is the analyzer's scratch and is wiped after every compile
 Memory_Arena temporary_memory;
+Memory_Arena permanent_memory;
+Memory_Arena analysis_memory;
+
+void init_arena(Memory_Arena *arena, i64 size)
+{
+	arena->Capacity = size;
+	arena->Size = size;
+	arena->Start = AllocateVirtualMemory(size);
+	arena->Current = arena->Start;
+}
 
 void init_memory()
 {
-	temporary_memory.Size = TEMP_SIZE;
-	temporary_memory.Start = AllocateVirtualMemory(TEMP_SIZE);
-	temporary_memory.Current = temporary_memory.Start;
+	init_arena(&temporary_memory, TEMP_SIZE);
+	init_arena(&permanent_memory, PERM_SIZE);
+	init_arena(&analysis_memory, ANALYSIS_SIZE);
 };
 
-void *alloc_temp_memory(int size)
+void *arena_alloc(Memory_Arena *arena, int size)
 {
-	void *result = temporary_memory.Current;
-	temporary_memory.Current = (char *)temporary_memory.Current + size;
-	temporary_memory.Size -= size;
-	if(temporary_memory.Size < 0)
+	// keep everything 8 byte aligned
+	size = (size + 7) & ~7;
+	void *result = arena->Current;
+	arena->Current = (char *)arena->Current + size;
+	arena->Size -= size;
+	if(arena->Size < 0)
 	{
 		assert(false);
 	}
+	arena->AllocationCount++;
+	if(arena->Capacity - arena->Size > arena->Peak)
+		arena->Peak = arena->Capacity - arena->Size;
+	return result;
+}
+
+void *alloc_temp_memory(int size)
+{
+	return arena_alloc(&temporary_memory, size);
+}
+
+void *alloc_perm_memory(int size)
+{
+	return arena_alloc(&permanent_memory, size);
+}
+
+void *alloc_analysis_memory(int size)
+{
+	return arena_alloc(&analysis_memory, size);
+}
+
+Arena_Stats get_analysis_memory_stats()
+{
+	Arena_Stats result = {
+		.used = analysis_memory.Capacity - analysis_memory.Size,
+		.peak = analysis_memory.Peak,
+		.allocation_count = analysis_memory.AllocationCount,
+	};
+	return result;
+}
+
+void reset_analysis_memory()
+{
+	memset(analysis_memory.Start, 0, analysis_memory.Capacity - analysis_memory.Size);
+	analysis_memory.Current = analysis_memory.Start;
+	analysis_memory.Size = analysis_memory.Capacity;
+	analysis_memory.AllocationCount = 0;
+}
+
+char *perm_strdup(const char *string)
+{
+	int len = VStrLen(string);
+	char *result = alloc_perm_memory(len + 1);
+	memcpy(result, string, len + 1);
 	return result;
 }
 
+void *get_perm_checkpoint()
+{
+	return permanent_memory.Current;
+}
+
+// @NOTE: used to throw away everything a failed line allocated
+void restore_perm_checkpoint(void *checkpoint)
+{
+	i64 freed = (char *)permanent_memory.Current - (char *)checkpoint;
+	memset(checkpoint, 0, freed);
+	permanent_memory.Current = checkpoint;
+	permanent_memory.Size += freed;
+}
+
 void reset_temporary_memory()
 {
 	memset(temporary_memory.Start, 0, TEMP_SIZE - temporary_memory.Size);
@@ -2,9 +2,36 @@
 #ifndef _MEMORY_H
 #define _MEMORY_H
 
+#include "vlib.h"
 
+typedef struct
+{
+	void *Start;
+	void *Current;
+	i64 Size;
+	i64 Capacity;
+	i64 AllocationCount; // Since the last reset
+	i64 Peak;            // High water mark over the arena's lifetime
+} Memory_Arena;
+
+typedef struct
+{
+	i64 used;
+	i64 peak;
+	i64 allocation_count;
+} Arena_Stats;
+
+void init_memory();
+void *arena_alloc(Memory_Arena *arena, int size);
 void *alloc_temp_memory(int size);
+void *alloc_perm_memory(int size);
+void *alloc_analysis_memory(int size);
+void reset_analysis_memory();
+Arena_Stats get_analysis_memory_stats();
+char *perm_strdup(const char *string);
+void *get_perm_checkpoint();
+void restore_perm_checkpoint(void *checkpoint);
+void reset_temporary_memory();
 
 
 #endif
-
@@ -59,7 +59,7 @@ Node *node_if(Token *token, Node *condition, Node *then)
 	return result;
 }
 
-Node *node_decl(Token *token, Node *operand, Node *expr, Node *type)
+Node *node_decl(Token *token, Node *operand, Node *expr, Node *type, b32 is_const)
 {
 	Node *result = alloc_node();
 	result->type = ND_DECL;
@@ -67,6 +67,7 @@ Node *node_decl(Token *token, Node *operand, Node *expr, Node *type)
 	result->decl.operand = operand;
 	result->decl.expr = expr;
 	result->decl.type = type;
+	result->decl.is_const = is_const;
 	return result;
 }
 
@@ -80,6 +81,38 @@ Node *node_fn_call(Token *token, Node *operand, Node **arguments)
 	return result;
 }
 
+Node *node_switch(Token *token, Node *value)
+{
+	Node *result = alloc_node();
+	result->type = ND_SWITCH;
+	result->token = token;
+	result->switch_.value = value;
+	result->switch_.cases = ArrCreate(Node *);
+	return result;
+}
+
+Node *node_for(Token *token, Node *init, Node *condition, Node *step, Node *body)
+{
+	Node *result = alloc_node();
+	result->type = ND_FOR;
+	result->token = token;
+	result->for_.init = init;
+	result->for_.condition = condition;
+	result->for_.step = step;
+	result->for_.body = body;
+	return result;
+}
+
+Node *node_field(Token *token, Node *operand, Token *name)
+{
+	Node *result = alloc_node();
+	result->type = ND_FIELD;
+	result->token = token;
+	result->field.operand = operand;
+	result->field.name = name;
+	return result;
+}
+
 Node *node_fn_arg(Token *token, Token *identifier, Token *type)
 {
 	Node *result = alloc_node();
@@ -120,7 +153,7 @@ Node *parse_func_arg(Token_Array *tokens)
 	// @TODO: default values for function arguments
 	Token *identifier = eat_token(tokens, tok_identifier);
 	if(peek_token(tokens)->value != ':')
-		return node_fn_arg(identifier, NULL, identifier);
+		return node_fn_arg(identifier, identifier, NULL);
 
 	get_token(tokens);
 	Token *type = eat_token(tokens, tok_identifier);
@@ -136,12 +169,10 @@ Node **parse_arguments(Token_Array *tokens)
 		Node *arg = parse_func_arg(tokens);
 		ArrPush(result, arg);
 		if(peek_token(tokens)->value != ',')
-		{
-			eat_token(tokens, tok_right_par);
 			break;
-		}
 		eat_token(tokens, ',');
 	}
+	eat_token(tokens, tok_right_par);
 	return result;
 }
 
@@ -150,7 +181,9 @@ Node *parse_func(Token_Array *tokens)
 	Node *result = alloc_node();
 	result->type = ND_FN;
 	result->token = eat_token(tokens, tok_func);
-	Token *identifier = eat_token(tokens, tok_identifier);
+	// fn types don't have a name: x : fn(a: i64) -> i64 = ...
+	if(peek_token(tokens)->value == tok_identifier)
+		result->func.name = get_token(tokens);
 	result->func.arguments = parse_arguments(tokens);
 	if(peek_token(tokens)->value == tok_arrow)
 	{
@@ -158,6 +191,8 @@ Node *parse_func(Token_Array *tokens)
 		// @TODO: fn returning fn pointer
 		result->func.ret = parse_expression(tokens);
 	}
+	if(peek_token(tokens)->value == '{')
+		result->func.body = parse_operand(tokens);
 	return result;
 }
 
@@ -244,11 +279,10 @@ Node *parse_atom(Node *operand, Token_Array *tokens)
 					}
 					ArrPush(arguments, arg);
 					if(peek_token(tokens)->value != ',')
-					{
-						eat_token(tokens, ')');
-					}
+						break;
 					get_token(tokens);
 				}
+				eat_token(tokens, ')');
 				operand = node_fn_call(token, operand, arguments);
 			} break;
 			case ':':
@@ -259,17 +293,38 @@ Node *parse_atom(Node *operand, Token_Array *tokens)
 				}
 				get_token(tokens);
 				Node *type = NULL;
-				if(peek_token(tokens)->value == '=')
+				b32 is_const = false;
+				if(peek_token(tokens)->value == '=' || peek_token(tokens)->value == ':')
 				{
-					get_token(tokens);
+					is_const = get_token(tokens)->value == ':';
 				}
 				else
 				{
 					type = parse_operand(tokens);
-					eat_token(tokens, '=');
+					if(peek_token(tokens)->value == ':')
+					{
+						get_token(tokens);
+						is_const = true;
+					}
+					else if(peek_token(tokens)->value == '=')
+					{
+						get_token(tokens);
+					}
+					else
+					{
+						// x : T with no value, only structs can be declared like that
+						operand = node_decl(token, operand, NULL, type, false);
+						break;
+					}
 				}
 				Node *assign_expr = parse_expression(tokens);
-				operand = node_decl(token, operand, assign_expr, type);
+				operand = node_decl(token, operand, assign_expr, type, is_const);
+			} break;
+			case '.':
+			{
+				get_token(tokens);
+				Token *field = eat_token(tokens, tok_identifier);
+				operand = node_field(token, operand, field);
 			} break;
 			default:
 			{
@@ -352,6 +407,7 @@ Node *parse_operand(Token_Array *tokens)
 				Node *expr = parse_expression(tokens);
 				ArrPush(result->body.expressions, expr);
 			};
+			get_token(tokens);
 		} break;
 		case '[':
 		{
@@ -363,6 +419,92 @@ Node *parse_operand(Token_Array *tokens)
 	return result;
 }
 
+// switch value { case 1, 2 { ... } case 3 x += 1 else { ... } }
+Node *parse_switch(Token_Array *tokens)
+{
+	Token *token = get_token(tokens);
+	Node *result = node_switch(token, parse_expression(tokens));
+	eat_token(tokens, '{');
+	while(peek_token(tokens)->value != '}')
+	{
+		Token *next = get_token(tokens);
+		if(next->value == tok_else)
+		{
+			if(result->switch_.otherwise)
+				report_error(next, "A switch can only have one else");
+			result->switch_.otherwise = parse_expression(tokens);
+		}
+		else if(next->value == tok_case)
+		{
+			Node *case_ = alloc_node();
+			case_->type = ND_CASE;
+			case_->token = next;
+			case_->case_.labels = ArrCreate(Node *);
+			while(true)
+			{
+				Node *label = parse_operand(tokens);
+				if(label == NULL)
+					report_error(next, "Expected a value for case");
+				ArrPush(case_->case_.labels, label);
+				if(peek_token(tokens)->value != ',')
+					break;
+				get_token(tokens);
+			}
+			case_->case_.body = parse_expression(tokens);
+			ArrPush(result->switch_.cases, case_);
+		}
+		else
+		{
+			report_error(next, "Expected case or else in switch");
+		}
+	}
+	get_token(tokens);
+	return result;
+}
+
+// struct Name { a: i64, b: f32 } or struct fixed Name { ... }, fields are
+// written like function arguments
+Node *parse_struct(Token_Array *tokens)
+{
+	Node *result = alloc_node();
+	result->type = ND_STRUCT;
+	result->token = get_token(tokens);
+	if(peek_token(tokens)->value == tok_fixed)
+	{
+		get_token(tokens);
+		result->struct_.is_fixed = true;
+	}
+	result->struct_.name = eat_token(tokens, tok_identifier);
+	result->struct_.fields = ArrCreate(Node *);
+	eat_token(tokens, '{');
+	while(peek_token(tokens)->value != '}')
+	{
+		Node *field = parse_func_arg(tokens);
+		ArrPush(result->struct_.fields, field);
+		if(peek_token(tokens)->value != ',')
+			break;
+		get_token(tokens);
+	}
+	eat_token(tokens, '}');
+	return result;
+}
+
+// for i := 0, i < n, i += 1 { ... } or for condition { ... }, ; ends the line
+// so the parts are separated with commas
+Node *parse_for(Token_Array *tokens)
+{
+	Token *token = get_token(tokens);
+	Node *first = parse_expression(tokens);
+	if(peek_token(tokens)->value != ',')
+		return node_for(token, NULL, first, NULL, parse_expression(tokens));
+
+	get_token(tokens);
+	Node *condition = parse_expression(tokens);
+	eat_token(tokens, ',');
+	Node *step = parse_expression(tokens);
+	return node_for(token, first, condition, step, parse_expression(tokens));
+}
+
 Node *parse_unary_expression(Token_Array *tokens)
 {
 	Token *token = peek_token(tokens);
@@ -375,6 +517,18 @@ Node *parse_unary_expression(Token_Array *tokens)
 			Node *then = parse_expression(tokens);
 			return node_if(token, condition, then);
 		} break;
+		case tok_switch:
+		{
+			return parse_switch(tokens);
+		} break;
+		case tok_for:
+		{
+			return parse_for(tokens);
+		} break;
+		case tok_struct:
+		{
+			return parse_struct(tokens);
+		} break;
 	}
 	Node *result = parse_atom(parse_operand(tokens), tokens);
 	if(result == NULL)
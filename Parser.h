@@ -8,6 +8,7 @@ typedef enum
 {
 	LIT_INVALID,
 	LIT_INT,
+	LIT_UINT,
 	LIT_DOUBLE,
 	LIT_CHAR
 } Literal_Type;
@@ -26,6 +27,11 @@ typedef enum
 	ND_BODY,
 	ND_DECL,
 	ND_CALL,
+	ND_SWITCH,
+	ND_CASE,
+	ND_FOR,
+	ND_STRUCT,
+	ND_FIELD,
 } Node_Type;
 
 typedef struct _ast_node Node;
@@ -55,15 +61,18 @@ typedef struct _ast_node
 		{
 			union
 			{
-				u64 _i64;
+				u64 _u64;
+				i64 _i64;
 				f64 _f64;
 			};
 			Literal_Type type;
 		} literal;
 		struct
 		{
-			Node **arguments; // Dynamic array
+			Token *name;        // NULL for fn types
+			Node **arguments;   // Dynamic array
 			Node *ret;
+			Node *body;         // NULL for fn types
 		} func;
 		struct
 		{
@@ -79,12 +88,44 @@ typedef struct _ast_node
 			Node *operand;
 			Node *expr;
 			Node *type;
+			b32 is_const;       // x :: e or x : T : e, can't be assigned to
 		} decl;
 		struct
 		{
 			Node *operand;
 			Node **arguments;
+			b32 is_tail;        // what it returns is what the fn it's in returns, see mark_tail_calls
 		} fn_call;
+		struct
+		{
+			Node *value;
+			Node **cases;       // Dynamic array of ND_CASE
+			Node *otherwise;    // the else body, NULL if there isn't one
+		} switch_;
+		struct
+		{
+			Node **labels;      // Dynamic array of literals
+			Node *body;
+		} case_;
+		struct
+		{
+			Node *init;         // NULL in the for condition { ... } form
+			Node *condition;
+			Node *step;         // NULL in the for condition { ... } form
+			Node *body;
+		} for_;
+		struct
+		{
+			Token *name;
+			Node **fields;      // Dynamic array of ND_FN_ARG
+			b32 is_fixed;       // struct fixed Name { ... }, laid out in the declared order
+		} struct_;
+		struct
+		{
+			Node *operand;      // a variable or another field
+			Token *name;
+			int offset;         // in bytes from the start of operand, added by analyzer
+		} field;
 	};
 
 	const struct _Type_Info *type_info; // added by analyzer
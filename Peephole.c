@@ -0,0 +1,346 @@
+#include "Peephole.h"
+#include <assert.h>
+
+// @NOTE: a rule gets the instructions at the window's start (as many as are
+// there, none of them but the first is a jump target) and emits what replaces
+// the first length of them. It gives false and emits nothing if it doesn't match
+typedef b32 (*Peephole_Apply)(u8 **window, int offset, Bytecode *out);
+
+typedef struct
+{
+	const char *name;
+	int length;
+	Peephole_Apply apply;
+} Peephole_Rule;
+
+int count_instructions(Bytecode *bytecode)
+{
+	int count = 0;
+	for(int at = 0; at < bytecode->i; at += get_instruction_size(bytecode->bytecode + at))
+		count++;
+	return count;
+}
+
+static b32 get_push_value(u8 *at, i64 *value)
+{
+	switch(at[0])
+	{
+		case PUSHB:  *value = (i8)at[1]; return true;
+		case PUSHW:  *value = (i16)read_word(at + 1); return true;
+		case PUSHDW: *value = (i32)read_dword(at + 1); return true;
+		case PUSHQW: *value = (i64)read_qword(at + 1); return true;
+		default: return false;
+	}
+}
+
+// @NOTE: does an integer op on constants the same way the interpreter would,
+// gives false for the ones that have to be left for runtime (division by 0)
+b32 fold_int_op(OP op, i64 a, i64 b, i64 *result)
+{
+	u32 a32 = (u32)a;
+	u32 b32 = (u32)b;
+	switch(op)
+	{
+		case ADDDW: *result = (i32)(a32 + b32); break;
+		case SUBDW: *result = (i32)(a32 - b32); break;
+		case MULDW: *result = (i32)(a32 * b32); break;
+		case ANDDW: *result = (i32)(a32 & b32); break;
+		case ORDW:  *result = (i32)(a32 | b32); break;
+		case XORDW: *result = (i32)(a32 ^ b32); break;
+		case SHLDW: *result = (i32)(a32 << (b32 & 31)); break;
+		case SHRDW: *result = (i32)a32 >> (b32 & 31); break;
+		case DIVDW:
+		case MODDW:
+		{
+			if((i32)b32 == 0)
+				return false;
+			if((i32)b32 == -1)
+				*result = op == DIVDW ? (i32)(0u - a32) : 0;
+			else
+				*result = op == DIVDW ? (i32)a32 / (i32)b32 : (i32)a32 % (i32)b32;
+		} break;
+
+		case ADDQW: *result = (i64)((u64)a + (u64)b); break;
+		case SUBQW: *result = (i64)((u64)a - (u64)b); break;
+		case MULQW: *result = (i64)((u64)a * (u64)b); break;
+		case ANDQW: *result = a & b; break;
+		case ORQW:  *result = a | b; break;
+		case XORQW: *result = a ^ b; break;
+		case SHLQW: *result = (i64)((u64)a << (b & 63)); break;
+		case SHRQW: *result = a >> (b & 63); break;
+		case DIVQW:
+		case MODQW:
+		{
+			if(b == 0)
+				return false;
+			if(b == -1)
+				*result = op == DIVQW ? (i64)(0 - (u64)a) : 0;
+			else
+				*result = op == DIVQW ? a / b : a % b;
+		} break;
+
+		case EQDW: *result = (i32)a32 == (i32)b32; break;
+		case NEDW: *result = (i32)a32 != (i32)b32; break;
+		case LTDW: *result = (i32)a32 <  (i32)b32; break;
+		case LEDW: *result = (i32)a32 <= (i32)b32; break;
+		case GTDW: *result = (i32)a32 >  (i32)b32; break;
+		case GEDW: *result = (i32)a32 >= (i32)b32; break;
+		case EQQW: *result = a == b; break;
+		case NEQW: *result = a != b; break;
+		case LTQW: *result = a <  b; break;
+		case LEQW: *result = a <= b; break;
+		case GTQW: *result = a >  b; break;
+		case GEQW: *result = a >= b; break;
+		default: return false;
+	}
+	return true;
+}
+
+// STORE x, LOAD x -> TEE x
+static b32 forward_store(u8 **window, int offset, Bytecode *out)
+{
+	OP store = window[0][0];
+	OP load = window[1][0];
+	if(store < STOREB || store > STORED || load != LOADB + (store - STOREB))
+		return false;
+	u16 slot = read_word(window[0] + 1);
+	if(read_word(window[1] + 1) != slot)
+		return false;
+	push_byte(TEEB + (store - STOREB), out);
+	push_word(slot, out);
+	return true;
+}
+
+// PUSH a, PUSH b, op -> PUSH (a op b)
+static b32 combine_constants(u8 **window, int offset, Bytecode *out)
+{
+	i64 a, b, result;
+	if(!get_push_value(window[0], &a) || !get_push_value(window[1], &b))
+		return false;
+	if(!fold_int_op(window[2][0], a, b, &result))
+		return false;
+	pushop_int(out, result);
+	return true;
+}
+
+// PUSH 0, ADD (and the rest that leave the value as it is) -> nothing
+static b32 remove_identity(u8 **window, int offset, Bytecode *out)
+{
+	i64 k;
+	if(!get_push_value(window[0], &k))
+		return false;
+	switch(window[1][0])
+	{
+		case ADDDW: case ADDQW:
+		case SUBDW: case SUBQW:
+		case ORDW:  case ORQW:
+		case XORDW: case XORQW:
+		case SHLDW: case SHLQW:
+		case SHRDW: case SHRQW:
+			return k == 0;
+		case MULDW: case MULQW:
+		case DIVDW: case DIVQW:
+			return k == 1;
+		default:
+			return false;
+	}
+}
+
+// Something already narrow enough, NARROW -> the something.
+// PUSH k, NARROW -> PUSH (narrowed k)
+static b32 remove_narrowing(u8 **window, int offset, Bytecode *out)
+{
+	OP narrow = window[1][0];
+	if(narrow != NARROWB && narrow != NARROWW)
+		return false;
+	OP load = LOADB + (narrow - NARROWB);
+	i64 k;
+	if(get_push_value(window[0], &k))
+	{
+		pushop_int(out, (i64)narrow_cell((u64)k, load));
+		return true;
+	}
+
+	// What the value was narrowed by, only bytes and words can be narrower
+	OP op = window[0][0];
+	OP narrowed;
+	if(op >= LOADB && op <= LOADW)
+		narrowed = op;
+	else if(op >= FLOADB && op <= FLOADW)
+		narrowed = LOADB + (op - FLOADB);
+	else if(op >= GFLOADB && op <= GFLOADW)
+		narrowed = LOADB + (op - GFLOADB);
+	else if(op == NARROWB || op == NARROWW)
+		narrowed = LOADB + (op - NARROWB);
+	else
+		return false;
+	if(narrowed > load)
+		return false;
+	int size = get_instruction_size(window[0]);
+	reserve_bytecode(size, out);
+	memcpy(out->bytecode + out->i, window[0], size);
+	out->i += size;
+	return true;
+}
+
+// Something that only pushes, then POP -> nothing. TEE x, POP -> STORE x
+static b32 remove_dead_push(u8 **window, int offset, Bytecode *out)
+{
+	if(window[1][0] != POP)
+		return false;
+	OP op = window[0][0];
+	if(op >= TEEB && op <= TEED)
+	{
+		push_byte(STOREB + (op - TEEB), out);
+		push_word(read_word(window[0] + 1), out);
+		return true;
+	}
+	return (op >= LOADB && op <= LOADD) || (op >= PUSHB && op <= PUSHD) ||
+		op == PUSHS || op == GLOAD;
+}
+
+// JMP to the instruction right after it -> nothing
+static b32 remove_jump_to_next(u8 **window, int offset, Bytecode *out)
+{
+	return window[0][0] == JMP && read_dword(window[0] + 1) == offset + get_instruction_size(window[0]);
+}
+
+// PUSH k, JZ or JNZ -> JMP if it's always taken, nothing if it never is.
+// PUSH k, SWITCH -> JMP to the entry k picks
+static b32 remove_constant_branch(u8 **window, int offset, Bytecode *out)
+{
+	i64 k;
+	OP jump = window[1][0];
+	if((jump != JZ && jump != JNZ && jump != SWITCH) || !get_push_value(window[0], &k))
+		return false;
+	if(jump == SWITCH)
+	{
+		u64 index = (u64)k - read_qword(window[1] + 1);
+		int target = index < read_dword(window[1] + 9) ? 17 + 4 * index : 13;
+		push_byte(JMP, out);
+		push_dword(read_dword(window[1] + target), out);
+		return true;
+	}
+	if((k == 0) == (jump == JZ))
+	{
+		push_byte(JMP, out);
+		push_dword(read_dword(window[1] + 1), out);
+	}
+	return true;
+}
+
+// JMP, RET or SWITCH, then something no jump goes to -> the JMP, RET or SWITCH.
+// Tail calls leave the RET after the body's last expression behind
+static b32 remove_unreachable(u8 **window, int offset, Bytecode *out)
+{
+	OP op = window[0][0];
+	if(op != JMP && op != RET && op != SWITCH)
+		return false;
+	int size = get_instruction_size(window[0]);
+	reserve_bytecode(size, out);
+	memcpy(out->bytecode + out->i, window[0], size);
+	out->i += size;
+	return true;
+}
+
+static Peephole_Rule peephole_rules[PEEPHOLE_RULE_COUNT] = {
+	[RULE_FORWARD_STORE]     = {"store/load forwarding", 2, forward_store},
+	[RULE_COMBINE_CONSTANTS] = {"constant combining",    3, combine_constants},
+	[RULE_IDENTITY]          = {"identity",              2, remove_identity},
+	[RULE_NARROWING]         = {"narrowing",             2, remove_narrowing},
+	[RULE_DEAD_PUSH]         = {"dead push",             2, remove_dead_push},
+	[RULE_JUMP_TO_NEXT]      = {"jump to next",          1, remove_jump_to_next},
+	[RULE_CONSTANT_BRANCH]   = {"constant branch",       2, remove_constant_branch},
+	[RULE_UNREACHABLE]       = {"unreachable code",      2, remove_unreachable},
+};
+
+// One pass over the code, gives false if no rule matched anywhere. The old code
+// is left for the caller to free
+static b32 peephole_pass(Function *fn, Peephole_Stats *stats)
+{
+	Bytecode *code = &fn->code;
+	b32 *targets = find_jump_targets(code);
+	int *new_offsets = alloc_temp_memory(sizeof(int) * (code->i + 1));
+	Bytecode result = make_bytecode(code->i);
+	b32 changed = false;
+
+	int at = 0;
+	while(at < code->i)
+	{
+		new_offsets[at] = result.i;
+
+		u8 *window[PEEPHOLE_MAX_WINDOW];
+		int ends[PEEPHOLE_MAX_WINDOW];
+		int window_size = 0;
+		int next = at;
+		do
+		{
+			window[window_size] = code->bytecode + next;
+			next += get_instruction_size(code->bytecode + next);
+			ends[window_size++] = next;
+		} while(window_size < PEEPHOLE_MAX_WINDOW && next < code->i && !targets[next]);
+
+		b32 applied = false;
+		for(int rule = 0; rule < PEEPHOLE_RULE_COUNT; ++rule)
+		{
+			Peephole_Rule *r = &peephole_rules[rule];
+			if(r->length <= window_size && r->apply(window, at, &result))
+			{
+				stats->rule_hits[rule]++;
+				at = ends[r->length - 1];
+				applied = true;
+				changed = true;
+				break;
+			}
+		}
+		if(!applied)
+		{
+			int size = get_instruction_size(window[0]);
+			reserve_bytecode(size, &result);
+			memcpy(result.bytecode + result.i, window[0], size);
+			result.i += size;
+			at += size;
+		}
+	}
+	new_offsets[code->i] = result.i;
+	relocate_jumps(&result, new_offsets);
+	finish_bytecode(&result);
+
+	*code = result;
+	return changed;
+}
+
+// @NOTE: runs the rules until none of them match, every rule removes at least
+// one instruction so this ends, and running it again on its output changes nothing
+Peephole_Stats peephole_optimize(Function *fn)
+{
+	Peephole_Stats stats = {};
+	stats.instructions_before = count_instructions(&fn->code);
+	b32 changed;
+	do
+	{
+		stats.passes++;
+		Bytecode before = fn->code;
+		changed = peephole_pass(fn, &stats);
+		// The pass that matched nothing is the run again, it has to leave every byte alone
+		assert(changed || (fn->code.i == before.i &&
+					memcmp(fn->code.bytecode, before.bytecode, before.i) == 0));
+		free_bytecode(&before);
+	} while(changed);
+	stats.instructions_after = count_instructions(&fn->code);
+	fn->max_stack = compute_max_stack(&fn->code);
+	return stats;
+}
+
+void print_peephole_stats(Function *fn, Peephole_Stats stats)
+{
+	printf("fn %s: peephole removed %d of %d instructions in %d passes", fn->name,
+			stats.instructions_before - stats.instructions_after, stats.instructions_before,
+			stats.passes);
+	for(int rule = 0; rule < PEEPHOLE_RULE_COUNT; ++rule)
+	{
+		if(stats.rule_hits[rule])
+			printf(", %s %d", peephole_rules[rule].name, stats.rule_hits[rule]);
+	}
+	putc('\n', stdout);
+}
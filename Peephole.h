@@ -0,0 +1,36 @@
+#ifndef _PEEPHOLE_H
+#define _PEEPHOLE_H
+
+#include "Basic.h"
+#include "Bytecode.h"
+
+#define PEEPHOLE_MAX_WINDOW 3
+
+typedef enum
+{
+	RULE_FORWARD_STORE,
+	RULE_COMBINE_CONSTANTS,
+	RULE_IDENTITY,
+	RULE_NARROWING,
+	RULE_DEAD_PUSH,
+	RULE_JUMP_TO_NEXT,
+	RULE_CONSTANT_BRANCH,
+	RULE_UNREACHABLE,
+
+	PEEPHOLE_RULE_COUNT,
+} Peephole_Rule_Kind;
+
+typedef struct
+{
+	int instructions_before;
+	int instructions_after;
+	int passes;
+	int rule_hits[PEEPHOLE_RULE_COUNT];
+} Peephole_Stats;
+
+int count_instructions(Bytecode *bytecode);
+b32 fold_int_op(OP op, i64 a, i64 b, i64 *result);
+Peephole_Stats peephole_optimize(Function *fn);
+void print_peephole_stats(Function *fn, Peephole_Stats stats);
+
+#endif // _PEEPHOLE_H
@@ -0,0 +1,90 @@
+#include "Profiler.h"
+
+Op_Profile *make_op_profile()
+{
+	Op_Profile *profile = VAlloc(sizeof(Op_Profile));
+	memset(profile, 0, sizeof(Op_Profile));
+	return profile;
+}
+
+static b32 ends_sequence(OP op)
+{
+	return ends_block(op) || op == CALL || op == CALLI || op == TAILCALL;
+}
+
+void profile_op(Op_Profile *profile, OP op)
+{
+	profile->dispatch_count++;
+	if(profile->history_count >= 1)
+		profile->pairs[profile->history[1]][op]++;
+	if(profile->history_count >= 2)
+	{
+		u32 key = profile->history[0] << 16 | profile->history[1] << 8 | op;
+		int index = hmgeti(profile->triples, key);
+		if(index == -1)
+			hmput(profile->triples, key, 1);
+		else
+			profile->triples[index].value++;
+	}
+
+	if(ends_sequence(op))
+	{
+		profile->history_count = 0;
+		return;
+	}
+	profile->history[0] = profile->history[1];
+	profile->history[1] = op;
+	if(profile->history_count < 2)
+		profile->history_count++;
+}
+
+static int compare_sequence_counts(const void *a, const void *b)
+{
+	u64 left = ((Sequence_Count *)a)->value;
+	u64 right = ((Sequence_Count *)b)->value;
+	return left < right ? 1 : left > right ? -1 : 0;
+}
+
+static void print_sequences(Sequence_Count *sequences, int count, int length, u64 total, FILE *out)
+{
+	qsort(sequences, count, sizeof(Sequence_Count), compare_sequence_counts);
+	for(int i = 0; i < count && i < PROFILE_TOP_SEQUENCES; ++i)
+	{
+		fprintf(out, "  %12llu %5.1f%%  ", (unsigned long long)sequences[i].value,
+				100.0 * sequences[i].value / total);
+		for(int j = length - 1; j >= 0; --j)
+			fprintf(out, " %s", op_info[(sequences[i].key >> (j * 8)) & 0xFF].name);
+		fputc('\n', out);
+	}
+}
+
+void print_op_profile(Op_Profile *profile, FILE *out)
+{
+	if(profile->dispatch_count == 0)
+		return;
+
+	Sequence_Count *pairs = NULL;
+	for(int a = 0; a < OP_COUNT; ++a)
+	{
+		for(int b = 0; b < OP_COUNT; ++b)
+		{
+			if(profile->pairs[a][b])
+			{
+				Sequence_Count pair = {.key = a << 8 | b, .value = profile->pairs[a][b]};
+				arrput(pairs, pair);
+			}
+		}
+	}
+	fprintf(out, "%llu instructions dispatched\n", (unsigned long long)profile->dispatch_count);
+	fprintf(out, "pairs:\n");
+	print_sequences(pairs, arrlen(pairs), 2, profile->dispatch_count, out);
+	arrfree(pairs);
+
+	// Sorted in a copy, the hash map's own array can't be reordered
+	Sequence_Count *triples = NULL;
+	for(int i = 0; i < hmlen(profile->triples); ++i)
+		arrput(triples, profile->triples[i]);
+	fprintf(out, "triples:\n");
+	print_sequences(triples, arrlen(triples), 3, profile->dispatch_count, out);
+	arrfree(triples);
+}
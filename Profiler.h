@@ -0,0 +1,30 @@
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include "Basic.h"
+#include "Bytecode.h"
+
+#define PROFILE_TOP_SEQUENCES 16
+
+typedef struct
+{
+	u32 key;   // opcodes, first one in the highest byte used
+	u64 value; // times it was dispatched
+} Sequence_Count;
+
+// @NOTE: counts opcode pairs and triples as they're dispatched. A sequence
+// ends at anything that changes control flow, those can't be fused anyway
+typedef struct
+{
+	u64 dispatch_count;
+	u64 pairs[OP_COUNT][OP_COUNT];
+	Sequence_Count *triples; // stb_ds hash map
+	u8 history[2];
+	int history_count;
+} Op_Profile;
+
+Op_Profile *make_op_profile();
+void profile_op(Op_Profile *profile, OP op);
+void print_op_profile(Op_Profile *profile, FILE *out);
+
+#endif // _PROFILER_H
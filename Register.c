@@ -0,0 +1,646 @@
+#include "Register.h"
+
+R_OP_Info r_op_info[R_OP_COUNT] = {
+	[R_NOP]    = {"NOP",    ""},
+	[R_MOVB]   = {"MOVB",   "rr"},
+	[R_MOVW]   = {"MOVW",   "rr"},
+	[R_MOVDW]  = {"MOVDW",  "rr"},
+	[R_MOVQW]  = {"MOVQW",  "rr"},
+	[R_MOVF]   = {"MOVF",   "rr"},
+	[R_MOVK]   = {"MOVK",   "rk"},
+	[R_ADDDW]  = {"ADDDW",  "rrr"},
+	[R_ADDQW]  = {"ADDQW",  "rrr"},
+	[R_ADDF]   = {"ADDF",   "rrr"},
+	[R_ADDD]   = {"ADDD",   "rrr"},
+	[R_SUBDW]  = {"SUBDW",  "rrr"},
+	[R_SUBQW]  = {"SUBQW",  "rrr"},
+	[R_SUBF]   = {"SUBF",   "rrr"},
+	[R_SUBD]   = {"SUBD",   "rrr"},
+	[R_MULDW]  = {"MULDW",  "rrr"},
+	[R_MULQW]  = {"MULQW",  "rrr"},
+	[R_MULF]   = {"MULF",   "rrr"},
+	[R_MULD]   = {"MULD",   "rrr"},
+	[R_DIVDW]  = {"DIVDW",  "rrr"},
+	[R_DIVQW]  = {"DIVQW",  "rrr"},
+	[R_DIVF]   = {"DIVF",   "rrr"},
+	[R_DIVD]   = {"DIVD",   "rrr"},
+	[R_MODDW]  = {"MODDW",  "rrr"},
+	[R_MODQW]  = {"MODQW",  "rrr"},
+	[R_ANDDW]  = {"ANDDW",  "rrr"},
+	[R_ANDQW]  = {"ANDQW",  "rrr"},
+	[R_ORDW]   = {"ORDW",   "rrr"},
+	[R_ORQW]   = {"ORQW",   "rrr"},
+	[R_XORDW]  = {"XORDW",  "rrr"},
+	[R_XORQW]  = {"XORQW",  "rrr"},
+	[R_SHLDW]  = {"SHLDW",  "rrr"},
+	[R_SHLQW]  = {"SHLQW",  "rrr"},
+	[R_SHRDW]  = {"SHRDW",  "rrr"},
+	[R_SHRQW]  = {"SHRQW",  "rrr"},
+	[R_EQDW]   = {"EQDW",   "rrr"},
+	[R_EQQW]   = {"EQQW",   "rrr"},
+	[R_EQF]    = {"EQF",    "rrr"},
+	[R_EQD]    = {"EQD",    "rrr"},
+	[R_NEDW]   = {"NEDW",   "rrr"},
+	[R_NEQW]   = {"NEQW",   "rrr"},
+	[R_NEF]    = {"NEF",    "rrr"},
+	[R_NED]    = {"NED",    "rrr"},
+	[R_LTDW]   = {"LTDW",   "rrr"},
+	[R_LTQW]   = {"LTQW",   "rrr"},
+	[R_LTF]    = {"LTF",    "rrr"},
+	[R_LTD]    = {"LTD",    "rrr"},
+	[R_LEDW]   = {"LEDW",   "rrr"},
+	[R_LEQW]   = {"LEQW",   "rrr"},
+	[R_LEF]    = {"LEF",    "rrr"},
+	[R_LED]    = {"LED",    "rrr"},
+	[R_GTDW]   = {"GTDW",   "rrr"},
+	[R_GTQW]   = {"GTQW",   "rrr"},
+	[R_GTF]    = {"GTF",    "rrr"},
+	[R_GTD]    = {"GTD",    "rrr"},
+	[R_GEDW]   = {"GEDW",   "rrr"},
+	[R_GEQW]   = {"GEQW",   "rrr"},
+	[R_GEF]    = {"GEF",    "rrr"},
+	[R_GED]    = {"GED",    "rrr"},
+	[R_GLOAD]  = {"GLOAD",  "rg"},
+	[R_GSTORE] = {"GSTORE", "gr"},
+	[R_FLOADB]    = {"FLOADB",    "rri"},
+	[R_FLOADW]    = {"FLOADW",    "rri"},
+	[R_FLOADDW]   = {"FLOADDW",   "rri"},
+	[R_FLOADQW]   = {"FLOADQW",   "rri"},
+	[R_FLOADF]    = {"FLOADF",    "rri"},
+	[R_FLOADD]    = {"FLOADD",    "rri"},
+	[R_FSTOREB]   = {"FSTOREB",   "rir"},
+	[R_FSTOREW]   = {"FSTOREW",   "rir"},
+	[R_FSTOREDW]  = {"FSTOREDW",  "rir"},
+	[R_FSTOREQW]  = {"FSTOREQW",  "rir"},
+	[R_FSTOREF]   = {"FSTOREF",   "rir"},
+	[R_FSTORED]   = {"FSTORED",   "rir"},
+	[R_GFLOADB]   = {"GFLOADB",   "rgi"},
+	[R_GFLOADW]   = {"GFLOADW",   "rgi"},
+	[R_GFLOADDW]  = {"GFLOADDW",  "rgi"},
+	[R_GFLOADQW]  = {"GFLOADQW",  "rgi"},
+	[R_GFLOADF]   = {"GFLOADF",   "rgi"},
+	[R_GFLOADD]   = {"GFLOADD",   "rgi"},
+	[R_GFSTOREB]  = {"GFSTOREB",  "gir"},
+	[R_GFSTOREW]  = {"GFSTOREW",  "gir"},
+	[R_GFSTOREDW] = {"GFSTOREDW", "gir"},
+	[R_GFSTOREQW] = {"GFSTOREQW", "gir"},
+	[R_GFSTOREF]  = {"GFSTOREF",  "gir"},
+	[R_GFSTORED]  = {"GFSTORED",  "gir"},
+	[R_EQS]    = {"EQS",    "rrr"},
+	[R_HASHS]  = {"HASHS",  "rrii"},
+	[R_JMP]    = {"JMP",    "o"},
+	[R_JZ]     = {"JZ",     "ro"},
+	[R_JNZ]    = {"JNZ",    "ro"},
+	[R_SWITCH] = {"SWITCH", "rt"},
+	[R_LOOPQW] = {"LOOPQW", "rrio"},
+	[R_LOOPQWI] = {"LOOPQWI", "riio"},
+	[R_CALL]   = {"CALL",   "fr"},
+	[R_CALLI]  = {"CALLI",  "rr"},
+	[R_RET]    = {"RET",    "r"},
+	[R_RET0]   = {"RET0",   ""},
+	[R_TAILCALL] = {"TAILCALL", "fr"},
+};
+
+_Static_assert(R_GED - R_ADDDW == GED - ADDDW, "register binary ops must mirror the stack ones");
+_Static_assert(R_GFSTORED - R_FLOADB == GFSTORED - FLOADB, "register field ops must mirror the stack ones");
+
+// at is where the operand starts
+int get_operand_size(char operand, u8 *at)
+{
+	switch(operand)
+	{
+		case 'r': return 2;
+		case 'g': return 2;
+		case 'k': return 8;
+		case 'o': return 4;
+		case 'f': return 4;
+		case 'i': return 4;
+		case 't': return 16 + 4 * read_dword(at + 8);
+	}
+	assert(false);
+	return 0;
+}
+
+int get_register_instruction_size(u8 *at)
+{
+	int size = 1;
+	for(const char *operand = r_op_info[at[0]].operands; *operand; ++operand)
+		size += get_operand_size(*operand, at + size);
+	return size;
+}
+
+typedef struct
+{
+	int at;     // where the 32 bit offset is in the register code
+	int target; // offset in the stack code
+} Jump_Fixup;
+
+// @NOTE: the translator keeps a stack of the registers the operand stack values
+// are in. Loads don't copy anything, the value stays in the local's register
+// until something is about to write over that local. Values made by an
+// instruction go in the register of their stack depth unless a store right
+// after takes them, then they're written to the local directly.
+//
+// This relies on every slot always holding a value that's already narrowed to
+// its type, which the stack code keeps up too, so the sign extending loads
+// don't have to do anything
+typedef struct
+{
+	Function *fn;
+	Bytecode *out;
+	u16 *stack;
+	int depth;
+} Register_Translator;
+
+static u16 temp_register(Register_Translator *t, int depth)
+{
+	return t->fn->frame_size + depth;
+}
+
+static void emit_op(Register_Translator *t, R_OP op)
+{
+	push_byte(op, t->out);
+}
+
+static void emit_register(Register_Translator *t, u16 reg)
+{
+	push_word(reg, t->out);
+}
+
+static void emit_move(Register_Translator *t, R_OP op, u16 dst, u16 src)
+{
+	emit_op(t, op);
+	emit_register(t, dst);
+	emit_register(t, src);
+}
+
+static void push_register(Register_Translator *t, u16 reg)
+{
+	t->stack[t->depth++] = reg;
+}
+
+static u16 pop_register(Register_Translator *t)
+{
+	assert(t->depth > 0);
+	return t->stack[--t->depth];
+}
+
+// Gives a stack value its own register if it's still sitting in a local's
+static void materialize(Register_Translator *t, int depth)
+{
+	u16 temp = temp_register(t, depth);
+	if(t->stack[depth] != temp)
+	{
+		emit_move(t, R_MOVQW, temp, t->stack[depth]);
+		t->stack[depth] = temp;
+	}
+}
+
+static void materialize_all(Register_Translator *t)
+{
+	for(int i = 0; i < t->depth; ++i)
+		materialize(t, i);
+}
+
+// Called before slot is written, stack values still reading it need a copy of the old value
+static void materialize_uses(Register_Translator *t, u16 slot)
+{
+	for(int i = 0; i < t->depth; ++i)
+	{
+		if(t->stack[i] == slot)
+			materialize(t, i);
+	}
+}
+
+static b32 is_store(OP op)
+{
+	return (op >= STOREB && op <= STORED) || (op >= TEEB && op <= TEED);
+}
+
+// TEEs narrow like the store they come from
+static OP get_store(OP op)
+{
+	return op >= TEEB && op <= TEED ? STOREB + (op - TEEB) : op;
+}
+
+u64 narrow_value(u64 value, OP store)
+{
+	switch(store)
+	{
+		case STOREB:  return (u64)(i64)(i8)value;
+		case STOREW:  return (u64)(i64)(i16)value;
+		case STOREDW: return (u64)(i64)(i32)value;
+		case STOREF:  return (u32)value;
+		default:      return value;
+	}
+}
+
+// If the next instruction stores the value that's about to be made, gives the
+// slot to write it to directly (and skips the store), otherwise the register
+// for the new top of the stack. DW results still need narrowing for i8 and i16
+// slots, already_narrowed says the value fits any slot of its type
+static u16 get_destination(Register_Translator *t, int *next, int *depths,
+		b32 *is_label, b32 already_narrowed)
+{
+	Bytecode *code = &t->fn->code;
+	if(*next < code->i && !is_label[*next] && depths[*next] != -1)
+	{
+		OP op = code->bytecode[*next];
+		OP store = get_store(op);
+		if(is_store(op) && (already_narrowed || (store != STOREB && store != STOREW)))
+		{
+			u16 slot = read_word(code->bytecode + *next + 1);
+			materialize_uses(t, slot);
+			*next += get_instruction_size(code->bytecode + *next);
+			// A TEE leaves the value on the stack, it's in the slot now
+			if(op != store)
+				push_register(t, slot);
+			return slot;
+		}
+	}
+	u16 result = temp_register(t, t->depth);
+	push_register(t, result);
+	return result;
+}
+
+static void emit_constant(Register_Translator *t, u64 value, int *next, int *depths, b32 *is_label)
+{
+	Bytecode *code = &t->fn->code;
+	// A constant can be narrowed right here, so it can always go straight to the slot
+	if(*next < code->i && !is_label[*next] && is_store(code->bytecode[*next]))
+		value = narrow_value(value, get_store(code->bytecode[*next]));
+	u16 dst = get_destination(t, next, depths, is_label, true);
+	emit_op(t, R_MOVK);
+	emit_register(t, dst);
+	push_qword(value, t->out);
+}
+
+static void emit_call_arguments(Register_Translator *t, int arg_count)
+{
+	// Arguments have to be in the registers the callee's frame starts at
+	for(int i = t->depth - arg_count; i < t->depth; ++i)
+		materialize(t, i);
+	t->depth -= arg_count;
+}
+
+// @NOTE: builds fn->registers from fn->code
+void translate_to_registers(Function *fn)
+{
+	Bytecode *code = &fn->code;
+	int max_depth;
+	int *depths = compute_stack_depths(code, &max_depth);
+	int *offsets = alloc_temp_memory(sizeof(int) * (code->i + 1));
+	b32 *is_label = find_jump_targets(code);
+
+	if(fn->registers.bytecode)
+		free_bytecode(&fn->registers);
+	fn->registers = make_bytecode(code->i + 16);
+	Register_Translator t = {.fn = fn, .out = &fn->registers,
+		.stack = alloc_temp_memory(sizeof(u16) * (max_depth + 1))};
+	Jump_Fixup *fixups = NULL;
+
+	b32 falls_through = false;
+	int at = 0;
+	while(at < code->i)
+	{
+		u8 *ip = code->bytecode + at;
+		OP op = ip[0];
+		int next = at + get_instruction_size(ip);
+		if(is_label[at])
+		{
+			// Every path coming in has the stack in the same registers
+			if(falls_through)
+				materialize_all(&t);
+			t.depth = depths[at];
+			for(int i = 0; i < t.depth; ++i)
+				t.stack[i] = temp_register(&t, i);
+		}
+		offsets[at] = t.out->i;
+		if(depths[at] == -1)
+		{
+			falls_through = false;
+			at = next;
+			continue;
+		}
+		assert(t.depth == depths[at]);
+
+		switch(op)
+		{
+			case NOP: break;
+			case LOADB:
+			case LOADW:
+			case LOADDW:
+			case LOADQW:
+			case LOADF:
+			case LOADD:
+			{
+				push_register(&t, read_word(ip + 1));
+			} break;
+			case STOREB:
+			case STOREW:
+			case STOREDW:
+			case STOREQW:
+			case STOREF:
+			case STORED:
+			{
+				static const R_OP moves[] = {R_MOVB, R_MOVW, R_MOVDW, R_MOVQW, R_MOVF, R_MOVQW};
+				u16 slot = read_word(ip + 1);
+				u16 src = pop_register(&t);
+				materialize_uses(&t, slot);
+				if(src != slot)
+					emit_move(&t, moves[op - STOREB], slot, src);
+			} break;
+			case TEEB:
+			case TEEW:
+			case TEEDW:
+			case TEEQW:
+			case TEEF:
+			case TEED:
+			{
+				static const R_OP moves[] = {R_MOVB, R_MOVW, R_MOVDW, R_MOVQW, R_MOVF, R_MOVQW};
+				u16 slot = read_word(ip + 1);
+				u16 src = pop_register(&t);
+				materialize_uses(&t, slot);
+				if(src != slot)
+					emit_move(&t, moves[op - TEEB], slot, src);
+				push_register(&t, slot);
+			} break;
+			case PUSHB:  emit_constant(&t, (u64)(i64)(i8)ip[1], &next, depths, is_label); break;
+			case PUSHW:  emit_constant(&t, (u64)(i64)(i16)read_word(ip + 1), &next, depths, is_label); break;
+			case PUSHDW: emit_constant(&t, (u64)(i64)(i32)read_dword(ip + 1), &next, depths, is_label); break;
+			case PUSHQW: emit_constant(&t, read_qword(ip + 1), &next, depths, is_label); break;
+			case PUSHF:  emit_constant(&t, read_dword(ip + 1), &next, depths, is_label); break;
+			case PUSHD:  emit_constant(&t, read_qword(ip + 1), &next, depths, is_label); break;
+			case PUSHS:
+			{
+				emit_constant(&t, (u64)string_pool[read_dword(ip + 1)], &next, depths, is_label);
+			} break;
+			case GLOAD:
+			{
+				u16 global = read_word(ip + 1);
+				u16 dst = get_destination(&t, &next, depths, is_label, true);
+				emit_op(&t, R_GLOAD);
+				emit_register(&t, dst);
+				push_word(global, t.out);
+			} break;
+			case GSTORE:
+			{
+				u16 src = pop_register(&t);
+				emit_op(&t, R_GSTORE);
+				push_word(read_word(ip + 1), t.out);
+				emit_register(&t, src);
+			} break;
+			// Struct slots are never loaded whole, so nothing on the stack is
+			// waiting on them
+			case FLOADB: case FLOADW: case FLOADDW: case FLOADQW: case FLOADF: case FLOADD:
+			case GFLOADB: case GFLOADW: case GFLOADDW: case GFLOADQW: case GFLOADF: case GFLOADD:
+			{
+				u16 dst = get_destination(&t, &next, depths, is_label, true);
+				emit_op(&t, R_FLOADB + (op - FLOADB));
+				emit_register(&t, dst);
+				push_word(read_word(ip + 1), t.out);
+				push_dword(read_word(ip + 3), t.out);
+			} break;
+			case FSTOREB: case FSTOREW: case FSTOREDW: case FSTOREQW: case FSTOREF: case FSTORED:
+			case GFSTOREB: case GFSTOREW: case GFSTOREDW: case GFSTOREQW: case GFSTOREF: case GFSTORED:
+			{
+				u16 src = pop_register(&t);
+				emit_op(&t, R_FLOADB + (op - FLOADB));
+				push_word(read_word(ip + 1), t.out);
+				push_dword(read_word(ip + 3), t.out);
+				emit_register(&t, src);
+			} break;
+			case NARROWB:
+			case NARROWW:
+			{
+				u16 src = pop_register(&t);
+				u16 dst = get_destination(&t, &next, depths, is_label, true);
+				emit_move(&t, op == NARROWB ? R_MOVB : R_MOVW, dst, src);
+			} break;
+			case POP:
+			{
+				pop_register(&t);
+			} break;
+			case JMP:
+			{
+				materialize_all(&t);
+				emit_op(&t, R_JMP);
+				Jump_Fixup fixup = {.at = t.out->i, .target = read_dword(ip + 1)};
+				arrput(fixups, fixup);
+				push_dword(0, t.out);
+			} break;
+			case JZ:
+			case JNZ:
+			{
+				u16 condition = pop_register(&t);
+				materialize_all(&t);
+				emit_op(&t, op == JZ ? R_JZ : R_JNZ);
+				emit_register(&t, condition);
+				Jump_Fixup fixup = {.at = t.out->i, .target = read_dword(ip + 1)};
+				arrput(fixups, fixup);
+				push_dword(0, t.out);
+			} break;
+			case EQS:
+			{
+				u16 b = pop_register(&t);
+				u16 a = pop_register(&t);
+				u16 dst = get_destination(&t, &next, depths, is_label, true);
+				emit_op(&t, R_EQS);
+				emit_register(&t, dst);
+				emit_register(&t, a);
+				emit_register(&t, b);
+			} break;
+			case HASHS:
+			{
+				u16 src = pop_register(&t);
+				u16 dst = get_destination(&t, &next, depths, is_label, true);
+				emit_op(&t, R_HASHS);
+				emit_register(&t, dst);
+				emit_register(&t, src);
+				push_dword(read_dword(ip + 1), t.out);
+				push_dword(read_dword(ip + 5), t.out);
+			} break;
+			case SWITCH:
+			{
+				u16 value = pop_register(&t);
+				materialize_all(&t);
+				emit_op(&t, R_SWITCH);
+				emit_register(&t, value);
+				u32 entries = read_dword(ip + 9);
+				push_qword(read_qword(ip + 1), t.out);
+				push_dword(entries, t.out);
+				for(u32 i = 0; i <= entries; ++i)
+				{
+					Jump_Fixup fixup = {.at = t.out->i, .target = read_dword(ip + 13 + 4 * i)};
+					arrput(fixups, fixup);
+					push_dword(0, t.out);
+				}
+			} break;
+			case LOOPQW_LI:
+			case LOOPQW_LL:
+			{
+				u16 counter = read_word(ip + 5);
+				materialize_uses(&t, counter);
+				materialize_all(&t);
+				emit_op(&t, op == LOOPQW_LI ? R_LOOPQWI : R_LOOPQW);
+				emit_register(&t, counter);
+				if(op == LOOPQW_LL)
+					emit_register(&t, read_word(ip + 11));
+				push_dword(read_dword(ip + 7), t.out);
+				if(op == LOOPQW_LI)
+					push_dword(read_dword(ip + 11), t.out);
+				Jump_Fixup fixup = {.at = t.out->i, .target = read_dword(ip + 1)};
+				arrput(fixups, fixup);
+				push_dword(0, t.out);
+			} break;
+			case CALL:
+			case TAILCALL:
+			{
+				u32 index = read_dword(ip + 1);
+				Function *callee = &functions[index];
+				emit_call_arguments(&t, callee->arg_count);
+				u16 base = temp_register(&t, t.depth);
+				emit_op(&t, op == CALL ? R_CALL : R_TAILCALL);
+				push_dword(index, t.out);
+				emit_register(&t, base);
+				if(callee->ret)
+					push_register(&t, base);
+			} break;
+			case CALLI:
+			{
+				u16 callee = pop_register(&t);
+				emit_call_arguments(&t, ip[1]);
+				u16 base = temp_register(&t, t.depth);
+				emit_move(&t, R_CALLI, callee, base);
+				if(ip[2])
+					push_register(&t, base);
+			} break;
+			case RET:
+			{
+				if(ip[1])
+				{
+					emit_op(&t, R_RET);
+					emit_register(&t, pop_register(&t));
+				}
+				else
+					emit_op(&t, R_RET0);
+			} break;
+			case ADDQW_LL:
+			case SUBQW_LL:
+			case MULQW_LL:
+			{
+				OP base_op = get_superinstruction_base(op);
+				u16 a = read_word(ip + 1);
+				u16 b = read_word(ip + 3);
+				u16 dst = get_destination(&t, &next, depths, is_label, false);
+				emit_op(&t, R_ADDDW + (base_op - ADDDW));
+				emit_register(&t, dst);
+				emit_register(&t, a);
+				emit_register(&t, b);
+			} break;
+			case ADDQW_LI:
+			case SUBQW_LI:
+			case MULQW_LI:
+			case EQQW_LI:
+			case NEQW_LI:
+			case LTQW_LI:
+			case LEQW_LI:
+			case GTQW_LI:
+			case GEQW_LI:
+			{
+				OP base_op = get_superinstruction_base(op);
+				u16 a = read_word(ip + 1);
+				// The immediate goes where the result would, it's read before that's written
+				u16 b = temp_register(&t, t.depth);
+				emit_op(&t, R_MOVK);
+				emit_register(&t, b);
+				push_qword((u64)(i64)(i32)read_dword(ip + 3), t.out);
+				u16 dst = get_destination(&t, &next, depths, is_label, true);
+				emit_op(&t, R_ADDDW + (base_op - ADDDW));
+				emit_register(&t, dst);
+				emit_register(&t, a);
+				emit_register(&t, b);
+			} break;
+			default:
+			{
+				b32 jumps_if;
+				OP compare = get_branch_compare(op, &jumps_if);
+				if(compare != NOP)
+				{
+					// Compare and branch goes back to the comparison and a
+					// JZ or JNZ, the result takes the register above what's left
+					u16 b = pop_register(&t);
+					u16 a = pop_register(&t);
+					u16 condition = temp_register(&t, t.depth);
+					emit_op(&t, R_ADDDW + (compare - ADDDW));
+					emit_register(&t, condition);
+					emit_register(&t, a);
+					emit_register(&t, b);
+					materialize_all(&t);
+					emit_op(&t, jumps_if ? R_JNZ : R_JZ);
+					emit_register(&t, condition);
+					Jump_Fixup fixup = {.at = t.out->i, .target = read_dword(ip + 1)};
+					arrput(fixups, fixup);
+					push_dword(0, t.out);
+					break;
+				}
+				assert(op >= ADDDW && op <= GED);
+				u16 b = pop_register(&t);
+				u16 a = pop_register(&t);
+				u16 dst = get_destination(&t, &next, depths, is_label, op >= EQDW);
+				emit_op(&t, R_ADDDW + (op - ADDDW));
+				emit_register(&t, dst);
+				emit_register(&t, a);
+				emit_register(&t, b);
+			} break;
+		}
+		falls_through = op != JMP && op != RET && op != SWITCH;
+		at = next;
+	}
+	offsets[code->i] = t.out->i;
+
+	for(int i = 0; i < arrlen(fixups); ++i)
+		patch_dword(offsets[fixups[i].target], fixups[i].at, t.out);
+	arrfree(fixups);
+
+	finish_bytecode(t.out);
+	fn->register_count = fn->frame_size + max_depth;
+}
+
+void disassemble_registers(Bytecode *bytecode, FILE *out)
+{
+	int i = 0;
+	while(i < bytecode->i)
+	{
+		u8 op = bytecode->bytecode[i];
+		if(op >= R_OP_COUNT)
+		{
+			fprintf(out, "%6d  <invalid op %d>\n", i, op);
+			return;
+		}
+		fprintf(out, "%6d  %-8s", i, r_op_info[op].name);
+		u8 *operand = bytecode->bytecode + i + 1;
+		for(const char *kind = r_op_info[op].operands; *kind; ++kind)
+		{
+			switch(*kind)
+			{
+				case 'r': fprintf(out, " r%d", read_word(operand)); break;
+				case 'g': fprintf(out, " g%d", read_word(operand)); break;
+				case 'k': fprintf(out, " %lld", (long long)read_qword(operand)); break;
+				case 'o': fprintf(out, " %u", read_dword(operand)); break;
+				case 'f': fprintf(out, " %s", functions[read_dword(operand)].name); break;
+				case 'i': fprintf(out, " %u", read_dword(operand)); break;
+				case 't':
+				{
+					u32 count = read_dword(operand + 8);
+					fprintf(out, " %lld %u default %u:", (long long)read_qword(operand), count, read_dword(operand + 12));
+					for(u32 e = 0; e < count; ++e)
+						fprintf(out, " %u", read_dword(operand + 16 + 4 * e));
+				} break;
+			}
+			operand += get_operand_size(*kind, operand);
+		}
+		fputc('\n', out);
+		i += get_register_instruction_size(bytecode->bytecode + i);
+	}
+}
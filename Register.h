@@ -0,0 +1,163 @@
+#ifndef _REGISTER_H
+#define _REGISTER_H
+
+#include "Basic.h"
+#include "Bytecode.h"
+
+// @NOTE: three address form of the stack bytecode. A function's registers are
+// its frame slots followed by one register per operand stack depth, so
+// r0..frame_size-1 are the same slots the stack code uses.
+// Register operands are 16 bits like slots, the binary ops are in the same
+// order as the stack ones so R_ADDDW + (op - ADDDW) gives the matching op
+typedef enum : uint8_t
+{
+	R_NOP,
+
+	// moves narrow to the width and sign extend back, like the stack stores do
+	R_MOVB,   // dst, src
+	R_MOVW,   // dst, src
+	R_MOVDW,  // dst, src
+	R_MOVQW,  // dst, src
+	R_MOVF,   // dst, src
+	R_MOVK,   // dst, 64 bit constant
+
+	// dst, a, b
+	R_ADDDW,
+	R_ADDQW,
+	R_ADDF,
+	R_ADDD,
+
+	R_SUBDW,
+	R_SUBQW,
+	R_SUBF,
+	R_SUBD,
+
+	R_MULDW,
+	R_MULQW,
+	R_MULF,
+	R_MULD,
+
+	R_DIVDW,
+	R_DIVQW,
+	R_DIVF,
+	R_DIVD,
+
+	R_MODDW,
+	R_MODQW,
+
+	R_ANDDW,
+	R_ANDQW,
+
+	R_ORDW,
+	R_ORQW,
+
+	R_XORDW,
+	R_XORQW,
+
+	R_SHLDW,
+	R_SHLQW,
+
+	R_SHRDW,
+	R_SHRQW,
+
+	R_EQDW,
+	R_EQQW,
+	R_EQF,
+	R_EQD,
+
+	R_NEDW,
+	R_NEQW,
+	R_NEF,
+	R_NED,
+
+	R_LTDW,
+	R_LTQW,
+	R_LTF,
+	R_LTD,
+
+	R_LEDW,
+	R_LEQW,
+	R_LEF,
+	R_LED,
+
+	R_GTDW,
+	R_GTQW,
+	R_GTF,
+	R_GTD,
+
+	R_GEDW,
+	R_GEQW,
+	R_GEF,
+	R_GED,
+
+	R_GLOAD,  // dst, global slot
+	R_GSTORE, // global slot, src
+
+	// struct fields, the slot is the register the struct starts at and the
+	// 32 bit immediate is the field's byte offset from there
+	R_FLOADB,   // dst, slot, offset
+	R_FLOADW,
+	R_FLOADDW,
+	R_FLOADQW,
+	R_FLOADF,
+	R_FLOADD,
+	R_FSTOREB,  // slot, offset, src
+	R_FSTOREW,
+	R_FSTOREDW,
+	R_FSTOREQW,
+	R_FSTOREF,
+	R_FSTORED,
+	R_GFLOADB,  // dst, global slot, offset
+	R_GFLOADW,
+	R_GFLOADDW,
+	R_GFLOADQW,
+	R_GFLOADF,
+	R_GFLOADD,
+	R_GFSTOREB, // global slot, offset, src
+	R_GFSTOREW,
+	R_GFSTOREDW,
+	R_GFSTOREQW,
+	R_GFSTOREF,
+	R_GFSTORED,
+
+	R_EQS,    // dst, a, b
+	R_HASHS,  // dst, src, 32 bit seed, 32 bit mask
+
+	R_JMP,    // 32 bit code offset
+	R_JZ,     // src, 32 bit code offset
+	R_JNZ,    // src, 32 bit code offset
+	R_SWITCH, // src, jump table laid out like the SWITCH one
+
+	// counted loop backedges like LOOPQW_LL and LOOPQW_LI, the counter register
+	// gets the step added and the jump is taken if it's less than the limit
+	R_LOOPQW,  // counter, limit register, 32 bit step, 32 bit code offset
+	R_LOOPQWI, // counter, 32 bit step, 32 bit limit, 32 bit code offset
+
+	// The callee's frame starts at the base register, where the arguments already
+	// are, and its return value is left in that same register
+	R_CALL,   // 32 bit function index, base
+	R_CALLI,  // register with the function index, base
+	R_RET,    // src
+	R_RET0,   // return without a value
+	R_TAILCALL, // 32 bit function index, base, the callee's frame replaces this one
+
+	R_OP_COUNT,
+} R_OP;
+
+// @NOTE: operand layout, one character per operand: r register (16 bits),
+// g global slot (16 bits), k constant (64 bits), o code offset (32 bits),
+// f function index (32 bits), i immediate (32 bits), t jump table (its size
+// depends on its entry count)
+typedef struct
+{
+	const char *name;
+	const char *operands;
+} R_OP_Info;
+
+extern R_OP_Info r_op_info[R_OP_COUNT];
+
+void translate_to_registers(Function *fn);
+int get_register_instruction_size(u8 *at);
+void disassemble_registers(Bytecode *bytecode, FILE *out);
+
+#endif // _REGISTER_H
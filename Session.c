@@ -0,0 +1,196 @@
+#include "Session.h"
+#include "Error.h"
+
+static Session session;
+
+void init_session(Session_Options options)
+{
+	session.options = options;
+	InitVLib();
+	init_memory();
+	init_lexer();
+	init_analyzer();
+	init_bytecode();
+	init_vm(&session.vm);
+	session.vm.tiering = options.engine == ENGINE_TIERED;
+	session.vm.tracing = options.engine == ENGINE_TRACING;
+	if(options.profile_ops)
+	{
+		session.vm.profiling = true;
+		session.vm.sequences = make_op_profile();
+	}
+}
+
+void end_session()
+{
+	if(session.vm.sequences)
+		print_op_profile(session.vm.sequences, stdout);
+
+	if(session.options.engine == ENGINE_C)
+	{
+		char *c_file = session.options.c_file;
+		if(c_file == NULL)
+		{
+			c_file = alloc_perm_memory(VStrLen(session.options.executable) + 3);
+			sprintf(c_file, "%s.c", session.options.executable);
+		}
+		if(session.failed_lines)
+			printf("%d lines had errors and were left out\n", session.failed_lines);
+		if(c_write_program(c_file) && session.options.executable)
+			c_build_program(c_file, session.options.executable);
+	}
+	else if(session.options.engine == ENGINE_ELF)
+	{
+		if(session.failed_lines)
+			printf("%d lines had errors and were left out\n", session.failed_lines);
+		elf_write(session.options.elf_file, session.options.elf_executable);
+	}
+}
+
+Session_Checkpoint get_session_checkpoint()
+{
+	Session_Checkpoint result = {
+		.analyzer = get_analyzer_checkpoint(),
+		.bytecode = get_bytecode_checkpoint(),
+		.perm_memory = get_perm_checkpoint(),
+	};
+	return result;
+}
+
+void restore_session_checkpoint(Session_Checkpoint checkpoint)
+{
+	restore_analyzer_checkpoint(checkpoint.analyzer);
+	restore_bytecode_checkpoint(checkpoint.bytecode);
+	restore_perm_checkpoint(checkpoint.perm_memory);
+}
+
+void end_line()
+{
+	free_temp_analyzer();
+	reset_temporary_memory();
+	if(session.tokens)
+		ArrFree(session.tokens);
+	session.tokens = NULL;
+}
+
+// Gives fn the form the session's engine runs
+void prepare_function(Function *fn)
+{
+	switch(session.options.engine)
+	{
+		case ENGINE_STACK: break;
+		case ENGINE_REGISTERS: translate_to_registers(fn); break;
+		case ENGINE_DECODED: decode_function(fn); break;
+		case ENGINE_JIT:
+		{
+			Jit_Stats stats = jit_function(fn);
+			if(codegen_options.print_optimizations)
+				print_jit_stats(fn, stats);
+		} break;
+		// Starts out interpreted, the entry could still be left from a function that was rolled back
+		case ENGINE_TIERED: jit_free_function(fn); break;
+		case ENGINE_TRACING: break;
+		case ENGINE_C: break;
+		case ENGINE_ELF: elf_compile_function(fn); break;
+	}
+}
+
+void dump_function(Function *fn)
+{
+	printf("fn %s (%d args, %d slots):\n", fn->name, fn->arg_count, fn->frame_size);
+	disassemble(&fn->code, stdout);
+	if(fn->registers.bytecode)
+	{
+		printf("fn %s registers (%d registers):\n", fn->name, fn->register_count);
+		disassemble_registers(&fn->registers, stdout);
+	}
+	if(fn->native)
+		printf("fn %s native: %d bytes at %p\n", fn->name, fn->native_size, fn->native);
+}
+
+// @NOTE: analyzes, compiles and runs a single line against the state left by
+// the previous ones, returns false if the line had an error and was rolled back
+b32 session_run_line(char *line, int line_len)
+{
+	session.line_count++;
+	Session_Checkpoint checkpoint = get_session_checkpoint();
+
+	jmp_buf recovery;
+	error_recovery = &recovery;
+	if(setjmp(recovery))
+	{
+		error_recovery = NULL;
+		reset_vm_stacks(&session.vm);
+		restore_session_checkpoint(checkpoint);
+		end_line();
+		session.failed_lines++;
+		return false;
+	}
+
+	Parsing_Buffer buf = {.data = line, .end = line + line_len};
+	session.tokens = lex_statement(&buf);
+
+	Node *tree = parse_tokens(session.tokens);
+	if(ArrLen(tree->root.expressions) != 0)
+	{
+		analyze_ast(tree);
+		if(session.options.print_memory_stats)
+		{
+			Arena_Stats stats = get_analysis_memory_stats();
+			printf("analysis memory: %lld bytes in %lld allocations (peak %lld bytes)\n",
+					(long long)stats.used, (long long)stats.allocation_count, (long long)stats.peak);
+		}
+		if(codegen_options.print_optimizations)
+		{
+			for(int i = 0; i < ArrLen(tree->root.expressions); ++i)
+			{
+				Node *expr = tree->root.expressions[i];
+				if(expr->type == ND_STRUCT)
+					print_struct_layout(expr->type_info);
+			}
+		}
+		if(codegen_options.fold_constants)
+		{
+			Fold_Stats stats = fold_constants(tree);
+			if(codegen_options.print_optimizations)
+				print_fold_stats(stats);
+		}
+		int first_new_function = arrlen(functions);
+		Function line_fn = generate_bytecode(tree);
+		for(int i = first_new_function; i < arrlen(functions); ++i)
+			prepare_function(&functions[i]);
+		prepare_function(&line_fn);
+		if(session.options.dump_bytecode)
+		{
+			for(int i = first_new_function; i < arrlen(functions); ++i)
+				dump_function(&functions[i]);
+			dump_function(&line_fn);
+		}
+
+		u64 result = 0;
+		switch(session.options.engine)
+		{
+			case ENGINE_STACK:     result = interpret(&session.vm, &line_fn, NULL); break;
+			case ENGINE_REGISTERS: result = interpret_registers(&session.vm, &line_fn, NULL); break;
+			case ENGINE_DECODED:   result = interpret_decoded(&session.vm, &line_fn, NULL); break;
+			case ENGINE_JIT:       result = run_jit(&session.vm, &line_fn, NULL); break;
+			case ENGINE_TIERED:    result = interpret(&session.vm, &line_fn, NULL); break;
+			case ENGINE_TRACING:   result = interpret(&session.vm, &line_fn, NULL); break;
+			case ENGINE_C:         c_emit_line(tree, &line_fn, line, line_len); break;
+			case ENGINE_ELF:       break;
+		}
+		b32 ahead_of_time = session.options.engine == ENGINE_C || session.options.engine == ENGINE_ELF;
+		if(line_fn.ret && !ahead_of_time)
+			print_value(result, line_fn.ret);
+		free_bytecode(&line_fn.code);
+		free_bytecode(&line_fn.registers);
+		if(line_fn.decoded)
+			VFree(line_fn.decoded);
+		jit_free_function(&line_fn);
+		trace_free_function(&line_fn);
+	}
+
+	error_recovery = NULL;
+	end_line();
+	return true;
+}
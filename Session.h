@@ -0,0 +1,66 @@
+#ifndef _SESSION_H
+#define _SESSION_H
+
+#include "Basic.h"
+#include "Analyzer.h"
+#include "Fold.h"
+#include "Bytecode.h"
+#include "Interpreter.h"
+#include "Jit.h"
+#include "Trace.h"
+#include "CBackend.h"
+#include "Elf.h"
+
+// @NOTE: everything a line can add to the session, a failed line is rolled
+// back to the checkpoint taken before it started
+typedef struct
+{
+	Analyzer_Checkpoint analyzer;
+	Bytecode_Checkpoint bytecode;
+	void *perm_memory;
+} Session_Checkpoint;
+
+typedef enum
+{
+	ENGINE_STACK,
+	ENGINE_REGISTERS, // the register form of the code
+	ENGINE_DECODED,   // the stack code, decoded into records first
+	ENGINE_JIT,       // native code, interpreted where it can't be compiled
+	ENGINE_TIERED,    // interpreted until a function gets hot, see Tier.c
+	ENGINE_TRACING,   // interpreted, hot loops run as native traces, see Trace.c
+	ENGINE_C,         // nothing runs, the lines are compiled into a C program, see CBackend.c
+	ENGINE_ELF,       // nothing runs, the lines are compiled to x86-64 and written as ELF, see Elf.c
+} Engine;
+
+typedef struct
+{
+	b32 print_memory_stats;
+	b32 dump_bytecode;
+	Engine engine;
+	b32 profile_ops; // count opcode sequences, printed when the session ends
+
+	// ENGINE_C writes the program to c_file when the session ends and builds
+	// it into executable if that's set, c_file defaults to executable.c
+	char *c_file;
+	char *executable;
+
+	// ENGINE_ELF writes elf_file when the session ends, a static executable if
+	// elf_executable is set and a relocatable object otherwise
+	char *elf_file;
+	b32 elf_executable;
+} Session_Options;
+
+typedef struct
+{
+	Session_Options options;
+	int line_count;
+	int failed_lines;
+	Token *tokens; // Current line, freed when it's done
+	VM vm;         // Globals live here across lines
+} Session;
+
+void init_session(Session_Options options);
+void end_session();
+b32 session_run_line(char *line, int line_len);
+
+#endif // _SESSION_H
@@ -0,0 +1,86 @@
+#include "Tier.h"
+#include "Jit.h"
+#include "IR.h"
+#include "Peephole.h"
+
+Tier_Options tier_options = {.call_threshold = 1000, .backedge_threshold = 10000, .optimize = true};
+
+// Counts a call to fn, gives true if fn has native code to run instead
+b32 tier_enter(Function *fn)
+{
+	if(!fn->tiered && ++fn->call_count >= tier_options.call_threshold)
+		tier_up(fn, "calls");
+	return fn->native != NULL;
+}
+
+void tier_backedge(Function *fn)
+{
+	if(!fn->tiered && ++fn->backedge_count >= tier_options.backedge_threshold)
+		tier_up(fn, "backedges");
+}
+
+// @NOTE: the stack code can't be changed under the interpreter, frames that
+// are still running it return into it, so the optimizing tier works on a copy
+// and only keeps the native code. Patching the function's entry switches
+// every native call site over at once, interpreted callers check for native
+// code when they call
+void tier_up(Function *fn, const char *trigger)
+{
+	fn->tiered = true;
+	int index = get_function_index(fn);
+	if(index < 0)
+		return;
+
+	i64 start = VLibClockNs();
+	Function optimized = *fn;
+	optimized.code = make_bytecode(fn->code.i);
+	memcpy(optimized.code.bytecode, fn->code.bytecode, fn->code.i);
+	optimized.code.i = fn->code.i;
+	optimized.registers = (Bytecode){};
+	optimized.decoded = NULL;
+	optimized.native = NULL;
+	if(tier_options.optimize)
+	{
+		optimize_ssa(&optimized);
+		peephole_optimize(&optimized);
+		fuse_superinstructions(&optimized);
+		demote_tail_calls(&optimized.code);
+	}
+
+	Jit_Stats stats = jit_compile(&optimized, index);
+	fn->native = optimized.native;
+	fn->native_size = optimized.native_size;
+	i64 elapsed = VLibClockNs() - start;
+	if(tier_options.log)
+	{
+		fprintf(stderr, "tier up: fn %s after %u calls and %u backedges (%s), ", fn->name,
+				fn->call_count, fn->backedge_count, trigger);
+		if(stats.fallback)
+			fprintf(stderr, "stays interpreted, %s\n", stats.fallback);
+		else
+			fprintf(stderr, "%d -> %d instructions, %d bytes of native code in %.1f us\n",
+					count_instructions(&fn->code), count_instructions(&optimized.code),
+					stats.code_bytes, elapsed / 1000.0);
+	}
+	free_bytecode(&optimized.code);
+}
+
+// @NOTE: runs fn's native code for an interpreted caller. The arguments are
+// still on the caller's operand stack, locals and frame are where the callee's
+// would have gone
+u64 tier_call_native(VM *vm, Function *fn, u64 *args, u64 *locals, Call_Frame *frame)
+{
+	u64 *stack_top = vm->stack_top;
+	u64 *locals_top = vm->locals_top;
+	Call_Frame *frame_top = vm->frame_top;
+	vm->stack_top = args - 1;
+	vm->locals_top = locals;
+	vm->frame_top = frame;
+
+	u64 result = run_jit(vm, fn, args);
+
+	vm->stack_top = stack_top;
+	vm->locals_top = locals_top;
+	vm->frame_top = frame_top;
+	return result;
+}
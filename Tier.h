@@ -0,0 +1,28 @@
+#ifndef _TIER_H
+#define _TIER_H
+
+#include "Basic.h"
+#include "Bytecode.h"
+#include "Interpreter.h"
+
+// @NOTE: the tiered engine starts every function in the stack interpreter and
+// compiles it to native code once it's called call_threshold times or its
+// loops jump back backedge_threshold times. There's no switching in the
+// middle of a call, a function that got hot inside a loop runs natively from
+// its next call on
+typedef struct
+{
+	u32 call_threshold;
+	u32 backedge_threshold;
+	b32 optimize; // run the SSA passes on a function before compiling it
+	b32 log;      // print every tier up to stderr
+} Tier_Options;
+
+extern Tier_Options tier_options;
+
+b32 tier_enter(Function *fn);
+void tier_backedge(Function *fn);
+void tier_up(Function *fn, const char *trigger);
+u64 tier_call_native(VM *vm, Function *fn, u64 *args, u64 *locals, Call_Frame *frame);
+
+#endif // _TIER_H
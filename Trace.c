@@ -0,0 +1,929 @@
+#include "Trace.h"
+#include "Jit.h"
+#include "IR.h"
+#include <assert.h>
+
+Trace_Options trace_options = {.hot_loop = 50, .max_length = 1000, .max_aborts = 3};
+
+// A compiled trace, it gives back the index of the exit it left through
+typedef int (*Trace_Entry)(u64 *locals, u64 *stack, u64 *globals);
+
+static struct
+{
+	Function *fn;
+	Trace *trace;
+	int *stack;  // stb_ds array, the instructions on the operand stack, like build_ir keeps it
+	int length;  // ops recorded so far
+} recorder;
+
+typedef struct
+{
+	int recorded;  // instructions before optimizing
+	int guards_removed;
+	int hoisted;
+	i64 ns;
+} Trace_Stats;
+
+static void clear_trace(Trace *trace)
+{
+	for(int i = 0; i < arrlen(trace->exits); ++i)
+		arrfree(trace->exits[i].stack);
+	arrfree(trace->exits);
+	arrfree(trace->code);
+	jit_release_code(trace->native, trace->native_size);
+	trace->native = NULL;
+	trace->native_size = 0;
+}
+
+static int add_trace_instruction(Trace *trace, Trace_Kind kind, OP op, int a, int b, u64 imm)
+{
+	Trace_Instruction ins = {.kind = kind, .op = op, .a = a, .b = b, .imm = imm, .exit = -1};
+	arrput(trace->code, ins);
+	return (int)arrlen(trace->code) - 1;
+}
+
+static int add_trace_exit(Trace *trace, int offset, int *stack, int depth)
+{
+	Trace_Exit exit = {.offset = offset};
+	for(int i = 0; i < depth; ++i)
+		arrput(exit.stack, stack[i]);
+	arrput(trace->exits, exit);
+	return (int)arrlen(trace->exits) - 1;
+}
+
+// The whole cell in a slot, narrowed the way the load would do it
+static int record_load(Trace *trace, OP load, int slot)
+{
+	int value = add_trace_instruction(trace, TR_LOAD, NOP, -1, -1, slot);
+	if(load == LOADQW || load == LOADD)
+		return value;
+	return add_trace_instruction(trace, TR_NARROW, load, value, -1, 0);
+}
+
+static int record_narrow(Trace *trace, OP load, int value)
+{
+	if(load == LOADQW || load == LOADD)
+		return value;
+	return add_trace_instruction(trace, TR_NARROW, load, value, -1, 0);
+}
+
+static void abort_recording(VM *vm, const char *reason)
+{
+	Trace *trace = recorder.trace;
+	vm->recording = false;
+	clear_trace(trace);
+	trace->hits = 0;
+	if(++trace->aborts >= trace_options.max_aborts)
+		trace->blacklisted = true;
+	if(trace_options.log)
+		fprintf(stderr, "trace: fn %s at %d aborted, %s%s\n", recorder.fn->name, trace->header,
+				reason, trace->blacklisted ? ", blacklisted" : "");
+	recorder.fn = NULL;
+	recorder.trace = NULL;
+}
+
+static void start_recording(VM *vm, Function *fn, Trace *trace)
+{
+	clear_trace(trace);
+	recorder.fn = fn;
+	recorder.trace = trace;
+	recorder.length = 0;
+	arrsetlen(recorder.stack, 0);
+	vm->recording = true;
+
+	// Side exits only put back what the trace pushed, the values under it would
+	// have to be loop carried
+	int max_depth;
+	int *depths = compute_stack_depths(&fn->code, &max_depth);
+	if(depths[trace->header] != 0)
+	{
+		trace->aborts = trace_options.max_aborts;
+		abort_recording(vm, "the operand stack isn't empty at the loop header");
+	}
+#if !JIT_SUPPORTED
+	else
+	{
+		trace->aborts = trace_options.max_aborts;
+		abort_recording(vm, "the JIT only targets x86-64 Linux");
+	}
+#endif
+}
+
+/* ---- Optimizing ---- */
+
+// Instructions that are the same value if their operands are, for CSE
+typedef struct
+{
+	u32 kind;
+	u32 op;
+	int a, b;
+	u64 imm;
+} Trace_Value_Key;
+
+static b32 can_trap(Trace *trace, Trace_Instruction *ins)
+{
+	if(ins->kind != TR_BINARY)
+		return false;
+	if(ins->op != DIVDW && ins->op != DIVQW && ins->op != MODDW && ins->op != MODQW)
+		return false;
+	Trace_Instruction *divisor = &trace->code[ins->b];
+	if(divisor->kind != TR_CONST)
+		return true;
+	return ins->op == DIVDW || ins->op == MODDW ? (i32)divisor->imm == 0 : divisor->imm == 0;
+}
+
+// Whether value already is what narrowing it with load would give, DW math
+// is sign extended and f32 math zero extended by the ops themselves
+static b32 is_narrow(Trace_Instruction *value, OP load)
+{
+	if(value->kind == TR_NARROW)
+		return value->op == load || (value->op < load && load <= LOADDW);
+	if(value->kind != TR_BINARY)
+		return false;
+	if(value->op >= EQDW && value->op <= GED)
+		return true;
+	if(value->op >= ADDDW && value->op <= DIVD)
+		return (load == LOADDW && (value->op - ADDDW) % 4 == 0) || (load == LOADF && (value->op - ADDDW) % 4 == 2);
+	return load == LOADDW && (value->op - MODDW) % 2 == 0;
+}
+
+// @NOTE: one pass down the trace. Loads see what was stored or loaded from the
+// same slot earlier in the iteration, constants are folded, values that were
+// already computed are reused and guards on something that was already
+// guarded (or is constant) go. Gives false if a guard always fails, the trace
+// would never make it around the loop then
+static b32 simplify_trace(Trace *trace, Trace_Stats *stats)
+{
+	int count = (int)arrlen(trace->code);
+	int *replaced = alloc_temp_memory(sizeof(int) * count);
+	struct { int key; int value; } *slots = NULL, *globals = NULL;
+	struct { Trace_Value_Key key; int value; } *values = NULL;
+	b32 ok = true;
+
+	for(int i = 0; i < count && ok; ++i)
+	{
+		Trace_Instruction *ins = &trace->code[i];
+		int slot = (int)ins->imm;
+		replaced[i] = i;
+		if(ins->a >= 0)
+			ins->a = replaced[ins->a];
+		if(ins->b >= 0)
+			ins->b = replaced[ins->b];
+
+		switch(ins->kind)
+		{
+			case TR_LOAD:
+			{
+				int known = hmgeti(slots, slot);
+				if(known >= 0)
+				{
+					replaced[i] = slots[known].value;
+					ins->dead = true;
+				}
+				else
+					hmput(slots, slot, i);
+				continue;
+			}
+			case TR_STORE: hmput(slots, slot, ins->a); continue;
+			case TR_GLOAD:
+			{
+				int known = hmgeti(globals, slot);
+				if(known >= 0)
+				{
+					replaced[i] = globals[known].value;
+					ins->dead = true;
+				}
+				else
+					hmput(globals, slot, i);
+				continue;
+			}
+			case TR_GSTORE: hmput(globals, slot, ins->a); continue;
+			case TR_LOOP: continue;
+
+			case TR_NARROW:
+			{
+				Trace_Instruction *value = &trace->code[ins->a];
+				if(value->kind == TR_CONST)
+				{
+					*ins = (Trace_Instruction){.kind = TR_CONST, .imm = narrow_cell(value->imm, ins->op),
+						.a = -1, .b = -1, .exit = -1};
+				}
+				else if(is_narrow(value, ins->op))
+				{
+					replaced[i] = ins->a;
+					ins->dead = true;
+					continue;
+				}
+			} break;
+			case TR_BINARY:
+			{
+				Trace_Instruction *a = &trace->code[ins->a];
+				Trace_Instruction *b = &trace->code[ins->b];
+				u64 folded;
+				if(a->kind == TR_CONST && b->kind == TR_CONST && fold_cells(ins->op, a->imm, b->imm, &folded))
+					*ins = (Trace_Instruction){.kind = TR_CONST, .imm = folded, .a = -1, .b = -1, .exit = -1};
+			} break;
+			case TR_GUARD:
+			{
+				Trace_Instruction *value = &trace->code[ins->a];
+				if(value->kind == TR_CONST)
+				{
+					ins->dead = true;
+					stats->guards_removed++;
+					if((value->imm != 0) != (ins->imm != 0))
+						ok = false;
+					continue;
+				}
+			} break;
+			default: break;
+		}
+
+		// Whatever's left is pure (or a guard), the first copy of it stands for all of them
+		Trace_Value_Key key = {.kind = ins->kind, .op = ins->op, .a = ins->a, .b = ins->b, .imm = ins->imm};
+		int seen = hmgeti(values, key);
+		if(seen >= 0)
+		{
+			replaced[i] = values[seen].value;
+			ins->dead = true;
+			if(ins->kind == TR_GUARD)
+				stats->guards_removed++;
+		}
+		else
+			hmput(values, key, i);
+	}
+
+	for(int i = 0; i < arrlen(trace->exits); ++i)
+	{
+		Trace_Exit *exit = &trace->exits[i];
+		for(int j = 0; j < arrlen(exit->stack); ++j)
+			exit->stack[j] = replaced[exit->stack[j]];
+	}
+	hmfree(slots);
+	hmfree(globals);
+	hmfree(values);
+	return ok;
+}
+
+// @NOTE: anything that only depends on constants and slots the loop never
+// stores to is the same every iteration and moves in front of it. A guard
+// that moves leaves at the header, nothing in the iteration has run yet when
+// it's checked so the interpreter can just run the whole iteration itself
+static void hoist_invariants(Trace *trace, Trace_Stats *stats)
+{
+	struct { int key; b32 value; } *stored = NULL, *gstored = NULL;
+	for(int i = 0; i < arrlen(trace->code); ++i)
+	{
+		Trace_Instruction *ins = &trace->code[i];
+		int slot = (int)ins->imm;
+		if(ins->dead)
+			continue;
+		if(ins->kind == TR_STORE)
+			hmput(stored, slot, true);
+		else if(ins->kind == TR_GSTORE)
+			hmput(gstored, slot, true);
+	}
+
+	for(int i = 0; i < arrlen(trace->code); ++i)
+	{
+		Trace_Instruction *ins = &trace->code[i];
+		int slot = (int)ins->imm;
+		if(ins->dead)
+			continue;
+		switch(ins->kind)
+		{
+			case TR_CONST:  ins->hoisted = true; break;
+			case TR_LOAD:   ins->hoisted = hmgeti(stored, slot) < 0; break;
+			case TR_GLOAD:  ins->hoisted = hmgeti(gstored, slot) < 0; break;
+			case TR_NARROW: ins->hoisted = trace->code[ins->a].hoisted; break;
+			case TR_BINARY:
+			{
+				ins->hoisted = trace->code[ins->a].hoisted && trace->code[ins->b].hoisted &&
+					!can_trap(trace, ins);
+			} break;
+			case TR_GUARD:
+			{
+				if(trace->code[ins->a].hoisted)
+				{
+					ins->hoisted = true;
+					ins->exit = add_trace_exit(trace, trace->header, NULL, 0);
+				}
+			} break;
+			default: break;
+		}
+		if(ins->hoisted)
+			stats->hoisted++;
+	}
+	hmfree(stored);
+	hmfree(gstored);
+}
+
+// Pure values nothing uses. Operands come before their users, one pass back up is enough
+static void remove_dead_values(Trace *trace)
+{
+	int count = (int)arrlen(trace->code);
+	b32 *used = alloc_temp_memory(sizeof(b32) * count);
+	memset(used, 0, sizeof(b32) * count);
+	for(int i = count - 1; i >= 0; --i)
+	{
+		Trace_Instruction *ins = &trace->code[i];
+		if(ins->dead)
+			continue;
+		b32 effect = ins->kind == TR_STORE || ins->kind == TR_GSTORE || ins->kind == TR_GUARD ||
+			ins->kind == TR_LOOP || can_trap(trace, ins);
+		if(!effect && !used[i])
+		{
+			ins->dead = true;
+			continue;
+		}
+		if(ins->a >= 0)
+			used[ins->a] = true;
+		if(ins->b >= 0)
+			used[ins->b] = true;
+		if(ins->kind == TR_GUARD)
+		{
+			Trace_Exit *exit = &trace->exits[ins->exit];
+			for(int j = 0; j < arrlen(exit->stack); ++j)
+				used[exit->stack[j]] = true;
+		}
+	}
+}
+
+/* ---- Native code ---- */
+
+#if JIT_SUPPORTED
+
+// @NOTE: rbx holds the locals, r12 the operand stack the exits write to and
+// r13 the globals like in a JIT'd function. Values get one of these for their
+// whole life, or a cell of the native stack frame if they run out. rax, rcx
+// and rdx stay scratch for the emitters
+static const X64_Register trace_registers[] = {RSI, RDI, R8, R9, R10, R11, RBP, R14, R15};
+#define TRACE_REGISTER_COUNT (int)(sizeof(trace_registers) / sizeof(trace_registers[0]))
+
+typedef struct
+{
+	Bytecode out;
+	Trace *trace;
+	X64_Operand *locations; // per instruction
+	int frame_size;         // bytes below the pushed registers
+	Jit_Fixup *exits;       // stb_ds array, target is the exit index
+	Jit_Fixup *errors;      // stb_ds array
+} Trace_Compiler;
+
+static b32 produces_value(Trace_Instruction *ins)
+{
+	return ins->kind == TR_CONST || ins->kind == TR_LOAD || ins->kind == TR_GLOAD ||
+		ins->kind == TR_BINARY || ins->kind == TR_NARROW;
+}
+
+// @NOTE: linear scan over the trace in the order it's emitted, hoisted
+// instructions first. A hoisted value that the loop uses is live for the
+// whole loop, everything else dies in the iteration it's made in. Intervals
+// that end where a new one starts aren't freed yet, so a result never shares
+// a register with an operand
+static void allocate_trace_registers(Trace_Compiler *tc, int *order, int count)
+{
+	Trace *trace = tc->trace;
+	int total = (int)arrlen(trace->code);
+	int *position = alloc_temp_memory(sizeof(int) * total);
+	int *end = alloc_temp_memory(sizeof(int) * total);
+	for(int p = 0; p < count; ++p)
+	{
+		position[order[p]] = p;
+		end[order[p]] = p;
+	}
+	for(int p = 0; p < count; ++p)
+	{
+		Trace_Instruction *ins = &trace->code[order[p]];
+		int uses[2] = {ins->a, ins->b};
+		for(int u = 0; u < 2; ++u)
+		{
+			if(uses[u] < 0)
+				continue;
+			b32 carried = trace->code[uses[u]].hoisted && !ins->hoisted;
+			if(carried || end[uses[u]] < p)
+				end[uses[u]] = carried ? INT32_MAX : p;
+		}
+		if(ins->kind == TR_GUARD)
+		{
+			Trace_Exit *exit = &trace->exits[ins->exit];
+			for(int j = 0; j < arrlen(exit->stack); ++j)
+			{
+				int value = exit->stack[j];
+				b32 carried = trace->code[value].hoisted && !ins->hoisted;
+				if(carried || end[value] < p)
+					end[value] = carried ? INT32_MAX : p;
+			}
+		}
+	}
+
+	int active[TRACE_REGISTER_COUNT];
+	int active_count = 0;
+	b32 taken[TRACE_REGISTER_COUNT] = {};
+	int spills = 0;
+	for(int p = 0; p < count; ++p)
+	{
+		int value = order[p];
+		if(!produces_value(&trace->code[value]))
+			continue;
+		for(int i = 0; i < active_count; ++i)
+		{
+			if(end[active[i]] < p)
+			{
+				for(int r = 0; r < TRACE_REGISTER_COUNT; ++r)
+				{
+					if(trace_registers[r] == tc->locations[active[i]].reg)
+						taken[r] = false;
+				}
+				active[i--] = active[--active_count];
+			}
+		}
+
+		int free = -1;
+		for(int r = 0; r < TRACE_REGISTER_COUNT && free < 0; ++r)
+		{
+			if(!taken[r])
+				free = r;
+		}
+		if(free >= 0)
+		{
+			taken[free] = true;
+			tc->locations[value] = reg_operand(trace_registers[free]);
+			active[active_count++] = value;
+			continue;
+		}
+
+		// Out of registers, whichever lives the longest goes to the frame
+		int furthest = 0;
+		for(int i = 1; i < active_count; ++i)
+		{
+			if(end[active[i]] > end[active[furthest]])
+				furthest = i;
+		}
+		int victim = active[furthest];
+		if(end[victim] > end[value])
+		{
+			tc->locations[value] = tc->locations[victim];
+			tc->locations[victim] = mem_operand(RSP, spills++ * 8);
+			active[furthest] = value;
+		}
+		else
+			tc->locations[value] = mem_operand(RSP, spills++ * 8);
+	}
+
+	// 6 pushes on top of the return address, the frame keeps rsp 16 byte
+	// aligned for the runtime_error call in the error stubs
+	tc->frame_size = spills * 8;
+	if(tc->frame_size % 16 == 0)
+		tc->frame_size += 8;
+}
+
+static const X64_Register trace_saved_registers[] = {RBX, RBP, R12, R13, R14, R15};
+#define TRACE_SAVED_COUNT (int)(sizeof(trace_saved_registers) / sizeof(trace_saved_registers[0]))
+
+static void emit_trace_epilogue(Bytecode *c, int frame_size)
+{
+	emit_x64(c, 0, true, 0x81, 0, reg_operand(RSP));
+	push_dword(frame_size, c);
+	for(int i = TRACE_SAVED_COUNT - 1; i >= 0; --i)
+		emit_pop(c, trace_saved_registers[i]);
+	push_byte(0xC3, c);
+}
+
+static void emit_trace_instruction(Trace_Compiler *tc, int index)
+{
+	Bytecode *c = &tc->out;
+	Trace_Instruction *ins = &tc->trace->code[index];
+	X64_Operand result = tc->locations[index];
+	switch(ins->kind)
+	{
+		case TR_CONST:  emit_immediate(c, result, ins->imm); break;
+		case TR_LOAD:   emit_mov(c, result, mem_operand(RBX, (i32)ins->imm * 8)); break;
+		case TR_STORE:  emit_mov(c, mem_operand(RBX, (i32)ins->imm * 8), tc->locations[ins->a]); break;
+		case TR_GLOAD:  emit_mov(c, result, mem_operand(R13, (i32)ins->imm * 8)); break;
+		case TR_GSTORE: emit_mov(c, mem_operand(R13, (i32)ins->imm * 8), tc->locations[ins->a]); break;
+		case TR_NARROW: emit_narrow(c, ins->op - LOADB, result, tc->locations[ins->a]); break;
+		case TR_BINARY:
+		{
+			emit_mov(c, result, tc->locations[ins->a]);
+			emit_binary(c, &tc->errors, ins->op, result, tc->locations[ins->b]);
+		} break;
+		case TR_GUARD:
+		{
+			X64_Operand value = tc->locations[ins->a];
+			if(value.is_register)
+				emit_x64(c, 0, true, 0x85, value.reg, value);
+			else
+			{
+				emit_x64(c, 0, true, 0x83, 7, value);
+				push_byte(0, c);
+			}
+			push_byte(0x0F, c);
+			push_byte(0x80 + (ins->imm ? CC_E : CC_NE), c);
+			Jit_Fixup fixup = {.at = c->i, .target = ins->exit};
+			arrput(tc->exits, fixup);
+			push_dword(0, c);
+		} break;
+		case TR_LOOP: break;
+	}
+}
+
+// Gives why it couldn't be compiled, NULL if it was
+static const char *compile_trace(Trace *trace)
+{
+	int total = (int)arrlen(trace->code);
+	int *order = alloc_temp_memory(sizeof(int) * total);
+	int count = 0;
+	for(int pass = 0; pass < 2; ++pass)
+	{
+		for(int i = 0; i < total; ++i)
+		{
+			if(!trace->code[i].dead && trace->code[i].hoisted == (pass == 0))
+				order[count++] = i;
+		}
+	}
+
+	Trace_Compiler tc = {.out = make_bytecode(count * 16 + 128), .trace = trace};
+	tc.locations = alloc_temp_memory(sizeof(X64_Operand) * total);
+	allocate_trace_registers(&tc, order, count);
+
+	Bytecode *c = &tc.out;
+	for(int i = 0; i < TRACE_SAVED_COUNT; ++i)
+		emit_push(c, trace_saved_registers[i]);
+	emit_mov(c, reg_operand(RBX), reg_operand(RDI));
+	emit_mov(c, reg_operand(R12), reg_operand(RSI));
+	emit_mov(c, reg_operand(R13), reg_operand(RDX));
+	emit_x64(c, 0, true, 0x81, 5, reg_operand(RSP));
+	push_dword(tc.frame_size, c);
+
+	int loop = -1;
+	for(int p = 0; p < count; ++p)
+	{
+		if(loop < 0 && !trace->code[order[p]].hoisted)
+			loop = c->i;
+		emit_trace_instruction(&tc, order[p]);
+	}
+	assert(loop >= 0 && trace->code[order[count - 1]].kind == TR_LOOP);
+	push_byte(0xE9, c);
+	push_dword(loop - (c->i + 4), c);
+
+	// @NOTE: one stub per exit, it writes the values the interpreter expects
+	// on the operand stack into its cells above the stack pointer it gave us
+	int *stubs = alloc_temp_memory(sizeof(int) * arrlen(trace->exits));
+	for(int i = 0; i < arrlen(trace->exits); ++i)
+		stubs[i] = -1;
+	for(int i = 0; i < arrlen(tc.exits); ++i)
+	{
+		int index = tc.exits[i].target;
+		if(stubs[index] < 0)
+		{
+			stubs[index] = c->i;
+			Trace_Exit *exit = &trace->exits[index];
+			for(int j = 0; j < arrlen(exit->stack); ++j)
+				emit_mov(c, mem_operand(R12, (j + 1) * 8), tc.locations[exit->stack[j]]);
+			emit_x64(c, 0, false, 0xC7, 0, reg_operand(RAX));
+			push_dword(index, c);
+			emit_trace_epilogue(c, tc.frame_size);
+		}
+		patch_dword(stubs[index] - (tc.exits[i].at + 4), tc.exits[i].at, c);
+	}
+	emit_error_stubs(c, tc.errors);
+
+	const char *failure = NULL;
+	trace->native = jit_install_code(c);
+	if(trace->native)
+		trace->native_size = c->i;
+	else
+		failure = "it doesn't fit in the code region";
+	arrfree(tc.exits);
+	arrfree(tc.errors);
+	free_bytecode(&tc.out);
+	return failure;
+}
+
+#endif // JIT_SUPPORTED
+
+static void finish_recording(VM *vm)
+{
+	Trace *trace = recorder.trace;
+	Function *fn = recorder.fn;
+	Trace_Stats stats = {.recorded = (int)arrlen(trace->code)};
+	i64 start = VLibClockNs();
+	add_trace_instruction(trace, TR_LOOP, NOP, -1, -1, 0);
+
+	if(!simplify_trace(trace, &stats))
+	{
+		abort_recording(vm, "a guard always fails");
+		return;
+	}
+	hoist_invariants(trace, &stats);
+	remove_dead_values(trace);
+	const char *failure = "the JIT only targets x86-64 Linux";
+#if JIT_SUPPORTED
+	failure = compile_trace(trace);
+#endif
+	if(failure)
+	{
+		abort_recording(vm, failure);
+		return;
+	}
+	stats.ns = VLibClockNs() - start;
+
+	vm->recording = false;
+	recorder.fn = NULL;
+	recorder.trace = NULL;
+	if(trace_options.log)
+	{
+		int live = 0;
+		for(int i = 0; i < arrlen(trace->code); ++i)
+			live += !trace->code[i].dead;
+		fprintf(stderr, "trace: fn %s at %d, %d -> %d instructions (%d hoisted, %d guards removed), "
+				"%d bytes of native code in %.1f us\n", fn->name, trace->header, stats.recorded, live,
+				stats.hoisted, stats.guards_removed, trace->native_size, stats.ns / 1000.0);
+		print_trace(fn, trace, stderr);
+	}
+}
+
+/* ---- Interpreter hooks ---- */
+
+// @NOTE: called by the interpreter on every jump back to header. Runs the
+// loop's trace if it has one and gives the exit it left through, the
+// interpreter carries on from there with the exit's values pushed. Otherwise
+// it counts and gives NULL, a hot loop starts recording from the header
+Trace_Exit *trace_backedge(VM *vm, Function *fn, int header, u64 *locals, u64 *stack)
+{
+	Trace *trace = hmget(fn->traces, header);
+	if(!trace)
+	{
+		trace = VAlloc(sizeof(Trace));
+		memset(trace, 0, sizeof(Trace));
+		trace->header = header;
+		hmput(fn->traces, header, trace);
+	}
+	if(trace->native)
+	{
+		trace->entered++;
+		int exit = ((Trace_Entry)trace->native)(locals, stack, vm->globals);
+		trace->exits[exit].taken++;
+		return &trace->exits[exit];
+	}
+
+	if(!trace->blacklisted && !vm->recording && ++trace->hits >= trace_options.hot_loop)
+		start_recording(vm, fn, trace);
+	return NULL;
+}
+
+static u64 read_push(u8 *ip)
+{
+	switch(*ip)
+	{
+		case PUSHB:  return (u64)(i64)(i8)ip[1];
+		case PUSHW:  return (u64)(i64)(i16)read_word(ip + 1);
+		case PUSHDW: return (u64)(i64)(i32)read_dword(ip + 1);
+		case PUSHF:  return read_dword(ip + 1);
+		case PUSHS:  return (u64)string_pool[read_dword(ip + 1)];
+		default:     return read_qword(ip + 1);
+	}
+}
+
+// A conditional jump becomes a guard on the value it tests, nonzero is what
+// that value is now and jumps_if the value the jump is taken for. The exit
+// goes the way the recording didn't, next is the offset after the jump. A
+// rotated loop's bottom test jumps back to the header, that ends the trace
+static void record_branch(VM *vm, int value, b32 nonzero, b32 jumps_if, int at, int next, int target)
+{
+	Trace *trace = recorder.trace;
+	b32 taken = nonzero == jumps_if;
+	if(taken && target <= at && target != trace->header)
+	{
+		abort_recording(vm, "it branches backwards");
+		return;
+	}
+	int exit = add_trace_exit(trace, taken ? next : target, recorder.stack, (int)arrlen(recorder.stack));
+	int guard = add_trace_instruction(trace, TR_GUARD, NOP, value, -1, nonzero);
+	trace->code[guard].exit = exit;
+	if(taken && target <= at)
+	{
+		assert(arrlen(recorder.stack) == 0);
+		finish_recording(vm);
+	}
+}
+
+// @NOTE: sees every op while recording, before the interpreter runs it. sp
+// and locals are the interpreter's, they're only looked at to see which way a
+// branch goes
+void trace_record(VM *vm, Function *fn, u8 *ip, u64 *sp, u64 *locals)
+{
+	Trace *trace = recorder.trace;
+	int at = (int)(ip - fn->code.bytecode);
+	if(fn != recorder.fn)
+	{
+		abort_recording(vm, "it left the function");
+		return;
+	}
+	if(++recorder.length > trace_options.max_length)
+	{
+		abort_recording(vm, "the trace is too long");
+		return;
+	}
+
+	OP op = *ip;
+	switch(op)
+	{
+		case NOP: break;
+
+		case LOADB: case LOADW: case LOADDW: case LOADQW: case LOADF: case LOADD:
+		{
+			arrput(recorder.stack, record_load(trace, op, read_word(ip + 1)));
+		} break;
+		case STOREB: case STOREW: case STOREDW: case STOREQW: case STOREF: case STORED:
+		{
+			int value = record_narrow(trace, LOADB + (op - STOREB), arrpop(recorder.stack));
+			add_trace_instruction(trace, TR_STORE, NOP, value, -1, read_word(ip + 1));
+		} break;
+		case TEEB: case TEEW: case TEEDW: case TEEQW: case TEEF: case TEED:
+		{
+			int value = record_narrow(trace, LOADB + (op - TEEB), arrpop(recorder.stack));
+			add_trace_instruction(trace, TR_STORE, NOP, value, -1, read_word(ip + 1));
+			arrput(recorder.stack, value);
+		} break;
+
+		case NARROWB: case NARROWW:
+		{
+			int value = record_narrow(trace, LOADB + (op - NARROWB), arrpop(recorder.stack));
+			arrput(recorder.stack, value);
+		} break;
+
+		case PUSHB: case PUSHW: case PUSHDW: case PUSHQW: case PUSHF: case PUSHD: case PUSHS:
+		{
+			arrput(recorder.stack, add_trace_instruction(trace, TR_CONST, NOP, -1, -1, read_push(ip)));
+		} break;
+
+		case ADDQW_LL: case SUBQW_LL: case MULQW_LL:
+		{
+			int a = record_load(trace, LOADQW, read_word(ip + 1));
+			int b = record_load(trace, LOADQW, read_word(ip + 3));
+			arrput(recorder.stack, add_trace_instruction(trace, TR_BINARY, get_superinstruction_base(op), a, b, 0));
+		} break;
+		case ADDQW_LI: case SUBQW_LI: case MULQW_LI:
+		case EQQW_LI: case NEQW_LI: case LTQW_LI: case LEQW_LI: case GTQW_LI: case GEQW_LI:
+		{
+			int a = record_load(trace, LOADQW, read_word(ip + 1));
+			int b = add_trace_instruction(trace, TR_CONST, NOP, -1, -1, (u64)(i64)(i32)read_dword(ip + 3));
+			arrput(recorder.stack, add_trace_instruction(trace, TR_BINARY, get_superinstruction_base(op), a, b, 0));
+		} break;
+
+		// The step is stored like a TEEQW would and the test is the LTQW the op was fused from
+		case LOOPQW_LI: case LOOPQW_LL:
+		{
+			int slot = read_word(ip + 5);
+			int current = record_load(trace, LOADQW, slot);
+			int step = add_trace_instruction(trace, TR_CONST, NOP, -1, -1, (u64)(i64)(i32)read_dword(ip + 7));
+			int value = add_trace_instruction(trace, TR_BINARY, ADDQW, current, step, 0);
+			add_trace_instruction(trace, TR_STORE, NOP, value, -1, slot);
+			int limit;
+			i64 limit_value;
+			if(op == LOOPQW_LI)
+			{
+				limit_value = (i32)read_dword(ip + 11);
+				limit = add_trace_instruction(trace, TR_CONST, NOP, -1, -1, (u64)limit_value);
+			}
+			else
+			{
+				limit_value = (i64)locals[read_word(ip + 11)];
+				limit = record_load(trace, LOADQW, read_word(ip + 11));
+			}
+			i64 next_value = (i64)(locals[slot] + (u64)(i64)(i32)read_dword(ip + 7));
+			int holds = add_trace_instruction(trace, TR_BINARY, LTQW, value, limit, 0);
+			record_branch(vm, holds, next_value < limit_value, true, at, at + get_instruction_size(ip), read_dword(ip + 1));
+		} break;
+
+		case GLOAD:
+		{
+			arrput(recorder.stack, add_trace_instruction(trace, TR_GLOAD, NOP, -1, -1, read_word(ip + 1)));
+		} break;
+		case GSTORE:
+		{
+			add_trace_instruction(trace, TR_GSTORE, NOP, arrpop(recorder.stack), -1, read_word(ip + 1));
+		} break;
+		case POP: arrpop(recorder.stack); break;
+
+		case JMP:
+		{
+			int target = read_dword(ip + 1);
+			if(target > at)
+				break;
+			if(target != trace->header)
+			{
+				abort_recording(vm, "it ran into an inner loop");
+				return;
+			}
+			assert(arrlen(recorder.stack) == 0);
+			finish_recording(vm);
+		} break;
+		case JZ: case JNZ:
+		{
+			record_branch(vm, arrpop(recorder.stack), *sp != 0, op == JNZ, at, at + 5, read_dword(ip + 1));
+		} break;
+
+		// A guard that the value is the one that picked the entry, its exit
+		// runs the SWITCH again with the value back on the stack
+		case SWITCH:
+		{
+			u64 index = *sp - read_qword(ip + 1);
+			if(index >= read_dword(ip + 9))
+			{
+				abort_recording(vm, "it takes a switch's default");
+				return;
+			}
+			if((int)read_dword(ip + 17 + 4 * index) <= at)
+			{
+				abort_recording(vm, "it branches backwards");
+				return;
+			}
+			int depth = (int)arrlen(recorder.stack);
+			int exit = add_trace_exit(trace, at, recorder.stack, depth);
+			int expected = add_trace_instruction(trace, TR_CONST, NOP, -1, -1, *sp);
+			int same = add_trace_instruction(trace, TR_BINARY, EQQW, recorder.stack[depth - 1], expected, 0);
+			int guard = add_trace_instruction(trace, TR_GUARD, NOP, same, -1, 1);
+			trace->code[guard].exit = exit;
+			arrpop(recorder.stack);
+		} break;
+
+		case CALL: case CALLI: case TAILCALL: abort_recording(vm, "it calls"); break;
+		case RET: abort_recording(vm, "it returns"); break;
+
+		default:
+		{
+			b32 jumps_if;
+			OP compare = get_branch_compare(op, &jumps_if);
+			if(op >= ADDDW && op <= GED)
+			{
+				int b = arrpop(recorder.stack);
+				int a = arrpop(recorder.stack);
+				arrput(recorder.stack, add_trace_instruction(trace, TR_BINARY, op, a, b, 0));
+			}
+			else if(compare != NOP)
+			{
+				// The trace keeps the comparison and guards on what it gave
+				int b = arrpop(recorder.stack);
+				int a = arrpop(recorder.stack);
+				u64 holds;
+				fold_cells(compare, sp[-1], sp[0], &holds);
+				int value = add_trace_instruction(trace, TR_BINARY, compare, a, b, 0);
+				record_branch(vm, value, holds != 0, jumps_if, at, at + 5, read_dword(ip + 1));
+			}
+			else
+				abort_recording(vm, "an op isn't supported");
+		} break;
+	}
+}
+
+void print_trace(Function *fn, Trace *trace, FILE *out)
+{
+	fprintf(out, "trace fn %s at %d:\n", fn->name, trace->header);
+	for(int i = 0; i < arrlen(trace->code); ++i)
+	{
+		Trace_Instruction *ins = &trace->code[i];
+		if(ins->dead)
+			continue;
+		fprintf(out, "  %c %4d ", ins->hoisted ? '^' : ' ', i);
+		switch(ins->kind)
+		{
+			case TR_CONST:  fprintf(out, "const %lld", (long long)ins->imm); break;
+			case TR_LOAD:   fprintf(out, "load slot %d", (int)ins->imm); break;
+			case TR_STORE:  fprintf(out, "store slot %d, %d", (int)ins->imm, ins->a); break;
+			case TR_GLOAD:  fprintf(out, "gload %d", (int)ins->imm); break;
+			case TR_GSTORE: fprintf(out, "gstore %d, %d", (int)ins->imm, ins->a); break;
+			case TR_BINARY: fprintf(out, "%s %d, %d", op_info[ins->op].name, ins->a, ins->b); break;
+			case TR_NARROW: fprintf(out, "narrow %s %d", op_info[ins->op].name, ins->a); break;
+			case TR_LOOP:   fprintf(out, "loop"); break;
+			case TR_GUARD:
+			{
+				Trace_Exit *exit = &trace->exits[ins->exit];
+				fprintf(out, "guard %d %s 0, else exit to %d", ins->a, ins->imm ? "!=" : "==", exit->offset);
+				if(arrlen(exit->stack))
+				{
+					fprintf(out, " with");
+					for(int j = 0; j < arrlen(exit->stack); ++j)
+						fprintf(out, " %d", exit->stack[j]);
+				}
+			} break;
+		}
+		fprintf(out, "\n");
+	}
+}
+
+void trace_free_function(Function *fn)
+{
+	if(recorder.fn == fn)
+	{
+		recorder.fn = NULL;
+		recorder.trace = NULL;
+	}
+	for(int i = 0; i < hmlen(fn->traces); ++i)
+	{
+		clear_trace(fn->traces[i].value);
+		VFree(fn->traces[i].value);
+	}
+	hmfree(fn->traces);
+}
@@ -0,0 +1,82 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "Basic.h"
+#include "Bytecode.h"
+#include "Interpreter.h"
+
+// @NOTE: the tracing engine interprets everything and counts the jumps back
+// to each loop header. Once one is hot the next trip around the loop is
+// recorded as the interpreter runs it, op by op, into a straight line of
+// instructions where every conditional jump became a guard on the way it
+// went. That gets optimized and compiled to native code that keeps looping by
+// itself until a guard fails, then a side exit puts the operand stack back and
+// tells the interpreter where to pick up. The ops are typed, a value can't change its
+// type between iterations, so branches are the only thing that's guarded
+typedef enum
+{
+	TR_CONST,  // imm is the cell
+	TR_LOAD,   // imm is the frame slot, read as a whole cell
+	TR_STORE,  // imm is the frame slot, a is stored as a whole cell
+	TR_GLOAD,  // imm is the global slot
+	TR_GSTORE, // imm is the global slot, a is stored there
+	TR_BINARY, // op is the stack op that computes it, ADDDW through GED
+	TR_NARROW, // op is the load (LOADB, LOADW, LOADDW or LOADF) that would narrow a
+	TR_GUARD,  // leaves through exit unless a is 0 (imm is 0) or isn't (imm is 1)
+	TR_LOOP,   // back to the first instruction that isn't hoisted, always the last one
+} Trace_Kind;
+
+typedef struct
+{
+	Trace_Kind kind;
+	OP op;
+	int a, b;     // operands, indexes of earlier instructions
+	u64 imm;
+	int exit;
+	b32 hoisted;  // loop invariant, runs once before the loop
+	b32 dead;
+} Trace_Instruction;
+
+typedef struct
+{
+	int offset;   // where the interpreter carries on
+	int *stack;   // stb_ds array of the instructions left on the operand stack there, bottom first
+	u64 taken;
+} Trace_Exit;
+
+typedef struct
+{
+	int header;               // the bytecode offset the loop jumps back to
+	u32 hits;                 // backedges to it while there was no trace
+	int aborts;
+	b32 blacklisted;          // never traced again
+	Trace_Instruction *code;  // stb_ds array, after optimizing
+	Trace_Exit *exits;        // stb_ds array
+	void *native;
+	int native_size;
+	u64 entered;
+} Trace;
+
+// Per function, keyed by the loop header's offset
+typedef struct _Trace_Table
+{
+	int key;
+	Trace *value;
+} Trace_Table;
+
+typedef struct
+{
+	u32 hot_loop;    // backedges to a header before its loop is recorded
+	int max_length;  // recorded ops, longer traces are aborted
+	int max_aborts;  // before a header is blacklisted
+	b32 log;         // print what gets recorded, compiled and aborted to stderr
+} Trace_Options;
+
+extern Trace_Options trace_options;
+
+Trace_Exit *trace_backedge(VM *vm, Function *fn, int header, u64 *locals, u64 *stack);
+void trace_record(VM *vm, Function *fn, u8 *ip, u64 *sp, u64 *locals);
+void print_trace(Function *fn, Trace *trace, FILE *out);
+void trace_free_function(Function *fn);
+
+#endif // _TRACE_H
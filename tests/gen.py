@@ -0,0 +1,193 @@
+# Random program generator for differential testing, see jit_diff.sh
+#
+# python3 gen.py <seed> prints a REPL session: a few functions with locals
+# of every type, switches, for loops, ifs and calls between them, a
+# recursive pair to give the tiered and tracing engines something hot,
+# and then globals that are assigned and printed. The same seed always
+# gives the same program
+import random, sys
+
+seed = int(sys.argv[1])
+random.seed(seed)
+
+TYPES = ['i64', 'i32', 'i8', 'f64', 'f32']
+INTS = ('i64', 'i32', 'i8')
+
+funcs = []        # (name, argument types), callable from the ones after it
+consts = set()    # loop counters and limits, never assigned to
+last_locals = []  # what the last body could see, for the function's return
+counter = [0]
+
+def name():
+	counter[0] += 1
+	return 'v%d' % counter[0]
+
+def lit(t):
+	if t.startswith('f'):
+		return '%d.%d' % (random.randint(0, 50), random.randint(0, 99))
+	return str(random.randint(0, 120))
+
+def call(vars_, depth):
+	f, args = random.choice(funcs)
+	return '%s(%s)' % (f, ', '.join(expr(a, vars_, depth + 1) for a in args))
+
+def expr(t, vars_, depth=0):
+	cands = [v for v, vt in vars_ if vt == t]
+	r = random.random()
+	if depth > 2 or r < 0.3:
+		if cands and random.random() < 0.7:
+			return random.choice(cands)
+		return lit(t)
+	if r < 0.4 and t == 'i64' and funcs:
+		return call(vars_, depth)
+	ops = ['+', '-', '*'] + (['/'] if t.startswith('f') else ['&', '|', '^', '%'])
+	op = random.choice(ops)
+	a = expr(t, vars_, depth + 1)
+	b = expr(t, vars_, depth + 1)
+	if op == '%':
+		b = str(random.randint(1, 9))
+	# Two literals fold into one that may not fit the type
+	if a[0].isdigit() and b[0].isdigit():
+		if not cands:
+			return lit(t)
+		a = random.choice(cands)
+	return '(%s %s %s)' % (a, op, b)
+
+def simple_cond(vars_):
+	bools = [v for v, vt in vars_ if vt == 'b32']
+	if bools and random.random() < 0.2:
+		return random.choice(bools)
+	t = random.choice(['i64', 'i32', 'f64', 'f32'])
+	cands = [v for v, vt in vars_ if vt == t]
+	if not cands:
+		return 'true_g'
+	rhs = lit(t)
+	if t == 'i64' and funcs and random.random() < 0.2:
+		f, args = random.choice(funcs)
+		rhs = '%s(%s)' % (f, ', '.join(lit(a) for a in args))
+	return '%s %s %s' % (random.choice(cands), random.choice(['<', '>', '==', '!=', '<=', '>=']), rhs)
+
+def cond(vars_, depth=0):
+	if depth < 2 and random.random() < 0.35:
+		return '(%s %s %s)' % (cond(vars_, depth + 1), random.choice(['&&', '||']), cond(vars_, depth + 1))
+	return simple_cond(vars_)
+
+def declaration(local):
+	t = random.choice(TYPES)
+	n = name()
+	if t == 'i64':
+		kind = random.choice([':=', '::', ': i64 ='])
+	else:
+		kind = random.choice([': %s =' % t, ': %s :' % t])
+	s = '%s %s %s' % (n, kind, expr(t, local))
+	if kind in ('::', ': %s :' % t):
+		consts.add(n)
+	local.append((n, t))
+	return s
+
+def switch(local, depth):
+	v, t = random.choice([(v, vt) for v, vt in local if vt in INTS])
+	style = random.choice(['dense', 'sparse', 'few'])
+	n = random.randint(1, 12)
+	if style == 'dense':
+		labels = random.sample(range(0, 20), n)
+	elif style == 'sparse':
+		labels = random.sample(range(0, 121), n)
+	else:
+		labels = random.sample(range(0, 8), random.randint(1, 3))
+	random.shuffle(labels)
+	cases = []
+	i = 0
+	while i < len(labels):
+		k = random.randint(1, 2)
+		cases.append('case %s { %s }' % (', '.join(map(str, labels[i:i+k])), body(local, depth + 1, random.randint(1, 2))))
+		i += k
+	if random.random() < 0.5:
+		cases.append('else { %s }' % body(local, depth + 1, random.randint(1, 2)))
+	subject = v if random.random() < 0.6 else expr(t, local)
+	return 'switch %s { %s }' % (subject, ' '.join(cases))
+
+def loop(local, depth):
+	n = name()
+	k = random.randint(0, 6)
+	consts.add(n)
+	inner = body(local + [(n, 'i64')], depth + 1, random.randint(1, 3))
+	form = random.random()
+	if form < 0.4:
+		return 'for %s := 0, %s < %d, %s += 1 { %s }' % (n, n, k, n, inner)
+	if form < 0.6:
+		return 'for %s := %d, %s > 0, %s -= 1 { %s }' % (n, k, n, n, inner)
+	if form < 0.8:
+		return 'for %s := 0, %s <= %d, %s += 2 { %s }' % (n, n, k, n, inner)
+	limit = name()
+	consts.add(limit)
+	local.append((limit, 'i64'))
+	return '%s := %d for %s := 0, %s < %s, %s += 1 { %s }' % (limit, k, n, n, limit, n, inner)
+
+def assignment(local):
+	muts = [v for v, vt in local if v not in consts and vt != 'b32']
+	if not muts:
+		return None
+	v = random.choice(muts)
+	t = dict(local)[v]
+	return '%s %s %s' % (v, random.choice(['=', '+=', '-=', '*=']), expr(t, local))
+
+def body(vars_, depth, count):
+	s = []
+	local = list(vars_)
+	for _ in range(count):
+		r = random.random()
+		if r < 0.4 or not local:
+			s.append(declaration(local))
+		elif r < 0.5:
+			n = name()
+			s.append('%s := %s' % (n, cond(local)))
+			local.append((n, 'b32'))
+		elif r < 0.6 and depth < 3 and any(vt in INTS for _, vt in local):
+			s.append(switch(local, depth))
+		elif r < 0.66 and depth < 3:
+			s.append(loop(local, depth))
+		elif r < 0.7 and depth < 3:
+			s.append('if %s { %s }' % (cond(local), body(local, depth + 1, random.randint(1, 3))))
+		else:
+			a = assignment(local)
+			if a:
+				s.append(a)
+	last_locals[:] = local
+	return ' '.join(s)
+
+out = ['true_g := 1 < 2']
+for i in range(random.randint(1, 4)):
+	fname = 'f%d' % i
+	args = [('a%d' % j, random.choice(['i64', 'i32', 'f64'])) for j in range(random.randint(0, 3))]
+	params = ', '.join('%s: %s' % a for a in args)
+	b = body(args, 1, random.randint(2, 6))
+	ret = expr('i64', list(last_locals))
+	if funcs and random.random() < 0.35:
+		# Ends in a call, so it's a tail call
+		tail = call(list(last_locals) + [('r_', 'i64')], 0)
+		out.append('fn %s(%s) -> i64 { %s r_ := %s %s }' % (fname, params, b, ret, tail))
+	else:
+		out.append('fn %s(%s) -> i64 { %s r_ := %s r_ }' % (fname, params, b, ret))
+	out.append('%s(%s)' % (fname, ', '.join(lit(t) for _, t in args)))
+	funcs.append((fname, [t for _, t in args]))
+
+if random.random() < 0.5:
+	k = random.randint(1, 9)
+	out.append('acc_g := 0')
+	out.append('fn w0(n: i64, m: i64) { if n > 0 { acc_g += n * m %s } }' % random.choice(['w0(n - 1, m + %d)' % k, 'w0(n - %d, m)' % k]))
+	out.append('fn w1(n: i64) { switch n % 3 { case 0 { acc_g += 1 w0(n, 2) } case 1 { w1(n - 1) } else { acc_g = acc_g ^ n } } }')
+	out.append('w0(%d, 1)' % random.choice([3, 100, 7000, 30000]))
+	out.append('w1(%d)' % random.randint(0, 30000))
+	out.append('acc_g')
+
+globals_ = []
+for i in range(4):
+	t = random.choice(TYPES)
+	n = name()
+	out.append('%s : %s = %s' % (n, t, expr(t, globals_)))
+	globals_.append((n, t))
+	out.append(n)
+	out.append('{ %s }' % body(globals_, 1, 3))
+	out.append(expr(t, globals_))
+print('\n'.join(out))
@@ -0,0 +1,46 @@
+#!/bin/bash
+# Differential test of the JIT against the interpreter
+#
+# ./jit_diff.sh <apoc> [first seed] [last seed]
+#
+# Runs every program gen.py makes for the seeds on the stack VM with all
+# optimizations off, then on every engine that runs native code, and prints
+# the seed and flags of each run whose output differs. A differing program
+# is left in diff_<seed>.apoc. Exits with 1 if anything differed
+apoc=$1
+first=${2:-1}
+last=${3:-200}
+if [ -z "$apoc" ]; then
+	echo "usage: $0 <apoc> [first seed] [last seed]"
+	exit 2
+fi
+
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+reference="-nofold -nopeephole -nofuse -noreuse -noinline -notailcalls"
+engines=(
+	"-jit"
+	"-jit -ssa"
+	"-jit -nofold -nopeephole -nofuse"
+	"-jit -noinline -notailcalls"
+	"-tiered -tiercalls=1 -tierloops=1"
+	"-tiered -tiercalls=2 -tierbaseline"
+	"-trace -tracehot=1"
+)
+
+fail=0
+for seed in $(seq "$first" "$last"); do
+	python3 "$dir/gen.py" "$seed" > "$tmp/p.apoc"
+	timeout 10 "$apoc" $reference < "$tmp/p.apoc" > "$tmp/ref" 2>&1
+	for flags in "${engines[@]}"; do
+		timeout 10 "$apoc" $flags < "$tmp/p.apoc" > "$tmp/out" 2>&1
+		if ! cmp -s "$tmp/out" "$tmp/ref"; then
+			echo "seed $seed [$flags] differs"
+			cp "$tmp/p.apoc" "diff_$seed.apoc"
+			fail=1
+		fi
+	done
+done
+exit $fail
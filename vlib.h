@@ -419,7 +419,8 @@ _VLibClock(i64 Factor)
 	timespec Counter;
 	clock_gettime(CPUClockID, &Counter);
 	
-	return (Counter.tv_nsec - StartCounter.tv_nsec) * (1000000000 / Factor);
+	i64 Ns = (Counter.tv_sec - StartCounter.tv_sec) * 1000000000 + (Counter.tv_nsec - StartCounter.tv_nsec);
+	return Ns / (1000000000 / Factor);
 #endif
 }
 